@@ -0,0 +1,720 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Math/Random.h>
+
+#include "Boids.h"
+#include "BoidSnapshot.h"
+#include "Replay.h"
+
+// Headless benchmark for the boid flocking kernels.
+// Works out the flocking force for every boid of a synthetic flock with the original Boids::Computeforce loop, which reads
+// every neighbour back from its RigidBody, then by testing every pair and through the spatial grid with each kernel
+// instruction set the CPU supports, and prints the time per tick and the speedup over the original loop as CSV. Every run
+// is checked against the original loop, and the exit code is non-zero if any kernel disagrees beyond the tolerance.
+// Run with "threads" to instead time the full BoidSet force pass on the work queue at several thread counts, or with
+// "physics" to compare the physics step of bullet driven and kinematic flocks in a headless scene as the flock grows, or
+// with "render" to compare the CPU frame time of per-boid StaticModels against instanced flock groups. The render run
+// opens a window, as the cost being measured is culling and batching. "snapshots FILE" plays a match recorded with -record
+// and prints the size of the boid snapshots it would send, as keyframes and delta coded at several acknowledgement delays.
+// Without a file it simulates a synthetic 5 minute match of unchased flocks instead, and labels its rows so.
+
+static const unsigned BOID_COUNTS[] = { 100, 1000, 10000, 50000 };
+static const unsigned NUM_BOID_COUNTS = sizeof(BOID_COUNTS) / sizeof(BOID_COUNTS[0]);
+/// Pair tests to aim for per measurement, the tick count is derived from it so small flocks are not lost in timer noise.
+static const unsigned long long TARGET_PAIR_TESTS = 200000000ull;
+/// Largest force difference from the reference, relative to the reference force, that still counts as agreeing.
+/// Paths only differ in summation order and in testing squared rather than plain distances, so anything bigger is a real bug.
+static const float FORCE_TOLERANCE = 1e-3f;
+
+static const unsigned THREAD_COUNTS[] = { 1, 2, 4, 8, 16 };
+static const unsigned NUM_THREAD_COUNTS = sizeof(THREAD_COUNTS) / sizeof(THREAD_COUNTS[0]);
+/// Flock layout of the thread scaling run, enough flocks and boids that every thread count has work to share.
+static const unsigned SCALING_FLOCKS = 16;
+static const unsigned SCALING_FLOCK_SIZE = 2500;
+static const unsigned SCALING_TICKS = 50;
+
+static const unsigned PHYSICS_BOID_COUNTS[] = { 100, 1000, 2500, 5000, 10000 };
+static const unsigned NUM_PHYSICS_BOID_COUNTS = sizeof(PHYSICS_BOID_COUNTS) / sizeof(PHYSICS_BOID_COUNTS[0]);
+/// Boids per flock in the physics run, the game default.
+static const unsigned PHYSICS_FLOCK_SIZE = NumBoids;
+/// Ticks of settling before the physics run starts timing, while bullet pushes apart boids that spawned overlapping.
+static const unsigned PHYSICS_WARMUP_TICKS = 10;
+static const unsigned PHYSICS_TICKS = 120;
+
+static const unsigned RENDER_BOID_COUNTS[] = { 1000, 10000 };
+static const unsigned NUM_RENDER_BOID_COUNTS = sizeof(RENDER_BOID_COUNTS) / sizeof(RENDER_BOID_COUNTS[0]);
+static const unsigned RENDER_WARMUP_FRAMES = 30;
+static const unsigned RENDER_FRAMES = 300;
+
+static const unsigned SNAPSHOT_FLOCK_COUNTS[] = { NumFlocks, 50 };
+static const unsigned NUM_SNAPSHOT_FLOCK_COUNTS = sizeof(SNAPSHOT_FLOCK_COUNTS) / sizeof(SNAPSHOT_FLOCK_COUNTS[0]);
+/// Synthetic match length in physics ticks, 5 minutes at 60 fps. A snapshot goes out every other tick, at the 30 fps network rate.
+static const unsigned SNAPSHOT_MATCH_TICKS = 5 * 60 * 60;
+static const unsigned SNAPSHOT_INTERVAL = 2;
+
+/// Ways of sending the match's snapshots. The ack delay is how many snapshots later the acknowledgement of one arrives.
+struct SnapshotCase
+{
+	const char* name_;
+	bool delta_;
+	unsigned ackDelay_;
+	float loss_;
+};
+
+static const SnapshotCase SNAPSHOT_CASES[] =
+{
+	{ "keyframe", false, 0, 0.0f },
+	{ "delta_rtt33", true, 1, 0.0f },
+	{ "delta_rtt100", true, 3, 0.0f },
+	{ "delta_rtt200", true, 6, 0.0f },
+	{ "delta_rtt100_loss5", true, 3, 0.05f },
+	{ "delta_rtt100_loss20", true, 3, 0.2f }
+};
+static const unsigned NUM_SNAPSHOT_CASES = sizeof(SNAPSHOT_CASES) / sizeof(SNAPSHOT_CASES[0]);
+
+/// Scatter the boids of one flock in the store at the density of a game flock, so the grid sees realistic occupancy as the count grows.
+static void ScatterFlock(FlockStore& store, unsigned flock)
+{
+	// A game flock holds 20 boids over roughly 60x60 units, inside the 10-50 height band
+	unsigned count = store.GetFlockSize(flock);
+	unsigned start = store.GetFlockStart(flock);
+	float extent = 60.0f * sqrtf(count / 20.0f);
+	for (unsigned i = start; i < start + count; ++i)
+	{
+		store.SetPosition(i, Vector3(Random(extent) - extent * 0.5f, Random(40.0f) + 10.0f, Random(extent) - extent * 0.5f));
+		store.SetVelocity(i, Vector3(Random(20.0f) - 20.0f, 0.0f, Random(20.0f) - 20.0f));
+	}
+}
+
+/// Fill the store with a single flock of count boids.
+static void CreateFlock(unsigned count, FlockStore& store)
+{
+	store.Resize(1, count);
+	ScatterFlock(store, 0);
+}
+
+/// The boid of the original game, cut down to what its force pass touches.
+struct OriginalBoid
+{
+	/// Work out the force on this boid from every boid of the flock, as the original game did each physics step.
+	void Computeforce(OriginalBoid * Boid, unsigned numBoids);
+
+	Vector3 force;
+	RigidBody *pRigidbody;
+};
+
+// The loop of the original Boids::Computeforce, unchanged apart from taking the flock size as a parameter. The capture
+// test at its end is left out, it only ran while the player was moving and is not part of the neighbour search.
+void OriginalBoid::Computeforce(OriginalBoid * Boid, unsigned numBoids)
+{
+	Vector3 CoM; //centre of mass, accumulated total
+	float n = 0.0f; //count number of neigbours
+	float a = 0.0f; //alignment
+	float r = 0.0f;
+	Vector3 sep_Distance;
+	//set the force member variable to zero 
+
+
+	force = Vector3(0, 0, 0);
+	//Search Neighbourhood
+	for (unsigned i = 0; i < numBoids; i++)
+	{
+		//the current boid?
+		if (this == &Boid[i]) continue;
+		//sep = vector position of this boid from current oid
+		Vector3 sep = pRigidbody->GetPosition() -
+			Boid[i].pRigidbody->GetPosition();
+		float d = sep.Length(); //distance of boid
+
+
+		if (d < Boids::Range_FAttract)
+		{
+			//with range, so is a neighbour
+			CoM += Boid[i].pRigidbody->GetPosition();
+			n++;
+		}
+
+		if (d < Boids::Range_FRepel)
+		{
+			float sep_Distancefloat = sep.Length();
+			sep_Distance += sep / (sep_Distancefloat*sep_Distancefloat);
+			r++;
+		}
+
+
+		if (d < Boids::Range_FAlign)
+		{
+			a++;
+		}
+
+	}
+
+	//Attractive force component
+	if (n > 0)
+	{
+		CoM /= n;
+		Vector3 dir = (CoM - pRigidbody->GetPosition()).Normalized();
+		Vector3 vDesired = dir*Boids::FAttract_Vmax;
+		force += (vDesired - pRigidbody->GetLinearVelocity())*Boids::FAttract_Factor;
+	}
+	//Repulsive force component
+	if (r > 0)
+	{
+		force += (sep_Distance * Boids::FRepel_Factor);
+
+	}
+
+	//Alignment force component
+	if (a > 0)
+	{
+		Vector3 dir = (CoM - pRigidbody->GetPosition()).Normalized();
+		force += (dir - Boids::FAlign_Factor * pRigidbody->GetLinearVelocity());
+	}
+}
+
+/// Run the original force pass for ticks ticks over rigid bodies placed as the boids of the store, and return the mean
+/// time of one tick in milliseconds.
+static float TimeOriginalForces(Scene* scene, const FlockStore& store, unsigned ticks, PODVector<Vector3>& forces)
+{
+	unsigned count = store.GetNumBoids();
+	Node* flockNode = scene->CreateChild("Flock");
+	PODVector<OriginalBoid> boids(count);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		// The same body setup as the original Boids::Initialise, without the model and shape the force pass never reads
+		RigidBody* body = flockNode->CreateChild("Boid")->CreateComponent<RigidBody>();
+		body->SetMass(1.0f);
+		body->SetUseGravity(false);
+		body->SetPosition(store.GetPosition(i));
+		body->SetLinearVelocity(store.GetVelocity(i));
+		boids[i].pRigidbody = body;
+	}
+	forces.Resize(count);
+
+	HiresTimer timer;
+	for (unsigned t = 0; t < ticks; ++t)
+	{
+		for (unsigned i = 0; i < count; ++i)
+			boids[i].Computeforce(&boids[0], count);
+	}
+	float ms = timer.GetUSec(false) / 1000.0f / ticks;
+
+	for (unsigned i = 0; i < count; ++i)
+		forces[i] = boids[i].force;
+	flockNode->Remove();
+	return ms;
+}
+
+/// Run the force pass for ticks ticks with the current kernel type and return the mean time of one tick in milliseconds.
+static float TimeForces(bool useGrid, const FlockStore& store, unsigned ticks, PODVector<Vector3>& forces)
+{
+	unsigned count = store.GetNumBoids();
+	const float* posX = store.posX_.Buffer();
+	const float* posY = store.posY_.Buffer();
+	const float* posZ = store.posZ_.Buffer();
+	FlockRanges ranges = Boids::Ranges();
+	BoidGrid grid;
+	FlockKernel kernel;
+	PODVector<unsigned> neighbours;
+	forces.Resize(count);
+
+	HiresTimer timer;
+	for (unsigned t = 0; t < ticks; ++t)
+	{
+		if (useGrid)
+		{
+			// The game rebuilds the grid every physics step, so it is part of the cost
+			grid.SetCellSize(Boids::GridCellSize());
+			grid.Build(posX, posY, posZ, count);
+		}
+		for (unsigned i = 0; i < count; ++i)
+		{
+			Vector3 pos = store.GetPosition(i);
+			FlockSums sums;
+			if (useGrid)
+			{
+				grid.Query(pos, neighbours);
+				kernel.SumIndexed(pos, posX, posY, posZ, neighbours.Buffer(), neighbours.Size(), ranges, sums);
+			}
+			else
+				FlockKernel::Sum(pos, posX, posY, posZ, count, ranges, sums);
+			forces[i] = Boids::SteeringForce(pos, store.GetVelocity(i), sums);
+		}
+	}
+	return timer.GetUSec(false) / 1000.0f / ticks;
+}
+
+/// Return the largest difference between two force sets, relative to the size of the reference force.
+static float MaxRelativeDifference(const PODVector<Vector3>& reference, const PODVector<Vector3>& forces)
+{
+	float maxDiff = 0.0f;
+	for (unsigned i = 0; i < reference.Size(); ++i)
+		maxDiff = Max(maxDiff, (reference[i] - forces[i]).Length() / Max(reference[i].Length(), 1.0f));
+	return maxDiff;
+}
+
+/// Time BoidSet::ComputeForces over a multi-flock store with 1 to 16 threads on the work queue and print the speedup over one thread.
+/// Tasks do the same work in the same order whatever thread runs them, so every run must match the single thread forces exactly.
+static bool RunThreadScaling()
+{
+	SharedPtr<Context> context(new Context());
+	BoidSet boidSet;
+	boidSet.store.Resize(SCALING_FLOCKS, SCALING_FLOCK_SIZE);
+	for (unsigned f = 0; f < SCALING_FLOCKS; ++f)
+		ScatterFlock(boidSet.store, f);
+	unsigned count = boidSet.store.GetNumBoids();
+
+	PrintLine("threads,flocks,boids,ms_per_tick,speedup,max_force_diff");
+
+	PODVector<Vector3> reference;
+	PODVector<Vector3> forces(count);
+	float singleThreadMs = 0.0f;
+	bool agreed = true;
+
+	for (unsigned t = 0; t < NUM_THREAD_COUNTS; ++t)
+	{
+		unsigned threads = THREAD_COUNTS[t];
+		// The main thread works through the queue too while it waits, so it counts as one of the threads
+		SharedPtr<WorkQueue> queue(new WorkQueue(context));
+		queue->CreateThreads(threads - 1);
+		boidSet.SetWorkQueue(queue);
+
+		// One untimed tick plans the tasks and warms the caches
+		boidSet.ComputeForces();
+		HiresTimer timer;
+		for (unsigned tick = 0; tick < SCALING_TICKS; ++tick)
+			boidSet.ComputeForces();
+		float ms = timer.GetUSec(false) / 1000.0f / SCALING_TICKS;
+		boidSet.SetWorkQueue(0);
+
+		for (unsigned i = 0; i < count; ++i)
+			forces[i] = boidSet.store.GetForce(i);
+		if (t == 0)
+		{
+			reference = forces;
+			singleThreadMs = ms;
+		}
+		float maxDiff = MaxRelativeDifference(reference, forces);
+		if (maxDiff > 0.0f)
+		{
+			PrintLine(ToString("Forces with %u threads differ from the single thread run", threads), true);
+			agreed = false;
+		}
+
+		PrintLine(ToString("%u,%u,%u,%.4f,%.2f,%g", threads, SCALING_FLOCKS, count, ms, singleThreadMs / ms, maxDiff));
+	}
+
+	return agreed;
+}
+
+/// Start a headless engine for the runs that need a scene. Returns null if it could not start.
+static SharedPtr<Engine> StartHeadlessEngine(Context* context)
+{
+	SharedPtr<Engine> engine(new Engine(context));
+	VariantMap engineParameters;
+	engineParameters["Headless"] = true;
+	engineParameters["LogQuiet"] = true;
+	engineParameters["LogName"] = String::EMPTY;
+	if (!engine->Initialize(engineParameters))
+		return SharedPtr<Engine>();
+	return engine;
+}
+
+/// Time one physics step of the game scene boids, flocking plus the bullet step, for bullet driven and kinematic flocks.
+/// Both modes spawn the same boids from the same seed. Returns false if the engine could not start.
+static bool RunPhysicsScaling()
+{
+	SharedPtr<Context> context(new Context());
+	SharedPtr<Engine> engine = StartHeadlessEngine(context);
+	if (!engine)
+		return false;
+	ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+
+	PrintLine("boids,mode,flocking_ms,physics_ms,step_ms");
+
+	for (unsigned c = 0; c < NUM_PHYSICS_BOID_COUNTS; ++c)
+	{
+		unsigned count = PHYSICS_BOID_COUNTS[c];
+		for (unsigned mode = 0; mode < 2; ++mode)
+		{
+			bool kinematic = mode == 1;
+			SharedPtr<Scene> scene(new Scene(context));
+			scene->CreateComponent<Octree>();
+			PhysicsWorld* physicsWorld = scene->CreateComponent<PhysicsWorld>();
+			// One bullet substep per tick, as the game runs at its default 60 fps
+			float timeStep = 1.0f / physicsWorld->GetFps();
+
+			SetRandomSeed(1);
+			BoidSet boidSet;
+			boidSet.SetFlockLayout(Max(count / PHYSICS_FLOCK_SIZE, 1u), PHYSICS_FLOCK_SIZE);
+			boidSet.SetKinematic(kinematic);
+			boidSet.Initialise(cache, scene);
+
+			long long flockingUSec = 0;
+			long long physicsUSec = 0;
+			for (unsigned tick = 0; tick < PHYSICS_WARMUP_TICKS + PHYSICS_TICKS; ++tick)
+			{
+				HiresTimer timer;
+				boidSet.Update(timeStep);
+				long long flocking = timer.GetUSec(true);
+				physicsWorld->Update(timeStep);
+				long long physics = timer.GetUSec(false);
+				if (tick >= PHYSICS_WARMUP_TICKS)
+				{
+					flockingUSec += flocking;
+					physicsUSec += physics;
+				}
+			}
+
+			float flockingMs = flockingUSec / 1000.0f / PHYSICS_TICKS;
+			float physicsMs = physicsUSec / 1000.0f / PHYSICS_TICKS;
+			PrintLine(ToString("%u,%s,%.4f,%.4f,%.4f", boidSet.store.GetNumBoids(), kinematic ? "kinematic" : "bullet", flockingMs,
+				physicsMs, flockingMs + physicsMs));
+		}
+	}
+
+	return true;
+}
+
+/// Snapshots of one flock layout sent through every case as the server would, and decoded on a simulated client.
+class SnapshotRun
+{
+public:
+	/// Construct with nothing sent.
+	SnapshotRun() :
+		serverRing_(SNAPSHOT_RING_SIZE),
+		clientRings_(NUM_SNAPSHOT_CASES),
+		delivered_(NUM_SNAPSHOT_CASES),
+		acked_(NUM_SNAPSHOT_CASES),
+		bytes_(NUM_SNAPSHOT_CASES),
+		keyframes_(NUM_SNAPSHOT_CASES),
+		tick_(0),
+		decoded_(true)
+	{
+		for (unsigned k = 0; k < NUM_SNAPSHOT_CASES; ++k)
+		{
+			clientRings_[k].Resize(SNAPSHOT_RING_SIZE);
+			delivered_[k].Resize(SNAPSHOT_RING_SIZE);
+			for (unsigned r = 0; r < SNAPSHOT_RING_SIZE; ++r)
+				delivered_[k][r] = 0;
+			acked_[k] = 0;
+			bytes_[k] = 0;
+			keyframes_[k] = 0;
+		}
+	}
+
+	/// Capture the next snapshot from store and send it through every case.
+	void Send(const FlockStore& store)
+	{
+		++tick_;
+		BoidSnapshot& current = serverRing_[tick_ % SNAPSHOT_RING_SIZE];
+		current.Capture(store, tick_);
+
+		for (unsigned k = 0; k < NUM_SNAPSHOT_CASES; ++k)
+		{
+			const SnapshotCase& snapshotCase = SNAPSHOT_CASES[k];
+			// The acknowledgement of the snapshot sent ackDelay ticks ago arrives now, if that snapshot got through
+			if (snapshotCase.delta_ && tick_ > snapshotCase.ackDelay_)
+			{
+				unsigned ackTick = tick_ - snapshotCase.ackDelay_;
+				if (delivered_[k][ackTick % SNAPSHOT_RING_SIZE] == ackTick)
+					acked_[k] = ackTick;
+			}
+
+			const BoidSnapshot* baseline = 0;
+			if (acked_[k] && tick_ - acked_[k] < SNAPSHOT_RING_SIZE && current.CanDeltaFrom(serverRing_[acked_[k] % SNAPSHOT_RING_SIZE]))
+				baseline = &serverRing_[acked_[k] % SNAPSHOT_RING_SIZE];
+			if (!baseline)
+				++keyframes_[k];
+
+			bool lost = Random(1.0f) < snapshotCase.loss_;
+			BoidSnapshot& received = clientRings_[k][tick_ % SNAPSHOT_RING_SIZE];
+			const BoidSnapshot* clientBaseline = baseline ? &clientRings_[k][acked_[k] % SNAPSHOT_RING_SIZE] : 0;
+			unsigned next = 0;
+			for (unsigned chunk = 0; next < current.GetNumBoids(); ++chunk)
+			{
+				message_.Clear();
+				current.WriteChunk(message_, baseline, 0, chunk, next);
+				bytes_[k] += message_.GetSize();
+				if (lost)
+					continue;
+
+				message_.Seek(0);
+				BoidChunkHeader header;
+				decodedBoids_.Clear();
+				if (!BoidSnapshot::ReadChunkHeader(message_, header) ||
+					!received.ReadChunk(message_, header, clientBaseline, decodedBoids_))
+					decoded_ = false;
+			}
+			if (lost)
+				continue;
+
+			delivered_[k][tick_ % SNAPSHOT_RING_SIZE] = tick_;
+			for (unsigned i = 0; i < current.GetNumBoids(); ++i)
+			{
+				if (received.posX_[i] != current.posX_[i] || received.posY_[i] != current.posY_[i] ||
+					received.posZ_[i] != current.posZ_[i] || received.heading_[i] != current.heading_[i])
+					decoded_ = false;
+			}
+		}
+	}
+
+	/// Print a row per case of what was sent, with the source of the boid motion.
+	void Print(const char* source, unsigned numBoids, float snapshotsPerSec) const
+	{
+		for (unsigned k = 0; k < NUM_SNAPSHOT_CASES; ++k)
+		{
+			float bytesPerSnapshot = (float)bytes_[k] / tick_;
+			PrintLine(ToString("%s,%u,%s,%u,%.1f,%.2f,%.1f,%.1f", source, numBoids, SNAPSHOT_CASES[k].name_, tick_, bytesPerSnapshot,
+				bytesPerSnapshot / numBoids, bytesPerSnapshot * snapshotsPerSec * 8.0f / 1000.0f, 100.0f * keyframes_[k] / tick_));
+		}
+	}
+
+	/// Return the number of snapshots sent.
+	unsigned GetNumSnapshots() const { return tick_; }
+	/// Return whether every snapshot that got through decoded to what was sent.
+	bool IsDecoded() const { return decoded_; }
+
+private:
+	/// Snapshots kept by the server, shared by every case.
+	Vector<BoidSnapshot> serverRing_;
+	/// Per case the client ring, the tick each ring slot last delivered and the newest acknowledged tick.
+	Vector<Vector<BoidSnapshot> > clientRings_;
+	Vector<PODVector<unsigned> > delivered_;
+	PODVector<unsigned> acked_;
+	/// Per case the bytes sent and the snapshots sent as keyframes.
+	PODVector<unsigned long long> bytes_;
+	PODVector<unsigned> keyframes_;
+	/// Tick of the last snapshot sent.
+	unsigned tick_;
+	/// Whether every snapshot decoded.
+	bool decoded_;
+	/// Message buffer and decoded boid list, reused between snapshots.
+	VectorBuffer message_;
+	PODVector<unsigned> decodedBoids_;
+};
+
+/// Send the snapshots of a match through each case as the server would, decoding them on a simulated client, and print
+/// the mean payload per snapshot and the resulting bandwidth. With a replay file the boids move as they did in that
+/// recorded match, otherwise a synthetic 5 minute match is simulated here, of the game's bullet driven flocks with no
+/// sharks chasing them, and the rows are labelled synthetic. Returns false if the engine could not start, the replay
+/// could not be opened or any decoded snapshot differs from what was sent.
+static bool RunSnapshotSizes(const String& replayFile)
+{
+	PrintLine("source,boids,case,snapshots,bytes_per_snapshot,bytes_per_boid,kbit_per_sec,keyframe_percent");
+
+	if (!replayFile.Empty())
+	{
+		ReplayPlayer replay;
+		if (!replay.Open(replayFile) || !replay.GetNumFrames() || !replay.GetNumFlocks())
+		{
+			PrintLine("Could not open replay " + replayFile, true);
+			return false;
+		}
+
+		SetRandomSeed(1);
+		FlockStore store;
+		store.Resize(replay.GetNumFlocks(), replay.GetNumBoids() / replay.GetNumFlocks());
+		SnapshotRun run;
+		float timeStep = 0.0f;
+		for (unsigned index = SNAPSHOT_INTERVAL - 1; index < replay.GetNumFrames(); index += SNAPSHOT_INTERVAL)
+		{
+			ReplayFrame frame;
+			if (!replay.GetFrame(index, frame))
+				break;
+			for (unsigned i = 0; i < frame.numBoids_; ++i)
+			{
+				store.SetPosition(i, frame.GetPosition(i));
+				store.SetVelocity(i, frame.GetVelocity(i));
+			}
+			timeStep = frame.timeStep_;
+			run.Send(store);
+		}
+
+		if (!run.GetNumSnapshots() || timeStep <= 0.0f)
+		{
+			PrintLine("Replay " + replayFile + " holds too few ticks", true);
+			return false;
+		}
+		run.Print("replay", store.GetNumBoids(), 1.0f / (timeStep * SNAPSHOT_INTERVAL));
+		if (!run.IsDecoded())
+			PrintLine("A decoded snapshot differs from the one sent", true);
+		return run.IsDecoded();
+	}
+
+	SharedPtr<Context> context(new Context());
+	SharedPtr<Engine> engine = StartHeadlessEngine(context);
+	if (!engine)
+		return false;
+	ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+	bool decoded = true;
+
+	for (unsigned c = 0; c < NUM_SNAPSHOT_FLOCK_COUNTS; ++c)
+	{
+		SharedPtr<Scene> scene(new Scene(context));
+		scene->CreateComponent<Octree>();
+		PhysicsWorld* physicsWorld = scene->CreateComponent<PhysicsWorld>();
+		float timeStep = 1.0f / physicsWorld->GetFps();
+
+		SetRandomSeed(1);
+		BoidSet boidSet;
+		boidSet.SetFlockLayout(SNAPSHOT_FLOCK_COUNTS[c], NumBoids);
+		boidSet.Initialise(cache, scene);
+
+		SnapshotRun run;
+		for (unsigned step = 1; step <= SNAPSHOT_MATCH_TICKS; ++step)
+		{
+			boidSet.Update(timeStep);
+			physicsWorld->Update(timeStep);
+			if (step % SNAPSHOT_INTERVAL == 0)
+				run.Send(boidSet.store);
+		}
+
+		run.Print("synthetic", boidSet.store.GetNumBoids(), physicsWorld->GetFps() / (float)SNAPSHOT_INTERVAL);
+		decoded &= run.IsDecoded();
+	}
+
+	if (!decoded)
+		PrintLine("A decoded snapshot differs from the one sent", true);
+	return decoded;
+}
+
+/// Render kinematic flocks of 1k and 10k fish with a StaticModel per boid and with one StaticModelGroup per flock, and
+/// print the mean CPU time of a frame and the draw calls of the last one. Flocking runs between frames and is not timed.
+static bool RunRenderComparison()
+{
+	SharedPtr<Context> context(new Context());
+	SharedPtr<Engine> engine(new Engine(context));
+	VariantMap engineParameters;
+	engineParameters["WindowWidth"] = 1280;
+	engineParameters["WindowHeight"] = 720;
+	engineParameters["FullScreen"] = false;
+	engineParameters["VSync"] = false;
+	engineParameters["FrameLimiter"] = false;
+	engineParameters["Sound"] = false;
+	engineParameters["LogQuiet"] = true;
+	engineParameters["LogName"] = String::EMPTY;
+	if (!engine->Initialize(engineParameters))
+		return false;
+	ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+	Renderer* renderer = context->GetSubsystem<Renderer>();
+
+	PrintLine("boids,drawing,frame_ms,fps,draw_calls");
+
+	for (unsigned c = 0; c < NUM_RENDER_BOID_COUNTS; ++c)
+	{
+		unsigned count = RENDER_BOID_COUNTS[c];
+		for (unsigned mode = 0; mode < 2; ++mode)
+		{
+			bool instanced = mode == 1;
+			SharedPtr<Scene> scene(new Scene(context));
+			scene->CreateComponent<Octree>();
+
+			Node* lightNode = scene->CreateChild("DirectionalLight");
+			lightNode->SetDirection(Vector3(0.6f, -1.0f, 0.8f));
+			Light* light = lightNode->CreateComponent<Light>();
+			light->SetLightType(LIGHT_DIRECTIONAL);
+			light->SetCastShadows(true);
+
+			// Looking down on the spawn area so most fish are in view, as they are when the shark is among a shoal
+			Node* cameraNode = scene->CreateChild("Camera");
+			cameraNode->SetPosition(Vector3(0.0f, 60.0f, -90.0f));
+			cameraNode->LookAt(Vector3(0.0f, 25.0f, 0.0f));
+			Camera* camera = cameraNode->CreateComponent<Camera>();
+			camera->SetFarClip(750.0f);
+			renderer->SetViewport(0, new Viewport(context, scene, camera));
+
+			SetRandomSeed(1);
+			BoidSet boidSet;
+			boidSet.SetFlockLayout(count / NumBoids, NumBoids);
+			boidSet.SetKinematic(true);
+			boidSet.SetInstancedRendering(instanced);
+			boidSet.Initialise(cache, scene);
+
+			long long frameUSec = 0;
+			for (unsigned frame = 0; frame < RENDER_WARMUP_FRAMES + RENDER_FRAMES; ++frame)
+			{
+				boidSet.Update(1.0f / 60.0f);
+				HiresTimer timer;
+				engine->RunFrame();
+				if (frame >= RENDER_WARMUP_FRAMES)
+					frameUSec += timer.GetUSec(false);
+			}
+
+			float frameMs = frameUSec / 1000.0f / RENDER_FRAMES;
+			PrintLine(ToString("%u,%s,%.4f,%.1f,%u", boidSet.store.GetNumBoids(), instanced ? "instanced" : "per_boid", frameMs,
+				1000.0f / frameMs, renderer->GetNumBatches()));
+
+			renderer->SetViewport(0, 0);
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	SetRandomSeed(1);
+
+	const Vector<String>& arguments = ParseArguments(argc, argv);
+	if (!arguments.Empty() && arguments[0] == "threads")
+		return RunThreadScaling() ? 0 : 1;
+	if (!arguments.Empty() && arguments[0] == "physics")
+		return RunPhysicsScaling() ? 0 : 1;
+	if (!arguments.Empty() && arguments[0] == "render")
+		return RunRenderComparison() ? 0 : 1;
+	if (!arguments.Empty() && arguments[0] == "snapshots")
+		return RunSnapshotSizes(arguments.Size() > 1 ? arguments[1] : String::EMPTY) ? 0 : 1;
+
+	// The original loop reads its boids from rigid bodies, so it needs a physics world
+	SharedPtr<Context> context(new Context());
+	SharedPtr<Engine> engine = StartHeadlessEngine(context);
+	if (!engine)
+		return 1;
+	SharedPtr<Scene> scene(new Scene(context));
+	scene->CreateComponent<PhysicsWorld>();
+
+	PrintLine("boids,search,kernel,ms_per_tick,ns_per_boid,speedup,max_force_diff");
+
+	FlockStore store;
+	PODVector<Vector3> reference;
+	PODVector<Vector3> forces;
+	FlockKernelType bestType = FlockKernel::GetSupportedType();
+	bool agreed = true;
+
+	for (unsigned c = 0; c < NUM_BOID_COUNTS; ++c)
+	{
+		unsigned count = BOID_COUNTS[c];
+		CreateFlock(count, store);
+		unsigned ticks = (unsigned)Max(TARGET_PAIR_TESTS / ((unsigned long long)count * count), 1ull);
+
+		// The original loop is the reference every other run is compared against
+		float originalMs = TimeOriginalForces(scene, store, ticks, reference);
+		PrintLine(ToString("%u,original,scalar,%.4f,%.1f,%.2f,%g", count, originalMs, originalMs * 1000000.0f / count, 1.0f, 0.0f));
+
+		for (unsigned search = 0; search < 2; ++search)
+		{
+			bool useGrid = search == 1;
+			for (unsigned type = FKT_SCALAR; type <= (unsigned)bestType; ++type)
+			{
+				FlockKernel::SetType((FlockKernelType)type);
+				float ms = TimeForces(useGrid, store, ticks, forces);
+				float maxDiff = MaxRelativeDifference(reference, forces);
+				if (maxDiff > FORCE_TOLERANCE)
+				{
+					PrintLine(ToString("%s %s kernel disagrees with the original loop at %u boids", useGrid ? "Grid" : "Brute force",
+						FlockKernel::GetTypeName((FlockKernelType)type), count), true);
+					agreed = false;
+				}
+
+				PrintLine(ToString("%u,%s,%s,%.4f,%.1f,%.2f,%g", count, useGrid ? "grid" : "brute",
+					FlockKernel::GetTypeName((FlockKernelType)type), ms, ms * 1000000.0f / count, originalMs / ms, maxDiff));
+			}
+		}
+	}
+
+	FlockKernel::SetType(bestType);
+	return agreed ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include <Urho3D/Math/MathDefs.h>
+
+#include "BoidGrid.h"
+
+#include <cmath>
+
+BoidGrid::BoidGrid() :
+	cellSize_(1.0f),
+	invCellSize_(1.0f),
+	mask_(0)
+{
+}
+
+void BoidGrid::SetCellSize(float size)
+{
+	cellSize_ = Max(size, M_EPSILON);
+	invCellSize_ = 1.0f / cellSize_;
+}
+
+unsigned BoidGrid::HashCell(int x, int y, int z) const
+{
+	// Large primes spread neighbouring cells across the table
+	return (((unsigned)x * 73856093u) ^ ((unsigned)y * 19349663u) ^ ((unsigned)z * 83492791u)) & mask_;
+}
+
+void BoidGrid::Build(const float* posX, const float* posY, const float* posZ, unsigned count)
+{
+	// Keep the table roughly half full so most buckets hold a single cell
+	unsigned tableSize = NextPowerOfTwo(Max(count * 2, 64u));
+	mask_ = tableSize - 1;
+
+	cellStart_.Resize(tableSize + 1);
+	for (unsigned b = 0; b <= tableSize; ++b)
+		cellStart_[b] = 0;
+
+	boidBucket_.Resize(count);
+	sortedIndices_.Resize(count);
+
+	// Count boids per bucket
+	for (unsigned i = 0; i < count; ++i)
+	{
+		unsigned b = HashCell((int)floorf(posX[i] * invCellSize_), (int)floorf(posY[i] * invCellSize_),
+			(int)floorf(posZ[i] * invCellSize_));
+		boidBucket_[i] = b;
+		++cellStart_[b + 1];
+	}
+
+	// Prefix sum turns counts into start offsets
+	for (unsigned b = 0; b < tableSize; ++b)
+		cellStart_[b + 1] += cellStart_[b];
+
+	cursor_.Resize(tableSize);
+	for (unsigned b = 0; b < tableSize; ++b)
+		cursor_[b] = cellStart_[b];
+
+	for (unsigned i = 0; i < count; ++i)
+		sortedIndices_[cursor_[boidBucket_[i]]++] = i;
+}
+
+void BoidGrid::Query(const Vector3& position, PODVector<unsigned>& result) const
+{
+	result.Clear();
+	if (sortedIndices_.Empty())
+		return;
+
+	int cx = (int)floorf(position.x_ * invCellSize_);
+	int cy = (int)floorf(position.y_ * invCellSize_);
+	int cz = (int)floorf(position.z_ * invCellSize_);
+
+	// Two neighbouring cells can share a bucket, remember which ones were walked so nobody is counted twice
+	unsigned visited[27];
+	unsigned numVisited = 0;
+
+	for (int dz = -1; dz <= 1; ++dz)
+	{
+		for (int dy = -1; dy <= 1; ++dy)
+		{
+			for (int dx = -1; dx <= 1; ++dx)
+			{
+				unsigned b = HashCell(cx + dx, cy + dy, cz + dz);
+				bool seen = false;
+				for (unsigned v = 0; v < numVisited; ++v)
+				{
+					if (visited[v] == b)
+					{
+						seen = true;
+						break;
+					}
+				}
+				if (seen)
+					continue;
+				visited[numVisited++] = b;
+
+				for (unsigned k = cellStart_[b]; k < cellStart_[b + 1]; ++k)
+					result.Push(sortedIndices_[k]);
+			}
+		}
+	}
+}
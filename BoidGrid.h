@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Uniform spatial hash grid used to find boid neighbours without testing every pair.
+/// Cells are hashed into a table sized from the boid count, so the world does not need fixed bounds.
+/// Rebuilt from scratch each physics step; boids are counting-sorted by bucket so a query only walks a few short runs.
+class BoidGrid
+{
+public:
+	BoidGrid();
+
+	/// Set the edge length of a cell. Should be at least the largest neighbour search range so a 3x3x3 block covers it.
+	void SetCellSize(float size);
+	/// Rebuild the grid from count positions given as separate component arrays. Query returns indices into them.
+	void Build(const float* posX, const float* posY, const float* posZ, unsigned count);
+	/// Collect the indices of everything in the 3x3x3 block of cells around a position.
+	/// Hash collisions can add boids from far away cells, so callers still do their own distance test.
+	void Query(const Vector3& position, PODVector<unsigned>& result) const;
+
+	/// Return cell edge length.
+	float GetCellSize() const { return cellSize_; }
+
+private:
+	/// Return the hash bucket of a cell.
+	unsigned HashCell(int x, int y, int z) const;
+
+	/// Cell edge length.
+	float cellSize_;
+	/// Reciprocal of the cell edge length.
+	float invCellSize_;
+	/// Hash table size minus one. The table size is always a power of two.
+	unsigned mask_;
+	/// First entry of each bucket in sortedIndices_. Bucket b spans [cellStart_[b], cellStart_[b + 1]).
+	PODVector<unsigned> cellStart_;
+	/// Boid indices sorted by bucket.
+	PODVector<unsigned> sortedIndices_;
+	/// Bucket of each boid, kept between the counting and placing passes of Build.
+	PODVector<unsigned> boidBucket_;
+	/// Insert position of each bucket while placing boids.
+	PODVector<unsigned> cursor_;
+};
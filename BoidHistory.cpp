@@ -0,0 +1,116 @@
+#include <Urho3D/Math/MathDefs.h>
+
+#include "BoidHistory.h"
+
+#include <cmath>
+
+/// Smallest extent of a quantization box axis, so a flat box still has a scale.
+static const float MIN_HISTORY_EXTENT = 0.001f;
+
+BoidHistory::BoidHistory() :
+	numBoids_(0),
+	newest_(0),
+	numRecorded_(0)
+{
+}
+
+void BoidHistory::Reset(unsigned numTicks, unsigned numBoids)
+{
+	numBoids_ = numBoids;
+	ticks_.Resize(numTicks);
+	bounds_.Resize(numTicks);
+	positions_.Resize(numTicks * numBoids * 3);
+	capturedTick_.Resize(numBoids);
+	for (unsigned i = 0; i < numBoids; ++i)
+		capturedTick_[i] = 0;
+	newest_ = 0;
+	numRecorded_ = 0;
+}
+
+void BoidHistory::Record(unsigned tick, const FlockStore& store)
+{
+	unsigned capacity = ticks_.Size();
+	if (!capacity || store.GetNumBoids() != numBoids_)
+		return;
+
+	const float* posX = store.posX_.Buffer();
+	const float* posY = store.posY_.Buffer();
+	const float* posZ = store.posZ_.Buffer();
+	Vector3 min(M_INFINITY, M_INFINITY, M_INFINITY);
+	Vector3 max(-M_INFINITY, -M_INFINITY, -M_INFINITY);
+	for (unsigned i = 0; i < numBoids_; ++i)
+	{
+		min.x_ = Min(min.x_, posX[i]);
+		min.y_ = Min(min.y_, posY[i]);
+		min.z_ = Min(min.z_, posZ[i]);
+		max.x_ = Max(max.x_, posX[i]);
+		max.y_ = Max(max.y_, posY[i]);
+		max.z_ = Max(max.z_, posZ[i]);
+	}
+	max.x_ = Max(max.x_, min.x_ + MIN_HISTORY_EXTENT);
+	max.y_ = Max(max.y_, min.y_ + MIN_HISTORY_EXTENT);
+	max.z_ = Max(max.z_, min.z_ + MIN_HISTORY_EXTENT);
+
+	unsigned slot = numRecorded_ ? (newest_ + 1) % capacity : 0;
+	ticks_[slot] = tick;
+	bounds_[slot] = numBoids_ ? BoundingBox(min, max) : BoundingBox(Vector3::ZERO, Vector3::ONE);
+	if (numBoids_)
+	{
+		Vector3 scale = Vector3(65535.0f, 65535.0f, 65535.0f) / (max - min);
+		unsigned short* dest = positions_.Buffer() + slot * numBoids_ * 3;
+		for (unsigned i = 0; i < numBoids_; ++i)
+		{
+			dest[i * 3] = (unsigned short)Clamp((int)((posX[i] - min.x_) * scale.x_ + 0.5f), 0, 65535);
+			dest[i * 3 + 1] = (unsigned short)Clamp((int)((posY[i] - min.y_) * scale.y_ + 0.5f), 0, 65535);
+			dest[i * 3 + 2] = (unsigned short)Clamp((int)((posZ[i] - min.z_) * scale.z_ + 0.5f), 0, 65535);
+		}
+	}
+	newest_ = slot;
+	numRecorded_ = Min(numRecorded_ + 1, capacity);
+}
+
+void BoidHistory::MarkCaptured(unsigned boid, unsigned tick)
+{
+	if (boid < capturedTick_.Size())
+		capturedTick_[boid] = tick;
+}
+
+unsigned BoidHistory::Query(unsigned back, const Vector3& center, float halfSize, PODVector<unsigned>& result) const
+{
+	if (!numRecorded_)
+		return 0;
+	unsigned capacity = ticks_.Size();
+	back = Min(back, numRecorded_ - 1);
+	unsigned slot = (newest_ + capacity - back) % capacity;
+	unsigned tick = ticks_[slot];
+	const BoundingBox& bounds = bounds_[slot];
+
+	// The query box in quantized steps, rounded outwards so no boid inside it is missed
+	Vector3 scale = Vector3(65535.0f, 65535.0f, 65535.0f) / (bounds.max_ - bounds.min_);
+	Vector3 low = (center - Vector3(halfSize, halfSize, halfSize) - bounds.min_) * scale;
+	Vector3 high = (center + Vector3(halfSize, halfSize, halfSize) - bounds.min_) * scale;
+	if (high.x_ < 0.0f || high.y_ < 0.0f || high.z_ < 0.0f || low.x_ > 65535.0f || low.y_ > 65535.0f || low.z_ > 65535.0f)
+		return tick;
+	int lowX = Max((int)floorf(low.x_), 0);
+	int lowY = Max((int)floorf(low.y_), 0);
+	int lowZ = Max((int)floorf(low.z_), 0);
+	int highX = Min((int)ceilf(high.x_), 65535);
+	int highY = Min((int)ceilf(high.y_), 65535);
+	int highZ = Min((int)ceilf(high.z_), 65535);
+
+	const unsigned short* positions = positions_.Buffer() + slot * numBoids_ * 3;
+	for (unsigned i = 0; i < numBoids_; ++i)
+	{
+		const unsigned short* p = positions + i * 3;
+		if (p[0] >= lowX && p[0] <= highX && p[1] >= lowY && p[1] <= highY && p[2] >= lowZ && p[2] <= highZ &&
+			capturedTick_[i] <= tick)
+			result.Push(i);
+	}
+	return tick;
+}
+
+unsigned BoidHistory::GetMemoryUse() const
+{
+	return positions_.Size() * sizeof(unsigned short) + ticks_.Size() * (sizeof(unsigned) + sizeof(BoundingBox)) +
+		capturedTick_.Size() * sizeof(unsigned);
+}
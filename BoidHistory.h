@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/BoundingBox.h>
+
+#include "FlockStore.h"
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Default furthest back a capture check is rewound, in seconds.
+static const float DEFAULT_MAX_REWIND = 0.25f;
+
+/// Ring of the boid positions of the last few ticks, so the server can check a capture against where a client saw the
+/// boids rather than where they are now. Each tick keeps its positions quantized to 16 bits per axis within the box
+/// around that tick's boids, interleaved so one boid is 6 contiguous bytes: thousands of boids over a quarter second at
+/// 60 ticks cost a few hundred kilobytes, and recording a tick is two passes over the position arrays.
+/// Box queries are answered in the quantized space, so they never dequantize a boid.
+class BoidHistory
+{
+public:
+	BoidHistory();
+
+	/// Keep up to numTicks ticks of numBoids boids. Forgets everything recorded.
+	void Reset(unsigned numTicks, unsigned numBoids);
+	/// Record the positions of every boid in the store at a tick, dropping the oldest tick if full.
+	void Record(unsigned tick, const FlockStore& store);
+	/// Note a boid was captured at a tick. A query on an earlier tick leaves it out, as it has been caught since.
+	void MarkCaptured(unsigned boid, unsigned tick);
+	/// Collect the boids within halfSize on each axis of center as they were back ticks before the newest tick, or at the
+	/// oldest tick kept if that is less far back. The box is widened to whole quantization steps, well under a
+	/// centimetre, so a boid right on its edge may be included. Returns the tick looked at, 0 if nothing is recorded.
+	unsigned Query(unsigned back, const Vector3& center, float halfSize, PODVector<unsigned>& result) const;
+
+	/// Return the number of ticks recorded.
+	unsigned GetNumTicks() const { return numRecorded_; }
+	/// Return the number of ticks kept at most.
+	unsigned GetCapacity() const { return ticks_.Size(); }
+	/// Return the newest tick recorded.
+	unsigned GetNewestTick() const { return numRecorded_ ? ticks_[newest_] : 0; }
+	/// Return the bytes the history takes.
+	unsigned GetMemoryUse() const;
+
+private:
+	/// Tick held in each slot.
+	PODVector<unsigned> ticks_;
+	/// Quantization box of each slot.
+	Vector<BoundingBox> bounds_;
+	/// Quantized positions, slot after slot, x y z of each boid together.
+	PODVector<unsigned short> positions_;
+	/// Tick each boid was last captured at, 0 if never.
+	PODVector<unsigned> capturedTick_;
+	/// Number of boids.
+	unsigned numBoids_;
+	/// Slot of the newest tick.
+	unsigned newest_;
+	/// Number of slots filled.
+	unsigned numRecorded_;
+};
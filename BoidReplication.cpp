@@ -0,0 +1,540 @@
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/StaticModelGroup.h>
+#include <Urho3D/IO/Compression.h>
+#include <Urho3D/Resource/ResourceCache.h>
+
+#include "BoidReplication.h"
+#include "Boids.h"
+#include "NetStats.h"
+
+/// A boid of a join keyframe with its squared distance from the client's starting point.
+struct JoinBoid
+{
+	float distance_;
+	unsigned index_;
+};
+
+/// Return whether tick a is newer than tick b, allowing for the counter wrapping.
+static bool IsNewer(unsigned a, unsigned b)
+{
+	return (int)(a - b) > 0;
+}
+
+static bool CompareJoinBoids(const JoinBoid& lhs, const JoinBoid& rhs)
+{
+	return lhs.distance_ < rhs.distance_;
+}
+
+BoidReplicator::BoidReplicator() :
+	ring_(SNAPSHOT_RING_SIZE),
+	interestRadius_(0.0f),
+	interestHysteresis_(DEFAULT_INTEREST_HYSTERESIS),
+	tick_(0),
+	bytesSent_(0),
+	keyframesSent_(0),
+	deltasSent_(0),
+	boidsSent_(0),
+	boidsCulled_(0),
+	joinChunkBoids_(DEFAULT_JOIN_CHUNK_BOIDS),
+	joinChunksPerUpdate_(DEFAULT_JOIN_CHUNKS_PER_UPDATE),
+	joinsSent_(0),
+	joinBytesSent_(0),
+	joinRawBytes_(0),
+	netStats_(0)
+{
+}
+
+void BoidReplicator::Send(const FlockStore& store, const Vector<SharedPtr<Connection> >& connections)
+{
+	bool anyReady = false;
+	for (unsigned i = 0; i < connections.Size(); ++i)
+		anyReady |= connections[i]->IsSceneLoaded();
+	if (!anyReady)
+		return;
+
+	// Tick 0 means no baseline, skip it when the counter wraps
+	if (++tick_ == 0)
+		++tick_;
+	BoidSnapshot& current = ring_[tick_ % SNAPSHOT_RING_SIZE];
+	current.Capture(store, tick_);
+	encoded_.Clear();
+
+	// Unreliable and unordered: a lost snapshot is replaced by the next one, never worth resending
+	for (unsigned i = 0; i < connections.Size(); ++i)
+	{
+		Connection* connection = connections[i];
+		if (!connection->IsSceneLoaded())
+			continue;
+
+		ClientState& client = clients_[connection];
+		if (client.joining_)
+		{
+			SendJoin(connection, client, store);
+			continue;
+		}
+
+		unsigned baseline = 0;
+		if (client.acked_ && tick_ - client.acked_ < SNAPSHOT_RING_SIZE)
+		{
+			const BoidSnapshot& candidate = ring_[client.acked_ % SNAPSHOT_RING_SIZE];
+			if (candidate.GetTick() == client.acked_ && current.CanDeltaFrom(candidate))
+				baseline = client.acked_;
+		}
+
+		const PODVector<unsigned char>* modes = 0;
+		unsigned numSent = current.GetNumBoids();
+		if (interestRadius_ > 0.0f)
+		{
+			numSent = UpdateInterest(client, store, connection->GetPosition(), baseline);
+			modes = &client.modes_;
+		}
+
+		const Vector<VectorBuffer>& messages = Encode(baseline, modes);
+		for (unsigned m = 0; m < messages.Size(); ++m)
+		{
+			connection->SendMessage(MSG_BOIDSNAPSHOT, false, false, messages[m]);
+			bytesSent_ += messages[m].GetSize();
+			if (netStats_)
+				netStats_->CountSent(connection, MSG_BOIDSNAPSHOT, messages[m].GetSize());
+		}
+		if (baseline)
+			++deltasSent_;
+		else
+			++keyframesSent_;
+		boidsSent_ += numSent;
+		boidsCulled_ += current.GetNumBoids() - numSent;
+	}
+}
+
+unsigned BoidReplicator::UpdateInterest(ClientState& client, const FlockStore& store, const Vector3& position, unsigned baseline)
+{
+	unsigned numBoids = store.GetNumBoids();
+	if (client.interested_.Size() != numBoids)
+	{
+		client.interested_.Resize(numBoids);
+		client.entered_.Resize(numBoids);
+		for (unsigned i = 0; i < numBoids; ++i)
+			client.interested_[i] = 0;
+	}
+	client.modes_.Resize(numBoids);
+
+	float enter2 = interestRadius_ * interestRadius_;
+	float leaveRadius = interestRadius_ * interestHysteresis_;
+	float leave2 = leaveRadius * leaveRadius;
+	unsigned numSent = 0;
+	for (unsigned i = 0; i < numBoids; ++i)
+	{
+		float dx = store.posX_[i] - position.x_;
+		float dy = store.posY_[i] - position.y_;
+		float dz = store.posZ_[i] - position.z_;
+		float d2 = dx * dx + dy * dy + dz * dz;
+		if (d2 >= (client.interested_[i] ? leave2 : enter2))
+		{
+			client.interested_[i] = 0;
+			client.modes_[i] = BSM_SKIP;
+			continue;
+		}
+
+		if (!client.interested_[i])
+		{
+			client.interested_[i] = 1;
+			client.entered_[i] = tick_;
+		}
+		// The baseline only holds the boid if it was already in interest when the baseline was sent
+		bool inBaseline = baseline && !IsNewer(client.entered_[i], baseline);
+		client.modes_[i] = (unsigned char)(inBaseline ? BSM_DELTA : BSM_FULL);
+		++numSent;
+	}
+	return numSent;
+}
+
+void BoidReplicator::SendJoin(Connection* connection, ClientState& client, const FlockStore& store)
+{
+	const BoidSnapshot& current = ring_[tick_ % SNAPSHOT_RING_SIZE];
+	unsigned numBoids = current.GetNumBoids();
+	if (!client.join_.GetTick())
+	{
+		// Nearest the starting point first, leaving out what a snapshot would leave out for interest
+		client.join_ = current;
+		PODVector<JoinBoid> boids;
+		float radius2 = interestRadius_ * interestRadius_;
+		for (unsigned i = 0; i < numBoids; ++i)
+		{
+			float dx = store.posX_[i] - client.joinOrigin_.x_;
+			float dy = store.posY_[i] - client.joinOrigin_.y_;
+			float dz = store.posZ_[i] - client.joinOrigin_.z_;
+			JoinBoid boid;
+			boid.distance_ = dx * dx + dy * dy + dz * dz;
+			boid.index_ = i;
+			if (interestRadius_ <= 0.0f || boid.distance_ < radius2)
+				boids.Push(boid);
+		}
+		Sort(boids.Begin(), boids.End(), CompareJoinBoids);
+		client.joinOrder_.Resize(boids.Size());
+		for (unsigned k = 0; k < boids.Size(); ++k)
+			client.joinOrder_[k] = boids[k].index_;
+		client.joinNext_ = 0;
+		client.joinChunk_ = 0;
+	}
+
+	// Each message is a keyframe chunk of just its own boids, which run in index order, so fish of one flock swimming
+	// together make long runs and the quantized values compress well. An empty keyframe still gets its message
+	const BoidSnapshot& join = client.join_;
+	unsigned numChunks = Max((client.joinOrder_.Size() + joinChunkBoids_ - 1) / joinChunkBoids_, 1u);
+	client.modes_.Resize(numBoids);
+	for (unsigned sent = 0; sent < joinChunksPerUpdate_ && client.joinChunk_ < numChunks; ++sent)
+	{
+		unsigned end = Min(client.joinNext_ + joinChunkBoids_, client.joinOrder_.Size());
+		for (unsigned i = 0; i < numBoids; ++i)
+			client.modes_[i] = BSM_SKIP;
+		for (unsigned k = client.joinNext_; k < end; ++k)
+			client.modes_[client.joinOrder_[k]] = BSM_FULL;
+
+		VectorBuffer raw;
+		raw.WriteVLE(client.joinChunk_);
+		raw.WriteVLE(numChunks);
+		unsigned next = 0;
+		join.WriteChunk(raw, 0, &client.modes_, client.joinChunk_, next, M_MAX_UNSIGNED);
+		raw.Seek(0);
+		VectorBuffer message;
+		CompressStream(message, raw);
+		connection->SendMessage(MSG_JOINKEYFRAME, true, true, message);
+		joinBytesSent_ += message.GetSize();
+		joinRawBytes_ += raw.GetSize();
+		bytesSent_ += message.GetSize();
+		boidsSent_ += end - client.joinNext_;
+		if (netStats_)
+			netStats_->CountSent(connection, MSG_JOINKEYFRAME, message.GetSize());
+		client.joinNext_ = end;
+		++client.joinChunk_;
+	}
+	if (client.joinChunk_ < numChunks)
+		return;
+
+	// Reliable, so the keyframe will reach the client and snapshots can be delta coded against it without waiting for
+	// the acknowledgement. Nothing orders them after it though: one that overtakes the keyframe's last messages finds
+	// no baseline and is dropped by the client, and the next one after the keyframe completes is shown
+	client.joining_ = false;
+	client.acked_ = join.GetTick();
+	if (interestRadius_ > 0.0f)
+	{
+		client.interested_.Resize(numBoids);
+		client.entered_.Resize(numBoids);
+		for (unsigned i = 0; i < numBoids; ++i)
+			client.interested_[i] = 0;
+		for (unsigned k = 0; k < client.joinOrder_.Size(); ++k)
+		{
+			client.interested_[client.joinOrder_[k]] = 1;
+			client.entered_[client.joinOrder_[k]] = join.GetTick();
+		}
+	}
+	client.joinOrder_.Clear();
+	client.join_ = BoidSnapshot();
+	++joinsSent_;
+}
+
+const Vector<VectorBuffer>& BoidReplicator::Encode(unsigned baseline, const PODVector<unsigned char>* modes)
+{
+	if (!modes)
+	{
+		HashMap<unsigned, Vector<VectorBuffer> >::Iterator i = encoded_.Find(baseline);
+		if (i != encoded_.End())
+			return i->second_;
+	}
+
+	const BoidSnapshot& current = ring_[tick_ % SNAPSHOT_RING_SIZE];
+	const BoidSnapshot* base = baseline ? &ring_[baseline % SNAPSHOT_RING_SIZE] : 0;
+	Vector<VectorBuffer>& messages = modes ? messages_ : encoded_[baseline];
+	unsigned next = 0;
+	unsigned chunk = 0;
+	do
+	{
+		if (messages.Size() <= chunk)
+			messages.Resize(chunk + 1);
+		messages[chunk].Clear();
+		current.WriteChunk(messages[chunk], base, modes, chunk, next);
+		++chunk;
+	} while (next < current.GetNumBoids());
+	messages.Resize(chunk);
+	return messages;
+}
+
+void BoidReplicator::HandleAck(Connection* connection, Deserializer& message)
+{
+	if (message.GetSize() < sizeof(unsigned))
+		return;
+	unsigned tick = message.ReadUInt();
+	// Acks are unordered too, only ever move forward, and never past what was sent
+	if (!tick || IsNewer(tick, tick_))
+		return;
+	HashMap<Connection*, ClientState>::Iterator client = clients_.Find(connection);
+	if (client == clients_.End())
+		return;
+	if (!client->second_.acked_ || IsNewer(tick, client->second_.acked_))
+		client->second_.acked_ = tick;
+}
+
+void BoidReplicator::AddConnection(Connection* connection, const Vector3& origin)
+{
+	ClientState& client = clients_[connection];
+	client.joining_ = joinChunkBoids_ > 0;
+	client.joinOrigin_ = origin;
+}
+
+void BoidReplicator::RemoveConnection(Connection* connection)
+{
+	clients_.Erase(connection);
+}
+
+void BoidReplicator::SetInterestRadius(float radius)
+{
+	interestRadius_ = Max(radius, 0.0f);
+}
+
+void BoidReplicator::SetInterestHysteresis(float factor)
+{
+	interestHysteresis_ = Max(factor, 1.0f);
+}
+
+RemoteFlock::RemoteFlock() :
+	ring_(SNAPSHOT_RING_SIZE),
+	numFlocks_(0),
+	missingBaselines_(0),
+	hasComplete_(false),
+	joinBoids_(0),
+	joinBytes_(0),
+	joined_(false),
+	netStats_(0)
+{
+	for (unsigned i = 0; i < ring_.Size(); ++i)
+		ResetSlot(ring_[i], 0);
+}
+
+void RemoteFlock::HandleMessage(Scene* scene, Connection* server, Deserializer& message, float time)
+{
+	BoidChunkHeader header;
+	if (!BoidSnapshot::ReadChunkHeader(message, header) || !header.tick_)
+		return;
+
+	// Reliable messages are not ordered against unreliable ones, so snapshots delta coded against a join keyframe can
+	// arrive before it is complete. Those are dropped like any other whose baseline is missing
+	const BoidSnapshot* baseline = 0;
+	if (header.baseline_)
+	{
+		const Slot& base = ring_[header.baseline_ % SNAPSHOT_RING_SIZE];
+		if (!base.complete_ || base.snapshot_.GetTick() != header.baseline_)
+		{
+			++missingBaselines_;
+			return;
+		}
+		baseline = &base.snapshot_;
+	}
+
+	// Start over on a slot still holding an older tick
+	Slot& slot = ring_[header.tick_ % SNAPSHOT_RING_SIZE];
+	if (slot.snapshot_.GetTick() != header.tick_ || slot.received_.Size() != header.numBoids_)
+		ResetSlot(slot, header.numBoids_);
+	if (header.chunk_ < slot.chunks_.Size() && slot.chunks_[header.chunk_])
+		return;
+	decoded_.Clear();
+	if (!slot.snapshot_.ReadChunk(message, header, baseline, decoded_))
+		return;
+
+	AddChunk(slot, header.chunk_);
+	if (header.last_)
+		slot.totalChunks_ = header.chunk_ + 1;
+	clock_.Receive(header.tick_, time);
+	ShowDecoded(scene, slot.snapshot_);
+	if (!slot.complete_ && slot.totalChunks_ && slot.numChunks_ == slot.totalChunks_)
+		CompleteSlot(slot, server);
+}
+
+void RemoteFlock::HandleJoinMessage(Scene* scene, Connection* server, Deserializer& message, float time)
+{
+	joinBytes_ += message.GetSize();
+	VectorBuffer data;
+	if (!DecompressStream(data, message))
+		return;
+	data.Seek(0);
+	unsigned chunk = data.ReadVLE();
+	unsigned numChunks = data.ReadVLE();
+	BoidChunkHeader header;
+	if (!BoidSnapshot::ReadChunkHeader(data, header) || !header.tick_ || header.baseline_ || chunk >= numChunks)
+		return;
+
+	// The keyframe's own numbering, its messages each look like the last chunk of a snapshot
+	Slot& slot = ring_[header.tick_ % SNAPSHOT_RING_SIZE];
+	if (slot.snapshot_.GetTick() != header.tick_ || slot.received_.Size() != header.numBoids_)
+		ResetSlot(slot, header.numBoids_);
+	if (chunk < slot.chunks_.Size() && slot.chunks_[chunk])
+		return;
+	decoded_.Clear();
+	if (!slot.snapshot_.ReadChunk(data, header, 0, decoded_))
+		return;
+	AddChunk(slot, chunk);
+	slot.totalChunks_ = numChunks;
+	joinBoids_ += decoded_.Size();
+
+	// The keyframe arrives over several updates but holds a single tick, which only starts the clock
+	if (!clock_.IsValid())
+		clock_.Receive(header.tick_, time);
+	ShowDecoded(scene, slot.snapshot_);
+	if (!slot.complete_ && slot.numChunks_ == slot.totalChunks_)
+	{
+		CompleteSlot(slot, server);
+		joined_ = true;
+	}
+}
+
+void RemoteFlock::AddChunk(Slot& slot, unsigned chunk)
+{
+	if (slot.chunks_.Size() <= chunk)
+	{
+		unsigned oldSize = slot.chunks_.Size();
+		slot.chunks_.Resize(chunk + 1);
+		for (unsigned c = oldSize; c < slot.chunks_.Size(); ++c)
+			slot.chunks_[c] = 0;
+	}
+	slot.chunks_[chunk] = 1;
+	++slot.numChunks_;
+	for (unsigned k = 0; k < decoded_.Size(); ++k)
+		slot.received_[decoded_[k]] = 1;
+}
+
+void RemoteFlock::ShowDecoded(Scene* scene, const BoidSnapshot& snapshot)
+{
+	if (!root_ || root_->GetScene() != scene || nodes_.Size() != snapshot.GetNumBoids() || numFlocks_ != snapshot.GetNumFlocks())
+		CreateNodes(scene, snapshot.GetNumBoids(), snapshot.GetNumFlocks());
+
+	// A late message can still fill a gap in a shown boid's buffer, but never brings back a hidden one
+	unsigned snapshotTick = snapshot.GetTick();
+	float tick = clock_.ToTick(snapshotTick);
+	for (unsigned k = 0; k < decoded_.Size(); ++k)
+	{
+		unsigned i = decoded_[k];
+		bool newer = IsNewer(snapshotTick, ticks_[i]);
+		if (!newer && !nodes_[i]->IsEnabled())
+			continue;
+		buffers_[i].Push(tick, snapshot.GetPosition(i), Boids::Heading(snapshot.GetDirection(i)));
+		if (!newer)
+			continue;
+		ticks_[i] = snapshotTick;
+		if (!nodes_[i]->IsEnabled())
+			nodes_[i]->SetEnabled(true);
+	}
+}
+
+void RemoteFlock::CompleteSlot(Slot& slot, Connection* server)
+{
+	unsigned tick = slot.snapshot_.GetTick();
+	slot.complete_ = true;
+	hasComplete_ = true;
+	VectorBuffer ack;
+	ack.WriteUInt(tick);
+	server->SendMessage(MSG_BOIDSNAPSHOTACK, false, false, ack);
+	if (netStats_)
+		netStats_->CountSent(server, MSG_BOIDSNAPSHOTACK, ack.GetSize());
+
+	// Whatever the whole tick left out has gone out of interest, unless a newer tick already showed it
+	for (unsigned i = 0; i < nodes_.Size(); ++i)
+	{
+		if (slot.received_[i] || !IsNewer(tick, ticks_[i]))
+			continue;
+		ticks_[i] = tick;
+		buffers_[i].Clear();
+		if (nodes_[i]->IsEnabled())
+			nodes_[i]->SetEnabled(false);
+	}
+}
+
+void RemoteFlock::Update(float time)
+{
+	clock_.Update(time);
+	float tick = clock_.GetRenderTick();
+	float maxExtrapolation = clock_.GetMaxExtrapolationTicks();
+	for (unsigned i = 0; i < nodes_.Size(); ++i)
+	{
+		if (!nodes_[i]->IsEnabled())
+			continue;
+
+		Vector3 position;
+		Quaternion rotation;
+		InterpolationResult result = buffers_[i].Sample(tick, maxExtrapolation, position, rotation);
+		if (result == IR_INTERPOLATED)
+			++stats_.interpolated_;
+		else if (result == IR_EXTRAPOLATED)
+			++stats_.extrapolated_;
+		else if (result == IR_HELD)
+			++stats_.held_;
+		if (result != IR_NONE)
+			nodes_[i]->SetTransform(position, rotation);
+	}
+}
+
+void RemoteFlock::Clear()
+{
+	RemoveNodes();
+	clock_.Reset();
+	hasComplete_ = false;
+	joinBoids_ = 0;
+	joinBytes_ = 0;
+	joined_ = false;
+	for (unsigned i = 0; i < ring_.Size(); ++i)
+	{
+		ring_[i].snapshot_ = BoidSnapshot();
+		ResetSlot(ring_[i], 0);
+	}
+}
+
+void RemoteFlock::RemoveNodes()
+{
+	if (root_)
+		root_->Remove();
+	root_.Reset();
+	nodes_.Clear();
+	ticks_.Clear();
+	buffers_.Clear();
+	numFlocks_ = 0;
+}
+
+void RemoteFlock::ResetSlot(Slot& slot, unsigned numBoids)
+{
+	slot.received_.Resize(numBoids);
+	for (unsigned i = 0; i < numBoids; ++i)
+		slot.received_[i] = 0;
+	slot.chunks_.Clear();
+	slot.numChunks_ = 0;
+	slot.totalChunks_ = 0;
+	slot.complete_ = false;
+}
+
+void RemoteFlock::CreateNodes(Scene* scene, unsigned numBoids, unsigned numFlocks)
+{
+	// Only the nodes go, the snapshots being reassembled stay valid for the new ones
+	RemoveNodes();
+
+	ResourceCache* cache = scene->GetSubsystem<ResourceCache>();
+	root_ = scene->CreateChild("RemoteFlock", LOCAL);
+	nodes_.Resize(numBoids);
+	ticks_.Resize(numBoids);
+	buffers_.Resize(numBoids);
+	numFlocks_ = numFlocks;
+
+	unsigned flockSize = numFlocks ? numBoids / numFlocks : numBoids;
+	StaticModelGroup* group = 0;
+	for (unsigned i = 0; i < numBoids; ++i)
+	{
+		if (!group || (flockSize && i % flockSize == 0))
+		{
+			group = root_->CreateChild("Flock", LOCAL)->CreateComponent<StaticModelGroup>(LOCAL);
+			group->SetModel(cache->GetResource<Model>("Models/tna_body.mdl"));
+			group->SetMaterial(cache->GetResource<Material>("Materials/Fishy.xml"));
+			group->SetCastShadows(true);
+		}
+		nodes_[i] = root_->CreateChild("Boid", LOCAL);
+		group->AddInstanceNode(nodes_[i]);
+		ticks_[i] = 0;
+	}
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "BoidSnapshot.h"
+#include "Interpolation.h"
+
+class NetStats;
+
+/// Default number of boids in one join keyframe message.
+static const unsigned DEFAULT_JOIN_CHUNK_BOIDS = 512;
+/// Default number of join keyframe messages sent to a joining client each network update.
+static const unsigned DEFAULT_JOIN_CHUNKS_PER_UPDATE = 4;
+/// Default factor of the interest radius something in interest has to move out to before it leaves it.
+static const float DEFAULT_INTEREST_HYSTERESIS = 1.25f;
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Server side of boid replication. Boid nodes are local to the server; instead of Urho3D replicating each of them,
+/// every network update quantizes the whole flock once and sends it to each client in a few MSG_BOIDSNAPSHOT messages.
+/// Snapshots are delta coded against the newest tick the client acknowledged receiving in full. The last
+/// SNAPSHOT_RING_SIZE snapshots are kept as baselines; once a client's acknowledgement is older than that, or the
+/// quantization box has moved since, it gets a keyframe instead.
+/// With an interest radius set, each client only gets the boids within it of the position its connection reports,
+/// the camera. A boid has to move a little further out than the radius before it is dropped, so one skirting the edge
+/// is not sent whole every time it comes back. A boid that comes into interest is sent whole until the client has
+/// acknowledged a tick that carried it, delta coded after that.
+/// A client that joins is first sent one keyframe as a stream of reliable MSG_JOINKEYFRAME messages, a few each update,
+/// each a batch of boids in the snapshot chunk layout compressed with LZ4. The boids go nearest the client's starting
+/// point first, so the fish around it show within the first message however large the flock. Once the last message
+/// is sent the keyframe's tick is taken as acknowledged, being reliable, and snapshots follow delta coded against it.
+/// kNet does not order those after the keyframe, so the client drops any that arrive before the keyframe is complete.
+class BoidReplicator
+{
+public:
+	BoidReplicator();
+
+	/// Capture the flock and send it to every connection whose scene has finished loading.
+	void Send(const FlockStore& store, const Vector<SharedPtr<Connection> >& connections);
+	/// Handle a MSG_BOIDSNAPSHOTACK payload from a client.
+	void HandleAck(Connection* connection, Deserializer& message);
+	/// Note a client that has joined and where it starts. Once its scene has loaded it is streamed the join keyframe
+	/// instead of snapshots, nearest origin first. Clients not added get keyframe snapshots from the start.
+	void AddConnection(Connection* connection, const Vector3& origin);
+	/// Forget a disconnected client.
+	void RemoveConnection(Connection* connection);
+	/// Set the interest radius around each client. 0 sends every boid to everyone.
+	void SetInterestRadius(float radius);
+	/// Set how much further than the interest radius a boid has to move to be dropped, as a factor of the radius.
+	void SetInterestHysteresis(float factor);
+	/// Set the network stats snapshots are counted in, or null.
+	void SetStats(NetStats* stats) { netStats_ = stats; }
+	/// Set the number of boids in each join keyframe message, 0 to send joining clients keyframe snapshots instead.
+	void SetJoinChunkBoids(unsigned count) { joinChunkBoids_ = count; }
+	/// Set the number of join keyframe messages sent to a joining client each update.
+	void SetJoinChunksPerUpdate(unsigned count) { joinChunksPerUpdate_ = Max(count, 1u); }
+
+	/// Return the interest radius.
+	float GetInterestRadius() const { return interestRadius_; }
+	/// Return the interest hysteresis factor.
+	float GetInterestHysteresis() const { return interestHysteresis_; }
+
+	/// Return the tick of the last snapshot sent.
+	unsigned GetTick() const { return tick_; }
+	/// Return total snapshot payload bytes sent to all connections.
+	unsigned long long GetBytesSent() const { return bytesSent_; }
+	/// Return the number of snapshots sent as keyframes.
+	unsigned GetKeyframesSent() const { return keyframesSent_; }
+	/// Return the number of snapshots sent delta coded.
+	unsigned GetDeltasSent() const { return deltasSent_; }
+	/// Return the number of boids sent to all connections.
+	unsigned long long GetBoidsSent() const { return boidsSent_; }
+	/// Return the number of boids left out of snapshots for being outside a client's interest.
+	unsigned long long GetBoidsCulled() const { return boidsCulled_; }
+	/// Return the number of join keyframes sent in full.
+	unsigned GetJoinsSent() const { return joinsSent_; }
+	/// Return total join keyframe bytes sent, compressed.
+	unsigned long long GetJoinBytesSent() const { return joinBytesSent_; }
+	/// Return total join keyframe bytes before compression.
+	unsigned long long GetJoinRawBytes() const { return joinRawBytes_; }
+
+private:
+	/// Replication state of one client.
+	struct ClientState
+	{
+		ClientState() :
+			acked_(0),
+			joinNext_(0),
+			joinChunk_(0),
+			joining_(false)
+		{
+		}
+
+		/// Newest tick received in full.
+		unsigned acked_;
+		/// Keyframe the client joins from, captured when its scene has loaded.
+		BoidSnapshot join_;
+		/// Boids of the join keyframe, nearest the origin first.
+		PODVector<unsigned> joinOrder_;
+		/// Next boid of joinOrder_ to send.
+		unsigned joinNext_;
+		/// Next join message number.
+		unsigned joinChunk_;
+		/// Where the client starts.
+		Vector3 joinOrigin_;
+		/// Whether the client is still to get all of the join keyframe.
+		bool joining_;
+		/// Whether each boid is inside the client's interest.
+		PODVector<unsigned char> interested_;
+		/// Tick each boid last came into interest.
+		PODVector<unsigned> entered_;
+		/// BoidSendMode of each boid this tick.
+		PODVector<unsigned char> modes_;
+	};
+
+	/// Encode the current snapshot against a baseline tick, 0 for a keyframe. Without modes the messages are reused if
+	/// another connection already needed the same baseline this tick.
+	const Vector<VectorBuffer>& Encode(unsigned baseline, const PODVector<unsigned char>* modes);
+	/// Work out which boids a client gets this tick and how, and return the number sent.
+	unsigned UpdateInterest(ClientState& client, const FlockStore& store, const Vector3& position, unsigned baseline);
+	/// Send a joining client the next messages of its join keyframe, starting the keyframe from the current snapshot
+	/// the first time.
+	void SendJoin(Connection* connection, ClientState& client, const FlockStore& store);
+
+	/// Recent snapshots, indexed by tick modulo the ring size. The current one is included.
+	Vector<BoidSnapshot> ring_;
+	/// Messages of the current snapshot by baseline tick, shared by every client while interest is off.
+	HashMap<unsigned, Vector<VectorBuffer> > encoded_;
+	/// Messages for the client being sent to while interest is on.
+	Vector<VectorBuffer> messages_;
+	/// State of each client.
+	HashMap<Connection*, ClientState> clients_;
+	/// Interest radius, 0 for none.
+	float interestRadius_;
+	/// Interest radius factor a boid has to move beyond to be dropped.
+	float interestHysteresis_;
+	/// Tick of the last snapshot.
+	unsigned tick_;
+	/// Payload bytes sent.
+	unsigned long long bytesSent_;
+	/// Keyframe snapshots sent.
+	unsigned keyframesSent_;
+	/// Delta coded snapshots sent.
+	unsigned deltasSent_;
+	/// Boids sent.
+	unsigned long long boidsSent_;
+	/// Boids left out for interest.
+	unsigned long long boidsCulled_;
+	/// Boids per join message, 0 for no join keyframes.
+	unsigned joinChunkBoids_;
+	/// Join messages per update.
+	unsigned joinChunksPerUpdate_;
+	/// Join keyframes sent in full.
+	unsigned joinsSent_;
+	/// Join bytes sent, compressed.
+	unsigned long long joinBytesSent_;
+	/// Join bytes before compression.
+	unsigned long long joinRawBytes_;
+	/// Network stats to count snapshots in.
+	NetStats* netStats_;
+};
+
+/// Client side of boid replication. Keeps a local, unreplicated node for every server boid and moves it to the
+/// position and heading of the newest snapshot message that covered it. Messages are unreliable and unordered, so a
+/// boid only takes state from a tick newer than the one it shows. Recent snapshots are reassembled from their
+/// messages so delta coded ones can be decoded, and each tick received in full is acknowledged to the server.
+/// Boids a complete tick left out are outside the client's interest and are hidden until a tick carries them again.
+/// Boids are not moved as messages arrive but buffered and shown a little in the past, interpolated between the two
+/// ticks either side, so the server can send snapshots less often without the fish stuttering.
+/// A join keyframe is reassembled the same way into the slot of its tick, each message shown as it arrives, and once
+/// complete is acknowledged like any tick and becomes the baseline of the snapshots that follow.
+class RemoteFlock
+{
+public:
+	RemoteFlock();
+
+	/// Apply one MSG_BOIDSNAPSHOT payload from the server, received at a local time in seconds. Boid nodes are created
+	/// in the scene on the first message, and again if the flock layout or the scene changes.
+	void HandleMessage(Scene* scene, Connection* server, Deserializer& message, float time);
+	/// Apply one MSG_JOINKEYFRAME payload from the server, received at a local time in seconds.
+	void HandleJoinMessage(Scene* scene, Connection* server, Deserializer& message, float time);
+	/// Move every shown boid to its state at a local time in seconds. Called once a frame.
+	void Update(float time);
+	/// Remove the boid nodes and forget every snapshot.
+	void Clear();
+	/// Set the network stats acknowledgements are counted in, or null.
+	void SetStats(NetStats* stats) { netStats_ = stats; }
+
+	/// Return the clock boids are shown by.
+	InterpolationClock& GetClock() { return clock_; }
+	/// Return how boids were shown so far.
+	const InterpolationStats& GetStats() const { return stats_; }
+
+	/// Return number of boids shown.
+	unsigned GetNumBoids() const { return nodes_.Size(); }
+	/// Return the node of a boid. Boids outside the interest radius are disabled.
+	Node* GetNode(unsigned index) const { return nodes_[index]; }
+	/// Return the number of messages dropped because their baseline was missing.
+	unsigned GetMissingBaselines() const { return missingBaselines_; }
+	/// Return whether a tick has been received in full since the flock was last cleared, every boid placed or hidden.
+	bool HasCompleteTick() const { return hasComplete_; }
+	/// Return the number of boids the join keyframe carried so far.
+	unsigned GetJoinBoids() const { return joinBoids_; }
+	/// Return the join keyframe bytes received so far, compressed.
+	unsigned GetJoinBytes() const { return joinBytes_; }
+	/// Return whether the join keyframe has arrived in full.
+	bool IsJoined() const { return joined_; }
+
+private:
+	/// A snapshot being reassembled from its messages.
+	struct Slot
+	{
+		/// Decoded state so far. Only the boids the tick carried are valid.
+		BoidSnapshot snapshot_;
+		/// Whether each boid has arrived.
+		PODVector<unsigned char> received_;
+		/// Whether each message has arrived.
+		PODVector<unsigned char> chunks_;
+		/// Number of messages arrived.
+		unsigned numChunks_;
+		/// Number of messages the tick was split into, 0 until the last one arrives.
+		unsigned totalChunks_;
+		/// Whether every message has arrived.
+		bool complete_;
+	};
+
+	/// Create the local boid nodes, drawn through one StaticModelGroup per flock like the server's.
+	void CreateNodes(Scene* scene, unsigned numBoids, unsigned numFlocks);
+	/// Remove the boid nodes.
+	void RemoveNodes();
+	/// Empty a snapshot slot to reassemble a new tick of numBoids boids.
+	void ResetSlot(Slot& slot, unsigned numBoids);
+	/// Note message number chunk of a slot's tick, and the boids just decoded from it, have arrived.
+	void AddChunk(Slot& slot, unsigned chunk);
+	/// Create the nodes if the snapshot's layout or the scene changed, and buffer the boids just decoded from it.
+	void ShowDecoded(Scene* scene, const BoidSnapshot& snapshot);
+	/// Acknowledge a slot whose tick has arrived in full and hide the boids it left out.
+	void CompleteSlot(Slot& slot, Connection* server);
+
+	/// Recent snapshots, indexed by tick modulo the ring size.
+	Vector<Slot> ring_;
+	/// Local parent of every node created, removing it removes the flock.
+	WeakPtr<Node> root_;
+	/// Node of each boid.
+	PODVector<Node*> nodes_;
+	/// Tick each boid was last moved to or hidden at.
+	PODVector<unsigned> ticks_;
+	/// Boids decoded from the last message.
+	PODVector<unsigned> decoded_;
+	/// Received states of each boid waiting to be shown.
+	Vector<InterpolationBuffer> buffers_;
+	/// Maps snapshot ticks to the time they are shown at.
+	InterpolationClock clock_;
+	/// How boids were shown.
+	InterpolationStats stats_;
+	/// Number of flocks the nodes were created for.
+	unsigned numFlocks_;
+	/// Messages dropped for want of their baseline.
+	unsigned missingBaselines_;
+	/// Whether a tick has been received in full.
+	bool hasComplete_;
+	/// Boids received in join messages.
+	unsigned joinBoids_;
+	/// Join message bytes received.
+	unsigned joinBytes_;
+	/// Whether the join keyframe is complete.
+	bool joined_;
+	/// Network stats to count acknowledgements in.
+	NetStats* netStats_;
+};
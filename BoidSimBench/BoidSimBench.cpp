@@ -0,0 +1,186 @@
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Math/Random.h>
+
+#include "Boids.h"
+#include "Replay.h"
+
+// Headless benchmark of the boid simulation as the server runs it.
+// Builds a scene with only an Octree and a PhysicsWorld, spawns the flocks through BoidSet::Initialise from a fixed seed,
+// then steps the physics world with the flock update in its pre-step, exactly as CharacterDemo::HandlePhysicsPreStep
+// does. Prints one CSV row of tick time statistics, so runs can be compared across builds.
+// -replay FILE takes the layout from a match recorded with -record instead, and puts every boid and the capturing shark
+// where the recording had them before each tick, looping over the recording, so the flocks clump and scatter as they
+// did in play rather than as they do straight after a random spawn. Loading a tick is not timed.
+//
+// Usage: BoidSimBench [-flocks N] [-flocksize N] [-threads N] [-ticks N] [-kinematic] [-replay FILE]
+// -threads counts the main thread, so 1 runs the flocking without worker threads.
+
+static const unsigned DEFAULT_TICKS = 600;
+/// Ticks left untimed at the start while bullet pushes apart boids that spawned overlapping.
+static const unsigned WARMUP_TICKS = 10;
+static const unsigned RANDOM_SEED = 1;
+
+/// Runs the flock update from the physics pre-step and times it.
+class BoidSimBench : public Object
+{
+	URHO3D_OBJECT(BoidSimBench, Object);
+
+public:
+	BoidSimBench(Context* context, BoidSet& boidSet) :
+		Object(context),
+		boidSet_(boidSet),
+		flockingUSec_(0)
+	{
+	}
+
+	/// Subscribe to the pre-step of the scene's physics world.
+	void Attach(PhysicsWorld* physicsWorld)
+	{
+		SubscribeToEvent(physicsWorld, E_PHYSICSPRESTEP, URHO3D_HANDLER(BoidSimBench, HandlePhysicsPreStep));
+	}
+
+	/// Return time spent in BoidSet::Update since the last call, in microseconds.
+	long long TakeFlockingUSec()
+	{
+		long long usec = flockingUSec_;
+		flockingUSec_ = 0;
+		return usec;
+	}
+
+private:
+	void HandlePhysicsPreStep(StringHash eventType, VariantMap& eventData)
+	{
+		using namespace PhysicsPreStep;
+
+		HiresTimer timer;
+		boidSet_.Update(eventData[P_TIMESTEP].GetFloat());
+		flockingUSec_ += timer.GetUSec(false);
+	}
+
+	/// Flocks being stepped.
+	BoidSet& boidSet_;
+	/// Accumulated flock update time.
+	long long flockingUSec_;
+};
+
+/// Return the value at fraction of the way through sorted values.
+static float Percentile(const PODVector<float>& sorted, float fraction)
+{
+	if (sorted.Empty())
+		return 0.0f;
+	unsigned index = (unsigned)(fraction * (sorted.Size() - 1) + 0.5f);
+	return sorted[index];
+}
+
+int main(int argc, char** argv)
+{
+	BoidSet boidSet;
+	unsigned threads = GetNumPhysicalCPUs();
+	unsigned ticks = DEFAULT_TICKS;
+	bool kinematic = false;
+	String replayFile;
+
+	const Vector<String>& arguments = ParseArguments(argc, argv);
+	for (unsigned i = 0; i < arguments.Size(); ++i)
+	{
+		String argument = arguments[i].ToLower();
+		bool hasValue = i + 1 < arguments.Size();
+		if (argument == "-flocks" && hasValue)
+			boidSet.SetFlockLayout(ToUInt(arguments[++i]), boidSet.GetFlockSize());
+		else if (argument == "-flocksize" && hasValue)
+			boidSet.SetFlockLayout(boidSet.GetNumFlocks(), ToUInt(arguments[++i]));
+		else if (argument == "-threads" && hasValue)
+			threads = Max(ToUInt(arguments[++i]), 1u);
+		else if (argument == "-ticks" && hasValue)
+			ticks = Max(ToUInt(arguments[++i]), 1u);
+		else if (argument == "-kinematic")
+			kinematic = true;
+		else if (argument == "-replay" && hasValue)
+			replayFile = arguments[++i];
+		else
+		{
+			PrintLine("Usage: BoidSimBench [-flocks N] [-flocksize N] [-threads N] [-ticks N] [-kinematic] [-replay FILE]",
+				true);
+			return 1;
+		}
+	}
+
+	SharedPtr<Context> context(new Context());
+	SharedPtr<Engine> engine(new Engine(context));
+	// Worker threads are created below, so the thread count does not depend on the machine
+	VariantMap engineParameters;
+	engineParameters["Headless"] = true;
+	engineParameters["WorkerThreads"] = false;
+	engineParameters["LogQuiet"] = true;
+	engineParameters["LogName"] = String::EMPTY;
+	if (!engine->Initialize(engineParameters))
+	{
+		PrintLine("Could not initialise the engine", true);
+		return 1;
+	}
+	context->GetSubsystem<WorkQueue>()->CreateThreads(threads - 1);
+
+	SharedPtr<Scene> scene(new Scene(context));
+	scene->CreateComponent<Octree>();
+	PhysicsWorld* physicsWorld = scene->CreateComponent<PhysicsWorld>();
+	// One bullet substep per tick
+	float timeStep = 1.0f / physicsWorld->GetFps();
+
+	ReplayPlayer replay;
+	if (!replayFile.Empty())
+	{
+		if (!replay.Open(replayFile) || !replay.GetNumFrames() || !replay.GetNumFlocks())
+		{
+			PrintLine("Could not open replay " + replayFile, true);
+			return 1;
+		}
+		boidSet.SetFlockLayout(replay.GetNumFlocks(), replay.GetNumBoids() / replay.GetNumFlocks());
+	}
+
+	SetRandomSeed(RANDOM_SEED);
+	boidSet.SetKinematic(kinematic);
+	boidSet.Initialise(context->GetSubsystem<ResourceCache>(), scene);
+
+	SharedPtr<BoidSimBench> bench(new BoidSimBench(context, boidSet));
+	bench->Attach(physicsWorld);
+
+	PODVector<float> tickMs;
+	tickMs.Reserve(ticks);
+	long long flockingUSec = 0;
+	long long totalUSec = 0;
+	for (unsigned tick = 0; tick < WARMUP_TICKS + ticks; ++tick)
+	{
+		ReplayFrame frame;
+		if (replay.IsOpen() && replay.GetFrame(tick % replay.GetNumFrames(), frame))
+		{
+			for (unsigned i = 0; i < frame.numBoids_; ++i)
+				boidSet.SetState(i, frame.GetPosition(i), frame.GetVelocity(i));
+			if (frame.numSharks_)
+				boidSet.SetCapturer(frame.sharks_[0].position_);
+		}
+
+		HiresTimer timer;
+		physicsWorld->Update(timeStep);
+		long long usec = timer.GetUSec(false);
+		long long flocking = bench->TakeFlockingUSec();
+		if (tick < WARMUP_TICKS)
+			continue;
+
+		tickMs.Push(usec / 1000.0f);
+		totalUSec += usec;
+		flockingUSec += flocking;
+	}
+
+	float meanMs = totalUSec / 1000.0f / ticks;
+	Sort(tickMs.Begin(), tickMs.End());
+
+	PrintLine("flocks,flock_size,boids,threads,mode,ticks,mean_ms,p50_ms,p99_ms,flocking_mean_ms,ticks_per_sec");
+	PrintLine(ToString("%u,%u,%u,%u,%s,%u,%.4f,%.4f,%.4f,%.4f,%.1f", boidSet.GetNumFlocks(), boidSet.GetFlockSize(),
+		boidSet.store.GetNumBoids(), threads, kinematic ? "kinematic" : "bullet", ticks, meanMs, Percentile(tickMs, 0.5f),
+		Percentile(tickMs, 0.99f), flockingUSec / 1000.0f / ticks, meanMs > 0.0f ? 1000.0f / meanMs : 0.0f));
+
+	return 0;
+}
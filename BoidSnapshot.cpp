@@ -0,0 +1,340 @@
+#include <Urho3D/Math/MathDefs.h>
+
+#include "BoidSnapshot.h"
+
+#include <cmath>
+
+/// Grid the quantization box is snapped out to. Coarse, so the box rarely changes, while 65536 steps across even a
+/// few hundred units still resolve well under a centimetre.
+static const float BOUNDS_SNAP = 64.0f;
+/// Bytes per boid in a chunk: three position components and a heading.
+static const unsigned BYTES_PER_BOID = 8;
+/// Largest header of a chunk: tick, baseline tick, box, chunk number and three variable length counts.
+static const unsigned MAX_CHUNK_HEADER = 4 + 4 + 24 + 2 + 3 * 4;
+/// Largest header of a run of boids: gap and length.
+static const unsigned MAX_RUN_HEADER = 2 * 4;
+/// Flag on the chunk number of the last message of a tick.
+static const unsigned short LAST_CHUNK = 0x8000;
+
+/// Change mask bits of a delta coded boid.
+static const unsigned char DELTA_X = 1;
+static const unsigned char DELTA_Y = 2;
+static const unsigned char DELTA_Z = 4;
+static const unsigned char DELTA_HEADING = 8;
+/// The boid follows whole, as in a keyframe.
+static const unsigned char DELTA_FULL = 16;
+
+/// Map a signed delta to unsigned so small steps either way stay small variable length numbers.
+static unsigned ZigZag(int value)
+{
+	return ((unsigned)value << 1) ^ (unsigned)(value >> 31);
+}
+
+static int UnZigZag(unsigned value)
+{
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+/// Return the bytes Serializer::WriteVLE takes for a value.
+static unsigned VLESize(unsigned value)
+{
+	return value < 0x80 ? 1 : value < 0x4000 ? 2 : value < 0x200000 ? 3 : 4;
+}
+
+static unsigned short Quantize(float value, float min, float scale)
+{
+	return (unsigned short)Clamp((int)((value - min) * scale + 0.5f), 0, 65535);
+}
+
+static float Dequantize(unsigned short value, float min, float step)
+{
+	return min + value * step;
+}
+
+BoidSnapshot::BoidSnapshot() :
+	tick_(0),
+	numFlocks_(0),
+	bounds_(Vector3::ZERO, Vector3::ONE)
+{
+}
+
+void BoidSnapshot::Resize(unsigned numBoids)
+{
+	posX_.Resize(numBoids);
+	posY_.Resize(numBoids);
+	posZ_.Resize(numBoids);
+	heading_.Resize(numBoids);
+}
+
+void BoidSnapshot::Capture(const FlockStore& store, unsigned tick)
+{
+	unsigned numBoids = store.GetNumBoids();
+	tick_ = tick;
+	numFlocks_ = store.GetNumFlocks();
+	Resize(numBoids);
+
+	Vector3 min(M_INFINITY, M_INFINITY, M_INFINITY);
+	Vector3 max(-M_INFINITY, -M_INFINITY, -M_INFINITY);
+	for (unsigned i = 0; i < numBoids; ++i)
+	{
+		min.x_ = Min(min.x_, store.posX_[i]);
+		min.y_ = Min(min.y_, store.posY_[i]);
+		min.z_ = Min(min.z_, store.posZ_[i]);
+		max.x_ = Max(max.x_, store.posX_[i]);
+		max.y_ = Max(max.y_, store.posY_[i]);
+		max.z_ = Max(max.z_, store.posZ_[i]);
+	}
+	if (!numBoids)
+		min = max = Vector3::ZERO;
+
+	// Snap outwards, always leaving at least one snap step per axis so the scale stays finite
+	bounds_.min_ = Vector3(floorf(min.x_ / BOUNDS_SNAP), floorf(min.y_ / BOUNDS_SNAP), floorf(min.z_ / BOUNDS_SNAP)) * BOUNDS_SNAP;
+	bounds_.max_ = Vector3(floorf(max.x_ / BOUNDS_SNAP) + 1.0f, floorf(max.y_ / BOUNDS_SNAP) + 1.0f,
+		floorf(max.z_ / BOUNDS_SNAP) + 1.0f) * BOUNDS_SNAP;
+
+	Vector3 size = bounds_.Size();
+	Vector3 scale(65535.0f / size.x_, 65535.0f / size.y_, 65535.0f / size.z_);
+	for (unsigned i = 0; i < numBoids; ++i)
+	{
+		posX_[i] = Quantize(store.posX_[i], bounds_.min_.x_, scale.x_);
+		posY_[i] = Quantize(store.posY_[i], bounds_.min_.y_, scale.y_);
+		posZ_[i] = Quantize(store.posZ_[i], bounds_.min_.z_, scale.z_);
+		heading_[i] = EncodeDirection(store.GetVelocity(i));
+	}
+}
+
+bool BoidSnapshot::CanDeltaFrom(const BoidSnapshot& baseline) const
+{
+	return baseline.GetNumBoids() == GetNumBoids() && baseline.numFlocks_ == numFlocks_ && baseline.bounds_.min_ == bounds_.min_ &&
+		baseline.bounds_.max_ == bounds_.max_;
+}
+
+BoidSendMode BoidSnapshot::GetMode(const BoidSnapshot* baseline, const PODVector<unsigned char>* modes, unsigned i) const
+{
+	BoidSendMode mode = modes ? (BoidSendMode)(*modes)[i] : BSM_DELTA;
+	if (mode == BSM_DELTA && !baseline)
+		mode = BSM_FULL;
+	return mode;
+}
+
+unsigned BoidSnapshot::EncodedSize(const BoidSnapshot* baseline, BoidSendMode mode, unsigned i) const
+{
+	// Messages with a baseline lead every boid with a change mask, keyframes carry bare values
+	unsigned size = baseline ? 1 : 0;
+	if (mode == BSM_FULL)
+		return size + BYTES_PER_BOID;
+	if (posX_[i] != baseline->posX_[i])
+		size += VLESize(ZigZag(posX_[i] - baseline->posX_[i]));
+	if (posY_[i] != baseline->posY_[i])
+		size += VLESize(ZigZag(posY_[i] - baseline->posY_[i]));
+	if (posZ_[i] != baseline->posZ_[i])
+		size += VLESize(ZigZag(posZ_[i] - baseline->posZ_[i]));
+	if (heading_[i] != baseline->heading_[i])
+		size += 2;
+	return size;
+}
+
+void BoidSnapshot::WriteBoid(Serializer& dest, const BoidSnapshot* baseline, BoidSendMode mode, unsigned i) const
+{
+	if (mode == BSM_FULL)
+	{
+		if (baseline)
+			dest.WriteUByte(DELTA_FULL);
+		dest.WriteUShort(posX_[i]);
+		dest.WriteUShort(posY_[i]);
+		dest.WriteUShort(posZ_[i]);
+		dest.WriteUShort(heading_[i]);
+		return;
+	}
+
+	unsigned char mask = 0;
+	if (posX_[i] != baseline->posX_[i])
+		mask |= DELTA_X;
+	if (posY_[i] != baseline->posY_[i])
+		mask |= DELTA_Y;
+	if (posZ_[i] != baseline->posZ_[i])
+		mask |= DELTA_Z;
+	if (heading_[i] != baseline->heading_[i])
+		mask |= DELTA_HEADING;
+	dest.WriteUByte(mask);
+	if (mask & DELTA_X)
+		dest.WriteVLE(ZigZag(posX_[i] - baseline->posX_[i]));
+	if (mask & DELTA_Y)
+		dest.WriteVLE(ZigZag(posY_[i] - baseline->posY_[i]));
+	if (mask & DELTA_Z)
+		dest.WriteVLE(ZigZag(posZ_[i] - baseline->posZ_[i]));
+	if (mask & DELTA_HEADING)
+		dest.WriteUShort(heading_[i]);
+}
+
+void BoidSnapshot::WriteChunk(Serializer& dest, const BoidSnapshot* baseline, const PODVector<unsigned char>* modes,
+	unsigned chunk, unsigned& next, unsigned maxBytes) const
+{
+	// Plan the runs that fit before writing anything, the header holds their count
+	unsigned numBoids = GetNumBoids();
+	unsigned budget = maxBytes > MAX_CHUNK_HEADER ? maxBytes - MAX_CHUNK_HEADER : 0;
+	unsigned bytes = 0;
+	unsigned numRuns = 0;
+	unsigned end = next;
+	bool inRun = false;
+	for (; end < numBoids; ++end)
+	{
+		BoidSendMode mode = GetMode(baseline, modes, end);
+		if (mode == BSM_SKIP)
+		{
+			inRun = false;
+			continue;
+		}
+		unsigned size = EncodedSize(baseline, mode, end) + (inRun ? 0 : MAX_RUN_HEADER);
+		if (bytes + size > budget && bytes)
+			break;
+		bytes += size;
+		if (!inRun)
+			++numRuns;
+		inRun = true;
+	}
+
+	dest.WriteUInt(tick_);
+	dest.WriteUInt(baseline ? baseline->tick_ : 0);
+	dest.WriteVLE(numBoids);
+	dest.WriteVLE(numFlocks_);
+	dest.WriteVector3(bounds_.min_);
+	dest.WriteVector3(bounds_.max_);
+	dest.WriteUShort((unsigned short)(chunk | (end == numBoids ? LAST_CHUNK : 0)));
+	dest.WriteVLE(numRuns);
+
+	// Each run is the gap since the previous one, its length and its boids
+	unsigned previousEnd = 0;
+	unsigned i = next;
+	while (i < end)
+	{
+		if (GetMode(baseline, modes, i) == BSM_SKIP)
+		{
+			++i;
+			continue;
+		}
+		unsigned runEnd = i;
+		while (runEnd < end && GetMode(baseline, modes, runEnd) != BSM_SKIP)
+			++runEnd;
+		dest.WriteVLE(i - previousEnd);
+		dest.WriteVLE(runEnd - i);
+		for (; i < runEnd; ++i)
+			WriteBoid(dest, baseline, GetMode(baseline, modes, i), i);
+		previousEnd = runEnd;
+	}
+
+	next = end;
+}
+
+bool BoidSnapshot::ReadChunkHeader(Deserializer& source, BoidChunkHeader& header)
+{
+	header.tick_ = source.ReadUInt();
+	header.baseline_ = source.ReadUInt();
+	header.numBoids_ = source.ReadVLE();
+	header.numFlocks_ = source.ReadVLE();
+	header.bounds_.min_ = source.ReadVector3();
+	header.bounds_.max_ = source.ReadVector3();
+	unsigned short chunk = source.ReadUShort();
+	header.chunk_ = chunk & ~LAST_CHUNK;
+	header.last_ = (chunk & LAST_CHUNK) != 0;
+	header.numRuns_ = source.ReadVLE();
+	// An empty message ends exactly at its header
+	return source.GetPosition() <= source.GetSize() && (!source.IsEof() || !header.numRuns_);
+}
+
+bool BoidSnapshot::ReadChunk(Deserializer& source, const BoidChunkHeader& header, const BoidSnapshot* baseline,
+	PODVector<unsigned>& decoded)
+{
+	if (header.baseline_)
+	{
+		if (!baseline || baseline->tick_ != header.baseline_ || baseline->GetNumBoids() != header.numBoids_ ||
+			baseline->numFlocks_ != header.numFlocks_ || baseline->bounds_.min_ != header.bounds_.min_ ||
+			baseline->bounds_.max_ != header.bounds_.max_)
+			return false;
+	}
+
+	tick_ = header.tick_;
+	numFlocks_ = header.numFlocks_;
+	bounds_ = header.bounds_;
+	Resize(header.numBoids_);
+
+	unsigned i = 0;
+	for (unsigned r = 0; r < header.numRuns_; ++r)
+	{
+		i += source.ReadVLE();
+		unsigned runEnd = i + source.ReadVLE();
+		if (runEnd > header.numBoids_)
+			return false;
+
+		for (; i < runEnd; ++i)
+		{
+			// Boids vary in size, so a message cut short only shows once it runs out
+			if (source.IsEof())
+				return false;
+
+			unsigned char mask = header.baseline_ ? source.ReadUByte() : DELTA_FULL;
+			if (mask & DELTA_FULL)
+			{
+				posX_[i] = source.ReadUShort();
+				posY_[i] = source.ReadUShort();
+				posZ_[i] = source.ReadUShort();
+				heading_[i] = source.ReadUShort();
+			}
+			else
+			{
+				posX_[i] = (mask & DELTA_X) ? (unsigned short)(baseline->posX_[i] + UnZigZag(source.ReadVLE())) : baseline->posX_[i];
+				posY_[i] = (mask & DELTA_Y) ? (unsigned short)(baseline->posY_[i] + UnZigZag(source.ReadVLE())) : baseline->posY_[i];
+				posZ_[i] = (mask & DELTA_Z) ? (unsigned short)(baseline->posZ_[i] + UnZigZag(source.ReadVLE())) : baseline->posZ_[i];
+				heading_[i] = (mask & DELTA_HEADING) ? source.ReadUShort() : baseline->heading_[i];
+			}
+			decoded.Push(i);
+		}
+	}
+
+	return true;
+}
+
+Vector3 BoidSnapshot::GetPosition(unsigned i) const
+{
+	Vector3 step = bounds_.Size() / 65535.0f;
+	return Vector3(Dequantize(posX_[i], bounds_.min_.x_, step.x_), Dequantize(posY_[i], bounds_.min_.y_, step.y_),
+		Dequantize(posZ_[i], bounds_.min_.z_, step.z_));
+}
+
+Vector3 BoidSnapshot::GetDirection(unsigned i) const
+{
+	return DecodeDirection(heading_[i]);
+}
+
+unsigned short BoidSnapshot::EncodeDirection(const Vector3& direction)
+{
+	// Project onto the octahedron |x| + |y| + |z| = 1, then fold the lower half out over the corners of the x/z square
+	float sum = Abs(direction.x_) + Abs(direction.y_) + Abs(direction.z_);
+	if (sum < M_EPSILON)
+		return EncodeDirection(Vector3::FORWARD);
+	float x = direction.x_ / sum;
+	float z = direction.z_ / sum;
+	if (direction.y_ < 0.0f)
+	{
+		float foldedX = (1.0f - Abs(z)) * (x >= 0.0f ? 1.0f : -1.0f);
+		z = (1.0f - Abs(x)) * (z >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+	}
+	unsigned u = (unsigned)Clamp((int)((x * 0.5f + 0.5f) * 255.0f + 0.5f), 0, 255);
+	unsigned v = (unsigned)Clamp((int)((z * 0.5f + 0.5f) * 255.0f + 0.5f), 0, 255);
+	return (unsigned short)(u | (v << 8));
+}
+
+Vector3 BoidSnapshot::DecodeDirection(unsigned short packed)
+{
+	float x = (packed & 0xff) / 255.0f * 2.0f - 1.0f;
+	float z = (packed >> 8) / 255.0f * 2.0f - 1.0f;
+	float y = 1.0f - Abs(x) - Abs(z);
+	if (y < 0.0f)
+	{
+		float unfoldedX = (1.0f - Abs(z)) * (x >= 0.0f ? 1.0f : -1.0f);
+		z = (1.0f - Abs(x)) * (z >= 0.0f ? 1.0f : -1.0f);
+		x = unfoldedX;
+	}
+	return Vector3(x, y, z).Normalized();
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/IO/Serializer.h>
+#include <Urho3D/Math/BoundingBox.h>
+
+#include "FlockStore.h"
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Network message carrying quantized boid states, server to client.
+static const int MSG_BOIDSNAPSHOT = 0x100;
+/// Network message acknowledging every boid of a snapshot tick arrived, client to server.
+static const int MSG_BOIDSNAPSHOTACK = 0x101;
+/// Network message carrying part of the keyframe a joining client starts from, server to client, reliable and compressed.
+static const int MSG_JOINKEYFRAME = 0x107;
+/// Largest payload of one snapshot message. Unreliable messages are not fragmented, so each must fit a datagram.
+static const unsigned MAX_SNAPSHOT_PAYLOAD = 1200;
+/// Snapshots kept by both ends for delta coding. A baseline older than this is gone and forces a keyframe.
+static const unsigned SNAPSHOT_RING_SIZE = 32;
+
+/// How a snapshot message carries a boid.
+enum BoidSendMode
+{
+	/// Left out.
+	BSM_SKIP = 0,
+	/// Sent whole.
+	BSM_FULL,
+	/// Delta coded against the baseline.
+	BSM_DELTA
+};
+
+/// Header of one snapshot message.
+struct BoidChunkHeader
+{
+	/// Server tick of the state carried.
+	unsigned tick_;
+	/// Tick the boids are delta coded against, 0 for a keyframe.
+	unsigned baseline_;
+	/// Number of boids in the whole snapshot.
+	unsigned numBoids_;
+	/// Number of flocks.
+	unsigned numFlocks_;
+	/// Quantization box.
+	BoundingBox bounds_;
+	/// Index of the message among those sent for the tick.
+	unsigned chunk_;
+	/// Whether this is the last message of the tick.
+	bool last_;
+	/// Number of runs of consecutive boids carried.
+	unsigned numRuns_;
+};
+
+/// Quantized state of every boid at one server tick, the unit of boid replication.
+/// Positions are stored as 16 bits per axis relative to a bounding box around the flocks, headings as an octahedral
+/// unit vector in 8 + 8 bits, so a boid costs 8 bytes against the 40-odd bytes of node and rigid body attributes.
+/// The box is snapped outwards to a coarse grid so it stays the same from tick to tick while the flocks move inside it,
+/// which is also what lets a snapshot be delta coded against an older one: each boid then costs a change mask plus
+/// small variable length deltas for the fields that moved.
+class BoidSnapshot
+{
+public:
+	BoidSnapshot();
+
+	/// Quantize the positions and velocity headings of every boid in the store.
+	void Capture(const FlockStore& store, unsigned tick);
+	/// Write message number chunk of a tick, holding as many boids from next on as fit in maxBytes, and advance next past
+	/// them. modes holds a BoidSendMode per boid; null sends every boid, delta coded if there is a baseline. Delta coding
+	/// needs a baseline CanDeltaFrom allows, without one every boid is sent whole. The message is flagged last once next
+	/// reaches the end, and a tick always gets at least one message so the client learns what was left out.
+	void WriteChunk(Serializer& dest, const BoidSnapshot* baseline, const PODVector<unsigned char>* modes, unsigned chunk,
+		unsigned& next, unsigned maxBytes = MAX_SNAPSHOT_PAYLOAD) const;
+	/// Read the header of a message payload. Returns false if it is malformed.
+	static bool ReadChunkHeader(Deserializer& source, BoidChunkHeader& header);
+	/// Decode the boids of a message whose header was just read. The snapshot takes the tick, layout and box of the
+	/// header and only the boids carried change, their indices are added to decoded. A delta message needs the complete
+	/// baseline snapshot it names. Returns false if the payload is malformed or the baseline does not match.
+	bool ReadChunk(Deserializer& source, const BoidChunkHeader& header, const BoidSnapshot* baseline, PODVector<unsigned>& decoded);
+	/// Return whether this snapshot can be delta coded against baseline, which needs the same layout and box.
+	bool CanDeltaFrom(const BoidSnapshot& baseline) const;
+
+	/// Return the server tick the state was captured at.
+	unsigned GetTick() const { return tick_; }
+	/// Return number of boids.
+	unsigned GetNumBoids() const { return posX_.Size(); }
+	/// Return number of flocks. Boids are split evenly between them, as FlockStore lays them out.
+	unsigned GetNumFlocks() const { return numFlocks_; }
+	/// Return the box positions are quantized against.
+	const BoundingBox& GetBounds() const { return bounds_; }
+	/// Return the dequantized position of a boid.
+	Vector3 GetPosition(unsigned i) const;
+	/// Return the dequantized unit heading of a boid.
+	Vector3 GetDirection(unsigned i) const;
+
+	/// Pack a direction into 16 bits with an octahedral mapping.
+	static unsigned short EncodeDirection(const Vector3& direction);
+	/// Unpack a direction packed by EncodeDirection.
+	static Vector3 DecodeDirection(unsigned short packed);
+
+	/// Quantized position components.
+	PODVector<unsigned short> posX_;
+	PODVector<unsigned short> posY_;
+	PODVector<unsigned short> posZ_;
+	/// Packed headings.
+	PODVector<unsigned short> heading_;
+
+private:
+	/// Resize the quantized arrays.
+	void Resize(unsigned numBoids);
+	/// Return the bytes boid i takes in a message.
+	unsigned EncodedSize(const BoidSnapshot* baseline, BoidSendMode mode, unsigned i) const;
+	/// Write boid i to a message.
+	void WriteBoid(Serializer& dest, const BoidSnapshot* baseline, BoidSendMode mode, unsigned i) const;
+	/// Return how boid i is sent.
+	BoidSendMode GetMode(const BoidSnapshot* baseline, const PODVector<unsigned char>* modes, unsigned i) const;
+
+	/// Server tick of the state.
+	unsigned tick_;
+	/// Number of flocks.
+	unsigned numFlocks_;
+	/// Quantization box.
+	BoundingBox bounds_;
+};
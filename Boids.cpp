@@ -10,11 +10,18 @@ float Boids::FAttract_Vmax = 2.0f;
 float Boids::FAttract_Factor = 5.0f;
 float Boids::FRepel_Factor = 7.0f;
 float Boids::FAlign_Factor = 4.0f;
-
-Vector3 Player_pos;
-bool isRunning;
-
-Boids::Boids()
+bool Boids::UseSpatialGrid = true;
+float Boids::Speed_Min = 10.0f;
+float Boids::Speed_Max = 50.0f;
+float Boids::Height_Min = 10.0f;
+float Boids::Height_Max = 50.0f;
+
+Boids::Boids() :
+	pNode(0),
+	pRigidbody(0),
+	pCollisionshape(0),
+	pObject(0),
+	pStaticmodel(0)
 {
 
 }
@@ -24,26 +31,46 @@ Boids::~Boids()
 {
 }
 
-void Boids::Initialise(ResourceCache * pRes, Scene * pScene)
+void Boids::SpawnState(Vector3 & pos, Vector3 & vel)
+{
+	pos = Vector3(Random(60.0f) - 30.0f, Random(10.0f) + 20, Random(60.0f) - 30.0f);
+	vel = Vector3(Random(20.0f) - 20.0f, 0.0f, Random(20.0f) - 20.0f);
+}
+
+void Boids::Initialise(ResourceCache * pRes, Scene * pScene, const Vector3 & pos, const Vector3 & vel, bool kinematic,
+	StaticModelGroup * pGroup, CreateMode mode)
 {
 
 
-	pNode = pScene->CreateChild("Boid");
+	pNode = pScene->CreateChild("Boid", mode);
 
 	pNode->SetScale(Vector3(1.0f, 1.0f, 1.0f));
 
-	pStaticmodel = pNode->CreateComponent<StaticModel>();
-	pStaticmodel->SetModel(pRes->GetResource<Model>("Models/tna_body.mdl"));
-	pStaticmodel->SetMaterial(pRes->GetResource<Material>("Materials/Fishy.xml"));
+	if (pGroup)
+		pGroup->AddInstanceNode(pNode);
+	else
+	{
+		pStaticmodel = pNode->CreateComponent<StaticModel>(mode);
+		pStaticmodel->SetModel(pRes->GetResource<Model>("Models/tna_body.mdl"));
+		pStaticmodel->SetMaterial(pRes->GetResource<Material>("Materials/Fishy.xml"));
+
+		pStaticmodel->SetCastShadows(true);
+	}
+
+	//kinematic boids are moved by BoidSet::Integrate, bullet never sees them
+	if (kinematic)
+	{
+		pNode->SetPosition(pos);
+		return;
+	}
 
-	pStaticmodel->SetCastShadows(true);
-	pRigidbody = pNode->CreateComponent<RigidBody>();
+	pRigidbody = pNode->CreateComponent<RigidBody>(mode);
 
 	pRigidbody->SetMass(1.0f);
 	pRigidbody->SetUseGravity(false);
-	pRigidbody->SetPosition(Vector3(Random(60.0f) - 30.0f, Random(10.0f) + 20, Random(60.0f) - 30.0f));
+	pRigidbody->SetPosition(pos);
 	//pRigidbody->SetRotation(Quaternion(0.0f, 0.0f, 0.0f));
-	pRigidbody->SetLinearVelocity(Vector3(Random(20.0f) - 20.0f, 0.0f, Random(20.0f) - 20.0f));
+	pRigidbody->SetLinearVelocity(vel);
 
 
 	// The Trigger mode makes the rigid body only detect collisions, but impart no forces on the
@@ -51,65 +78,28 @@ void Boids::Initialise(ResourceCache * pRes, Scene * pScene)
 	pRigidbody->SetTrigger(false);
 	pRigidbody->SetCollisionLayer(2);
 
-	pCollisionshape = pNode->CreateComponent<CollisionShape>();
+	pCollisionshape = pNode->CreateComponent<CollisionShape>(mode);
 	//pCollisionshape->SetModel(pRes->GetResource<Model>("Models/tna_body.mdl"));
 	pCollisionshape->SetCapsule(3.0f, 1.0f, Vector3(0.0f, 1.0f, 0.0f));
 	
 }
 
-void Boids::Computeforce(Boids * Boid)
+Vector3 Boids::SteeringForce(const Vector3 & pos, const Vector3 & vel, const FlockSums & sums)
 {
-
-
-	Vector3 CoM; //centre of mass, accumulated total
-	float n = 0.0f; //count number of neigbours
-	float a = 0.0f; //alignment
-	float r = 0.0f;
-	Vector3 sep_Distance;
-	//set the force member variable to zero 
-
-
-	force = Vector3(0, 0, 0);
-	//Search Neighbourhood
-	for (int i = 0; i < NumBoids; i++)
-	{
-		//the current boid?
-		if (this == &Boid[i]) continue;
-		//sep = vector position of this boid from current oid
-		Vector3 sep = pRigidbody->GetPosition() -
-			Boid[i].pRigidbody->GetPosition();
-		float d = sep.Length(); //distance of boid
-
-
-		if (d < Range_FAttract)
-		{
-			//with range, so is a neighbour
-			CoM += Boid[i].pRigidbody->GetPosition();
-			n++;
-		}
-
-		if (d < Range_FRepel)
-		{
-			float sep_Distancefloat = sep.Length();
-			sep_Distance += sep / (sep_Distancefloat*sep_Distancefloat);
-			r++;
-		}
-
-
-		if (d < Range_FAlign)
-		{
-			a++;
-		}
-
-	}
+	Vector3 CoM(sums.comX_, sums.comY_, sums.comZ_); //centre of mass, accumulated total
+	Vector3 sep_Distance(sums.sepX_, sums.sepY_, sums.sepZ_);
+	float n = sums.numAttract_; //count number of neigbours
+	float r = sums.numRepel_;
+	float a = sums.numAlign_; //alignment
+	Vector3 force;
 
 	//Attractive force component
 	if (n > 0)
 	{
 		CoM /= n;
-		Vector3 dir = (CoM - pRigidbody->GetPosition()).Normalized();
+		Vector3 dir = (CoM - pos).Normalized();
 		Vector3 vDesired = dir*FAttract_Vmax;
-		force += (vDesired - pRigidbody->GetLinearVelocity())*FAttract_Factor;
+		force += (vDesired - vel)*FAttract_Factor;
 	}
 	//Repulsive force component
 	if (r > 0)
@@ -121,93 +111,389 @@ void Boids::Computeforce(Boids * Boid)
 	//Alignment force component
 	if (a > 0)
 	{
-		Vector3 dir = (CoM - pRigidbody->GetPosition()).Normalized();
-		force += (dir - FAlign_Factor * pRigidbody->GetLinearVelocity());
+		Vector3 dir = (CoM - pos).Normalized();
+		force += (dir - FAlign_Factor * vel);
 	}
 
-	Vector3 Boid_Loc = pRigidbody->GetPosition();
+	return force;
+}
 
+FlockRanges Boids::Ranges()
+{
+	FlockRanges ranges;
+	ranges.attract2_ = Range_FAttract * Range_FAttract;
+	ranges.repel2_ = Range_FRepel * Range_FRepel;
+	ranges.align2_ = Range_FAlign * Range_FAlign;
+	return ranges;
+}
 
-	if (isRunning == true)
-	{
+float Boids::GridCellSize()
+{
+	return Max(Range_FAttract, Max(Range_FRepel, Range_FAlign));
+}
 
-		if (Boid_Loc.x_ <= (Player_pos.x_ + 5) & Boid_Loc.x_ >= (Player_pos.x_ - 5) & Boid_Loc.y_ <= (Player_pos.y_ + 5) & Boid_Loc.y_ >= (Player_pos.y_ - 5) & Boid_Loc.z_ <= (Player_pos.z_ + 5) & Boid_Loc.z_ >= (Player_pos.z_ - 5))
-		{
-			Log::WriteRaw("A Boid has been Captured!");
-			pRigidbody->SetPosition(Vector3(0, -1000, 0));
-		}
-	}
+Quaternion Boids::Heading(const Vector3 & vel)
+{
+	Vector3 vn = vel.Normalized();
+	Vector3 cp = -vn.CrossProduct(Vector3(0.0f, 1.0f, 0.0f));
+	float dp = cp.DotProduct(vn);
+	return Quaternion(Acos(dp), cp);
+}
+
+bool Boids::IsCaptured(const Vector3 & Boid_Loc, const Vector3 & Player_pos)
+{
+	if (Boid_Loc.x_ <= (Player_pos.x_ + CaptureRange) & Boid_Loc.x_ >= (Player_pos.x_ - CaptureRange) & Boid_Loc.y_ <= (Player_pos.y_ + CaptureRange) & Boid_Loc.y_ >= (Player_pos.y_ - CaptureRange) & Boid_Loc.z_ <= (Player_pos.z_ + CaptureRange) & Boid_Loc.z_ >= (Player_pos.z_ - CaptureRange))
+		return true;
+	return false;
 }
 
-void Boids::Update(float tm)
+void Boids::Update(const Vector3 & force, const Vector3 & vel, const Vector3 & pos, float tm)
 {
 	pRigidbody->ApplyForce(force);
-	Vector3 vel = pRigidbody->GetLinearVelocity();
 	float d = vel.Length();
-	if (d < 10.0f)
+	if (d < Speed_Min)
 	{
-		d = 10.0f;
+		d = Speed_Min;
 		pRigidbody->SetLinearVelocity(vel.Normalized()*d);
 	}
-	else if (d > 50.0f)
+	else if (d > Speed_Max)
 	{
-		d = 50.0f;
+		d = Speed_Max;
 		pRigidbody->SetLinearVelocity(vel.Normalized()*d);
 	}
-	Vector3 vn = vel.Normalized();
-	Vector3 cp = -vn.CrossProduct(Vector3(0.0f, 1.0f, 0.0f));
-	float dp = cp.DotProduct(vn);
-	pRigidbody->SetRotation(Quaternion(Acos(dp), cp));
-	Vector3 p = pRigidbody->GetPosition();
-	if (p.y_ < 10.0f)
+	pRigidbody->SetRotation(Heading(vel));
+	Vector3 p = pos;
+	if (p.y_ < Height_Min)
 	{
-		p.y_ = 10.0f;
+		p.y_ = Height_Min;
 		pRigidbody->SetPosition(p);
 	}
-	else if (p.y_ > 50.0f)
+	else if (p.y_ > Height_Max)
 	{
-		p.y_ = 50.0f;
+		p.y_ = Height_Max;
 		pRigidbody->SetPosition(p);
 	}
 
 
 }
 
-void Boids::GetPlayerPos(Vector3 coords, bool Game_Running)
+void BoidSet::SetFlockLayout(unsigned flocks, unsigned boidsPerFlock)
 {
-	Player_pos = coords;
-	isRunning = true;
+	numFlocks = flocks;
+	flockSize = boidsPerFlock;
+}
+
+void BoidSet::CopySettings(const BoidSet & other)
+{
+	numFlocks = other.numFlocks;
+	flockSize = other.flockSize;
+	kinematicRequested = other.kinematicRequested;
+	instanced = other.instanced;
+	replicated = other.replicated;
 }
 
 void BoidSet::Initialise(ResourceCache * pRes, Scene * pScene)
 {
-	for (int i = 0; i < NumBoids; i++)
+	kinematic = kinematicRequested;
+	CreateMode mode = replicated ? REPLICATED : LOCAL;
+	store.Resize(numFlocks, flockSize);
+	boidList.Resize(store.GetNumBoids());
+	flockNodes.Clear();
+	tick = 0;
+	for (unsigned f = 0; f < store.GetNumFlocks(); f++)
+	{
+		//one group per flock, so a flock out of view is culled as a whole
+		StaticModelGroup* pGroup = 0;
+		if (instanced)
+		{
+			Node* flockNode = pScene->CreateChild("Flock", mode);
+			flockNodes.Push(WeakPtr<Node>(flockNode));
+			pGroup = flockNode->CreateComponent<StaticModelGroup>(mode);
+			pGroup->SetModel(pRes->GetResource<Model>("Models/tna_body.mdl"));
+			pGroup->SetMaterial(pRes->GetResource<Material>("Materials/Fishy.xml"));
+			pGroup->SetCastShadows(true);
+		}
+
+		unsigned start = store.GetFlockStart(f);
+		for (unsigned i = start; i < start + store.GetFlockSize(f); i++)
+		{
+			Vector3 pos, vel;
+			Boids::SpawnState(pos, vel);
+			boidList[i].Initialise(pRes, pScene, pos, vel, kinematic, pGroup, mode);
+			//with no rigid body to read back from, the store is where kinematic boids live
+			store.SetPosition(i, pos);
+			store.SetVelocity(i, vel);
+		}
+	}
+
+	workQueue = pScene->GetSubsystem<WorkQueue>();
+}
+
+void BoidSet::SetState(unsigned i, const Vector3 & pos, const Vector3 & vel)
+{
+	store.SetPosition(i, pos);
+	store.SetVelocity(i, vel);
+	if (kinematic)
+	{
+		boidList[i].pNode->SetTransform(pos, Boids::Heading(vel));
+		return;
+	}
+	//the next Update reads the state back from the rigid body
+	boidList[i].pRigidbody->SetPosition(pos);
+	boidList[i].pRigidbody->SetRotation(Boids::Heading(vel));
+	boidList[i].pRigidbody->SetLinearVelocity(vel);
+}
+
+void BoidSet::Clear()
+{
+	for (unsigned i = 0; i < boidList.Size(); i++)
 	{
-		boidList1[i].Initialise(pRes, pScene);
-		boidList2[i].Initialise(pRes, pScene);
-		boidList3[i].Initialise(pRes, pScene);
-		boidList4[i].Initialise(pRes, pScene);
-		boidList5[i].Initialise(pRes, pScene);
+		if (boidList[i].pNode)
+			boidList[i].pNode->Remove();
 	}
+	for (unsigned f = 0; f < flockNodes.Size(); f++)
+	{
+		if (flockNodes[f])
+			flockNodes[f]->Remove();
+	}
+	boidList.Clear();
+	flockNodes.Clear();
+}
+
+void BoidSet::Capture(unsigned i)
+{
+	if (i < boidList.Size() && !toCapture.Contains(i))
+		toCapture.Push(i);
 }
 
 void BoidSet::Update(float tm)
 {
-	for (int i = 0; i < NumBoids; i++)
+	captured.Clear();
+	++tick;
+	//captures decided outside, moved away like the ones found in the step itself
+	for (unsigned c = 0; c < toCapture.Size(); c++)
 	{
-		boidList1[i].Computeforce(&boidList1[0]);
-		boidList1[i].Update(tm);
+		unsigned i = toCapture[c];
+		if (i >= boidList.Size())
+			continue;
+		SetState(i, Vector3(0, -1000, 0), store.GetVelocity(i));
+		captured.Push(i);
+	}
+	toCapture.Clear();
+	if (kinematic)
+	{
+		ComputeForces();
+		Integrate(tm);
+		return;
+	}
+	ReadState();
+	ComputeForces();
+	WriteState(tm);
+}
+
+void BoidSet::ReadState()
+{
+	//the only per-boid trips into bullet before the flocking runs
+	for (unsigned i = 0; i < boidList.Size(); i++)
+	{
+		store.SetPosition(i, boidList[i].pRigidbody->GetPosition());
+		store.SetVelocity(i, boidList[i].pRigidbody->GetLinearVelocity());
+	}
+}
+
+void BoidSet::PlanTasks()
+{
+	//big flocks are cut into several tasks so one large flock still spreads over every thread
+	tasks.Clear();
+	for (unsigned f = 0; f < store.GetNumFlocks(); f++)
+	{
+		unsigned start = store.GetFlockStart(f);
+		unsigned end = start + store.GetFlockSize(f);
+		for (unsigned begin = start; begin < end; begin += FlockTaskSize)
+		{
+			FlockTask task;
+			task.flock = f;
+			task.begin = begin;
+			task.end = Min(begin + FlockTaskSize, end);
+			task.forceX.Resize(task.end - task.begin);
+			task.forceY.Resize(task.end - task.begin);
+			task.forceZ.Resize(task.end - task.begin);
+			tasks.Push(task);
+		}
+	}
+	grids.Resize(store.GetNumFlocks());
+
+	plannedBoids = store.GetNumBoids();
+	plannedFlocks = store.GetNumFlocks();
+}
+
+void BoidSet::BuildGrid(unsigned flock)
+{
+	unsigned start = store.GetFlockStart(flock);
+	grids[flock].SetCellSize(Boids::GridCellSize());
+	grids[flock].Build(store.posX_.Buffer() + start, store.posY_.Buffer() + start, store.posZ_.Buffer() + start,
+		store.GetFlockSize(flock));
+}
+
+void BoidSet::RunTask(FlockTask & task) const
+{
+	//indices into the arrays below are relative to the first boid of the flock
+	unsigned start = store.GetFlockStart(task.flock);
+	unsigned count = store.GetFlockSize(task.flock);
+	const float* posX = store.posX_.Buffer() + start;
+	const float* posY = store.posY_.Buffer() + start;
+	const float* posZ = store.posZ_.Buffer() + start;
+	const BoidGrid& grid = grids[task.flock];
+
+	FlockRanges ranges = Boids::Ranges();
+	for (unsigned i = task.begin; i < task.end; i++)
+	{
+		Vector3 pos = store.GetPosition(i);
+		FlockSums sums;
+		if (Boids::UseSpatialGrid)
+		{
+			grid.Query(pos, task.neighbours);
+			task.kernel.SumIndexed(pos, posX, posY, posZ, task.neighbours.Buffer(), task.neighbours.Size(), ranges, sums);
+		}
+		else
+			FlockKernel::Sum(pos, posX, posY, posZ, count, ranges, sums);
+
+		Vector3 force = Boids::SteeringForce(pos, store.GetVelocity(i), sums);
+		task.forceX[i - task.begin] = force.x_;
+		task.forceY[i - task.begin] = force.y_;
+		task.forceZ[i - task.begin] = force.z_;
+	}
+}
 
-		boidList2[i].Computeforce(&boidList2[0]);
-		boidList2[i].Update(tm);
+void BoidSet::BuildGridWork(const WorkItem * item, unsigned threadIndex)
+{
+	BoidSet* set = static_cast<BoidSet*>(item->aux_);
+	set->BuildGrid((unsigned)(size_t)item->start_);
+}
 
-		boidList3[i].Computeforce(&boidList3[0]);
-		boidList3[i].Update(tm);
+void BoidSet::RunTaskWork(const WorkItem * item, unsigned threadIndex)
+{
+	const BoidSet* set = static_cast<const BoidSet*>(item->aux_);
+	set->RunTask(*static_cast<FlockTask*>(item->start_));
+}
 
-		boidList4[i].Computeforce(&boidList4[0]);
-		boidList4[i].Update(tm);
+void BoidSet::ComputeForces()
+{
+	if (tasks.Empty() || plannedBoids != store.GetNumBoids() || plannedFlocks != store.GetNumFlocks())
+		PlanTasks();
 
-		boidList5[i].Computeforce(&boidList5[0]);
-		boidList5[i].Update(tm);
+	if (workQueue)
+	{
+		//grids first, every task of a flock reads the same one
+		if (Boids::UseSpatialGrid)
+		{
+			for (unsigned f = 0; f < grids.Size(); f++)
+			{
+				SharedPtr<WorkItem> item = workQueue->GetFreeItem();
+				item->priority_ = M_MAX_UNSIGNED;
+				item->workFunction_ = BuildGridWork;
+				item->aux_ = this;
+				item->start_ = (void*)(size_t)f;
+				workQueue->AddWorkItem(item);
+			}
+			workQueue->Complete(M_MAX_UNSIGNED);
+		}
+
+		for (unsigned t = 0; t < tasks.Size(); t++)
+		{
+			SharedPtr<WorkItem> item = workQueue->GetFreeItem();
+			item->priority_ = M_MAX_UNSIGNED;
+			item->workFunction_ = RunTaskWork;
+			item->aux_ = this;
+			item->start_ = &tasks[t];
+			workQueue->AddWorkItem(item);
+		}
+		workQueue->Complete(M_MAX_UNSIGNED);
+	}
+	else
+	{
+		if (Boids::UseSpatialGrid)
+		{
+			for (unsigned f = 0; f < grids.Size(); f++)
+				BuildGrid(f);
+		}
+		for (unsigned t = 0; t < tasks.Size(); t++)
+			RunTask(tasks[t]);
+	}
+
+	//gather the per-task buffers back into the store on this thread
+	for (unsigned t = 0; t < tasks.Size(); t++)
+	{
+		const FlockTask& task = tasks[t];
+		for (unsigned i = task.begin; i < task.end; i++)
+			store.SetForce(i, Vector3(task.forceX[i - task.begin], task.forceY[i - task.begin], task.forceZ[i - task.begin]));
+	}
+}
+
+void BoidSet::WriteState(float tm)
+{
+	for (unsigned i = 0; i < boidList.Size(); i++)
+	{
+		if (capturing && Boids::IsCaptured(store.GetPosition(i), capturer))
+		{
+			store.SetPosition(i, Vector3(0, -1000, 0));
+			captured.Push(i);
+		}
+		boidList[i].Update(store.GetForce(i), store.GetVelocity(i), store.GetPosition(i), tm);
+	}
+}
+
+//same order as a bullet step: clamp the state read this tick, add the force, then move along the new velocity
+static void StepKinematic(Vector3 & pos, Vector3 & vel, const Vector3 & force, float tm)
+{
+	float d = vel.Length();
+	if (d < Boids::Speed_Min)
+		vel = vel.Normalized() * Boids::Speed_Min;
+	else if (d > Boids::Speed_Max)
+		vel = vel.Normalized() * Boids::Speed_Max;
+	pos.y_ = Clamp(pos.y_, Boids::Height_Min, Boids::Height_Max);
+
+	//unit mass, as the rigid bodies have
+	vel += force * tm;
+	pos += vel * tm;
+}
+
+void BoidSet::Integrate(float tm)
+{
+	for (unsigned i = 0; i < boidList.Size(); i++)
+	{
+		Vector3 pos = store.GetPosition(i);
+		Vector3 vel = store.GetVelocity(i);
+		if (capturing && Boids::IsCaptured(pos, capturer))
+		{
+			pos = Vector3(0, -1000, 0);
+			captured.Push(i);
+		}
+
+		Quaternion heading = Boids::Heading(vel);
+		StepKinematic(pos, vel, store.GetForce(i), tm);
+
+		store.SetPosition(i, pos);
+		store.SetVelocity(i, vel);
+		boidList[i].pNode->SetTransform(pos, heading);
+	}
+}
+
+void BoidSet::Advance(unsigned i, Vector3 & pos, Vector3 & vel, unsigned steps, float tm) const
+{
+	//the rest of the flock is only known where it is now, which for a few steps is close to where it was.
+	//boid i's own store entry stays among the neighbours, it is about to be overwritten and is near pos anyway
+	unsigned flock = store.flockId_[i];
+	unsigned start = store.GetFlockStart(flock);
+	unsigned count = store.GetFlockSize(flock);
+	const float* posX = store.posX_.Buffer() + start;
+	const float* posY = store.posY_.Buffer() + start;
+	const float* posZ = store.posZ_.Buffer() + start;
+	FlockRanges ranges = Boids::Ranges();
+	for (unsigned s = 0; s < steps; s++)
+	{
+		FlockSums sums;
+		FlockKernel::Sum(pos, posX, posY, posZ, count, ranges, sums);
+		StepKinematic(pos, vel, Boids::SteeringForce(pos, vel, sums), tm);
 	}
 }
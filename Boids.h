@@ -1,4 +1,7 @@
+#pragma once
+
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/WorkQueue.h>
 #include <Urho3D/Core/ProcessUtils.h>
 #include <Urho3D/Engine/Engine.h>
 #include <Urho3D/Graphics/AnimatedModel.h>
@@ -11,6 +14,7 @@
 #include <Urho3D/Graphics/Octree.h>
 #include <Urho3D/Graphics/Renderer.h>
 #include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Graphics/StaticModelGroup.h>
 
 #include <Urho3D/Graphics/Skybox.h>
 #include <Urho3D/Graphics/Terrain.h>
@@ -43,6 +47,9 @@
 #include <Urho3D/UI/Window.h>
 #include <Urho3D/UI/CheckBox.h>
 
+#include "BoidGrid.h"
+#include "FlockKernel.h"
+#include "FlockStore.h"
 
 
 
@@ -56,14 +63,18 @@ namespace Urho3D
 }
 // All Urho3D classes reside in namespace Urho3D
 using namespace Urho3D;
+///default flock layout, both can be changed at runtime before BoidSet::Initialise
 const static int NumBoids = 20;
+const static int NumFlocks = 5;
+///most boids handed to one work item when flocks are split up for the worker threads
+const static int FlockTaskSize = 256;
+///half the edge of the box around a player that captures boids
+const static float CaptureRange = 5.0f;
 
 
 class Boids
 {
 public:
-	Vector3 force;
-
 	static float Range_FRepel;
 	static float Range_FAlign;
 	static float FAttract_Factor;
@@ -71,6 +82,13 @@ public:
 	static float FAlign_Factor;
 	static float FAttract_Vmax;
 	static float Range_FAttract;
+	///use the spatial grid for neighbour searches, false falls back to testing every pair
+	static bool UseSpatialGrid;
+	///speed and height band every boid is held inside
+	static float Speed_Min;
+	static float Speed_Max;
+	static float Height_Min;
+	static float Height_Max;
 
 	Node *pNode;
 	RigidBody *pRigidbody;
@@ -81,27 +99,140 @@ public:
 	Boids();
 	~Boids();
 
-	void Initialise(ResourceCache *pRes, Scene *pScene);
+	///create the boid's node at pos moving at vel. kinematic boids get no rigid body or collision shape, BoidSet moves their node itself.
+	///with a group the boid is drawn as one of its instances instead of getting a StaticModel of its own
+	void Initialise(ResourceCache *pRes, Scene *pScene, const Vector3 &pos, const Vector3 &vel, bool kinematic = false,
+		StaticModelGroup *pGroup = 0, CreateMode mode = REPLICATED);
+	///pick a random spawn position and velocity
+	static void SpawnState(Vector3 &pos, Vector3 &vel);
 
+	///apply the flocking force and clamp speed and height, pos and vel are this tick's state from the flock store
+	void Update(const Vector3 &force, const Vector3 &vel, const Vector3 &pos, float tm);
+	///true if a boid at pos is inside the capture box around a player at playerPos
+	static bool IsCaptured(const Vector3 &pos, const Vector3 &playerPos);
+	///rotation that points a boid along vel
+	static Quaternion Heading(const Vector3 &vel);
 
+	///turn the neighbour sums gathered by FlockKernel into the steering force of a boid at pos moving at vel
+	static Vector3 SteeringForce(const Vector3 &pos, const Vector3 &vel, const FlockSums &sums);
+	///squared neighbour ranges for the flocking kernel
+	static FlockRanges Ranges();
+	///cell size for the neighbour grid, large enough that the 3x3x3 block around a boid covers every range
+	static float GridCellSize();
 
-	void Computeforce(Boids *Boid);
-	void Update(float tm);
 
-	void GetPlayerPos(Vector3 coords, bool Game_Running);
+};
 
+///one work item of the parallel flocking pass, a range of boids in one flock.
+///owns its scratch state and writes its forces into its own buffers, so items share nothing mutable
+struct FlockTask
+{
+	unsigned flock;
+	///first boid and one past the last, as store indices
+	unsigned begin;
+	unsigned end;
+	///forces of boids begin..end-1, copied into the store once every item has finished
+	PODVector<float> forceX;
+	PODVector<float> forceY;
+	PODVector<float> forceZ;
+	///scratch list of grid query results
+	PODVector<unsigned> neighbours;
+	///flocking kernel with its neighbour packing buffers
+	FlockKernel kernel;
 };
 
 class BoidSet
 {
 public:
-	Boids boidList1[NumBoids];
-	Boids boidList2[NumBoids];
-	Boids boidList3[NumBoids];
-	Boids boidList4[NumBoids];
-	Boids boidList5[NumBoids];
-
-	BoidSet() {};
+	///scene objects of every boid, in the same order as the store
+	Vector<Boids> boidList;
+	///dense per-boid state the flocking runs on, synced with the scene once per tick
+	FlockStore store;
+
+	BoidSet() : numFlocks(NumFlocks), flockSize(NumBoids), kinematicRequested(false), kinematic(false), instanced(true), replicated(false), workQueue(0), tick(0), capturing(false), plannedBoids(0), plannedFlocks(0) {};
+	///choose how many flocks to create and how many boids each holds, takes effect on the next Initialise
+	void SetFlockLayout(unsigned flocks, unsigned boidsPerFlock);
+	///work queue the force pass is spread over, null runs it on the calling thread. Initialise uses the engine's queue
+	void SetWorkQueue(WorkQueue *queue) { workQueue = queue; }
+	///integrate the boids ourselves instead of through bullet rigid bodies, takes effect on the next Initialise.
+	///kinematic boids keep the same speed and height clamps but no longer collide with the scene
+	void SetKinematic(bool enable) { kinematicRequested = enable; }
+	///draw each flock through one StaticModelGroup instead of a StaticModel per boid, takes effect on the next Initialise.
+	///the renderer then culls whole flocks and draws every fish of the species as one instanced batch
+	void SetInstancedRendering(bool enable) { instanced = enable; }
+	///let Urho3D replicate every boid node to clients, takes effect on the next Initialise.
+	///off by default: the nodes stay local and BoidReplicator sends the flock as quantized snapshots instead
+	void SetReplicated(bool enable) { replicated = enable; }
+	///take the layout and modes of another set, so several flocks can be set up alike. takes effect on the next Initialise
+	void CopySettings(const BoidSet &other);
+	///capture boids that come near a player at pos from the next Update on. until this is called nothing is captured
+	void SetCapturer(const Vector3 &pos) { capturer = pos; capturing = true; }
+	///capture boid i at the start of the next Update, for captures the caller decides, e.g. against rewound positions
+	void Capture(unsigned i);
 	void Initialise(ResourceCache *pRes, Scene *pScene);
+	///put boid i at pos moving at vel, in the store and in the scene, e.g. to play back a recorded tick
+	void SetState(unsigned i, const Vector3 &pos, const Vector3 &vel);
+	///step a state of boid i from an older tick on by steps kinematic ticks of tm, flocking with the rest of its flock
+	///where it is now, with the same clamps as Update. the store is not changed
+	void Advance(unsigned i, Vector3 &pos, Vector3 &vel, unsigned steps, float tm) const;
+	///remove every boid and flock node from the scene, the store keeps its state
+	void Clear();
 	void Update(float tm);
-};
\ No newline at end of file
+	///work out the force of every boid in the store from its position and velocity, in parallel over the work queue
+	void ComputeForces();
+
+	unsigned GetNumFlocks() const { return numFlocks; }
+	unsigned GetFlockSize() const { return flockSize; }
+	bool IsKinematic() const { return kinematic; }
+	bool IsInstancedRendering() const { return instanced; }
+	bool IsReplicated() const { return replicated; }
+	///number of Update calls since Initialise, or since the tick was last set. kinematic flocks given the same state,
+	///parameters and ticks stay in step on every machine, which is what FlockSync relies on
+	unsigned GetTick() const { return tick; }
+	void SetTick(unsigned t) { tick = t; }
+	///boids captured during the last Update
+	const PODVector<unsigned> &GetCaptured() const { return captured; }
+
+private:
+	///read position and velocity of every boid from its rigid body
+	void ReadState();
+	///split the flocks into work items, redone whenever the store layout changes
+	void PlanTasks();
+	///rebuild the grid of one flock
+	void BuildGrid(unsigned flock);
+	///work out the forces of one task's boids into its own buffers
+	void RunTask(FlockTask &task) const;
+	///check captures, then apply the forces and clamps back to the rigid bodies
+	void WriteState(float tm);
+	///kinematic flock: check captures, clamp and integrate in the store, then write the node transforms
+	void Integrate(float tm);
+
+	///work queue entry points
+	static void BuildGridWork(const WorkItem *item, unsigned threadIndex);
+	static void RunTaskWork(const WorkItem *item, unsigned threadIndex);
+
+	unsigned numFlocks;
+	unsigned flockSize;
+	///kinematic mode asked for, and the mode the current boids were created in
+	bool kinematicRequested;
+	bool kinematic;
+	bool instanced;
+	bool replicated;
+	WorkQueue *workQueue;
+	unsigned tick;
+	PODVector<unsigned> captured;
+	///boids Capture was called for since the last Update
+	PODVector<unsigned> toCapture;
+	///player position boids are captured around, and whether there is one
+	Vector3 capturer;
+	bool capturing;
+	///one node per flock holding its StaticModelGroup
+	Vector<WeakPtr<Node> > flockNodes;
+	///neighbour grid of every flock, rebuilt every physics step and only read while the tasks run
+	Vector<BoidGrid> grids;
+	///work items of the force pass
+	Vector<FlockTask> tasks;
+	///store layout the tasks were planned for
+	unsigned plannedBoids;
+	unsigned plannedFlocks;
+};
@@ -0,0 +1,548 @@
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Engine/Engine.h>
+#include <Urho3D/Graphics/Octree.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Math/Random.h>
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Network/Network.h>
+#include <Urho3D/Network/NetworkEvents.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "BoidReplication.h"
+#include "GameEvents.h"
+#include "InputChannel.h"
+#include "NetConditions.h"
+#include "ServerStats.h"
+#include "SharkPrediction.h"
+
+// Headless bot clients for load testing a server.
+// Each bot is a full client of its own: a Network instance with one connection and a scene the server replicates into.
+// Once the scene has loaded it sends E_CLIENTISREADY like the start button, and then swims its shark after the nearest
+// fish through the input channel, taking boid snapshots through RemoteFlock and acknowledging them like the game does.
+// Bots join in steps, 1 to 128 by default. After each step has settled the bots are measured for a while and one CSV row
+// is printed: the server's frame time as its MSG_SERVERSTATS report it, the time from an input being made to the
+// server's shark state acknowledging it, the connection round trip and the bytes received per bot. It also has how long
+// the step's bots took to join, from connecting to every boid shown as the server has it.
+//
+// What the bots send can be impaired like the game's with -latency MS, -jitter MS, -loss P and -duplicate P.
+//
+// Usage: BotClient [-address A] [-port N] [-bots N | -ramp N,N,...] [-settle S] [-hold S] [-seed N] [-latency MS ...]
+// Start the server first, e.g. UrhoTutorial -dedicated. Bots run at the server's 60 steps a second.
+
+static const unsigned DEFAULT_RAMP[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+static const unsigned NUM_DEFAULT_RAMP = sizeof(DEFAULT_RAMP) / sizeof(DEFAULT_RAMP[0]);
+static const float DEFAULT_SETTLE_SECONDS = 5.0f;
+static const float DEFAULT_HOLD_SECONDS = 15.0f;
+/// Longest wait for the bots of a step to connect and get their shark.
+static const float JOIN_TIMEOUT_SECONDS = 30.0f;
+static const int BOT_FPS = 60;
+/// Rate inputs are sent at, the game's network update rate.
+static const float INPUT_SEND_INTERVAL = 1.0f / 30.0f;
+/// Time between a bot picking the fish to chase.
+static const float RETARGET_INTERVAL = 0.2f;
+/// Inputs remembered for timing their acknowledgement, well past any latency worth measuring.
+static const unsigned LATENCY_RING = 256;
+static const unsigned RANDOM_SEED = 1;
+
+/// One bot: a connection, the scene it replicates into and the state of its chase.
+class Bot : public RefCounted
+{
+public:
+	Bot(Context* context) :
+		network_(new Network(context)),
+		scene_(new Scene(context)),
+		sequence_(0),
+		acknowledged_(0),
+		sharkID_(0),
+		readySent_(false),
+		joined_(false),
+		connectTime_(0.0f),
+		sendTime_(0.0f),
+		retargetTime_(0.0f)
+	{
+		// Physics is only there so the replicated sharks have a world to sit in, the server moves everything
+		scene_->CreateComponent<Octree>(LOCAL);
+		scene_->CreateComponent<PhysicsWorld>(LOCAL);
+		scene_->SetUpdateEnabled(false);
+		for (unsigned i = 0; i < LATENCY_RING; ++i)
+			inputTimes_[i] = 0.0f;
+	}
+
+	/// The bot's own network, so each bot is a separate client.
+	SharedPtr<Network> network_;
+	/// Scene the server replicates into.
+	SharedPtr<Scene> scene_;
+	/// Boids from the server's snapshots.
+	RemoteFlock flock_;
+	/// Inputs going to the server.
+	InputSender inputs_;
+	/// Input being held until the next retarget.
+	InputFrame steer_;
+	/// Number of the newest input.
+	unsigned sequence_;
+	/// Newest input the server acknowledged.
+	unsigned acknowledged_;
+	/// Time each recent input was made, by number modulo the ring size.
+	float inputTimes_[LATENCY_RING];
+	/// Node ID of the bot's shark, 0 until the server tells.
+	unsigned sharkID_;
+	/// Whether E_CLIENTISREADY has been sent.
+	bool readySent_;
+	/// Whether the flock has been shown in full.
+	bool joined_;
+	/// Time the bot connected.
+	float connectTime_;
+	/// Time inputs were last sent.
+	float sendTime_;
+	/// Time a fish was last picked.
+	float retargetTime_;
+};
+
+/// Measurements of one step.
+struct StepStats
+{
+	StepStats() :
+		serverReports_(0),
+		serverFrameMs_(0.0),
+		serverFrameMaxMs_(0.0f),
+		bytesIn_(0.0),
+		rttMs_(0.0),
+		numRtt_(0),
+		boidsSeen_(0.0),
+		numBoidSamples_(0)
+	{
+	}
+
+	/// Input to acknowledgement latencies.
+	PODVector<float> latencyMs_;
+	/// MSG_SERVERSTATS received.
+	unsigned serverReports_;
+	/// Sum of the server's mean frame times.
+	double serverFrameMs_;
+	/// Longest server frame.
+	float serverFrameMaxMs_;
+	/// Bytes received by every bot.
+	double bytesIn_;
+	/// Sum of round trip times sampled.
+	double rttMs_;
+	unsigned numRtt_;
+	/// Sum of the boids each bot was sent, sampled at retargets.
+	double boidsSeen_;
+	unsigned numBoidSamples_;
+};
+
+/// Runs the bots from the engine's frame events.
+class BotSwarm : public Object
+{
+	URHO3D_OBJECT(BotSwarm, Object);
+
+public:
+	BotSwarm(Context* context, const String& address, unsigned short port, const NetConditions& conditions) :
+		Object(context),
+		address_(address),
+		port_(port),
+		conditions_(conditions),
+		targetBots_(0),
+		measuring_(false)
+	{
+		SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(BotSwarm, HandleUpdate));
+		SubscribeToEvent(E_NETWORKMESSAGE, URHO3D_HANDLER(BotSwarm, HandleNetworkMessage));
+		SubscribeToEvent(E_CLIENTOBJECTAUTHORITY, URHO3D_HANDLER(BotSwarm, HandleObjectAuthority));
+	}
+
+	/// Add bots up to count. They connect from the next frame, one a frame.
+	void SetNumBots(unsigned count)
+	{
+		targetBots_ = count;
+	}
+
+	/// Return the number of bots with a shark to swim.
+	unsigned GetNumPlaying() const
+	{
+		unsigned count = 0;
+		for (unsigned i = 0; i < bots_.Size(); ++i)
+		{
+			if (bots_[i]->sharkID_ && bots_[i]->scene_->GetNode(bots_[i]->sharkID_))
+				++count;
+		}
+		return count;
+	}
+
+	/// Return the number of bots connected.
+	unsigned GetNumConnected() const
+	{
+		unsigned count = 0;
+		for (unsigned i = 0; i < bots_.Size(); ++i)
+		{
+			Connection* connection = bots_[i]->network_->GetServerConnection();
+			if (connection && connection->IsConnected())
+				++count;
+		}
+		return count;
+	}
+
+	/// Start measuring.
+	void BeginMeasure()
+	{
+		stats_ = StepStats();
+		measuring_ = true;
+	}
+
+	/// Stop measuring and return what was measured.
+	const StepStats& EndMeasure()
+	{
+		measuring_ = false;
+		return stats_;
+	}
+
+	/// Return the join times of the bots that joined since the last call, and forget them.
+	PODVector<float> TakeJoinTimes()
+	{
+		PODVector<float> joinMs;
+		joinMs.Swap(joinMs_);
+		return joinMs;
+	}
+
+	/// Disconnect every bot.
+	void DisconnectAll()
+	{
+		for (unsigned i = 0; i < bots_.Size(); ++i)
+			bots_[i]->network_->Disconnect();
+	}
+
+private:
+	void HandleUpdate(StringHash eventType, VariantMap& eventData)
+	{
+		using namespace Update;
+
+		float timeStep = eventData[P_TIMESTEP].GetFloat();
+		float time = GetSubsystem<Time>()->GetElapsedTime();
+
+		// Joining is the heaviest thing a server does for a client, so they come in one at a time
+		if (bots_.Size() < targetBots_)
+		{
+			SharedPtr<Bot> bot(new Bot(context_));
+			conditions_.Apply(bot->network_);
+			if (bot->network_->Connect(address_, port_, bot->scene_))
+			{
+				bot->connectTime_ = time;
+				conditions_.Apply(bot->network_->GetServerConnection());
+				bots_.Push(bot);
+			}
+			else
+				PrintLine("Bot could not connect to " + address_ + ":" + String(port_), true);
+		}
+
+		for (unsigned i = 0; i < bots_.Size(); ++i)
+			UpdateBot(*bots_[i], timeStep, time);
+	}
+
+	void UpdateBot(Bot& bot, float timeStep, float time)
+	{
+		Connection* connection = bot.network_->GetServerConnection();
+		if (!connection || !connection->IsConnected())
+			return;
+		if (measuring_)
+		{
+			stats_.bytesIn_ += connection->GetBytesInPerSec() * timeStep;
+			stats_.rttMs_ += connection->GetRoundTripTime();
+			++stats_.numRtt_;
+		}
+
+		if (!bot.readySent_ && connection->IsSceneLoaded())
+		{
+			VariantMap remoteEventData;
+			remoteEventData[PLAYER_ID] = 0;
+			remoteEventData[VIEW_DELAY] = bot.flock_.GetClock().GetDelay();
+			connection->SendRemoteEvent(E_CLIENTISREADY, true, remoteEventData);
+			bot.readySent_ = true;
+		}
+
+		Node* shark = bot.sharkID_ ? bot.scene_->GetNode(bot.sharkID_) : 0;
+		if (!shark)
+			return;
+		// Interest is worked out around the shark, where the game has its camera
+		connection->SetPosition(shark->GetPosition());
+
+		if (time - bot.retargetTime_ >= RETARGET_INTERVAL)
+		{
+			bot.retargetTime_ = time;
+			Steer(bot, shark->GetPosition(), time);
+		}
+
+		bot.steer_.sequence_ = ++bot.sequence_;
+		bot.inputs_.Push(bot.steer_);
+		bot.inputTimes_[bot.sequence_ % LATENCY_RING] = time;
+
+		if (time - bot.sendTime_ >= INPUT_SEND_INTERVAL)
+		{
+			bot.sendTime_ = time;
+			VectorBuffer message;
+			if (bot.inputs_.Write(message))
+				connection->SendMessage(MSG_INPUT, false, false, message);
+		}
+	}
+
+	/// Point the bot at the nearest fish it can see, or wander if it sees none.
+	void Steer(Bot& bot, const Vector3& position, float time)
+	{
+		RemoteFlock& flock = bot.flock_;
+		flock.Update(time);
+
+		Node* nearest = 0;
+		float nearestDistance = M_INFINITY;
+		unsigned seen = 0;
+		for (unsigned i = 0; i < flock.GetNumBoids(); ++i)
+		{
+			Node* boid = flock.GetNode(i);
+			if (!boid->IsEnabled())
+				continue;
+			++seen;
+			float distance = (boid->GetPosition() - position).LengthSquared();
+			if (distance < nearestDistance)
+			{
+				nearestDistance = distance;
+				nearest = boid;
+			}
+		}
+		if (measuring_)
+		{
+			stats_.boidsSeen_ += seen;
+			++stats_.numBoidSamples_;
+		}
+
+		bot.steer_.buttons_ = IB_FORWARD;
+		if (!nearest)
+		{
+			bot.steer_.yaw_ += InputFrame::QuantizeAngle(Random(-30.0f, 30.0f));
+			bot.steer_.pitch_ = 0;
+			return;
+		}
+
+		// The shark swims along its rotation's forward, so yaw turns it towards the fish and a negative pitch lifts it
+		Vector3 offset = nearest->GetPosition() - position;
+		float yaw = Atan2(offset.x_, offset.z_);
+		float pitch = -Atan2(offset.y_, Vector2(offset.x_, offset.z_).Length());
+		bot.steer_.yaw_ = InputFrame::QuantizeAngle(yaw);
+		bot.steer_.pitch_ = InputFrame::QuantizeAngle(pitch);
+	}
+
+	void HandleNetworkMessage(StringHash eventType, VariantMap& eventData)
+	{
+		using namespace NetworkMessage;
+
+		Connection* connection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
+		Bot* bot = FindBot(connection);
+		if (!bot)
+			return;
+
+		int messageID = eventData[P_MESSAGEID].GetInt();
+		MemoryBuffer message(eventData[P_DATA].GetBuffer());
+		float time = GetSubsystem<Time>()->GetElapsedTime();
+		if (messageID == MSG_BOIDSNAPSHOT || messageID == MSG_JOINKEYFRAME)
+		{
+			if (messageID == MSG_BOIDSNAPSHOT)
+				bot->flock_.HandleMessage(bot->scene_, connection, message, time);
+			else
+				bot->flock_.HandleJoinMessage(bot->scene_, connection, message, time);
+			if (!bot->joined_ && bot->flock_.HasCompleteTick())
+			{
+				bot->joined_ = true;
+				joinMs_.Push((time - bot->connectTime_) * 1000.0f);
+			}
+		}
+		else if (messageID == MSG_SHARKSTATE)
+		{
+			// The server answers with the newest input it has applied, timed from when the bot made it
+			unsigned sequence = message.ReadUInt();
+			if ((int)(sequence - bot->acknowledged_) <= 0 || (int)(bot->sequence_ - sequence) >= (int)LATENCY_RING)
+				return;
+			bot->acknowledged_ = sequence;
+			if (measuring_)
+				stats_.latencyMs_.Push((time - bot->inputTimes_[sequence % LATENCY_RING]) * 1000.0f);
+		}
+		else if (messageID == MSG_SERVERSTATS && measuring_ && bot == bots_[0])
+		{
+			// Every bot gets the same report, one is enough
+			ServerFrameStats server;
+			server.Read(message);
+			stats_.serverFrameMs_ += server.meanMs_;
+			stats_.serverFrameMaxMs_ = Max(stats_.serverFrameMaxMs_, server.maxMs_);
+			++stats_.serverReports_;
+		}
+	}
+
+	void HandleObjectAuthority(StringHash eventType, VariantMap& eventData)
+	{
+		using namespace RemoteEventData;
+
+		Bot* bot = FindBot(static_cast<Connection*>(eventData[P_CONNECTION].GetPtr()));
+		if (bot)
+			bot->sharkID_ = eventData[PLAYER_ID].GetUInt();
+	}
+
+	Bot* FindBot(Connection* connection) const
+	{
+		for (unsigned i = 0; i < bots_.Size(); ++i)
+		{
+			if (bots_[i]->network_->GetServerConnection() == connection)
+				return bots_[i];
+		}
+		return 0;
+	}
+
+	/// Server address.
+	String address_;
+	/// Server port.
+	unsigned short port_;
+	/// Simulated network conditions of every bot.
+	NetConditions conditions_;
+	/// Bots wanted.
+	unsigned targetBots_;
+	/// Bots created.
+	Vector<SharedPtr<Bot> > bots_;
+	/// Whether the step is being measured.
+	bool measuring_;
+	/// Measurements of the step.
+	StepStats stats_;
+	/// Join times of bots since they were last taken.
+	PODVector<float> joinMs_;
+};
+
+/// Return the value at fraction of the way through sorted values.
+static float Percentile(const PODVector<float>& sorted, float fraction)
+{
+	if (sorted.Empty())
+		return 0.0f;
+	unsigned index = (unsigned)(fraction * (sorted.Size() - 1) + 0.5f);
+	return sorted[index];
+}
+
+/// Run frames for a while, or until the engine exits.
+static void RunFor(Engine* engine, Time* time, float seconds)
+{
+	float end = time->GetElapsedTime() + seconds;
+	while (!engine->IsExiting() && time->GetElapsedTime() < end)
+		engine->RunFrame();
+}
+
+int main(int argc, char** argv)
+{
+	String address = "localhost";
+	unsigned short port = SERVER_PORT;
+	PODVector<unsigned> ramp;
+	float settleSeconds = DEFAULT_SETTLE_SECONDS;
+	float holdSeconds = DEFAULT_HOLD_SECONDS;
+	unsigned seed = RANDOM_SEED;
+	NetConditions conditions;
+
+	const Vector<String>& arguments = ParseArguments(argc, argv);
+	for (unsigned i = 0; i < arguments.Size(); ++i)
+	{
+		String argument = arguments[i].ToLower();
+		bool hasValue = i + 1 < arguments.Size();
+		if (argument == "-address" && hasValue)
+			address = arguments[++i];
+		else if (argument == "-port" && hasValue)
+			port = (unsigned short)ToUInt(arguments[++i]);
+		else if (argument == "-bots" && hasValue)
+		{
+			ramp.Clear();
+			ramp.Push(Max(ToUInt(arguments[++i]), 1u));
+		}
+		else if (argument == "-ramp" && hasValue)
+		{
+			ramp.Clear();
+			Vector<String> counts = arguments[++i].Split(',');
+			for (unsigned k = 0; k < counts.Size(); ++k)
+				ramp.Push(Max(ToUInt(counts[k]), 1u));
+		}
+		else if (argument == "-settle" && hasValue)
+			settleSeconds = Max(ToFloat(arguments[++i]), 0.0f);
+		else if (argument == "-hold" && hasValue)
+			holdSeconds = Max(ToFloat(arguments[++i]), 1.0f);
+		else if (argument == "-seed" && hasValue)
+			seed = ToUInt(arguments[++i]);
+		else if (hasValue && conditions.Set(argument.Substring(1), arguments[i + 1]))
+			++i;
+		else
+		{
+			PrintLine("Usage: BotClient [-address A] [-port N] [-bots N | -ramp N,N,...] [-settle S] [-hold S] [-seed N] "
+				"[-latency MS] [-jitter MS] [-loss P] [-duplicate P]", true);
+			return 1;
+		}
+	}
+	if (ramp.Empty())
+	{
+		for (unsigned i = 0; i < NUM_DEFAULT_RAMP; ++i)
+			ramp.Push(DEFAULT_RAMP[i]);
+	}
+
+	SharedPtr<Context> context(new Context());
+	SharedPtr<Engine> engine(new Engine(context));
+	VariantMap engineParameters;
+	engineParameters["Headless"] = true;
+	engineParameters["LogQuiet"] = true;
+	engineParameters["LogName"] = String::EMPTY;
+	if (!engine->Initialize(engineParameters))
+	{
+		PrintLine("Could not initialise the engine", true);
+		return 1;
+	}
+	engine->SetMaxFps(BOT_FPS);
+	// Remote events are checked against the engine's network, whichever bot's network they arrive through
+	context->GetSubsystem<Network>()->RegisterRemoteEvent(E_CLIENTOBJECTAUTHORITY);
+	SetRandomSeed(seed);
+
+	Time* time = context->GetSubsystem<Time>();
+	SharedPtr<BotSwarm> swarm(new BotSwarm(context, address, port, conditions));
+	PrintLine("bots,connected,playing,server_frame_mean_ms,server_frame_max_ms,latency_mean_ms,latency_p50_ms,"
+		"latency_p99_ms,rtt_ms,kbytes_in_per_bot_per_sec,boids_seen_per_bot,join_mean_ms,join_max_ms");
+	for (unsigned step = 0; step < ramp.Size() && !engine->IsExiting(); ++step)
+	{
+		unsigned count = ramp[step];
+		swarm->SetNumBots(count);
+		float joinEnd = time->GetElapsedTime() + JOIN_TIMEOUT_SECONDS;
+		while (!engine->IsExiting() && swarm->GetNumPlaying() < count && time->GetElapsedTime() < joinEnd)
+			engine->RunFrame();
+		RunFor(engine, time, settleSeconds);
+
+		swarm->BeginMeasure();
+		RunFor(engine, time, holdSeconds);
+		StepStats stats = swarm->EndMeasure();
+		PODVector<float> joinMs = swarm->TakeJoinTimes();
+		float joinSum = 0.0f;
+		float joinMax = 0.0f;
+		for (unsigned i = 0; i < joinMs.Size(); ++i)
+		{
+			joinSum += joinMs[i];
+			joinMax = Max(joinMax, joinMs[i]);
+		}
+
+		unsigned connected = swarm->GetNumConnected();
+		unsigned playing = swarm->GetNumPlaying();
+		double latencySum = 0.0;
+		for (unsigned i = 0; i < stats.latencyMs_.Size(); ++i)
+			latencySum += stats.latencyMs_[i];
+		Sort(stats.latencyMs_.Begin(), stats.latencyMs_.End());
+		PrintLine(ToString("%u,%u,%u,%.3f,%.3f,%.2f,%.2f,%.2f,%.2f,%.3f,%.1f,%.1f,%.1f", count, connected, playing,
+			stats.serverReports_ ? stats.serverFrameMs_ / stats.serverReports_ : 0.0,
+			stats.serverFrameMaxMs_,
+			stats.latencyMs_.Size() ? latencySum / stats.latencyMs_.Size() : 0.0,
+			Percentile(stats.latencyMs_, 0.5f), Percentile(stats.latencyMs_, 0.99f),
+			stats.numRtt_ ? stats.rttMs_ / stats.numRtt_ : 0.0,
+			connected ? stats.bytesIn_ / 1024.0 / connected / holdSeconds : 0.0,
+			stats.numBoidSamples_ ? stats.boidsSeen_ / stats.numBoidSamples_ : 0.0,
+			joinMs.Size() ? joinSum / joinMs.Size() : 0.0f, joinMax));
+	}
+
+	swarm->DisconnectAll();
+	RunFor(engine, time, 0.5f);
+	return 0;
+}
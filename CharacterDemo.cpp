@@ -1,7 +1,9 @@
 #include <Urho3D/Core/CoreEvents.h>
 #include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/Timer.h>
 #include <Urho3D/Core/Object.h>
 #include <Urho3D/Core/Context.h>
+#include <Urho3D/Engine/Console.h>
 #include <Urho3D/Engine/Engine.h>
 #include <Urho3D/Graphics/AnimatedModel.h>
 #include <Urho3D/Graphics/AnimationController.h>
@@ -24,10 +26,12 @@
 #include <Urho3D/IO/FileSystem.h>
 #include <Urho3D/IO/Log.h>
 #include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
 
 #include <Urho3D/Network/Connection.h>
 #include <Urho3D/Network/Network.h>
 #include <Urho3D/Network/NetworkEvents.h>
+#include <Urho3D/Network/NetworkPriority.h>
 
 #include <Urho3D/Physics/CollisionShape.h>
 #include <Urho3D/Physics/PhysicsWorld.h>
@@ -36,6 +40,7 @@
 #include <Urho3D/Physics/Constraint.h>
 #include <Urho3D/Resource/ResourceCache.h>
 #include <Urho3D/Scene/Scene.h>
+#include <Urho3D/Scene/SceneEvents.h>
 #include <Urho3D/UI/Font.h>
 #include <Urho3D/UI/Text.h>
 #include <Urho3D/UI/UI.h>
@@ -48,30 +53,57 @@
 
 #include "Character.h"
 #include "CharacterDemo.h"
+#include "GameEvents.h"
 #include "Touch.h"
 
 #include <Urho3D/DebugNew.h>
 #include <Urho3D/Engine/DebugHud.h>
 
-// Custom remote event we use to tell the client which object they control
-static const StringHash E_CLIENTOBJECTAUTHORITY("ClientObjectAuthority");
-// Identifier for the node ID parameter in the event data
-static const StringHash PLAYER_ID("IDENTITY");
-// Custom event on server, client has pressed button that it wants to start game
-static const StringHash E_CLIENTISREADY("ClientReadyToStart");
-
 static const String INSTRUCTION("instructionText");
-Boids boids;
-bool Game_Running;
+static const String NET_STATS("netStatsText");
+// Default distance from a client's camera within which it is sent boids and full rate shark updates, just past the fog
+static const float INTEREST_RADIUS = 160.0f;
+// Factor of the interest radius at which other clients stop getting shark updates
+static const float SHARK_UPDATE_RADIUS_FACTOR = 2.0f;
 
 
 URHO3D_DEFINE_APPLICATION_MAIN(CharacterDemo)
 
 CharacterDemo::CharacterDemo(Context* context) :
 	Sample(context),
-	firstPerson_(false)
+	firstPerson_(false),
+	dedicated_(false),
+	sceneDescription_(DEFAULT_SCENE_DESCRIPTION),
+	serverPort_(SERVER_PORT),
+	numRooms_(1),
+	roomSize_(DEFAULT_ROOM_SIZE),
+	interestRadius_(INTEREST_RADIUS),
+	flockCorrections_(DEFAULT_FLOCK_CORRECTIONS),
+	flockCorrectionPeriod_(DEFAULT_FLOCK_CORRECTION_PERIOD),
+	joinChunkBoids_(DEFAULT_JOIN_CHUNK_BOIDS),
+	joinChunksPerUpdate_(DEFAULT_JOIN_CHUNKS_PER_UPDATE),
+	clientFlocks_(false),
+	flockSeed_(0),
+	serverStatsTime_(0.0f),
+	checkpointInterval_(DEFAULT_CHECKPOINT_INTERVAL),
+	checkpointTime_(0.0f),
+	maxRewind_(DEFAULT_MAX_REWIND),
+	inputSequence_(0),
+	numSceneChildren_(0),
+	joinSceneUSec_(0),
+	joinFirstUSec_(0),
+	joinReported_(false)
 {
 	//TUTORIAL: TODO
+	netStats_.SetMessageName(MSG_BOIDSNAPSHOT, "BoidSnapshot");
+	netStats_.SetMessageName(MSG_BOIDSNAPSHOTACK, "BoidSnapshotAck");
+	netStats_.SetMessageName(MSG_JOINKEYFRAME, "JoinKeyframe");
+	netStats_.SetMessageName(MSG_FLOCKSETUP, "FlockSetup");
+	netStats_.SetMessageName(MSG_FLOCKCORRECTION, "FlockCorrection");
+	netStats_.SetMessageName(MSG_SHARKSTATE, "SharkState");
+	netStats_.SetMessageName(MSG_INPUT, "Input");
+	netStats_.SetMessageName(MSG_SERVERSTATS, "ServerStats");
+	remoteFlock_.SetStats(&netStats_);
 
 }
 
@@ -79,202 +111,204 @@ CharacterDemo::~CharacterDemo()
 {
 }
 
+void CharacterDemo::Setup()
+{
+	Sample::Setup();
+
+	// -dedicated runs a server with no window, graphics or sound. Everything else is read in Start
+	const Vector<String>& arguments = GetArguments();
+	for (unsigned i = 0; i < arguments.Size(); ++i)
+	{
+		if (arguments[i].ToLower() == "-dedicated")
+			dedicated_ = true;
+	}
+	if (dedicated_)
+		engineParameters_["Headless"] = true;
+}
+
+void CharacterDemo::UpdateSharkInterest()
+{
+	if (interestRadius_ <= 0.0f)
+		return;
+
+	// Same enter and leave distances as the server uses for boids, so sharks and fish at the edge come and go together
+	Vector3 camera = cameraNode_->GetPosition();
+	float enter2 = interestRadius_ * interestRadius_;
+	float leaveRadius = interestRadius_ * DEFAULT_INTEREST_HYSTERESIS;
+	float leave2 = leaveRadius * leaveRadius;
+	for (unsigned i = 0; i < remoteSharks_.Size();)
+	{
+		Node* shark = remoteSharks_[i];
+		if (!shark)
+		{
+			remoteSharks_.Erase(i);
+			continue;
+		}
+
+		float d2 = (shark->GetPosition() - camera).LengthSquared();
+		if (shark->IsEnabled() && d2 >= leave2)
+			shark->SetEnabled(false);
+		else if (!shark->IsEnabled() && d2 < enter2)
+			shark->SetEnabled(true);
+		++i;
+	}
+}
+
 void CharacterDemo::Start()
 {
-	// Execute base class startup
-	Sample::Start();
+	// Execute base class startup. Its logo, console and debug HUD all need graphics
+	if (!dedicated_)
+		Sample::Start();
 	if (touchEnabled_)
 		touch_ = new Touch(context_, TOUCH_SENSITIVITY);
 	//TUTORIAL: TODO
 
+	// Flock layout comes from the command line, e.g. -flocks 10 -flocksize 200 -kinematic -noinstancing -replicateboids
+	// -aoiradius 0 sends every boid and shark to every client. Clients hide other sharks past their own, so give both the same radius
+	// -clientflocks has clients simulate the flock from its exact state when they join, with at least -flockcorrections N
+	// boids fixed per update and every boid within -flockcorrectionperiod N updates. -flockseed N sets the spawn seed
+	// -interpdelay MS and -maxextrapolation MS tune how far in the past clients show remote boids and sharks
+	// -predictionthreshold D and -predictionsmoothing MS tune when and how gently the own shark's prediction is corrected
+	// -inputredundancy N sends each client input in N messages
+	// -port N serves on, or connects to, port N instead of SERVER_PORT
+	// -rooms N serves N separate matches of -roomsize N clients each, flocks of different rooms only step in parallel with -kinematic
+	// -netstats FILE logs the network stats every -netstatsinterval S seconds, as JSON lines to a .json file, else CSV
+	// -netlatency MS, -netjitter MS, -netloss P and -netduplicate P impair everything sent, as does the netsim command
+	// -record FILE records every room's match for replays, with several rooms room N to FILE with _N before the extension
+	// -replay FILE plays a recorded match instead of joining one. P pauses and the arrow keys skip back and forward
+	// -checkpoint FILE saves every room's live state every -checkpointinterval S seconds and on exit, and -restore FILE
+	// starts the server from such a file, carrying the matches on. Clients get their sharks back when they rejoin
+	// -lagcompensation MS caps how far back captures are checked against what clients saw, 0 checks the current boids
+	// -joinchunk N streams joining clients their first keyframe N boids a message, nearest first, -joinrate N messages
+	// an update. -joinchunk 0 sends them keyframe snapshots instead. Clients log how long their join took
+	// -scene NAME builds the world from another scene description, cooked by SceneCook or on first use
+	flockSeed_ = Time::GetSystemTime();
+	String replayFile;
+	const Vector<String>& arguments = GetArguments();
+	for (unsigned i = 0; i < arguments.Size(); ++i)
+	{
+		String argument = arguments[i].ToLower();
+		bool hasValue = i + 1 < arguments.Size();
+		if (argument == "-flocks" && hasValue)
+			boidSet.SetFlockLayout(ToUInt(arguments[i + 1]), boidSet.GetFlockSize());
+		else if (argument == "-flocksize" && hasValue)
+			boidSet.SetFlockLayout(boidSet.GetNumFlocks(), ToUInt(arguments[i + 1]));
+		else if (argument == "-kinematic")
+			boidSet.SetKinematic(true);
+		else if (argument == "-noinstancing")
+			boidSet.SetInstancedRendering(false);
+		else if (argument == "-replicateboids")
+			boidSet.SetReplicated(true);
+		else if (argument == "-aoiradius" && hasValue)
+			interestRadius_ = ToFloat(arguments[i + 1]);
+		else if (argument == "-clientflocks")
+			clientFlocks_ = true;
+		else if (argument == "-flockseed" && hasValue)
+			flockSeed_ = ToUInt(arguments[i + 1]);
+		else if (argument == "-flockcorrections" && hasValue)
+			flockCorrections_ = ToUInt(arguments[i + 1]);
+		else if (argument == "-flockcorrectionperiod" && hasValue)
+			flockCorrectionPeriod_ = ToUInt(arguments[i + 1]);
+		else if (argument == "-interpdelay" && hasValue)
+		{
+			remoteFlock_.GetClock().SetDelay(ToFloat(arguments[i + 1]) / 1000.0f);
+			sharkInterpolator_.GetClock().SetDelay(ToFloat(arguments[i + 1]) / 1000.0f);
+		}
+		else if (argument == "-maxextrapolation" && hasValue)
+		{
+			remoteFlock_.GetClock().SetMaxExtrapolation(ToFloat(arguments[i + 1]) / 1000.0f);
+			sharkInterpolator_.GetClock().SetMaxExtrapolation(ToFloat(arguments[i + 1]) / 1000.0f);
+		}
+		else if (argument == "-predictionthreshold" && hasValue)
+			sharkPredictor_.SetCorrectionThreshold(ToFloat(arguments[i + 1]));
+		else if (argument == "-predictionsmoothing" && hasValue)
+			sharkPredictor_.SetCorrectionSmoothing(ToFloat(arguments[i + 1]) / 1000.0f);
+		else if (argument == "-inputredundancy" && hasValue)
+			inputSender_.SetRedundancy(ToUInt(arguments[i + 1]));
+		else if (argument == "-rooms" && hasValue)
+			numRooms_ = Max(ToUInt(arguments[i + 1]), 1u);
+		else if (argument == "-roomsize" && hasValue)
+			roomSize_ = Max(ToUInt(arguments[i + 1]), 1u);
+		else if (argument == "-port" && hasValue)
+			serverPort_ = (unsigned short)ToUInt(arguments[i + 1]);
+		else if (argument == "-record" && hasValue)
+			recordFile_ = arguments[i + 1];
+		else if (argument == "-replay" && hasValue)
+			replayFile = arguments[i + 1];
+		else if (argument == "-checkpoint" && hasValue)
+			checkpointFile_ = arguments[i + 1];
+		else if (argument == "-checkpointinterval" && hasValue)
+			checkpointInterval_ = Max(ToFloat(arguments[i + 1]), 1.0f);
+		else if (argument == "-restore" && hasValue)
+			restoreFile_ = arguments[i + 1];
+		else if (argument == "-joinchunk" && hasValue)
+			joinChunkBoids_ = ToUInt(arguments[i + 1]);
+		else if (argument == "-joinrate" && hasValue)
+			joinChunksPerUpdate_ = Max(ToUInt(arguments[i + 1]), 1u);
+		else if (argument == "-scene" && hasValue)
+			sceneDescription_ = arguments[i + 1];
+		else if (argument == "-lagcompensation" && hasValue)
+			maxRewind_ = Max(ToFloat(arguments[i + 1]) / 1000.0f, 0.0f);
+		else if (argument == "-netstats" && hasValue)
+		{
+			if (!netStats_.OpenLog(context_, arguments[i + 1]))
+				Log::WriteRaw("Could not open network stats log " + arguments[i + 1] + "\n");
+		}
+		else if (argument == "-netstatsinterval" && hasValue)
+			netStats_.SetInterval(Max(ToFloat(arguments[i + 1]), 0.1f));
+		else if (argument.StartsWith("-net") && hasValue)
+			netConditions_.Set(argument.Substring(4), arguments[i + 1]);
+	}
+	netConditions_.Apply(GetSubsystem<Network>());
+	if (netConditions_.IsEnabled())
+		Log::WriteRaw("Simulating network conditions: " + netConditions_.ToString() + "\n");
+
+	// Only a kinematic flock steps the same on every machine
+	if (clientFlocks_)
+		boidSet.SetKinematic(true);
+
 	// Create static scene content
 	CreateScene();
+
+	// A dedicated server has nothing to show and no one to press start, it serves straight away. Frames past the
+	// physics rate would do nothing but burn a core another server could use
+	if (dedicated_)
+	{
+		SubscribeToEvents();
+		engine_->SetMaxFps(scene_->GetComponent<PhysicsWorld>()->GetFps());
+		StartServer();
+		return;
+	}
+
 	CreateMainMenu();
 
 	// Create the UI content
 	CreateInstructions();
+	CreateNetStatsOverlay();
 	// Subscribe to necessary events
 	SubscribeToEvents();
 	// Set the mouse mode to use in the sample
 	Sample::InitMouseMode(MM_RELATIVE);
 
+	// A replay plays in the scene just made, watched with the free camera
+	if (!replayFile.Empty() && !StartReplay(replayFile))
+		Log::WriteRaw("Could not open replay " + replayFile + "\n");
+
 }
 
-void CharacterDemo::CreateScene()
+void CharacterDemo::Stop()
 {
-	//Hashmap Pointer
-	HashMap<Connection*, WeakPtr<Node> > serverObjects_;
-	//so we can access resources
-	ResourceCache* cache = GetSubsystem<ResourceCache>();
-	scene_ = new Scene(context_);
-	// Create scene subsystem components
-	scene_->CreateComponent<Octree>(LOCAL);
-	scene_->CreateComponent<PhysicsWorld>(LOCAL);
-
-	//Create camera node and component
-	cameraNode_ = new Node(context_);
-	Camera* camera = cameraNode_->CreateComponent<Camera>(LOCAL);
-	cameraNode_->SetPosition(Vector3(0.0f, 20.0f, 0.0f));
-	camera->SetFarClip(600.0f);
-
-	GetSubsystem<Renderer>()->SetViewport(0, new Viewport(context_,
-		scene_, camera));
-
-	// Create static scene content. First create a zone for ambient
-	//lighting and fog control
-	Node* zoneNode = scene_->CreateChild("Zone",LOCAL);
-	Zone* zone = zoneNode->CreateComponent<Zone>(LOCAL);
-	zone->SetAmbientColor(Color(0.15f, 0.15f, 0.15f));
-	zone->SetFogColor(Color(0.2f, 0.5f, 0.7f));
-	zone->SetFogStart(40.0f);
-	zone->SetFogEnd(150.0f);
-	zone->SetBoundingBox(BoundingBox(-1000.0f, 1000.0f));
-
-	// Create a directional light with cascaded shadow mapping
-	Node* lightNode = scene_->CreateChild("DirectionalLight",LOCAL);
-	lightNode->SetDirection(Vector3(0.3f, -0.5f, 0.425f));
-	Light* light = lightNode->CreateComponent<Light>(LOCAL);
-	light->SetLightType(LIGHT_DIRECTIONAL);
-	light->SetCastShadows(true);
-	light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
-	light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f, 0.8f));
-	//alter brightness values
-	light->SetSpecularIntensity(1.0f);
-	light->SetBrightness(0.6f);
-
-	// Create skybox. The Skybox component is used like StaticModel, but it will be always located at the camera, giving the
-	// illusion of the box planes being far away. Use just the ordinary Box model and a suitable material, whose shader will
-	// generate the necessary 3D texture coordinates for cube mapping
-	Node* skyNode = scene_->CreateChild("Sky",LOCAL);
-	skyNode->SetScale(80.0f); // The scale actually does not matter
-	Skybox* skybox = skyNode->CreateComponent<Skybox>(LOCAL);
-	skybox->SetModel(cache->GetResource<Model>("Models/Box.mdl"));
-	skybox->SetMaterial(cache->GetResource<Material>("Materials/Skybox.xml"));
-
-	// Create heightmap terrain
-	Node* terrainNode = scene_->CreateChild("Terrain",LOCAL);
-	terrainNode->SetPosition(Vector3(20.0f, -10.0f, 0.0f));
-	Terrain* terrain = terrainNode->CreateComponent<Terrain>(LOCAL);
-	terrain->SetPatchSize(64);
-	terrain->SetSpacing(Vector3(0.6f, 0.3f, 0.6f)); // Spacing between vertices and vertical resolution of the height map
-	terrain->SetSmoothing(true);
-	terrain->SetHeightMap(cache->GetResource<Image>("Textures/HeightMap.png"));
-	terrain->SetMaterial(cache->GetResource<Material>("Materials/Terrain.xml"));
-	// The terrain consists of large triangles, which fits well for occlusion rendering, as a hill can occlude all
-	// terrain patches and other objects behind it
-	terrain->SetOccluder(true);
-
-	RigidBody* Terrainbody = terrainNode->CreateComponent<RigidBody>(LOCAL);
-	Terrainbody->SetCollisionLayer(2); // Use layer bitmask 2 for static geometry
-
-	CollisionShape* Terrainshape = terrainNode->CreateComponent<CollisionShape>(LOCAL);
-	Terrainshape->SetTerrain();
-	
-
-	// Create a water plane object that is as large as the terrain
-	waterNode_ = scene_->CreateChild("Water",LOCAL);
-	waterNode_->SetScale(Vector3(2048.0f, 1.0f, 2048.0f));
-	waterNode_->SetPosition(Vector3(0.0f, 45.0f, 0.0f));
-
-	waterNode_->SetRotation(Quaternion(0.0f, 0.0f, 180.0f));
-
-	StaticModel* water = waterNode_->CreateComponent<StaticModel>(LOCAL);
-	water->SetModel(cache->GetResource<Model>("Models/Plane.mdl"));
-	water->SetMaterial(cache->GetResource<Material>("Materials/Water.xml"));
-	// Set a different viewmask on the water plane to be able to hide it from the reflection camera
-	water->SetViewMask(0x80000000);
-
-	// Create a mathematical plane to represent the water in calculations
-	waterPlane_ = Plane(waterNode_->GetWorldRotation() * Vector3(0.0f, 1.0f, 0.0f), waterNode_->GetWorldPosition());
-	//Create a downward biased plane for reflection view clipping. Biasing is necessary to avoid too aggressive //clipping
-	waterClipPlane_ = Plane(waterNode_->GetWorldRotation() * Vector3(0.0f, 1.0f, 0.0f),
-		waterNode_->GetWorldPosition() - Vector3(0.0f, 0.01f, 0.0f));
-	
-	RigidBody* Waterbody = waterNode_->CreateComponent<RigidBody>(LOCAL);
-	Waterbody->SetCollisionLayer(2); // Use layer bitmask 2 for static geometry
-	CollisionShape* Watershape = waterNode_->CreateComponent<CollisionShape>(LOCAL);
-	Watershape->SetTerrain();
-
-	// Create Plants of varying sizes
-	const unsigned NUM_PLANTS = 40;
-	for (unsigned i = 0; i < NUM_PLANTS; ++i)
-	{
-		Node* objectNode = scene_->CreateChild("Plant");
-
-		Vector3 position(Random(100.0f) - 30.0f, 0.0f, Random(100.0f) - 30.0f);
-		position.y_ = terrain->GetHeight(position);
-		objectNode->SetPosition(position);
-
-		objectNode->SetRotation(Quaternion(0.0f, Random(360.0f), 0.0f));
-		objectNode->SetScale(0.05f + Random(0.05f));
-		StaticModel* object = objectNode->CreateComponent<StaticModel>();
-		object->SetModel(cache->GetResource<Model>("Models/plant_002a.mdl"));
-		object->SetMaterial(cache->GetResource<Material>("Materials/Foliage.xml"));
-		object->SetCastShadows(true);
-
-		RigidBody* body = objectNode->CreateComponent<RigidBody>();
-		body->SetCollisionLayer(2);
-		CollisionShape* shape = objectNode->CreateComponent<CollisionShape>();
-		shape->SetTriangleMesh(object->GetModel(), 0);
-	}
-
-	// Create Plants of varying sizes, replicated code for easy alterations
-	const unsigned NUM_BAMBOO = 60;
-	for (unsigned i = 0; i < NUM_BAMBOO; ++i)
+	if (GetSubsystem<Network>()->IsServerRunning() && !checkpointFile_.Empty())
 	{
-		Node* objectNode = scene_->CreateChild("Bamboo");
-
-		Vector3 position(Random(150.0f) - 30.0f, 0.0f, Random(150.0f) - 30.0f);
-		position.y_ = terrain->GetHeight(position);
-		objectNode->SetPosition(position);
-
-		objectNode->SetRotation(Quaternion(0.0f, Random(360.0f), 0.0f));
-		objectNode->SetScale(0.02f + Random(0.03f));
-		StaticModel* object = objectNode->CreateComponent<StaticModel>();
-		object->SetModel(cache->GetResource<Model>("Models/Bamboo.mdl"));
-		object->SetMaterial(cache->GetResource<Material>("Materials/Foliage.xml"));
-		object->SetCastShadows(true);
-
-		RigidBody* body = objectNode->CreateComponent<RigidBody>();
-		body->SetCollisionLayer(2);
-		CollisionShape* shape = objectNode->CreateComponent<CollisionShape>();
-		shape->SetTriangleMesh(object->GetModel(), 0);
+		checkpointWriter_.Wait();
+		WriteCheckpoint();
+		checkpointWriter_.Wait();
 	}
-	// Create camera for water reflection
-	// It will have the same farclip and position as the main viewport camera, but uses a reflection plane to modify
-	// its position when rendering
-	reflectionCameraNode_ = cameraNode_->CreateChild();
-	Camera* reflectionCamera = reflectionCameraNode_->CreateComponent<Camera>();
-	reflectionCamera->SetFarClip(50.0);
-	reflectionCamera->SetViewMask(0x7fffffff); // Hide objects with only bit 31 in the viewmask (the water plane)
-	reflectionCamera->SetAutoAspectRatio(true);
-	reflectionCamera->SetUseReflection(true);
-	reflectionCamera->SetReflectionPlane(waterPlane_);
-	reflectionCamera->SetUseClipping(true); // Enable clipping of geometry behind water plane
-	reflectionCamera->SetClipPlane(waterClipPlane_);
-
-	//// The water reflection texture is rectangular. Set reflection camera aspect ratio to match
-	//reflectionCamera->SetAspectRatio((float)graphics->GetWidth() / (float)graphics->GetHeight());
-
-	// View override flags could be used to optimize reflection rendering. For example disable shadows
-	//reflectionCamera->SetViewOverrideFlags(VO_DISABLE_SHADOWS);
-	// Create a texture and setup viewport for water reflection. Assign the reflection texture to the diffuse
-	// texture unit of the water material
-	int texSize = 1024;
-	SharedPtr<Texture2D> renderTexture(new Texture2D(context_));
-	renderTexture->SetSize(texSize, texSize, Graphics::GetRGBFormat(), TEXTURE_RENDERTARGET);
-	renderTexture->SetFilterMode(FILTER_BILINEAR);
-	RenderSurface* surface = renderTexture->GetRenderSurface();
-	SharedPtr<Viewport> rttViewport(new Viewport(context_, scene_, reflectionCamera));
-	surface->SetViewport(0, rttViewport);
-	Material* waterMat = cache->GetResource<Material>("Materials/Water.xml");
-	waterMat->SetTexture(TU_DIFFUSE, renderTexture);
-
+	Sample::Stop();
 }
 
-void CharacterDemo::CreateClientScene() 
+void CharacterDemo::CreateScene()
 {
-	//Same as the create scene for server, alterations for what the client handles
 	//so we can access resources
 	ResourceCache* cache = GetSubsystem<ResourceCache>();
 	scene_ = new Scene(context_);
@@ -288,132 +322,33 @@ void CharacterDemo::CreateClientScene()
 	cameraNode_->SetPosition(Vector3(0.0f, 20.0f, 0.0f));
 	camera->SetFarClip(600.0f);
 
-	GetSubsystem<Renderer>()->SetViewport(0, new Viewport(context_,
-		scene_, camera));
-
-	// Create static scene content. First create a zone for ambient
-	//lighting and fog control
-	Node* zoneNode = scene_->CreateChild("Zone", LOCAL);
-	Zone* zone = zoneNode->CreateComponent<Zone>(LOCAL);
-	zone->SetAmbientColor(Color(0.15f, 0.15f, 0.15f));
-	zone->SetFogColor(Color(0.2f, 0.5f, 0.7f));
-	zone->SetFogStart(40.0f);
-	zone->SetFogEnd(150.0f);
-	zone->SetBoundingBox(BoundingBox(-1000.0f, 1000.0f));
-
-	// Create a directional light with cascaded shadow mapping
-	Node* lightNode = scene_->CreateChild("DirectionalLight", LOCAL);
-	lightNode->SetDirection(Vector3(0.3f, -0.5f, 0.425f));
-	Light* light = lightNode->CreateComponent<Light>(LOCAL);
-	light->SetLightType(LIGHT_DIRECTIONAL);
-	light->SetCastShadows(true);
-
-	light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
-	light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f, 0.8f));
-	light->SetSpecularIntensity(1.0f);
-	light->SetBrightness(0.6f);
-
-	// Create skybox. The Skybox component is used like StaticModel, but it will be always located at the camera, giving the
-	// illusion of the box planes being far away. Use just the ordinary Box model and a suitable material, whose shader will
-	// generate the necessary 3D texture coordinates for cube mapping
-	Node* skyNode = scene_->CreateChild("Sky", LOCAL);
-	skyNode->SetScale(80.0f); // The scale actually does not matter
-	Skybox* skybox = skyNode->CreateComponent<Skybox>(LOCAL);
-	skybox->SetModel(cache->GetResource<Model>("Models/Box.mdl"));
-	skybox->SetMaterial(cache->GetResource<Material>("Materials/Skybox.xml"));
-
-	// Create heightmap terrain
-	Node* terrainNode = scene_->CreateChild("Terrain", LOCAL);
-	terrainNode->SetPosition(Vector3(20.0f, -10.0f, 0.0f));
-	Terrain* terrain = terrainNode->CreateComponent<Terrain>(LOCAL);
-	terrain->SetPatchSize(64);
-	terrain->SetSpacing(Vector3(0.6f, 0.3f, 0.6f)); // Spacing between vertices and vertical resolution of the height map
-	terrain->SetSmoothing(true);
-	terrain->SetHeightMap(cache->GetResource<Image>("Textures/HeightMap.png", LOCAL));
-	terrain->SetMaterial(cache->GetResource<Material>("Materials/Terrain.xml", LOCAL));
-	// The terrain consists of large triangles, which fits well for occlusion rendering, as a hill can occlude all
-	// terrain patches and other objects behind it
-	terrain->SetOccluder(true);
-
-	RigidBody* Terrainbody = terrainNode->CreateComponent<RigidBody>(LOCAL);
-	Terrainbody->SetCollisionLayer(2); // Use layer bitmask 2 for static geometry
-
-	CollisionShape* Terrainshape = terrainNode->CreateComponent<CollisionShape>(LOCAL);
-	Terrainshape->SetTerrain();
-
-
-	// Create a water plane object that is as large as the terrain
-	waterNode_ = scene_->CreateChild("Water", LOCAL);
-	waterNode_->SetScale(Vector3(2048.0f, 1.0f, 2048.0f));
-	waterNode_->SetPosition(Vector3(0.0f, 45.0f, 0.0f));
-
-	waterNode_->SetRotation(Quaternion(0.0f, 0.0f, 180.0f));
-
-	StaticModel* water = waterNode_->CreateComponent<StaticModel>(LOCAL);
-	water->SetModel(cache->GetResource<Model>("Models/Plane.mdl"));
-	water->SetMaterial(cache->GetResource<Material>("Materials/Water.xml"));
-	// Set a different viewmask on the water plane to be able to hide it from the reflection camera
-	water->SetViewMask(0x80000000);
+	// A dedicated server only builds what collides or is replicated: no viewport, zone, light, sky, water surface or
+	// reflection. Those are all local to each client anyway
+	if (!dedicated_)
+		GetSubsystem<Renderer>()->SetViewport(0, new Viewport(context_, scene_, camera));
 
+	// The static content comes from the cooked scene, read once and built again for every connect
+	if (!sceneData_.IsLoaded())
+	{
+		if (!sceneData_.Load(context_, sceneDescription_))
+			ErrorExit("Could not load scene " + sceneDescription_);
+		Log::WriteRaw(String(sceneData_.WasCooked() ? "Cooked scene " : "Read cooked scene ") + sceneDescription_ + " in " +
+			String(sceneData_.GetLoadUSec() / 1000.0f) + " ms\n");
+	}
+	HiresTimer buildTimer;
+	sceneData_.Build(scene_, !dedicated_);
+	Log::WriteRaw("Built scene of " + String(sceneData_.GetNumInstances()) + " plants in " +
+		String(buildTimer.GetUSec(false) / 1000.0f) + " ms, " + String(sceneData_.GetCollisionUSec() / 1000.0f) +
+		" ms of it building collision geometry\n");
+	waterNode_ = scene_->GetChild("Water");
 	// Create a mathematical plane to represent the water in calculations
 	waterPlane_ = Plane(waterNode_->GetWorldRotation() * Vector3(0.0f, 1.0f, 0.0f), waterNode_->GetWorldPosition());
 	//Create a downward biased plane for reflection view clipping. Biasing is necessary to avoid too aggressive //clipping
 	waterClipPlane_ = Plane(waterNode_->GetWorldRotation() * Vector3(0.0f, 1.0f, 0.0f),
 		waterNode_->GetWorldPosition() - Vector3(0.0f, 0.01f, 0.0f));
 
-	RigidBody* Waterbody = waterNode_->CreateComponent<RigidBody>(LOCAL);
-	Waterbody->SetCollisionLayer(2); // Use layer bitmask 2 for static geometry
-	CollisionShape* Watershape = waterNode_->CreateComponent<CollisionShape>(LOCAL);
-	Watershape->SetTerrain();
-
-
-	// Create Plants of varying sizes
-	const unsigned NUM_PLANTS = 40;
-	for (unsigned i = 0; i < NUM_PLANTS; ++i)
-	{
-		Node* objectNode = scene_->CreateChild("Plant",LOCAL);
-
-		Vector3 position(Random(100.0f) - 30.0f, 0.0f, Random(100.0f) - 30.0f);
-		position.y_ = terrain->GetHeight(position);
-		objectNode->SetPosition(position);
-
-		objectNode->SetRotation(Quaternion(0.0f, Random(360.0f), 0.0f));
-		objectNode->SetScale(0.05f + Random(0.05f));
-		StaticModel* object = objectNode->CreateComponent<StaticModel>(LOCAL);
-		object->SetModel(cache->GetResource<Model>("Models/plant_002a.mdl"));
-		object->SetMaterial(cache->GetResource<Material>("Materials/Foliage.xml"));
-		object->SetCastShadows(true);
-		RigidBody* body = objectNode->CreateComponent<RigidBody>(LOCAL);
-		body->SetCollisionLayer(2);
-		//body->SetMass(2.0f);
-		CollisionShape* shape = objectNode->CreateComponent<CollisionShape>(LOCAL);
-		shape->SetTriangleMesh(object->GetModel(), 0);
-	}
-
-	// Create Plants of varying sizes
-	const unsigned NUM_BAMBOO = 60;
-	for (unsigned i = 0; i < NUM_BAMBOO; ++i)
-	{
-		Node* objectNode = scene_->CreateChild("Bamboo", LOCAL);
-
-		Vector3 position(Random(150.0f) - 30.0f, 0.0f, Random(150.0f) - 30.0f);
-		position.y_ = terrain->GetHeight(position);
-		objectNode->SetPosition(position);
-
-		objectNode->SetRotation(Quaternion(0.0f, Random(360.0f), 0.0f));
-		objectNode->SetScale(0.02f + Random(0.03f));
-		StaticModel* object = objectNode->CreateComponent<StaticModel>(LOCAL);
-		object->SetModel(cache->GetResource<Model>("Models/Bamboo.mdl"));
-		object->SetMaterial(cache->GetResource<Material>("Materials/Foliage.xml"));
-		object->SetCastShadows(true);
-		RigidBody* body = objectNode->CreateComponent<RigidBody>(LOCAL);
-		body->SetCollisionLayer(2);
-		//body->SetMass(2.0f);
-		CollisionShape* shape = objectNode->CreateComponent<CollisionShape>(LOCAL);
-		shape->SetTriangleMesh(object->GetModel(), 0);
-	}
-
-
+	if (dedicated_)
+		return;
 
 	// Create camera for water reflection
 	// It will have the same farclip and position as the main viewport camera, but uses a reflection plane to modify
@@ -428,7 +363,6 @@ void CharacterDemo::CreateClientScene()
 	reflectionCamera->SetUseClipping(true); // Enable clipping of geometry behind water plane
 	reflectionCamera->SetClipPlane(waterClipPlane_);
 
-
 	//// The water reflection texture is rectangular. Set reflection camera aspect ratio to match
 	//reflectionCamera->SetAspectRatio((float)graphics->GetWidth() / (float)graphics->GetHeight());
 
@@ -445,6 +379,16 @@ void CharacterDemo::CreateClientScene()
 	surface->SetViewport(0, rttViewport);
 	Material* waterMat = cache->GetResource<Material>("Materials/Water.xml");
 	waterMat->SetTexture(TU_DIFFUSE, renderTexture);
+
+}
+
+Scene* CharacterDemo::CreateRoomScene()
+{
+	Scene* scene = new Scene(context_);
+	scene->CreateComponent<Octree>(LOCAL);
+	scene->CreateComponent<PhysicsWorld>(LOCAL);
+	sceneData_.Build(scene, false);
+	return scene;
 }
 
 void CharacterDemo::CreateMainMenu()
@@ -552,15 +496,35 @@ void CharacterDemo::CreateInstructions()
 	instructionText->SetPosition(0, ui->GetRoot()->GetHeight() / 4);
 }
 
+void CharacterDemo::CreateNetStatsOverlay()
+{
+	ResourceCache* cache = GetSubsystem<ResourceCache>();
+	UI* ui = GetSubsystem<UI>();
+
+	// Top right, clear of the debug HUD's stats in the top left, and toggled with F3 next to its F2
+	Text* netStatsText = ui->GetRoot()->CreateChild<Text>(NET_STATS);
+	netStatsText->SetFont(cache->GetResource<Font>("Fonts/Anonymous Pro.ttf"), 11);
+	netStatsText->SetHorizontalAlignment(HA_RIGHT);
+	netStatsText->SetVerticalAlignment(VA_TOP);
+	netStatsText->SetPosition(-10, 10);
+	netStatsText->SetPriority(100);
+	netStatsText->SetVisible(false);
+}
+
 void CharacterDemo::SubscribeToEvents()
 {
 	//TUTORIAL: TODO
-	// Subscribe to Update event for setting the character controls
-	SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(CharacterDemo, HandleUpdate));
+	// Subscribe to Update event for setting the character controls. A dedicated server has no camera or UI to drive
+	if (!dedicated_)
+		SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(CharacterDemo, HandleUpdate));
 
 	// Subscribe to Update event for setting the character controls
 	SubscribeToEvent(E_POSTUPDATE, URHO3D_HANDLER(CharacterDemo, HandlePostUpdate));
 
+	// Server: time the work of each frame, from reading the network to sending it
+	SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(CharacterDemo, HandleBeginFrame));
+	SubscribeToEvent(E_POSTRENDERUPDATE, URHO3D_HANDLER(CharacterDemo, HandlePostRenderUpdate));
+
 	// Setting or applying controls
 	SubscribeToEvent(E_PHYSICSPRESTEP, URHO3D_HANDLER(CharacterDemo, HandlePhysicsPreStep));
 
@@ -572,12 +536,21 @@ void CharacterDemo::SubscribeToEvents()
 	//Server: This is called when a client has connected to a Server
 	SubscribeToEvent(E_CLIENTSCENELOADED, URHO3D_HANDLER(CharacterDemo, HandleClientFinishedLoading));
 
+	// Server: boid snapshots go out with every network update. Client: they arrive as custom messages
+	SubscribeToEvent(E_NETWORKUPDATE, URHO3D_HANDLER(CharacterDemo, HandleNetworkUpdate));
+	SubscribeToEvent(E_NETWORKMESSAGE, URHO3D_HANDLER(CharacterDemo, HandleNetworkMessage));
+	// Client: shark transforms are intercepted and interpolated
+	SubscribeToEvent(E_INTERCEPTNETWORKUPDATE, URHO3D_HANDLER(CharacterDemo, HandleInterceptNetworkUpdate));
+
 
 	SubscribeToEvent(E_CLIENTISREADY, URHO3D_HANDLER(CharacterDemo, HandleClientToServerReadyToStart));
 	GetSubsystem<Network>()->RegisterRemoteEvent(E_CLIENTISREADY);
 	SubscribeToEvent(E_CLIENTOBJECTAUTHORITY, URHO3D_HANDLER(CharacterDemo, HandleServerToClientObjectID));
 	GetSubsystem<Network>()->RegisterRemoteEvent(E_CLIENTOBJECTAUTHORITY);
 
+	// Console: netsim changes the simulated network conditions
+	if (!dedicated_)
+		SubscribeToEvent(E_CONSOLECOMMAND, URHO3D_HANDLER(CharacterDemo, HandleConsoleCommand));
 }
 
 void CharacterDemo::HandleUpdate(StringHash eventType, VariantMap& eventData)
@@ -629,10 +602,31 @@ void CharacterDemo::HandleUpdate(StringHash eventType, VariantMap& eventData)
 		instruction ->SetVisible(!instruction->IsVisible());
 	}
 
+	if (input->GetKeyPress(KEY_F3))
+	{
+		UIElement* netStatsText = ui->GetRoot()->GetChild(NET_STATS);
+		netStatsText->SetVisible(!netStatsText->IsVisible());
+	}
+
 }
 
 void CharacterDemo::HandlePostUpdate(StringHash eventType, VariantMap& eventData)
 {
+	using namespace PostUpdate;
+	UpdateInterpolation(eventData[P_TIMESTEP].GetFloat());
+	if (replay_.IsOpen())
+		UpdateReplay(eventData[P_TIMESTEP].GetFloat());
+	// Server: every room has run its physics for the frame, run the flock steps they queued side by side
+	if (GetSubsystem<Network>()->IsServerRunning())
+	{
+		Room::StepRooms(GetSubsystem<WorkQueue>(), rooms_);
+		checkpointTime_ += eventData[P_TIMESTEP].GetFloat();
+		if (!checkpointFile_.Empty() && checkpointTime_ >= checkpointInterval_)
+		{
+			checkpointTime_ = 0.0f;
+			WriteCheckpoint();
+		}
+	}
     //update the camera 
 	MoveCamera();
 }
@@ -649,35 +643,40 @@ void CharacterDemo::HandlePhysicsPreStep(StringHash eventType, VariantMap & even
 	if (serverConnection)
 	{
 		serverConnection->SetPosition(cameraNode_->GetPosition()); // send camera position too
-		serverConnection->SetControls(FromClientToServerControls()); // send controls to serve
+		PredictShark(timeStep); // queue controls for the server, and move the own shark ahead with them
 		VariantMap remoteEventData;
 		remoteEventData["aValueRemoteValue"] = 0;
+		// step the local copy of the server's flock, if the server has it simulated here
+		flockSyncClient_.Update(boidSet, timeStep);
 	}
 	// Server: Read Controls, Apply them if needed
 	else if (network->IsServerRunning())
 	{
-		ProcessClientControls(); // take data from clients, process it
-		//update boids
-		boidSet.Update(timeStep);
-		//if a client object is active, run collision code to check for collisions with boids.
-		if (ballNode)
+		// Each room's physics world sends its own pre-step
+		PhysicsWorld* world = static_cast<PhysicsWorld*>(eventData[PhysicsPreStep::P_WORLD].GetPtr());
+		Room* room = 0;
+		for (unsigned i = 0; i < rooms_.Size() && !room; ++i)
 		{
-			Game_Running = true;
-			Vector3 Player_pos = ballNode->GetPosition();
-			boids.GetPlayerPos(Player_pos, Game_Running);
+			if (rooms_[i]->GetScene()->GetComponent<PhysicsWorld>() == world)
+				room = rooms_[i];
 		}
+		if (!room)
+			return;
+		ProcessClientControls(room); // take data from the room's clients, process it
+		//update boids, captured by the room's shark
+		room->Update(timeStep);
 	}
 	
 	
 }
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-Node* CharacterDemo::CreateControllableObject()
+Node* CharacterDemo::CreateControllableObject(Scene* scene)
 {
 
 	ResourceCache* cache = GetSubsystem<ResourceCache>();
 	// Create the scene node & visual representation. This will be a replicated object
-	ballNode = scene_->CreateChild("AClientBall");
-	ballNode->SetPosition(Vector3(0.0f, 5.0f, 0.0f));
+	Node* ballNode = scene->CreateChild("AClientBall");
+	ballNode->SetPosition(SHARK_SPAWN_POSITION);
 	ballNode->SetScale(2.0f);
 	StaticModel* ballObject = ballNode->CreateComponent<StaticModel>();
 	//set model 
@@ -687,18 +686,30 @@ Node* CharacterDemo::CreateControllableObject()
 
 	// Create the physics components	
 	RigidBody* body = ballNode->CreateComponent<RigidBody>();
-	body->SetMass(3.0f);
+	body->SetMass(SHARK_MASS);
 	body->SetUseGravity(false);
 	body->SetTrigger(false);
 	body->SetFriction(1.0f);
 	body->SetAngularFactor(Vector3::ZERO);
 	body->SetCollisionLayer(2);
-	body->SetLinearDamping(0.95f);
+	body->SetLinearDamping(SHARK_LINEAR_DAMPING);
 	body->SetAngularDamping(0.95f);
 
 	CollisionShape* shape = ballNode->CreateComponent<CollisionShape>();
 	//shape->SetModel(cache->GetResource<Model>("Models/3Shark.mdl"));
 	shape->SetCapsule(5.0f, 4.0f, Vector3(0.0, 1.0, 0.0));
+
+	// Other clients get this shark less often the further it is from their camera, and not at all past twice the
+	// interest radius. That is well past where they hide it as out of interest, so the last update they get before it
+	// stops is of a shark they have hidden, not one left frozen in view. Its owner always gets it at full rate
+	if (interestRadius_ > 0.0f)
+	{
+		NetworkPriority* priority = ballNode->CreateComponent<NetworkPriority>();
+		priority->SetBasePriority(100.0f);
+		priority->SetDistanceFactor(100.0f / (SHARK_UPDATE_RADIUS_FACTOR * interestRadius_));
+		priority->SetMinPriority(0.0f);
+		priority->SetAlwaysUpdateOwner(true);
+	}
 	//returns the node
 	return ballNode;
 }
@@ -737,59 +748,226 @@ Controls CharacterDemo::FromClientToServerControls()
 	return controls;
 }
 
-void CharacterDemo::ProcessClientControls()
+void CharacterDemo::ProcessClientControls(Room* room)
 {
-	Network* network = GetSubsystem<Network>();
-	UI* ui = GetSubsystem<UI>();
-	const Vector<SharedPtr<Connection> >& connections = network->GetClientConnections();
-	// Movement speed as world units per second, for realism/balancing, client has slower movement on movement in non-forward directions
-	float MOVE_SPEED = 50.0f;
-	const float MOVE_SPEED_SLOW = MOVE_SPEED/2;
-	//Server: go through every client connected
+	const Vector<SharedPtr<Connection> >& connections = room->GetConnections();
+	//Server: go through every client in the room
 	for (unsigned i = 0; i < connections.Size(); ++i)
 	{
 		Connection* connection = connections[i];
 		// Get the object this connection is controlling
-		Node* ballNode = serverObjects_[connection];
+		Node* ballNode = room->GetPlayer(connection);
 		// Client has no item connected
 		if (!ballNode) continue;
+		// Take the client's input for this step, in the order the client made them
+		HashMap<Connection*, InputReceiver>::Iterator receiver = inputReceivers_.Find(connection);
+		InputFrame input;
+		if (receiver == inputReceivers_.End() || !receiver->second_.Next(input))
+			continue;
+		room->RecordInput(connection, input);
 		RigidBody* body = ballNode->GetComponent<RigidBody>();
-		// Get the last controls sent by the client
-		const Controls& controls = connection->GetControls();
+		Controls controls = FromInput(input);
 		Quaternion rotation(controls.pitch_, controls.yaw_, 0.0f);
 		// yaw and pitch. Roll is fixed to zero
 		body->SetRotation(rotation);
-		//each movement updates the players location by the movespeed, mouse input moves the camera with the player, movement adjusts acordingly
-		//so the client camera is always facing the back end of the player model
-		if (controls.buttons_ & CTRL_FORWARD)
-		{
-			body->ApplyForce(rotation * Vector3::FORWARD * MOVE_SPEED);
-		}
+		body->ApplyForce(ControlForce(controls));
+	}
+}
 
-		if (controls.buttons_ & CTRL_BACK)
-		{
-			body->ApplyForce(rotation * Vector3::BACK * MOVE_SPEED);
-		}
+Vector3 CharacterDemo::ControlForce(const Controls& controls) const
+{
+	// Movement speed as world units per second, for realism/balancing, client has slower movement on movement in non-forward directions
+	const float MOVE_SPEED = 50.0f;
+	const float MOVE_SPEED_SLOW = MOVE_SPEED/2;
+	Quaternion rotation(controls.pitch_, controls.yaw_, 0.0f);
+	//each movement updates the players location by the movespeed, mouse input moves the camera with the player, movement adjusts acordingly
+	//so the client camera is always facing the back end of the player model
+	Vector3 force = Vector3::ZERO;
+	if (controls.buttons_ & CTRL_FORWARD)
+		force += rotation * Vector3::FORWARD * MOVE_SPEED;
+	if (controls.buttons_ & CTRL_BACK)
+		force += rotation * Vector3::BACK * MOVE_SPEED;
+	if (controls.buttons_ & CTRL_LEFT)
+		force += rotation * Vector3::LEFT * MOVE_SPEED_SLOW;
+	if (controls.buttons_ & CTRL_RIGHT)
+		force += rotation * Vector3::RIGHT * MOVE_SPEED_SLOW;
+	if (controls.buttons_ & CTRL_UP)
+		force += rotation * Vector3::UP * MOVE_SPEED;
+	return force;
+}
 
-		if (controls.buttons_ & CTRL_LEFT)
-		{
-			body->ApplyForce(rotation * Vector3::LEFT * MOVE_SPEED_SLOW);
-		}
-		if (controls.buttons_ & CTRL_RIGHT)
-		{
-			body->ApplyForce(rotation * Vector3::RIGHT * MOVE_SPEED_SLOW);
-		}
-		if (controls.buttons_ & CTRL_UP)
-		{
-			body->ApplyForce(rotation * Vector3::UP * MOVE_SPEED);
-		}
+void CharacterDemo::SendSharkStates()
+{
+	Network* network = GetSubsystem<Network>();
+	const Vector<SharedPtr<Connection> >& connections = network->GetClientConnections();
+	for (unsigned i = 0; i < connections.Size(); ++i)
+	{
+		Connection* connection = connections[i];
+		HashMap<Connection*, InputReceiver>::Iterator receiver = inputReceivers_.Find(connection);
+		Room* room = GetRoom(connection);
+		Node* ballNode = room ? room->GetPlayer(connection) : 0;
+		if (!ballNode || receiver == inputReceivers_.End() || !receiver->second_.IsStarted())
+			continue;
+		RigidBody* body = ballNode->GetComponent<RigidBody>();
+
+		// Only the newest state matters, a lost one is replaced by the next
+		VectorBuffer message;
+		message.WriteUInt(receiver->second_.GetApplied());
+		message.WriteVector3(ballNode->GetPosition());
+		message.WriteVector3(body->GetLinearVelocity());
+		connection->SendMessage(MSG_SHARKSTATE, false, false, message);
+		netStats_.CountSent(connection, MSG_SHARKSTATE, message.GetSize());
 	}
 }
+
+void CharacterDemo::SendServerStats()
+{
+	float time = GetSubsystem<Time>()->GetElapsedTime();
+	if (time - serverStatsTime_ < SERVER_STATS_INTERVAL)
+		return;
+	serverStatsTime_ = time;
+
+	const Vector<SharedPtr<Connection> >& connections = GetSubsystem<Network>()->GetClientConnections();
+	serverStats_ = frameTimer_.Take(connections.Size());
+	VectorBuffer message;
+	serverStats_.Write(message);
+	for (unsigned i = 0; i < connections.Size(); ++i)
+	{
+		connections[i]->SendMessage(MSG_SERVERSTATS, false, false, message);
+		netStats_.CountSent(connections[i], MSG_SERVERSTATS, message.GetSize());
+	}
+}
+
+void CharacterDemo::UpdateNetStats()
+{
+	Network* network = GetSubsystem<Network>();
+	Vector<Connection*> connections;
+	if (network->GetServerConnection())
+		connections.Push(network->GetServerConnection());
+	else
+	{
+		const Vector<SharedPtr<Connection> >& clients = network->GetClientConnections();
+		for (unsigned i = 0; i < clients.Size(); ++i)
+			connections.Push(clients[i]);
+	}
+	if (!netStats_.Update(connections, GetSubsystem<Time>()->GetElapsedTime()) || dedicated_)
+		return;
+
+	Text* netStatsText = static_cast<Text*>(GetSubsystem<UI>()->GetRoot()->GetChild(NET_STATS));
+	if (!netStatsText)
+		return;
+	String text = netStats_.ToText();
+	for (unsigned i = 0; i < rooms_.Size(); ++i)
+	{
+		text += "Room " + String(rooms_[i]->GetID()) + ": " + String(rooms_[i]->GetNumConnections()) + " clients, " +
+			String(rooms_[i]->GetNumCaptured()) + " boids captured\n";
+	}
+	netStatsText->SetText(text);
+}
+
+void CharacterDemo::HandleConsoleCommand(StringHash eventType, VariantMap& eventData)
+{
+	using namespace ConsoleCommand;
+
+	// Every subscriber is offered to the console as an interpreter, only take what was typed to this one
+	if (eventData[P_ID].GetString() != GetTypeName())
+		return;
+	Vector<String> words = eventData[P_COMMAND].GetString().Split(' ');
+	if (words.Empty() || words[0].ToLower() != "netsim")
+	{
+		Log::WriteRaw("Commands: netsim [off] [latency MS] [jitter MS] [loss P] [duplicate P]\n");
+		return;
+	}
+
+	bool valid = true;
+	if (words.Size() == 2 && words[1].ToLower() == "off")
+		netConditions_ = NetConditions();
+	else
+	{
+		for (unsigned i = 1; i + 1 < words.Size(); i += 2)
+			valid &= netConditions_.Set(words[i], words[i + 1]);
+		valid &= words.Size() % 2 == 1;
+	}
+	if (!valid)
+		Log::WriteRaw("Usage: netsim [off] [latency MS] [jitter MS] [loss P] [duplicate P]\n");
+	netConditions_.Apply(GetSubsystem<Network>());
+	Log::WriteRaw("Simulating network conditions: " + netConditions_.ToString() + "\n");
+}
+
+void CharacterDemo::HandleBeginFrame(StringHash eventType, VariantMap& eventData)
+{
+	if (GetSubsystem<Network>()->IsServerRunning())
+		frameTimer_.Begin();
+}
+
+void CharacterDemo::HandlePostRenderUpdate(StringHash eventType, VariantMap& eventData)
+{
+	frameTimer_.End();
+}
+
+void CharacterDemo::PredictShark(float timeStep)
+{
+	// The prediction uses the controls as the server gets them, quantized
+	InputFrame input = ToInput(FromClientToServerControls(), ++inputSequence_);
+	inputSender_.Push(input);
+	Controls controls = FromInput(input);
+
+	Node* ownNode = clientObjectID_ ? scene_->GetNode(clientObjectID_) : 0;
+	if (!ownNode)
+		return;
+
+	// The own shark is shown where it is predicted to be, not where the server last had it
+	if (!sharkPredictor_.IsActive())
+	{
+		sharkInterpolator_.Unwatch(ownNode);
+		ownNode->SetInterceptNetworkUpdate("Network Position", true);
+		ownNode->SetInterceptNetworkUpdate("Network Rotation", true);
+		SharkState state;
+		state.position_ = ownNode->GetPosition();
+		state.rotation_ = ownNode->GetRotation();
+		sharkPredictor_.Reset(state);
+	}
+	sharkPredictor_.Predict(inputSequence_, ControlForce(controls), Quaternion(controls.pitch_, controls.yaw_, 0.0f), timeStep);
+}
+
+InputFrame CharacterDemo::ToInput(const Controls& controls, unsigned sequence) const
+{
+	// Only these buttons move the shark, one InputButton bit each in this order
+	const int buttons[] = { CTRL_FORWARD, CTRL_BACK, CTRL_LEFT, CTRL_RIGHT, CTRL_UP, CTRL_DOWN };
+	InputFrame input;
+	input.sequence_ = sequence;
+	for (unsigned i = 0; i < 6; ++i)
+	{
+		if ((int)(controls.buttons_ & buttons[i]) == buttons[i])
+			input.buttons_ |= 1 << i;
+	}
+	input.yaw_ = InputFrame::QuantizeAngle(controls.yaw_);
+	input.pitch_ = InputFrame::QuantizeAngle(controls.pitch_);
+	return input;
+}
+
+Controls CharacterDemo::FromInput(const InputFrame& input) const
+{
+	const int buttons[] = { CTRL_FORWARD, CTRL_BACK, CTRL_LEFT, CTRL_RIGHT, CTRL_UP, CTRL_DOWN };
+	Controls controls;
+	for (unsigned i = 0; i < 6; ++i)
+	{
+		if (input.buttons_ & (1 << i))
+			controls.buttons_ |= buttons[i];
+	}
+	controls.yaw_ = InputFrame::DequantizeAngle(input.yaw_);
+	controls.pitch_ = InputFrame::DequantizeAngle(input.pitch_);
+	return controls;
+}
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void CharacterDemo::HandleConnect(StringHash eventType, VariantMap& eventData)
 {
 	//Clears scene, prepares it for receiving
-	CreateClientScene();
+	joinTimer_.Reset();
+	CreateScene();
+	joinSceneUSec_ = joinTimer_.GetUSec(false);
+	joinFirstUSec_ = 0;
+	joinReported_ = false;
 
 	Network* network = GetSubsystem<Network>();
 	String address = serverAddressLineEdit_->GetText().Trimmed();
@@ -799,7 +977,9 @@ void CharacterDemo::HandleConnect(StringHash eventType, VariantMap& eventData)
 	} // Default to localhost if nothing else specified
 
 	  // Connect to server, specify scene to use as a client for replication
-	network->Connect(address, SERVER_PORT, scene_);
+	network->Connect(address, serverPort_, scene_);
+	if (network->GetServerConnection())
+		netConditions_.Apply(network->GetServerConnection());
 }
 
 void CharacterDemo::HandleDisconnect(StringHash eventType, VariantMap& eventData)
@@ -812,28 +992,275 @@ void CharacterDemo::HandleDisconnect(StringHash eventType, VariantMap& eventData
 	{
 		serverConnection->Disconnect();
 		scene_->Clear(true, false);
+		remoteFlock_.Clear();
+		flockSyncClient_.Clear(boidSet);
+		sharkInterpolator_.Clear();
+		remoteSharks_.Clear();
+		if (sharkPredictor_.IsActive())
+		{
+			Log::WriteRaw("Shark prediction: " + String(sharkPredictor_.GetNumCorrections()) + " corrections in " +
+				String(sharkPredictor_.GetNumReconciled()) + " server states, " + String(sharkPredictor_.GetNumReplayed()) +
+				" inputs replayed, error mean " + String(sharkPredictor_.GetMeanError()) + " max " +
+				String(sharkPredictor_.GetMaxError()) + "\n");
+		}
+		sharkPredictor_ = SharkPredictor();
+		inputSender_.Clear();
+		numSceneChildren_ = 0;
 		clientObjectID_ = 0;
 	}
 	// Running as a server, stop it
 	else if (network->IsServerRunning())
 	{
+		// A stopped server is restarted from where it stopped
+		if (!checkpointFile_.Empty())
+		{
+			checkpointWriter_.Wait();
+			WriteCheckpoint();
+			checkpointWriter_.Wait();
+		}
 		network->StopServer();
+		for (unsigned i = 0; i < rooms_.Size(); ++i)
+			rooms_[i]->GetBoidSet().Clear();
+		rooms_.Clear();
+		connectionRooms_.Clear();
 		scene_->Clear(true, false);
 	}
 }
 
 void CharacterDemo::HandleStartServer(StringHash eventType, VariantMap&eventData)
+{
+	StartServer();
+	// code to make your main menu disappear. Boolean value
+	menuVisible = !menuVisible;
+}
+
+void CharacterDemo::StartServer()
 {
 	ResourceCache* cache = GetSubsystem<ResourceCache>();
 
-	Log::WriteRaw("(HandleStartServer called) Server is started!");
+	Log::WriteRaw("(StartServer called) Server is started on port " + String(serverPort_) + "!\n");
 	Network* network = GetSubsystem<Network>();
-	network->StartServer(SERVER_PORT);
-	// code to make your main menu disappear. Boolean value
-	menuVisible = !menuVisible;
-	//initialise boids upon starting the server
-	boidSet.Initialise(cache, scene_);
+	network->StartServer(serverPort_);
+	checkpointTime_ = 0.0f;
+
+	// A warm start takes its rooms from the checkpoint, and starts new matches only if it cannot be read
+	Checkpoint checkpoint;
+	if (!restoreFile_.Empty())
+	{
+		HiresTimer timer;
+		if (CheckpointWriter::Read(context_, restoreFile_, checkpoint) && !checkpoint.rooms_.Empty())
+		{
+			numRooms_ = checkpoint.rooms_.Size();
+			Log::WriteRaw("Read checkpoint " + restoreFile_ + " in " + String(timer.GetUSec(false) / 1000.0f) + " ms\n");
+		}
+		else
+			Log::WriteRaw("Could not read checkpoint " + restoreFile_ + ", starting new matches\n");
+	}
+	HiresTimer restoreTimer;
+
+	//initialise the rooms upon starting the server, the first plays in the main scene. Each room's flock gets its own
+	//seed, which its replays and checkpoints keep
+	for (unsigned i = 0; i < numRooms_; ++i)
+	{
+		SharedPtr<Room> room(new Room(i, i == 0 ? scene_.Get() : CreateRoomScene()));
+		room->SetClientFlocks(clientFlocks_);
+		room->GetReplicator().SetInterestRadius(interestRadius_);
+		room->GetReplicator().SetStats(&netStats_);
+		room->GetReplicator().SetJoinChunkBoids(joinChunkBoids_);
+		room->GetReplicator().SetJoinChunksPerUpdate(joinChunksPerUpdate_);
+		room->GetFlockSync().SetCorrectionsPerUpdate(flockCorrections_);
+		room->GetFlockSync().SetCorrectionPeriod(flockCorrectionPeriod_);
+		room->GetFlockSync().SetStats(&netStats_);
+		room->SetDeferSteps(numRooms_ > 1);
+		room->SetMaxRewind(maxRewind_);
+		if (checkpoint.rooms_.Empty())
+			room->Initialise(cache, boidSet, flockSeed_ + i);
+		else
+		{
+			const CheckpointRoom& source = checkpoint.rooms_[i];
+			room->Restore(cache, boidSet, source);
+			// Sharks wait in place for their clients to come back
+			for (unsigned j = 0; j < source.sharks_.Size(); ++j)
+			{
+				const CheckpointShark& shark = source.sharks_[j];
+				Node* node = CreateControllableObject(room->GetScene());
+				node->SetTransform(shark.position_, shark.rotation_);
+				RigidBody* body = node->GetComponent<RigidBody>();
+				body->SetLinearVelocity(shark.linearVelocity_);
+				body->SetAngularVelocity(shark.angularVelocity_);
+				room->AddRestoredPlayer(shark.owner_, node);
+			}
+		}
+		if (!recordFile_.Empty())
+		{
+			String fileName = GetRecordFileName(i);
+			if (room->StartRecording(fileName))
+				Log::WriteRaw("Recording room " + String(i) + " to " + fileName + "\n");
+			else
+				Log::WriteRaw("Could not open replay file " + fileName + "\n");
+		}
+		rooms_.Push(room);
+	}
+	if (!checkpoint.rooms_.Empty())
+		Log::WriteRaw("Restored " + String(rooms_.Size()) + " rooms in " + String(restoreTimer.GetUSec(false) / 1000.0f) + " ms\n");
+	Log::WriteRaw(String(rooms_.Size()) + " rooms of up to " + String(roomSize_) + " clients\n");
+	if (rooms_.Size() > 1 && !rooms_[0]->GetBoidSet().IsKinematic())
+		Log::WriteRaw("Rigid body flocks step one room after another on the main thread, -kinematic steps rooms in parallel\n");
+}
+
+void CharacterDemo::WriteCheckpoint()
+{
+	// Only the copy happens here, serializing and writing the file are left to a worker
+	if (checkpointWriter_.IsWriting())
+		return;
+	Checkpoint checkpoint;
+	checkpoint.rooms_.Resize(rooms_.Size());
+	for (unsigned i = 0; i < rooms_.Size(); ++i)
+		rooms_[i]->SaveCheckpoint(checkpoint.rooms_[i]);
+	checkpointWriter_.Write(context_, checkpointFile_, checkpoint);
+}
+
+Room* CharacterDemo::AssignRoom(Connection* connection)
+{
+	// A client coming back to a restored match goes where its shark is waiting. Otherwise fill the rooms in order,
+	// and once all are full, share the extra clients out over the emptiest
+	Room* room = 0;
+	for (unsigned i = 0; i < rooms_.Size() && !room; ++i)
+	{
+		if (rooms_[i]->HasRestoredPlayer(connection->GetAddress()))
+			room = rooms_[i];
+	}
+	for (unsigned i = 0; i < rooms_.Size() && !room; ++i)
+	{
+		if (rooms_[i]->GetNumConnections() < roomSize_)
+			room = rooms_[i];
+	}
+	if (!room)
+	{
+		if (rooms_.Empty())
+			return 0;
+		room = rooms_[0];
+		for (unsigned i = 1; i < rooms_.Size(); ++i)
+		{
+			if (rooms_[i]->GetNumConnections() < room->GetNumConnections())
+				room = rooms_[i];
+		}
+	}
+	room->AddConnection(connection);
+	connectionRooms_[connection] = room;
+	return room;
+}
+
+Room* CharacterDemo::GetRoom(Connection* connection) const
+{
+	HashMap<Connection*, SharedPtr<Room> >::ConstIterator room = connectionRooms_.Find(connection);
+	return room != connectionRooms_.End() ? room->second_.Get() : 0;
+}
+
+String CharacterDemo::GetRecordFileName(unsigned room) const
+{
+	if (numRooms_ == 1)
+		return recordFile_;
+	return GetPath(recordFile_) + GetFileName(recordFile_) + "_" + String(room) + GetExtension(recordFile_, false);
+}
+
+bool CharacterDemo::StartReplay(const String& fileName)
+{
+	if (!replay_.Open(fileName) || !replay_.GetNumFlocks())
+		return false;
+	// The recorded states are shown as they are, so the boids only need nodes to move
+	boidSet.SetFlockLayout(replay_.GetNumFlocks(), replay_.GetNumBoids() / replay_.GetNumFlocks());
+	boidSet.SetKinematic(true);
+	boidSet.SetReplicated(false);
+	boidSet.Initialise(GetSubsystem<ResourceCache>(), scene_);
+	replayFrame_ = 0;
+	replayTime_ = 0.0f;
+	replayPaused_ = false;
+	Log::WriteRaw("Replaying " + String(replay_.GetNumFrames()) + " ticks from " + fileName +
+		(replay_.IsIndexed() ? "" : ", its index rebuilt as it was not closed") + "\n");
+	return true;
+}
+
+void CharacterDemo::UpdateReplay(float timeStep)
+{
+	const float REPLAY_SKIP_SECONDS = 5.0f;
+	float tickTime = 1.0f / scene_->GetComponent<PhysicsWorld>()->GetFps();
+	unsigned numFrames = replay_.GetNumFrames();
+	if (!numFrames)
+		return;
+
+	Input* input = GetSubsystem<Input>();
+	if (!GetSubsystem<UI>()->GetFocusElement())
+	{
+		if (input->GetKeyPress(KEY_P))
+			replayPaused_ = !replayPaused_;
+		// Skipping is one lookup in the chunk index however far it goes
+		unsigned skip = (unsigned)(REPLAY_SKIP_SECONDS / tickTime);
+		if (input->GetKeyPress(KEY_RIGHT))
+			replayFrame_ = Min(replayFrame_ + skip, numFrames - 1);
+		if (input->GetKeyPress(KEY_LEFT))
+			replayFrame_ = replayFrame_ > skip ? replayFrame_ - skip : 0;
+	}
+
+	ReplayFrame frame;
+	if (!replay_.GetFrame(replayFrame_, frame))
+		return;
+	if (!replayPaused_)
+	{
+		// Step through as many recorded ticks as the frame took
+		replayTime_ += timeStep;
+		while (replayFrame_ + 1 < numFrames)
+		{
+			float frameTime = frame.timeStep_ > 0.0f ? frame.timeStep_ : tickTime;
+			if (replayTime_ < frameTime || !replay_.GetFrame(replayFrame_ + 1, frame))
+				break;
+			replayTime_ -= frameTime;
+			++replayFrame_;
+		}
+	}
+
+	unsigned numBoids = Min(frame.numBoids_, boidSet.store.GetNumBoids());
+	for (unsigned i = 0; i < numBoids; ++i)
+		boidSet.SetState(i, frame.GetPosition(i), frame.GetVelocity(i));
 
+	ResourceCache* cache = GetSubsystem<ResourceCache>();
+	HashMap<unsigned, SharedPtr<Node> > sharks;
+	for (unsigned i = 0; i < frame.numSharks_; ++i)
+	{
+		const ReplayShark& shark = frame.sharks_[i];
+		SharedPtr<Node> node;
+		HashMap<unsigned, SharedPtr<Node> >::Iterator existing = replaySharks_.Find(shark.id_);
+		if (existing != replaySharks_.End())
+			node = existing->second_;
+		else
+		{
+			node = scene_->CreateChild("ReplayShark", LOCAL);
+			node->SetScale(2.0f);
+			StaticModel* model = node->CreateComponent<StaticModel>(LOCAL);
+			model->SetModel(cache->GetResource<Model>("Models/3Shark.mdl"));
+			model->SetMaterial(cache->GetResource<Material>("Materials/Player.xml"));
+		}
+		node->SetPosition(shark.position_);
+		sharks[shark.id_] = node;
+	}
+	// Sharks face where their input steered them, and keep facing there between inputs
+	for (unsigned i = 0; i < frame.numInputs_; ++i)
+	{
+		const ReplayInput& replayInput = frame.inputs_[i];
+		HashMap<unsigned, SharedPtr<Node> >::Iterator shark = sharks.Find(replayInput.player_);
+		if (shark != sharks.End())
+		{
+			shark->second_->SetRotation(Quaternion(InputFrame::DequantizeAngle(replayInput.pitch_),
+				InputFrame::DequantizeAngle(replayInput.yaw_), 0.0f));
+		}
+	}
+	// Sharks that are not in this tick have left the match, or not joined it yet
+	for (HashMap<unsigned, SharedPtr<Node> >::Iterator i = replaySharks_.Begin(); i != replaySharks_.End(); ++i)
+	{
+		if (!sharks.Contains(i->first_))
+			i->second_->Remove();
+	}
+	replaySharks_ = sharks;
 }
 
 void CharacterDemo::HandleClientConnected(StringHash eventType, VariantMap& eventData)
@@ -843,7 +1270,10 @@ void CharacterDemo::HandleClientConnected(StringHash eventType, VariantMap& even
 
 	// When a client connects, assign to a scene
 	Connection* newConnection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
-	newConnection->SetScene(scene_);
+	Room* room = AssignRoom(newConnection);
+	if (room)
+		Log::WriteRaw(" Assigned to room " + String(room->GetID()) + "\n");
+	netConditions_.Apply(newConnection);
 
 	//send an event to the client that has just connected
 	VariantMap remoteEventData;
@@ -852,13 +1282,29 @@ void CharacterDemo::HandleClientConnected(StringHash eventType, VariantMap& even
 
 void CharacterDemo::HandleClientDisconnected(StringHash eventType, VariantMap& eventData)
 {
-	using namespace ClientConnected;
+	using namespace ClientDisconnected;
+
+	Connection* connection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
+	Room* room = GetRoom(connection);
+	if (room)
+		room->RemoveConnection(connection);
+	connectionRooms_.Erase(connection);
+	netStats_.RemoveConnection(connection);
+	HashMap<Connection*, InputReceiver>::Iterator receiver = inputReceivers_.Find(connection);
+	if (receiver != inputReceivers_.End())
+	{
+		const InputReceiver& inputs = receiver->second_;
+		Log::WriteRaw("Client inputs: " + String(inputs.GetNumReceived()) + " received, " + String(inputs.GetNumSkipped()) +
+			" skipped, " + String(inputs.GetNumRepeated()) + " steps repeated\n");
+		inputReceivers_.Erase(receiver);
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 void CharacterDemo::HandleServerToClientObjectID(StringHash eventType, VariantMap & eventData)
 {
 	clientObjectID_ = eventData[PLAYER_ID].GetUInt();
+	netStats_.CountRemoteEvent(static_cast<Connection*>(eventData[RemoteEventData::P_CONNECTION].GetPtr()), false);
 	printf("Client ID : %i \n", clientObjectID_);
 }
 
@@ -867,13 +1313,24 @@ void CharacterDemo::HandleClientToServerReadyToStart(StringHash eventType, Varia
 	printf("Event sent by the Client and running on Server: Client is ready to start the game \n");
 	using namespace ClientConnected;
 	Connection* newConnection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
-	// Create a controllable object for that client
-	Node* newObject = CreateControllableObject();
-	serverObjects_[newConnection] = newObject;
+	netStats_.CountRemoteEvent(newConnection, false);
+	Room* room = GetRoom(newConnection);
+	if (!room)
+		return;
+	// Give the client back its shark from before a restart, or create a controllable object for it in its room
+	Node* newObject = room->ClaimRestoredPlayer(newConnection);
+	if (!newObject)
+		newObject = CreateControllableObject(room->GetScene());
+	newObject->SetOwner(newConnection);
+	// Clients report how far behind they show the boids, older ones are taken to use the default
+	float viewDelay = eventData.Contains(VIEW_DELAY) ? Clamp(eventData[VIEW_DELAY].GetFloat(), 0.0f, 1.0f) :
+		DEFAULT_INTERPOLATION_DELAY;
+	room->SetPlayer(newConnection, newObject, viewDelay);
 	// Finally send the object's node ID using a remote event
 	VariantMap remoteEventData;
 	remoteEventData[PLAYER_ID] = newObject->GetID();
 	newConnection->SendRemoteEvent(E_CLIENTOBJECTAUTHORITY, true, remoteEventData);
+	netStats_.CountRemoteEvent(newConnection, true);
 
 }
 
@@ -889,7 +1346,10 @@ void CharacterDemo::HandleClientStartGame(StringHash eventType, VariantMap & eve
 		{
 			VariantMap remoteEventData;
 			remoteEventData[PLAYER_ID] = 0;
+			// A client simulating the flock shows it as it steps, one interpolating it shows it that far in the past
+			remoteEventData[VIEW_DELAY] = flockSyncClient_.IsActive() ? 0.0f : remoteFlock_.GetClock().GetDelay();
 			serverConnection->SendRemoteEvent(E_CLIENTISREADY, true, remoteEventData);
+			netStats_.CountRemoteEvent(serverConnection, true);
 		}
 	}
 }
@@ -899,6 +1359,147 @@ void CharacterDemo::HandleClientFinishedLoading(StringHash eventType, VariantMap
 	Log::WriteRaw("Client has finished loading up the scene from the server \n");
 }
 
+void CharacterDemo::HandleNetworkUpdate(StringHash eventType, VariantMap & eventData)
+{
+	Network* network = GetSubsystem<Network>();
+	// Client: every update carries the newest inputs, so a lost one is made up by the next
+	Connection* serverConnection = network->GetServerConnection();
+	if (serverConnection)
+	{
+		VectorBuffer message;
+		if (inputSender_.Write(message))
+		{
+			serverConnection->SendMessage(MSG_INPUT, false, false, message);
+			netStats_.CountSent(serverConnection, MSG_INPUT, message.GetSize());
+		}
+		UpdateNetStats();
+		return;
+	}
+	if (!network->IsServerRunning())
+		return;
+	PODVector<Scene*> scenes(rooms_.Size());
+	for (unsigned i = 0; i < rooms_.Size(); ++i)
+		scenes[i] = rooms_[i]->GetScene();
+	netStats_.CountSceneUpdates(scenes);
+	UpdateNetStats();
+	SendSharkStates();
+	SendServerStats();
+	for (unsigned i = 0; i < rooms_.Size(); ++i)
+		rooms_[i]->SendFlock();
+}
+
+void CharacterDemo::HandleNetworkMessage(StringHash eventType, VariantMap & eventData)
+{
+	using namespace NetworkMessage;
+
+	Network* network = GetSubsystem<Network>();
+	Connection* connection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
+	int messageID = eventData[P_MESSAGEID].GetInt();
+	MemoryBuffer message(eventData[P_DATA].GetBuffer());
+	netStats_.CountReceived(connection, messageID, message.GetSize());
+	// Only the server sends boid snapshots, flock corrections and shark states, and only clients send inputs and acknowledge
+	// snapshots
+	bool fromServer = connection == network->GetServerConnection();
+	if (messageID == MSG_BOIDSNAPSHOT && fromServer)
+	{
+		remoteFlock_.HandleMessage(scene_, connection, message, GetSubsystem<Time>()->GetElapsedTime());
+		UpdateJoinTiming();
+	}
+	else if (messageID == MSG_JOINKEYFRAME && fromServer)
+	{
+		remoteFlock_.HandleJoinMessage(scene_, connection, message, GetSubsystem<Time>()->GetElapsedTime());
+		UpdateJoinTiming();
+	}
+	else if (messageID == MSG_FLOCKSETUP && fromServer)
+	{
+		flockSyncClient_.HandleSetup(GetSubsystem<ResourceCache>(), scene_, boidSet, message);
+		UpdateJoinTiming();
+	}
+	else if (messageID == MSG_FLOCKCORRECTION && fromServer)
+		flockSyncClient_.HandleCorrection(boidSet, message);
+	else if (messageID == MSG_SHARKSTATE && fromServer)
+	{
+		unsigned sequence = message.ReadUInt();
+		Vector3 position = message.ReadVector3();
+		Vector3 velocity = message.ReadVector3();
+		sharkPredictor_.Reconcile(sequence, position, velocity);
+	}
+	else if (messageID == MSG_INPUT && network->IsServerRunning())
+		inputReceivers_[connection].HandleMessage(message);
+	else if (messageID == MSG_BOIDSNAPSHOTACK && network->IsServerRunning())
+	{
+		Room* room = GetRoom(connection);
+		if (room)
+			room->GetReplicator().HandleAck(connection, message);
+	}
+}
+
+void CharacterDemo::UpdateJoinTiming()
+{
+	if (joinReported_)
+		return;
+	long long elapsed = joinTimer_.GetUSec(false);
+	if (!joinFirstUSec_ && (remoteFlock_.GetNumBoids() || flockSyncClient_.IsActive()))
+		joinFirstUSec_ = elapsed;
+	// Playable once every boid is where the server has it, or hidden as out of interest
+	if (!remoteFlock_.HasCompleteTick() && !flockSyncClient_.IsActive())
+		return;
+
+	joinReported_ = true;
+	String report = "Joined in " + String(elapsed / 1000.0f) + " ms: scene built in " + String(joinSceneUSec_ / 1000.0f) +
+		" ms, first boids shown after " + String(joinFirstUSec_ / 1000.0f) + " ms";
+	if (remoteFlock_.IsJoined())
+	{
+		report += ", join keyframe of " + String(remoteFlock_.GetJoinBoids()) + " boids in " +
+			String(remoteFlock_.GetJoinBytes()) + " bytes";
+	}
+	Log::WriteRaw(report + "\n");
+}
+
+void CharacterDemo::HandleInterceptNetworkUpdate(StringHash eventType, VariantMap & eventData)
+{
+	using namespace InterceptNetworkUpdate;
+
+	Node* node = dynamic_cast<Node*>(static_cast<Serializable*>(eventData[P_SERIALIZABLE].GetPtr()));
+	if (node)
+		sharkInterpolator_.HandleNetworkUpdate(node, eventData[P_TIMESTAMP].GetUInt(), eventData[P_NAME].GetString(),
+			eventData[P_VALUE], GetSubsystem<Time>()->GetElapsedTime());
+}
+
+void CharacterDemo::UpdateInterpolation(float timeStep)
+{
+	if (!GetSubsystem<Network>()->GetServerConnection())
+		return;
+
+	// Sharks arrive as new scene children with their name already set, so only look again when the count changes
+	if (scene_->GetNumChildren() != numSceneChildren_)
+	{
+		numSceneChildren_ = scene_->GetNumChildren();
+		const Vector<SharedPtr<Node> >& children = scene_->GetChildren();
+		for (unsigned i = 0; i < children.Size(); ++i)
+		{
+			if (children[i]->IsReplicated() && children[i]->GetName() == "AClientBall" && children[i]->GetID() != clientObjectID_)
+			{
+				sharkInterpolator_.Watch(children[i]);
+				if (!remoteSharks_.Contains(WeakPtr<Node>(children[i])))
+					remoteSharks_.Push(WeakPtr<Node>(children[i]));
+			}
+		}
+	}
+
+	float time = GetSubsystem<Time>()->GetElapsedTime();
+	remoteFlock_.Update(time);
+	sharkInterpolator_.Update(time);
+	UpdateSharkInterest();
+
+	Node* ownNode = clientObjectID_ ? scene_->GetNode(clientObjectID_) : 0;
+	if (ownNode && sharkPredictor_.IsActive())
+	{
+		sharkPredictor_.Update(timeStep);
+		ownNode->SetTransform(sharkPredictor_.GetShownPosition(), sharkPredictor_.GetState().rotation_);
+	}
+}
+
 void CharacterDemo::MoveCamera()
 {
 	ResourceCache* cache = GetSubsystem<ResourceCache>();
@@ -3,6 +3,17 @@
 
 #include "Sample.h"
 #include "Boids.h"
+#include "BoidReplication.h"
+#include "Checkpoint.h"
+#include "CookedScene.h"
+#include "FlockSync.h"
+#include "InputChannel.h"
+#include "NetConditions.h"
+#include "NetStats.h"
+#include "Replay.h"
+#include "Room.h"
+#include "ServerStats.h"
+#include "SharkPrediction.h"
 
 namespace Urho3D
 {
@@ -34,13 +45,15 @@ public:
 	/// Destruct.
 	~CharacterDemo();
 
-	/// Which port this is running on
-	static const unsigned short SERVER_PORT = 2345;
 	///initialise Window
 	SharedPtr<Window> window_;
 
+	/// Setup before engine initialization. Starts the engine headless for a dedicated server.
+	virtual void Setup();
 	/// Setup after engine initialization and before running the main loop.
 	virtual void Start();
+	/// Cleanup after the main loop. Writes a last checkpoint, so a restarted server carries on where this one stopped.
+	virtual void Stop();
 
 	const int CTRL_FORWARD = 1;
 	const int CTRL_BACK = 2;
@@ -110,14 +123,67 @@ private:
 
 	Controls FromClientToServerControls();
 
-	void ProcessClientControls();
+	/// Server: apply each step's inputs of a room's clients to their sharks.
+	void ProcessClientControls(Room* room);
+	/// Force a shark's controls push it with, shared by the server and the client's prediction.
+	Vector3 ControlForce(const Controls& controls) const;
+	/// Server: send each client its shark's state and the newest input applied to it.
+	void SendSharkStates();
+	/// Server: send every client the frame times, once a second.
+	void SendServerStats();
+	/// Server: start timing a frame.
+	void HandleBeginFrame(StringHash eventType, VariantMap& eventData);
+	/// Server: stop timing a frame, its network update has gone out.
+	void HandlePostRenderUpdate(StringHash eventType, VariantMap& eventData);
+	/// Sample the network stats when due, and show them on the overlay.
+	void UpdateNetStats();
+	/// Client: note how far the join has got, and report the join once the flock is shown in full.
+	void UpdateJoinTiming();
+	/// Create the network stats overlay, hidden until toggled.
+	void CreateNetStatsOverlay();
+	/// Handle the netsim console command, which shows or changes the simulated network conditions.
+	void HandleConsoleCommand(StringHash eventType, VariantMap& eventData);
+	/// Client: number the controls, queue them for the server and predict the own shark with them.
+	void PredictShark(float timeStep);
+	/// Pack controls into the input channel's form.
+	InputFrame ToInput(const Controls& controls, unsigned sequence) const;
+	/// Unpack controls from the input channel's form.
+	Controls FromInput(const InputFrame& input) const;
 	void HandlePhysicsPreStep(StringHash eventType, VariantMap & eventData);
 	void HandleClientFinishedLoading(StringHash eventType, VariantMap& eventData);
+	/// Send the custom messages going out with each network update: boid snapshots and shark states from the server, inputs
+	/// from a client.
+	void HandleNetworkUpdate(StringHash eventType, VariantMap& eventData);
+	/// Apply custom messages: boid snapshots and shark states on the client, inputs and acknowledgements on the server.
+	void HandleNetworkMessage(StringHash eventType, VariantMap& eventData);
+	/// Client: buffer the shark transforms the server sends instead of applying them.
+	void HandleInterceptNetworkUpdate(StringHash eventType, VariantMap& eventData);
+	/// Client: show remote boids and sharks interpolated, picking up sharks that joined since the last frame, and the
+	/// own shark where it is predicted to be.
+	void UpdateInterpolation(float timeStep);
+	/// Client: hide other players' sharks that have left the interest radius around the camera, and show them again once
+	/// they are back inside it. The server stops updating them a little further out, so hidden ones are not frozen in view.
+	void UpdateSharkInterest();
 
-	/// Create static scene content.
+	/// Create the scene and its static content from the cooked scene, visible unless dedicated. A client recreates it on
+	/// every connect.
 	void CreateScene();
-
-	void CreateClientScene();
+	/// Server: create the scene of another room, with the content every room shares and nothing to render.
+	Scene* CreateRoomScene();
+	/// Server: put a new connection in the first room with space, or the emptiest one if all are full.
+	Room* AssignRoom(Connection* connection);
+	/// Server: return the room a connection is in, or null.
+	Room* GetRoom(Connection* connection) const;
+	/// Server: copy the state of every room and have it written to the checkpoint file in the background.
+	void WriteCheckpoint();
+	/// Server: build the rooms from a checkpoint file instead of spawning new matches. Return false if it cannot be read.
+	bool RestoreCheckpoint(const String& fileName);
+	/// Server: return the file a room's match is recorded to.
+	String GetRecordFileName(unsigned room) const;
+	/// Play a recorded match in the scene instead of joining one.
+	bool StartReplay(const String& fileName);
+	/// Replay: step through the recorded ticks in real time and show the boids and sharks of the current one.
+	void UpdateReplay(float timeStep);
 
 	///Create Main Menu
 	void CreateMainMenu();
@@ -132,6 +198,8 @@ private:
 	void HandlePostUpdate(StringHash eventType, VariantMap& eventData);
 	///Handle the serverStartup
 	void HandleStartServer(StringHash eventType, VariantMap&eventData);
+	/// Start the network server and the boids.
+	void StartServer();
 	///Handles connecting and disconnecting
 	void HandleConnect(StringHash eventType, VariantMap& eventData);
 	void HandleDisconnect(StringHash eventType, VariantMap& eventData);
@@ -148,9 +216,8 @@ private:
 	///toggles menu with a button
 	void HandleResume(StringHash eventType, VariantMap& eventData);
 
-	Node* CreateControllableObject(); // Server: Create a controllable ball
+	Node* CreateControllableObject(Scene* scene); // Server: Create a controllable ball in a room's scene
 	unsigned clientObjectID_ = 0; // Client: ID of own object
-	HashMap<Connection*, WeakPtr<Node> > serverObjects_; // Server Client/Object HashMap
 														 // Handle remote event from server to Client to share controlled object node ID.
 	void HandleServerToClientObjectID(StringHash eventType, VariantMap& eventData);
 	/// Handle remote event, client tells server that client is ready to start game
@@ -165,6 +232,96 @@ private:
 	bool menuVisible = false;
 	///boidset class obj
 	BoidSet boidSet;
+	/// Server: matches being played, each with its own scene, flock and sharks. The first plays in scene_.
+	Vector<SharedPtr<Room> > rooms_;
+	/// Server: room of each connection.
+	HashMap<Connection*, SharedPtr<Room> > connectionRooms_;
+	/// Server: number of rooms.
+	unsigned numRooms_;
+	/// Server: clients a room takes before the next one is filled.
+	unsigned roomSize_;
+	/// Server: distance from a client's camera within which it is sent boids and sharks, 0 for everything.
+	float interestRadius_;
+	/// Server: least boids sent each update to fix drift of client simulated flocks.
+	unsigned flockCorrections_;
+	/// Server: updates every boid of a client simulated flock is fixed within.
+	unsigned flockCorrectionPeriod_;
+	/// Server: boids in each join keyframe message, 0 to send joining clients keyframe snapshots instead.
+	unsigned joinChunkBoids_;
+	/// Server: join keyframe messages sent to a joining client each network update.
+	unsigned joinChunksPerUpdate_;
+	/// Client: local copy of the server's flock, driven by the snapshots.
+	RemoteFlock remoteFlock_;
+	/// Client: simulates the server's flock locally from its setup and corrections.
+	FlockSyncClient flockSyncClient_;
+	/// Run as a dedicated server: headless, with no UI, serving from startup.
+	bool dedicated_;
+	/// Scene description the world is built from.
+	String sceneDescription_;
+	/// Static world, loaded once and built into every scene.
+	CookedScene sceneData_;
+	/// Port the server listens on, or the client connects to.
+	unsigned short serverPort_;
+	/// Server: let clients simulate the flock instead of sending snapshots.
+	bool clientFlocks_;
+	/// Server: random seed the flock is spawned with.
+	unsigned flockSeed_;
+	/// Client: shows the sharks in the past, interpolated between server updates.
+	NodeInterpolator sharkInterpolator_;
+	/// Server: times each frame's work.
+	FrameTimer frameTimer_;
+	/// Server: frame times last sent.
+	ServerFrameStats serverStats_;
+	/// Server: time the frame times were last sent.
+	float serverStatsTime_;
+	/// Traffic of every connection and custom message.
+	NetStats netStats_;
+	/// Simulated network conditions everything sent is impaired with.
+	NetConditions netConditions_;
+	/// Server: file the live state of every room is checkpointed to, no checkpoints if empty.
+	String checkpointFile_;
+	/// Server: seconds between checkpoints.
+	float checkpointInterval_;
+	/// Server: time since the last checkpoint.
+	float checkpointTime_;
+	/// Server: writes the checkpoints off the main thread.
+	CheckpointWriter checkpointWriter_;
+	/// Server: checkpoint file to warm start from, instead of starting new matches.
+	String restoreFile_;
+	/// Server: furthest back in seconds captures are checked against the boids as clients saw them.
+	float maxRewind_;
+	/// Server: file the matches are recorded to, no recording if empty.
+	String recordFile_;
+	/// Recording being played back instead of a match.
+	ReplayPlayer replay_;
+	/// Replay: tick shown.
+	unsigned replayFrame_;
+	/// Replay: time since the tick shown started.
+	float replayTime_;
+	/// Replay: whether playback is paused.
+	bool replayPaused_;
+	/// Replay: shark nodes by their ID on the recording server.
+	HashMap<unsigned, SharedPtr<Node> > replaySharks_;
+	/// Client: predicts the own shark ahead of the server.
+	SharkPredictor sharkPredictor_;
+	/// Client: number of the newest input.
+	unsigned inputSequence_;
+	/// Client: sends the newest inputs to the server, each several times over.
+	InputSender inputSender_;
+	/// Server: inputs received from each client, taken one a physics step.
+	HashMap<Connection*, InputReceiver> inputReceivers_;
+	/// Client: number of scene children when sharks were last looked for.
+	unsigned numSceneChildren_;
+	/// Client: other players' sharks, shown only while in interest.
+	Vector<WeakPtr<Node> > remoteSharks_;
+	/// Client: times the join from pressing connect.
+	HiresTimer joinTimer_;
+	/// Client: time building the scene took, in microseconds.
+	long long joinSceneUSec_;
+	/// Client: time from pressing connect to the first boids shown, in microseconds, 0 until then.
+	long long joinFirstUSec_;
+	/// Client: whether the join has been reported.
+	bool joinReported_;
 	///shared pointed for all instances of clients object node
 	SharedPtr<Node> ballNode;
 	/// Reflection camera scene node.
@@ -0,0 +1,194 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+
+#include "Checkpoint.h"
+
+/// Bytes a boid takes in a checkpoint: position and velocity.
+static const unsigned CHECKPOINT_BOID_SIZE = 6 * sizeof(float);
+
+/// Write one state array of a flock.
+static void WriteArray(Serializer& dest, const PODVector<float>& values)
+{
+	if (!values.Empty())
+		dest.Write(values.Buffer(), values.Size() * sizeof(float));
+}
+
+/// Read one state array of a flock, sized already. Return false if the data ends first.
+static bool ReadArray(Deserializer& source, PODVector<float>& values)
+{
+	unsigned bytes = values.Size() * sizeof(float);
+	return !bytes || source.Read(values.Buffer(), bytes) == bytes;
+}
+
+void Checkpoint::Write(Serializer& dest) const
+{
+	dest.WriteFileID("UCKP");
+	dest.WriteUInt(CHECKPOINT_VERSION);
+	dest.WriteVLE(rooms_.Size());
+	for (unsigned i = 0; i < rooms_.Size(); ++i)
+	{
+		const CheckpointRoom& room = rooms_[i];
+		const FlockStore& boids = room.boids_;
+		unsigned numFlocks = boids.GetNumFlocks();
+		dest.WriteUInt(room.id_);
+		dest.WriteUInt(room.seed_);
+		dest.WriteUInt(room.tick_);
+		dest.WriteFloat(room.elapsedTime_);
+		dest.WriteVLE(numFlocks);
+		dest.WriteVLE(numFlocks ? boids.GetFlockSize(0) : 0);
+		// The arrays go out as they lie, which is what makes reading them back a handful of copies
+		WriteArray(dest, boids.posX_);
+		WriteArray(dest, boids.posY_);
+		WriteArray(dest, boids.posZ_);
+		WriteArray(dest, boids.velX_);
+		WriteArray(dest, boids.velY_);
+		WriteArray(dest, boids.velZ_);
+
+		dest.WriteVLE(room.sharks_.Size());
+		for (unsigned j = 0; j < room.sharks_.Size(); ++j)
+		{
+			const CheckpointShark& shark = room.sharks_[j];
+			dest.WriteString(shark.owner_);
+			dest.WriteVector3(shark.position_);
+			dest.WriteQuaternion(shark.rotation_);
+			dest.WriteVector3(shark.linearVelocity_);
+			dest.WriteVector3(shark.angularVelocity_);
+		}
+	}
+}
+
+bool Checkpoint::Read(Deserializer& source)
+{
+	rooms_.Clear();
+	if (source.ReadFileID() != "UCKP" || source.ReadUInt() != CHECKPOINT_VERSION)
+		return false;
+
+	unsigned numRooms = source.ReadVLE();
+	for (unsigned i = 0; i < numRooms; ++i)
+	{
+		if (source.IsEof())
+			return false;
+		rooms_.Push(CheckpointRoom());
+		CheckpointRoom& room = rooms_.Back();
+		room.id_ = source.ReadUInt();
+		room.seed_ = source.ReadUInt();
+		room.tick_ = source.ReadUInt();
+		room.elapsedTime_ = source.ReadFloat();
+		unsigned numFlocks = source.ReadVLE();
+		unsigned flockSize = source.ReadVLE();
+		// Check the size against what is left before allocating anything for it
+		unsigned long long bytes = (unsigned long long)numFlocks * flockSize * CHECKPOINT_BOID_SIZE;
+		if (bytes > source.GetSize() - source.GetPosition())
+			return false;
+		room.boids_.Resize(numFlocks, flockSize);
+		FlockStore& boids = room.boids_;
+		if (!ReadArray(source, boids.posX_) || !ReadArray(source, boids.posY_) || !ReadArray(source, boids.posZ_) ||
+			!ReadArray(source, boids.velX_) || !ReadArray(source, boids.velY_) || !ReadArray(source, boids.velZ_))
+			return false;
+
+		unsigned numSharks = source.ReadVLE();
+		for (unsigned j = 0; j < numSharks; ++j)
+		{
+			if (source.IsEof())
+				return false;
+			CheckpointShark shark;
+			shark.owner_ = source.ReadString();
+			shark.position_ = source.ReadVector3();
+			shark.rotation_ = source.ReadQuaternion();
+			shark.linearVelocity_ = source.ReadVector3();
+			shark.angularVelocity_ = source.ReadVector3();
+			room.sharks_.Push(shark);
+		}
+	}
+	return true;
+}
+
+CheckpointWriter::CheckpointWriter() :
+	context_(0),
+	lastWriteUSec_(0)
+{
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+	Wait();
+}
+
+bool CheckpointWriter::Write(Context* context, const String& fileName, Checkpoint& checkpoint)
+{
+	if (IsWriting())
+		return false;
+	context_ = context;
+	fileName_ = fileName;
+	checkpoint_.rooms_.Swap(checkpoint.rooms_);
+	checkpoint.rooms_.Clear();
+
+	WorkQueue* queue = context->GetSubsystem<WorkQueue>();
+	if (!queue)
+	{
+		WriteFile();
+		return true;
+	}
+	// An item of our own rather than a pooled one, as the queue resets pooled items when it purges them and the flag
+	// IsWriting reads would go with it. Lowest priority, so the flock steps never wait for it
+	queue_ = queue;
+	item_ = new WorkItem();
+	item_->priority_ = 0;
+	item_->workFunction_ = WriteFileWork;
+	item_->aux_ = this;
+	queue->AddWorkItem(item_);
+	return true;
+}
+
+void CheckpointWriter::Wait()
+{
+	if (IsWriting() && queue_)
+		queue_->Complete(0);
+	item_.Reset();
+}
+
+bool CheckpointWriter::Read(Context* context, const String& fileName, Checkpoint& dest)
+{
+	SharedPtr<File> file(new File(context));
+	if (!file->Open(fileName, FILE_READ))
+		return false;
+	// One read of the whole file, then parse from memory
+	PODVector<unsigned char> data(file->GetSize());
+	if (!data.Empty() && file->Read(data.Buffer(), data.Size()) != data.Size())
+		return false;
+	MemoryBuffer source(data);
+	return dest.Read(source);
+}
+
+void CheckpointWriter::WriteFile()
+{
+	HiresTimer timer;
+	buffer_.Clear();
+	checkpoint_.Write(buffer_);
+	checkpoint_.rooms_.Clear();
+
+	String tempName = fileName_ + ".tmp";
+	SharedPtr<File> file(new File(context_));
+	bool written = file->Open(tempName, FILE_WRITE) && file->Write(buffer_.GetData(), buffer_.GetSize()) == buffer_.GetSize();
+	file->Close();
+
+	FileSystem* fileSystem = context_->GetSubsystem<FileSystem>();
+	if (written && fileSystem)
+	{
+#ifdef _WIN32
+		// Windows will not rename over an existing file
+		if (fileSystem->FileExists(fileName_))
+			fileSystem->Delete(fileName_);
+#endif
+		fileSystem->Rename(tempName, fileName_);
+	}
+	lastWriteUSec_ = timer.GetUSec(false);
+}
+
+void CheckpointWriter::WriteFileWork(const WorkItem* item, unsigned threadIndex)
+{
+	static_cast<CheckpointWriter*>(item->aux_)->WriteFile();
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/IO/Serializer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Math/Quaternion.h>
+
+#include "FlockStore.h"
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Default seconds between checkpoints.
+static const float DEFAULT_CHECKPOINT_INTERVAL = 10.0f;
+/// Version of the checkpoint file layout.
+static const unsigned CHECKPOINT_VERSION = 1;
+
+/// A shark as a checkpoint keeps it.
+struct CheckpointShark
+{
+	/// Address of the client playing it, so the client gets it back when it reconnects.
+	String owner_;
+	/// Body state.
+	Vector3 position_;
+	Quaternion rotation_;
+	Vector3 linearVelocity_;
+	Vector3 angularVelocity_;
+};
+
+/// A room as a checkpoint keeps it.
+struct CheckpointRoom
+{
+	CheckpointRoom() :
+		id_(0),
+		seed_(0),
+		tick_(0),
+		elapsedTime_(0.0f)
+	{
+	}
+
+	/// Room ID.
+	unsigned id_;
+	/// Seed the flock was spawned with.
+	unsigned seed_;
+	/// Flock tick.
+	unsigned tick_;
+	/// Time the room's scene has run, the match clock.
+	float elapsedTime_;
+	/// Flock layout and state. Only positions and velocities are kept, the forces are worked out again every tick.
+	FlockStore boids_;
+	/// Sharks.
+	Vector<CheckpointShark> sharks_;
+};
+
+/// Live state of every room on a server, enough to carry the matches on in a new server process: each flock's state,
+/// tick and seed, the sharks' bodies and who plays them, and each room's clock. Scene content is not kept, a restarted
+/// server builds its static scene as usual.
+struct Checkpoint
+{
+	/// Write in binary.
+	void Write(Serializer& dest) const;
+	/// Read what Write wrote. Return false if the data is not a checkpoint or is cut short.
+	bool Read(Deserializer& source);
+
+	/// Rooms.
+	Vector<CheckpointRoom> rooms_;
+};
+
+/// Writes checkpoints on a worker thread. The main thread only copies the live state into a Checkpoint, which the
+/// writer takes over; serializing and the disk write then run as a work item while the game carries on. Each file is
+/// written under a temporary name and renamed over the last, so a crash mid-write leaves the previous checkpoint whole.
+class CheckpointWriter
+{
+public:
+	CheckpointWriter();
+	/// Wait for a write in flight.
+	~CheckpointWriter();
+
+	/// Take over the contents of checkpoint, leaving it empty, and write them to fileName in the background. Return
+	/// false without taking anything if the previous checkpoint is still being written.
+	bool Write(Context* context, const String& fileName, Checkpoint& checkpoint);
+	/// Wait for a write in flight to finish.
+	void Wait();
+	/// Return whether a checkpoint is being written.
+	bool IsWriting() const { return item_ && !item_->completed_; }
+	/// Return how long the last finished write took on its worker, in microseconds.
+	long long GetLastWriteUSec() const { return lastWriteUSec_; }
+	/// Return the size of the last checkpoint written.
+	unsigned GetLastSize() const { return buffer_.GetSize(); }
+
+	/// Read a checkpoint file. Return false if it cannot be read.
+	static bool Read(Context* context, const String& fileName, Checkpoint& dest);
+
+private:
+	/// Serialize the checkpoint and write the file. Runs on a worker.
+	void WriteFile();
+	/// Work queue entry point.
+	static void WriteFileWork(const WorkItem* item, unsigned threadIndex);
+
+	/// Context to open the file with.
+	Context* context_;
+	/// Work queue the write runs on.
+	WeakPtr<WorkQueue> queue_;
+	/// Work item of the write in flight.
+	SharedPtr<WorkItem> item_;
+	/// File being written.
+	String fileName_;
+	/// Checkpoint being written.
+	Checkpoint checkpoint_;
+	/// Serialized checkpoint.
+	VectorBuffer buffer_;
+	/// Duration of the last write.
+	long long lastWriteUSec_;
+};
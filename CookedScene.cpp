@@ -0,0 +1,482 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/Light.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/Skybox.h>
+#include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Graphics/Terrain.h>
+#include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/Graphics/Zone.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/Math/Random.h>
+#include <Urho3D/Physics/CollisionShape.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+#include <Urho3D/Physics/RigidBody.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Resource/XMLFile.h>
+
+#include "CookedScene.h"
+
+/// Collision layer of static geometry.
+static const unsigned STATIC_COLLISION_LAYER = 2;
+
+/// Return a model holding only the points of a cooked convex hull, for a physics world to take the hull from.
+static SharedPtr<Model> CreateHullModel(Context* context, const PODVector<Vector3>& hull)
+{
+	SharedPtr<VertexBuffer> vertexBuffer(new VertexBuffer(context));
+	vertexBuffer->SetShadowed(true);
+	vertexBuffer->SetSize(hull.Size(), MASK_POSITION);
+	vertexBuffer->SetData(hull.Buffer());
+	SharedPtr<Geometry> geometry(new Geometry(context));
+	geometry->SetVertexBuffer(0, vertexBuffer);
+	geometry->SetDrawRange(TRIANGLE_LIST, 0, 0, 0, hull.Size());
+
+	SharedPtr<Model> model(new Model(context));
+	model->SetNumGeometries(1);
+	model->SetNumGeometryLodLevels(0, 1);
+	model->SetGeometry(0, 0, geometry);
+	model->SetBoundingBox(BoundingBox(hull.Buffer(), hull.Size()));
+	return model;
+}
+
+CookedScene::CookedScene() :
+	seed_(0),
+	fogStart_(0.0f),
+	fogEnd_(0.0f),
+	zoneSize_(0.0f),
+	lightBrightness_(1.0f),
+	lightSpecular_(1.0f),
+	terrainPatchSize_(32),
+	terrainSmoothing_(false),
+	checksum_(0),
+	cooked_(false),
+	loadUSec_(0),
+	collisionUSec_(0)
+{
+}
+
+bool CookedScene::Load(Context* context, const String& descriptionName)
+{
+	HiresTimer timer;
+	ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+	cooked_ = false;
+
+	// The cooked file is only good for the description it was cooked from. Without the description, as in a build
+	// shipped with cooked files only, it is taken as it is
+	SharedPtr<File> description = cache->GetFile(descriptionName, false);
+	unsigned checksum = description ? description->GetChecksum() : 0;
+	SharedPtr<File> cookedFile = cache->GetFile(GetCookedName(descriptionName), false);
+	if (cookedFile && ReadFile(context, *cookedFile) && (!description || checksum_ == checksum))
+	{
+		loadUSec_ = timer.GetUSec(false);
+		return true;
+	}
+
+	if (!description || !Cook(context, descriptionName))
+		return false;
+	cooked_ = true;
+	loadUSec_ = timer.GetUSec(false);
+
+	// Saved next to the description so the next start reads it, unless the description is in a package or read-only
+	String path = cache->GetResourceFileName(descriptionName);
+	if (!path.Empty())
+	{
+		SharedPtr<File> file(new File(context));
+		if (file->Open(ReplaceExtension(path, ".bin"), FILE_WRITE))
+			Write(*file);
+	}
+	return true;
+}
+
+bool CookedScene::Cook(Context* context, const String& descriptionName)
+{
+	ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+	SharedPtr<File> file = cache->GetFile(descriptionName, false);
+	if (!file)
+		return false;
+	unsigned checksum = file->GetChecksum();
+	SharedPtr<XMLFile> xml(new XMLFile(context));
+	if (!xml->Load(*file))
+		return false;
+	XMLElement root = xml->GetRoot("scenedescription");
+	if (!root)
+		return false;
+
+	seed_ = root.GetUInt("seed");
+	XMLElement zone = root.GetChild("zone");
+	ambientColor_ = zone.GetColor("ambient");
+	fogColor_ = zone.GetColor("fogcolor");
+	fogStart_ = zone.GetFloat("fogstart");
+	fogEnd_ = zone.GetFloat("fogend");
+	zoneSize_ = zone.GetFloat("size");
+	XMLElement light = root.GetChild("light");
+	lightDirection_ = light.GetVector3("direction");
+	lightBrightness_ = light.GetFloat("brightness");
+	lightSpecular_ = light.GetFloat("specular");
+	XMLElement sky = root.GetChild("sky");
+	skyModel_ = sky.GetAttribute("model");
+	skyMaterial_ = sky.GetAttribute("material");
+	XMLElement water = root.GetChild("water");
+	waterModel_ = water.GetAttribute("model");
+	waterMaterial_ = water.GetAttribute("material");
+	waterPosition_ = water.GetVector3("position");
+	waterScale_ = water.GetVector3("scale");
+	waterRotation_ = water.GetVector3("rotation");
+
+	XMLElement terrainElement = root.GetChild("terrain");
+	terrainPosition_ = terrainElement.GetVector3("position");
+	terrainSpacing_ = terrainElement.GetVector3("spacing");
+	terrainPatchSize_ = terrainElement.GetInt("patchsize");
+	terrainSmoothing_ = terrainElement.GetBool("smoothing");
+	terrainMaterial_ = terrainElement.GetAttribute("material");
+	// Decoded once here, the cooked file keeps the pixels
+	Image* heightMap = cache->GetResource<Image>(terrainElement.GetAttribute("heightmap"));
+	if (!heightMap || heightMap->IsCompressed())
+		return false;
+	heightMap_ = heightMap;
+
+	// Plants are placed from the description's seed, on a terrain built as Build builds it in a scene of its own. The
+	// global random state is put back after, the flocks spawn from it
+	SharedPtr<Scene> scratch(new Scene(context));
+	Terrain* terrain = BuildTerrain(scratch, false);
+	unsigned oldSeed = GetRandomSeed();
+	SetRandomSeed(seed_);
+	vegetation_.Clear();
+	collision_.Clear();
+	for (XMLElement group = root.GetChild("vegetation"); group; group = group.GetNext("vegetation"))
+	{
+		vegetation_.Push(CookedVegetation());
+		CookedVegetation& vegetation = vegetation_.Back();
+		vegetation.name_ = group.GetAttribute("name");
+		vegetation.model_ = group.GetAttribute("model");
+		vegetation.material_ = group.GetAttribute("material");
+		vegetation.collision_ = group.GetAttribute("collision") == "convexhull" ? VC_CONVEXHULL : VC_TRIANGLEMESH;
+		if (vegetation.collision_ == VC_CONVEXHULL)
+		{
+			// The hull is worked out here from every vertex of the model, so building only has its points to take
+			Model* model = cache->GetResource<Model>(vegetation.model_);
+			if (!model)
+				return false;
+			SharedPtr<ConvexData> hull(new ConvexData(model, 0));
+			vegetation.hull_.Resize(hull->vertexCount_);
+			for (unsigned i = 0; i < hull->vertexCount_; ++i)
+				vegetation.hull_[i] = hull->vertexData_[i];
+		}
+		Vector2 min = group.GetVector2("min");
+		Vector2 max = group.GetVector2("max");
+		float minScale = group.GetFloat("minscale");
+		float maxScale = group.GetFloat("maxscale");
+		vegetation.instances_.Resize(group.GetUInt("count"));
+		for (unsigned i = 0; i < vegetation.instances_.Size(); ++i)
+		{
+			CookedInstance& instance = vegetation.instances_[i];
+			instance.position_ = Vector3(Random(min.x_, max.x_), 0.0f, Random(min.y_, max.y_));
+			instance.position_.y_ = terrain->GetHeight(instance.position_);
+			instance.yaw_ = Random(360.0f);
+			instance.scale_ = Random(minScale, maxScale);
+		}
+	}
+	SetRandomSeed(oldSeed);
+	checksum_ = checksum;
+	return true;
+}
+
+void CookedScene::Write(Serializer& dest) const
+{
+	dest.WriteFileID("USCN");
+	dest.WriteUInt(COOKED_SCENE_VERSION);
+	dest.WriteUInt(checksum_);
+	dest.WriteUInt(seed_);
+	dest.WriteColor(ambientColor_);
+	dest.WriteColor(fogColor_);
+	dest.WriteFloat(fogStart_);
+	dest.WriteFloat(fogEnd_);
+	dest.WriteFloat(zoneSize_);
+	dest.WriteVector3(lightDirection_);
+	dest.WriteFloat(lightBrightness_);
+	dest.WriteFloat(lightSpecular_);
+	dest.WriteString(skyModel_);
+	dest.WriteString(skyMaterial_);
+	dest.WriteString(waterModel_);
+	dest.WriteString(waterMaterial_);
+	dest.WriteVector3(waterPosition_);
+	dest.WriteVector3(waterScale_);
+	dest.WriteVector3(waterRotation_);
+
+	dest.WriteVector3(terrainPosition_);
+	dest.WriteVector3(terrainSpacing_);
+	dest.WriteVLE(terrainPatchSize_);
+	dest.WriteBool(terrainSmoothing_);
+	dest.WriteString(terrainMaterial_);
+	unsigned width = heightMap_ ? heightMap_->GetWidth() : 0;
+	unsigned height = heightMap_ ? heightMap_->GetHeight() : 0;
+	unsigned components = heightMap_ ? heightMap_->GetComponents() : 0;
+	dest.WriteVLE(width);
+	dest.WriteVLE(height);
+	dest.WriteVLE(components);
+	if (width && height && components)
+		dest.Write(heightMap_->GetData(), width * height * components);
+
+	// Placements go out as they lie, so reading them back is one copy per group
+	dest.WriteVLE(vegetation_.Size());
+	for (unsigned i = 0; i < vegetation_.Size(); ++i)
+	{
+		const CookedVegetation& vegetation = vegetation_[i];
+		dest.WriteString(vegetation.name_);
+		dest.WriteString(vegetation.model_);
+		dest.WriteString(vegetation.material_);
+		dest.WriteUByte((unsigned char)vegetation.collision_);
+		dest.WriteVLE(vegetation.hull_.Size());
+		if (!vegetation.hull_.Empty())
+			dest.Write(vegetation.hull_.Buffer(), vegetation.hull_.Size() * sizeof(Vector3));
+		dest.WriteVLE(vegetation.instances_.Size());
+		if (!vegetation.instances_.Empty())
+			dest.Write(vegetation.instances_.Buffer(), vegetation.instances_.Size() * sizeof(CookedInstance));
+	}
+}
+
+bool CookedScene::Read(Context* context, Deserializer& source)
+{
+	if (source.ReadFileID() != "USCN" || source.ReadUInt() != COOKED_SCENE_VERSION)
+		return false;
+	checksum_ = source.ReadUInt();
+	seed_ = source.ReadUInt();
+	ambientColor_ = source.ReadColor();
+	fogColor_ = source.ReadColor();
+	fogStart_ = source.ReadFloat();
+	fogEnd_ = source.ReadFloat();
+	zoneSize_ = source.ReadFloat();
+	lightDirection_ = source.ReadVector3();
+	lightBrightness_ = source.ReadFloat();
+	lightSpecular_ = source.ReadFloat();
+	skyModel_ = source.ReadString();
+	skyMaterial_ = source.ReadString();
+	waterModel_ = source.ReadString();
+	waterMaterial_ = source.ReadString();
+	waterPosition_ = source.ReadVector3();
+	waterScale_ = source.ReadVector3();
+	waterRotation_ = source.ReadVector3();
+
+	terrainPosition_ = source.ReadVector3();
+	terrainSpacing_ = source.ReadVector3();
+	terrainPatchSize_ = source.ReadVLE();
+	terrainSmoothing_ = source.ReadBool();
+	terrainMaterial_ = source.ReadString();
+	unsigned width = source.ReadVLE();
+	unsigned height = source.ReadVLE();
+	unsigned components = source.ReadVLE();
+	// Check the size against what is left before allocating anything for it
+	unsigned long long bytes = (unsigned long long)width * height * components;
+	if (!bytes || bytes > source.GetSize() - source.GetPosition())
+		return false;
+	SharedPtr<Image> heightMap(new Image(context));
+	if (!heightMap->SetSize(width, height, components))
+		return false;
+	source.Read(heightMap->GetData(), (unsigned)bytes);
+
+	unsigned numGroups = source.ReadVLE();
+	vegetation_.Clear();
+	collision_.Clear();
+	for (unsigned i = 0; i < numGroups; ++i)
+	{
+		if (source.IsEof())
+			return false;
+		vegetation_.Push(CookedVegetation());
+		CookedVegetation& vegetation = vegetation_.Back();
+		vegetation.name_ = source.ReadString();
+		vegetation.model_ = source.ReadString();
+		vegetation.material_ = source.ReadString();
+		vegetation.collision_ = source.ReadUByte() == VC_CONVEXHULL ? VC_CONVEXHULL : VC_TRIANGLEMESH;
+		unsigned numHull = source.ReadVLE();
+		if ((unsigned long long)numHull * sizeof(Vector3) > source.GetSize() - source.GetPosition())
+			return false;
+		vegetation.hull_.Resize(numHull);
+		if (numHull)
+			source.Read(vegetation.hull_.Buffer(), numHull * sizeof(Vector3));
+		if (vegetation.collision_ == VC_CONVEXHULL && !numHull)
+			return false;
+		unsigned numInstances = source.ReadVLE();
+		unsigned long long instanceBytes = (unsigned long long)numInstances * sizeof(CookedInstance);
+		if (instanceBytes > source.GetSize() - source.GetPosition())
+			return false;
+		vegetation.instances_.Resize(numInstances);
+		if (numInstances)
+			source.Read(vegetation.instances_.Buffer(), (unsigned)instanceBytes);
+	}
+	heightMap_ = heightMap;
+	return true;
+}
+
+bool CookedScene::ReadFile(Context* context, File& file)
+{
+	// One read of the whole file, then parse from memory
+	PODVector<unsigned char> data(file.GetSize());
+	if (!data.Empty() && file.Read(data.Buffer(), data.Size()) != data.Size())
+		return false;
+	MemoryBuffer source(data);
+	return Read(context, source);
+}
+
+void CookedScene::Build(Scene* scene, bool visible) const
+{
+	ResourceCache* cache = scene->GetSubsystem<ResourceCache>();
+	if (visible)
+	{
+		// A zone for ambient lighting and fog control
+		Node* zoneNode = scene->CreateChild("Zone", LOCAL);
+		Zone* zone = zoneNode->CreateComponent<Zone>(LOCAL);
+		zone->SetAmbientColor(ambientColor_);
+		zone->SetFogColor(fogColor_);
+		zone->SetFogStart(fogStart_);
+		zone->SetFogEnd(fogEnd_);
+		zone->SetBoundingBox(BoundingBox(-zoneSize_, zoneSize_));
+
+		// A directional light with cascaded shadow mapping
+		Node* lightNode = scene->CreateChild("DirectionalLight", LOCAL);
+		lightNode->SetDirection(lightDirection_);
+		Light* light = lightNode->CreateComponent<Light>(LOCAL);
+		light->SetLightType(LIGHT_DIRECTIONAL);
+		light->SetCastShadows(true);
+		light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
+		light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f, 0.8f));
+		light->SetSpecularIntensity(lightSpecular_);
+		light->SetBrightness(lightBrightness_);
+
+		// The Skybox component is used like StaticModel, but it will be always located at the camera, giving the
+		// illusion of the box planes being far away
+		Node* skyNode = scene->CreateChild("Sky", LOCAL);
+		skyNode->SetScale(80.0f); // The scale actually does not matter
+		Skybox* skybox = skyNode->CreateComponent<Skybox>(LOCAL);
+		skybox->SetModel(cache->GetResource<Model>(skyModel_));
+		skybox->SetMaterial(cache->GetResource<Material>(skyMaterial_));
+	}
+
+	Node* terrainNode = BuildTerrain(scene, visible)->GetNode();
+	RigidBody* terrainBody = terrainNode->CreateComponent<RigidBody>(LOCAL);
+	terrainBody->SetCollisionLayer(STATIC_COLLISION_LAYER);
+	CollisionShape* terrainShape = terrainNode->CreateComponent<CollisionShape>(LOCAL);
+	terrainShape->SetTerrain();
+
+	// A water plane as large as the terrain
+	Node* waterNode = scene->CreateChild("Water", LOCAL);
+	waterNode->SetScale(waterScale_);
+	waterNode->SetPosition(waterPosition_);
+	waterNode->SetRotation(Quaternion(waterRotation_.x_, waterRotation_.y_, waterRotation_.z_));
+	if (visible)
+	{
+		StaticModel* water = waterNode->CreateComponent<StaticModel>(LOCAL);
+		water->SetModel(cache->GetResource<Model>(waterModel_));
+		water->SetMaterial(cache->GetResource<Material>(waterMaterial_));
+		// Set a different viewmask on the water plane to be able to hide it from the reflection camera
+		water->SetViewMask(0x80000000);
+	}
+	RigidBody* waterBody = waterNode->CreateComponent<RigidBody>(LOCAL);
+	waterBody->SetCollisionLayer(STATIC_COLLISION_LAYER);
+	CollisionShape* waterShape = waterNode->CreateComponent<CollisionShape>(LOCAL);
+	waterShape->SetTerrain();
+
+	// Plants collide with their mesh or its hull. The geometry goes into the physics world's own cache under the model
+	// the shapes are given, so every plant finds it there instead of building it, and scales it in a shape of its own
+	PhysicsWorld* physicsWorld = scene->GetComponent<PhysicsWorld>();
+	collisionUSec_ = 0;
+	for (unsigned i = 0; i < vegetation_.Size(); ++i)
+	{
+		const CookedVegetation& vegetation = vegetation_[i];
+		const SharedCollision& collision = GetCollision(scene->GetContext(), vegetation);
+		bool hull = vegetation.collision_ == VC_CONVEXHULL;
+		if (physicsWorld && collision.geometry_)
+		{
+			Pair<Model*, unsigned> id = MakePair(collision.model_.Get(), 0u);
+			if (hull)
+				physicsWorld->GetConvexCache()[id] = collision.geometry_;
+			else
+				physicsWorld->GetTriMeshCache()[id] = collision.geometry_;
+		}
+		Model* model = cache->GetResource<Model>(vegetation.model_);
+		Material* material = visible ? cache->GetResource<Material>(vegetation.material_) : 0;
+		for (unsigned j = 0; j < vegetation.instances_.Size(); ++j)
+		{
+			const CookedInstance& instance = vegetation.instances_[j];
+			Node* objectNode = scene->CreateChild(vegetation.name_, LOCAL);
+			objectNode->SetPosition(instance.position_);
+			objectNode->SetRotation(Quaternion(0.0f, instance.yaw_, 0.0f));
+			objectNode->SetScale(instance.scale_);
+			if (visible)
+			{
+				StaticModel* object = objectNode->CreateComponent<StaticModel>(LOCAL);
+				object->SetModel(model);
+				object->SetMaterial(material);
+				object->SetCastShadows(true);
+			}
+			RigidBody* body = objectNode->CreateComponent<RigidBody>(LOCAL);
+			body->SetCollisionLayer(STATIC_COLLISION_LAYER);
+			CollisionShape* shape = objectNode->CreateComponent<CollisionShape>(LOCAL);
+			if (hull)
+				shape->SetConvexHull(collision.model_, 0);
+			else
+				shape->SetTriangleMesh(model, 0);
+		}
+	}
+}
+
+Terrain* CookedScene::BuildTerrain(Scene* scene, bool visible) const
+{
+	Node* terrainNode = scene->CreateChild("Terrain", LOCAL);
+	terrainNode->SetPosition(terrainPosition_);
+	Terrain* terrain = terrainNode->CreateComponent<Terrain>(LOCAL);
+	terrain->SetPatchSize(terrainPatchSize_);
+	terrain->SetSpacing(terrainSpacing_); // Spacing between vertices and vertical resolution of the height map
+	terrain->SetSmoothing(terrainSmoothing_);
+	terrain->SetHeightMap(heightMap_);
+	if (visible)
+		terrain->SetMaterial(scene->GetSubsystem<ResourceCache>()->GetResource<Material>(terrainMaterial_));
+	// The terrain consists of large triangles, which fits well for occlusion rendering, as a hill can occlude all
+	// terrain patches and other objects behind it
+	terrain->SetOccluder(true);
+	return terrain;
+}
+
+const CookedScene::SharedCollision& CookedScene::GetCollision(Context* context, const CookedVegetation& vegetation) const
+{
+	bool hull = vegetation.collision_ == VC_CONVEXHULL;
+	SharedCollision& collision = collision_[hull ? vegetation.model_ + "#hull" : vegetation.model_];
+	if (hull)
+	{
+		if (!collision.geometry_ && !vegetation.hull_.Empty())
+		{
+			HiresTimer timer;
+			collision.model_ = CreateHullModel(context, vegetation.hull_);
+			collision.geometry_ = new ConvexData(collision.model_, 0);
+			collisionUSec_ += timer.GetUSec(false);
+		}
+		return collision;
+	}
+
+	// The mesh is the model resource's, built again only if the resource has been released and reloaded since
+	Model* model = context->GetSubsystem<ResourceCache>()->GetResource<Model>(vegetation.model_);
+	if (model != collision.model_)
+	{
+		HiresTimer timer;
+		collision.model_ = model;
+		collision.geometry_ = model ? new TriangleMeshData(model, 0) : 0;
+		collisionUSec_ += timer.GetUSec(false);
+	}
+	return collision;
+}
+
+unsigned CookedScene::GetNumInstances() const
+{
+	unsigned count = 0;
+	for (unsigned i = 0; i < vegetation_.Size(); ++i)
+		count += vegetation_[i].instances_.Size();
+	return count;
+}
+
+String CookedScene::GetCookedName(const String& descriptionName)
+{
+	return ReplaceExtension(descriptionName, ".bin");
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/IO/Serializer.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Math/Color.h>
+#include <Urho3D/Physics/CollisionShape.h>
+#include <Urho3D/Resource/Image.h>
+#include <Urho3D/Scene/Scene.h>
+
+namespace Urho3D
+{
+
+class File;
+class Terrain;
+
+}
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Scene description the game is built from by default.
+static const String DEFAULT_SCENE_DESCRIPTION("Scenes/SharkWorld.xml");
+/// Version of the cooked scene file layout.
+static const unsigned COOKED_SCENE_VERSION = 2;
+
+/// Collision geometry of a vegetation group.
+enum VegetationCollision
+{
+	/// The model's own triangles. Exact, but the costliest for bodies brushing through, and its BVH is built again on
+	/// every start, as Urho3D's TriangleMeshData always builds its own.
+	VC_TRIANGLEMESH = 0,
+	/// The convex hull of the model, whose points the cooked file holds, so a start only makes a shape of those. Cheap
+	/// to build and to collide with, but fills the gaps between leaves and stalks.
+	VC_CONVEXHULL
+};
+
+/// One plant of a vegetation group, placed on the terrain.
+struct CookedInstance
+{
+	/// Position, on the terrain surface.
+	Vector3 position_;
+	/// Rotation about the vertical axis in degrees.
+	float yaw_;
+	/// Uniform scale.
+	float scale_;
+};
+
+/// Plants of one model scattered over an area of the terrain.
+struct CookedVegetation
+{
+	/// Node name of each plant.
+	String name_;
+	/// Model, drawn and used as the collision mesh.
+	String model_;
+	/// Material.
+	String material_;
+	/// Collision geometry.
+	VegetationCollision collision_;
+	/// Convex hull points of the model when colliding with its hull.
+	PODVector<Vector3> hull_;
+	/// Placements.
+	PODVector<CookedInstance> instances_;
+};
+
+/// The static world of a match, cooked from a scene description so the server, every room and every client build the
+/// same one. The description is an XML file listing the zone, light, sky, terrain, water and vegetation groups, each
+/// group with a count, an area, a scale range and whether it collides with its mesh or its convex hull. Cooking places the vegetation from the description's random seed and
+/// samples the terrain height under every plant, and keeps the decoded heightmap, so the cooked binary file holds
+/// everything building the scene needs without decoding an image or placing anything. The cooked file sits next to the
+/// description and carries its checksum: a missing or stale one is cooked again at startup and saved if it can be.
+/// Every node built is local, as both ends build the same content from the same file. The collision geometry of each
+/// vegetation model is built once and shared by every scene built after, and within a scene by every plant of the model
+/// at whatever scale. Convex hulls are the collision kept on disk: their points are cooked, so a cold start does not
+/// work them out from the model again. Triangle mesh BVHs are not, they are built once per process.
+class CookedScene
+{
+public:
+	CookedScene();
+
+	/// Read the cooked file of a description resource, or cook the description if the cooked file is missing or was
+	/// cooked from another version of it, and save the result for next time. Return false if neither can be read.
+	bool Load(Context* context, const String& descriptionName);
+	/// Cook a description resource. Return false if it cannot be read.
+	bool Cook(Context* context, const String& descriptionName);
+	/// Write in binary.
+	void Write(Serializer& dest) const;
+	/// Read what Write wrote. Return false if the data is not a cooked scene or is cut short.
+	bool Read(Context* context, Deserializer& source);
+	/// Read a cooked scene file in one go. Return false if it cannot be read.
+	bool ReadFile(Context* context, File& file);
+	/// Build the content into a scene: terrain, water and vegetation with their collision, and for a visible scene the
+	/// zone, light, sky, materials and water surface.
+	void Build(Scene* scene, bool visible) const;
+
+	/// Return whether a scene has been loaded or cooked.
+	bool IsLoaded() const { return heightMap_.NotNull(); }
+	/// Return whether the last Load had to cook the description.
+	bool WasCooked() const { return cooked_; }
+	/// Return how long the last Load took, in microseconds.
+	long long GetLoadUSec() const { return loadUSec_; }
+	/// Return how long the last Build spent building collision geometry no scene had yet, in microseconds.
+	long long GetCollisionUSec() const { return collisionUSec_; }
+	/// Return the checksum of the description cooked.
+	unsigned GetChecksum() const { return checksum_; }
+	/// Return the number of plants over every vegetation group.
+	unsigned GetNumInstances() const;
+
+	/// Return the cooked file name of a description.
+	static String GetCookedName(const String& descriptionName);
+
+	/// Seed the vegetation was placed from.
+	unsigned seed_;
+	/// Zone.
+	Color ambientColor_;
+	Color fogColor_;
+	float fogStart_;
+	float fogEnd_;
+	float zoneSize_;
+	/// Directional light.
+	Vector3 lightDirection_;
+	float lightBrightness_;
+	float lightSpecular_;
+	/// Skybox.
+	String skyModel_;
+	String skyMaterial_;
+	/// Terrain.
+	Vector3 terrainPosition_;
+	Vector3 terrainSpacing_;
+	int terrainPatchSize_;
+	bool terrainSmoothing_;
+	String terrainMaterial_;
+	/// Water plane.
+	String waterModel_;
+	String waterMaterial_;
+	Vector3 waterPosition_;
+	Vector3 waterScale_;
+	Vector3 waterRotation_;
+	/// Vegetation groups.
+	Vector<CookedVegetation> vegetation_;
+
+private:
+	/// Collision geometry shared by every plant of a vegetation group.
+	struct SharedCollision
+	{
+		/// Model the geometry was built from: the plant model, or a model of the cooked hull points.
+		SharedPtr<Model> model_;
+		/// Triangle mesh or convex hull data.
+		SharedPtr<CollisionGeometryData> geometry_;
+	};
+
+	/// Create the terrain node of a scene, without its collision.
+	Terrain* BuildTerrain(Scene* scene, bool visible) const;
+	/// Return the collision geometry of a vegetation group, building it if no scene has yet.
+	const SharedCollision& GetCollision(Context* context, const CookedVegetation& vegetation) const;
+
+	/// Decoded heightmap, shared by every terrain built.
+	SharedPtr<Image> heightMap_;
+	/// Checksum of the description cooked.
+	unsigned checksum_;
+	/// Whether the last Load cooked.
+	bool cooked_;
+	/// Duration of the last Load.
+	long long loadUSec_;
+	/// Collision geometry by model and collision type, kept across scenes so no physics world builds it again.
+	mutable HashMap<String, SharedCollision> collision_;
+	/// Collision geometry build time of the last Build.
+	mutable long long collisionUSec_;
+};
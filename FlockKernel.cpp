@@ -0,0 +1,306 @@
+#include "FlockKernel.h"
+
+// SSE2 is part of every x86-64 CPU; on 32-bit x86 it is only used when the build already targets it
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FLOCK_KERNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is compiled per function and only called after a runtime CPU check, so the rest of the build stays at the baseline
+#if defined(FLOCK_KERNEL_SSE2) && !defined(__EMSCRIPTEN__)
+#if defined(_MSC_VER)
+#define FLOCK_KERNEL_AVX2
+#define FLOCK_KERNEL_AVX2_TARGET
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FLOCK_KERNEL_AVX2
+#define FLOCK_KERNEL_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#endif
+
+typedef void (*FlockSumFunction)(const Vector3& pos, const float* posX, const float* posY, const float* posZ,
+	unsigned count, const FlockRanges& ranges, FlockSums& sums);
+
+static void SumScalar(const Vector3& pos, const float* posX, const float* posY, const float* posZ, unsigned count,
+	const FlockRanges& ranges, FlockSums& sums)
+{
+	for (unsigned i = 0; i < count; ++i)
+	{
+		float dx = pos.x_ - posX[i];
+		float dy = pos.y_ - posY[i];
+		float dz = pos.z_ - posZ[i];
+		float d2 = dx * dx + dy * dy + dz * dz;
+		// Skips the boid itself, and avoids dividing by zero for two boids on the same spot
+		if (d2 <= 0.0f)
+			continue;
+
+		if (d2 < ranges.attract2_)
+		{
+			sums.comX_ += posX[i];
+			sums.comY_ += posY[i];
+			sums.comZ_ += posZ[i];
+			sums.numAttract_ += 1.0f;
+		}
+		if (d2 < ranges.repel2_)
+		{
+			float invD2 = 1.0f / d2;
+			sums.sepX_ += dx * invD2;
+			sums.sepY_ += dy * invD2;
+			sums.sepZ_ += dz * invD2;
+			sums.numRepel_ += 1.0f;
+		}
+		if (d2 < ranges.align2_)
+			sums.numAlign_ += 1.0f;
+	}
+}
+
+#ifdef FLOCK_KERNEL_SSE2
+static inline float HorizontalSum(__m128 v)
+{
+	float lanes[4];
+	_mm_storeu_ps(lanes, v);
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+static void SumSSE2(const Vector3& pos, const float* posX, const float* posY, const float* posZ, unsigned count,
+	const FlockRanges& ranges, FlockSums& sums)
+{
+	const __m128 px = _mm_set1_ps(pos.x_);
+	const __m128 py = _mm_set1_ps(pos.y_);
+	const __m128 pz = _mm_set1_ps(pos.z_);
+	const __m128 attract2 = _mm_set1_ps(ranges.attract2_);
+	const __m128 repel2 = _mm_set1_ps(ranges.repel2_);
+	const __m128 align2 = _mm_set1_ps(ranges.align2_);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	__m128 comX = zero, comY = zero, comZ = zero;
+	__m128 sepX = zero, sepY = zero, sepZ = zero;
+	__m128 numAttract = zero, numRepel = zero, numAlign = zero;
+
+	unsigned i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 ox = _mm_loadu_ps(posX + i);
+		__m128 oy = _mm_loadu_ps(posY + i);
+		__m128 oz = _mm_loadu_ps(posZ + i);
+		__m128 dx = _mm_sub_ps(px, ox);
+		__m128 dy = _mm_sub_ps(py, oy);
+		__m128 dz = _mm_sub_ps(pz, oz);
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+		// Masks are all ones in lanes that pass; AND-ing with them drops the other lanes, including inf/nan from d2 == 0
+		__m128 valid = _mm_cmpgt_ps(d2, zero);
+		__m128 inAttract = _mm_and_ps(valid, _mm_cmplt_ps(d2, attract2));
+		__m128 inRepel = _mm_and_ps(valid, _mm_cmplt_ps(d2, repel2));
+		__m128 inAlign = _mm_and_ps(valid, _mm_cmplt_ps(d2, align2));
+
+		comX = _mm_add_ps(comX, _mm_and_ps(inAttract, ox));
+		comY = _mm_add_ps(comY, _mm_and_ps(inAttract, oy));
+		comZ = _mm_add_ps(comZ, _mm_and_ps(inAttract, oz));
+		numAttract = _mm_add_ps(numAttract, _mm_and_ps(inAttract, one));
+
+		__m128 invD2 = _mm_div_ps(one, d2);
+		sepX = _mm_add_ps(sepX, _mm_and_ps(inRepel, _mm_mul_ps(dx, invD2)));
+		sepY = _mm_add_ps(sepY, _mm_and_ps(inRepel, _mm_mul_ps(dy, invD2)));
+		sepZ = _mm_add_ps(sepZ, _mm_and_ps(inRepel, _mm_mul_ps(dz, invD2)));
+		numRepel = _mm_add_ps(numRepel, _mm_and_ps(inRepel, one));
+
+		numAlign = _mm_add_ps(numAlign, _mm_and_ps(inAlign, one));
+	}
+
+	sums.comX_ += HorizontalSum(comX);
+	sums.comY_ += HorizontalSum(comY);
+	sums.comZ_ += HorizontalSum(comZ);
+	sums.sepX_ += HorizontalSum(sepX);
+	sums.sepY_ += HorizontalSum(sepY);
+	sums.sepZ_ += HorizontalSum(sepZ);
+	sums.numAttract_ += HorizontalSum(numAttract);
+	sums.numRepel_ += HorizontalSum(numRepel);
+	sums.numAlign_ += HorizontalSum(numAlign);
+
+	// Remainder that does not fill a whole register
+	SumScalar(pos, posX + i, posY + i, posZ + i, count - i, ranges, sums);
+}
+#endif
+
+#ifdef FLOCK_KERNEL_AVX2
+FLOCK_KERNEL_AVX2_TARGET static inline float HorizontalSum(__m256 v)
+{
+	float lanes[8];
+	_mm256_storeu_ps(lanes, v);
+	return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+FLOCK_KERNEL_AVX2_TARGET static void SumAVX2(const Vector3& pos, const float* posX, const float* posY, const float* posZ,
+	unsigned count, const FlockRanges& ranges, FlockSums& sums)
+{
+	const __m256 px = _mm256_set1_ps(pos.x_);
+	const __m256 py = _mm256_set1_ps(pos.y_);
+	const __m256 pz = _mm256_set1_ps(pos.z_);
+	const __m256 attract2 = _mm256_set1_ps(ranges.attract2_);
+	const __m256 repel2 = _mm256_set1_ps(ranges.repel2_);
+	const __m256 align2 = _mm256_set1_ps(ranges.align2_);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	__m256 comX = zero, comY = zero, comZ = zero;
+	__m256 sepX = zero, sepY = zero, sepZ = zero;
+	__m256 numAttract = zero, numRepel = zero, numAlign = zero;
+
+	unsigned i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 ox = _mm256_loadu_ps(posX + i);
+		__m256 oy = _mm256_loadu_ps(posY + i);
+		__m256 oz = _mm256_loadu_ps(posZ + i);
+		__m256 dx = _mm256_sub_ps(px, ox);
+		__m256 dy = _mm256_sub_ps(py, oy);
+		__m256 dz = _mm256_sub_ps(pz, oz);
+		// Separate multiply and add rather than FMA, so the rounding matches the scalar reference
+		__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+
+		__m256 valid = _mm256_cmp_ps(d2, zero, _CMP_GT_OQ);
+		__m256 inAttract = _mm256_and_ps(valid, _mm256_cmp_ps(d2, attract2, _CMP_LT_OQ));
+		__m256 inRepel = _mm256_and_ps(valid, _mm256_cmp_ps(d2, repel2, _CMP_LT_OQ));
+		__m256 inAlign = _mm256_and_ps(valid, _mm256_cmp_ps(d2, align2, _CMP_LT_OQ));
+
+		comX = _mm256_add_ps(comX, _mm256_and_ps(inAttract, ox));
+		comY = _mm256_add_ps(comY, _mm256_and_ps(inAttract, oy));
+		comZ = _mm256_add_ps(comZ, _mm256_and_ps(inAttract, oz));
+		numAttract = _mm256_add_ps(numAttract, _mm256_and_ps(inAttract, one));
+
+		__m256 invD2 = _mm256_div_ps(one, d2);
+		sepX = _mm256_add_ps(sepX, _mm256_and_ps(inRepel, _mm256_mul_ps(dx, invD2)));
+		sepY = _mm256_add_ps(sepY, _mm256_and_ps(inRepel, _mm256_mul_ps(dy, invD2)));
+		sepZ = _mm256_add_ps(sepZ, _mm256_and_ps(inRepel, _mm256_mul_ps(dz, invD2)));
+		numRepel = _mm256_add_ps(numRepel, _mm256_and_ps(inRepel, one));
+
+		numAlign = _mm256_add_ps(numAlign, _mm256_and_ps(inAlign, one));
+	}
+
+	sums.comX_ += HorizontalSum(comX);
+	sums.comY_ += HorizontalSum(comY);
+	sums.comZ_ += HorizontalSum(comZ);
+	sums.sepX_ += HorizontalSum(sepX);
+	sums.sepY_ += HorizontalSum(sepY);
+	sums.sepZ_ += HorizontalSum(sepZ);
+	sums.numAttract_ += HorizontalSum(numAttract);
+	sums.numRepel_ += HorizontalSum(numRepel);
+	sums.numAlign_ += HorizontalSum(numAlign);
+
+	// Remainder of up to 7 neighbours goes through the 4-wide path and then scalar
+	SumSSE2(pos, posX + i, posY + i, posZ + i, count - i, ranges, sums);
+}
+#endif
+
+static bool CPUHasAVX2()
+{
+#if defined(FLOCK_KERNEL_AVX2) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	// AVX needs both CPU support and the OS saving the YMM registers on context switches
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)))
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(FLOCK_KERNEL_AVX2)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#else
+	return false;
+#endif
+}
+
+static FlockKernelType DetectSupportedType()
+{
+	if (CPUHasAVX2())
+		return FKT_AVX2;
+#ifdef FLOCK_KERNEL_SSE2
+	return FKT_SSE2;
+#else
+	return FKT_SCALAR;
+#endif
+}
+
+static const FlockSumFunction sumFunctions[] =
+{
+	SumScalar,
+#ifdef FLOCK_KERNEL_SSE2
+	SumSSE2,
+#else
+	SumScalar,
+#endif
+#ifdef FLOCK_KERNEL_AVX2
+	SumAVX2
+#else
+	SumScalar
+#endif
+};
+
+static const char* typeNames[] =
+{
+	"scalar",
+	"sse2",
+	"avx2"
+};
+
+static const FlockKernelType supportedType = DetectSupportedType();
+static FlockKernelType currentType = supportedType;
+
+void FlockKernel::Sum(const Vector3& pos, const float* posX, const float* posY, const float* posZ, unsigned count,
+	const FlockRanges& ranges, FlockSums& sums)
+{
+	sumFunctions[currentType](pos, posX, posY, posZ, count, ranges, sums);
+}
+
+void FlockKernel::Sum(FlockKernelType type, const Vector3& pos, const float* posX, const float* posY, const float* posZ,
+	unsigned count, const FlockRanges& ranges, FlockSums& sums)
+{
+	if (type > supportedType)
+		type = FKT_SCALAR;
+	sumFunctions[type](pos, posX, posY, posZ, count, ranges, sums);
+}
+
+void FlockKernel::SumIndexed(const Vector3& pos, const float* posX, const float* posY, const float* posZ,
+	const unsigned* indices, unsigned count, const FlockRanges& ranges, FlockSums& sums)
+{
+	packX_.Resize(count);
+	packY_.Resize(count);
+	packZ_.Resize(count);
+	for (unsigned k = 0; k < count; ++k)
+	{
+		unsigned i = indices[k];
+		packX_[k] = posX[i];
+		packY_[k] = posY[i];
+		packZ_[k] = posZ[i];
+	}
+	Sum(pos, packX_.Buffer(), packY_.Buffer(), packZ_.Buffer(), count, ranges, sums);
+}
+
+void FlockKernel::SetType(FlockKernelType type)
+{
+	currentType = Min(type, supportedType);
+}
+
+FlockKernelType FlockKernel::GetType()
+{
+	return currentType;
+}
+
+FlockKernelType FlockKernel::GetSupportedType()
+{
+	return supportedType;
+}
+
+const char* FlockKernel::GetTypeName(FlockKernelType type)
+{
+	return type < MAX_FLOCK_KERNEL_TYPES ? typeNames[type] : "unknown";
+}
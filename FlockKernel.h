@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Instruction set used by the flocking kernel.
+enum FlockKernelType
+{
+	FKT_SCALAR = 0,
+	FKT_SSE2,
+	FKT_AVX2,
+	MAX_FLOCK_KERNEL_TYPES
+};
+
+/// Squared neighbour ranges tested by the kernel.
+struct FlockRanges
+{
+	/// Squared attraction range.
+	float attract2_;
+	/// Squared repulsion range.
+	float repel2_;
+	/// Squared alignment range.
+	float align2_;
+};
+
+/// Neighbour sums of one boid. Boids::SteeringForce turns them into a force.
+struct FlockSums
+{
+	/// Construct with all sums zero.
+	FlockSums() :
+		comX_(0.0f), comY_(0.0f), comZ_(0.0f),
+		sepX_(0.0f), sepY_(0.0f), sepZ_(0.0f),
+		numAttract_(0.0f), numRepel_(0.0f), numAlign_(0.0f)
+	{
+	}
+
+	/// Sum of neighbour positions inside attraction range.
+	float comX_, comY_, comZ_;
+	/// Sum of separation / distance^2 inside repulsion range.
+	float sepX_, sepY_, sepZ_;
+	/// Neighbours inside attraction range.
+	float numAttract_;
+	/// Neighbours inside repulsion range.
+	float numRepel_;
+	/// Neighbours inside alignment range.
+	float numAlign_;
+};
+
+/// Innermost flocking loop: distance test and cohesion/separation/alignment accumulation for one boid against a run
+/// of neighbours. The scalar path is the reference; the SSE2 and AVX2 paths test 4 or 8 neighbours per step and the
+/// best one the CPU supports is chosen at startup. Neighbours at exactly the boid's own position, the boid itself
+/// included, are skipped.
+class FlockKernel
+{
+public:
+	/// Add the neighbours among count contiguous positions to sums, using the current kernel type.
+	static void Sum(const Vector3& pos, const float* posX, const float* posY, const float* posZ, unsigned count,
+		const FlockRanges& ranges, FlockSums& sums);
+	/// Add the neighbours among count contiguous positions to sums with a specific kernel type. An unsupported type falls back to scalar.
+	static void Sum(FlockKernelType type, const Vector3& pos, const float* posX, const float* posY, const float* posZ,
+		unsigned count, const FlockRanges& ranges, FlockSums& sums);
+	/// Add the neighbours listed by index to sums. They are packed into contiguous scratch arrays first so the vector path can stream them.
+	void SumIndexed(const Vector3& pos, const float* posX, const float* posY, const float* posZ, const unsigned* indices,
+		unsigned count, const FlockRanges& ranges, FlockSums& sums);
+
+	/// Select the kernel type. Clamped to what the CPU supports.
+	static void SetType(FlockKernelType type);
+	/// Return the kernel type in use.
+	static FlockKernelType GetType();
+	/// Return the best kernel type this CPU and build support.
+	static FlockKernelType GetSupportedType();
+	/// Return a short name for a kernel type.
+	static const char* GetTypeName(FlockKernelType type);
+
+private:
+	/// Packed neighbour positions for SumIndexed.
+	PODVector<float> packX_;
+	PODVector<float> packY_;
+	PODVector<float> packZ_;
+};
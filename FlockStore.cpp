@@ -0,0 +1,37 @@
+#include "FlockStore.h"
+
+FlockStore::FlockStore()
+{
+}
+
+static void ResizeAndClear(PODVector<float>& values, unsigned size)
+{
+	values.Resize(size);
+	for (unsigned i = 0; i < size; ++i)
+		values[i] = 0.0f;
+}
+
+void FlockStore::Resize(unsigned numFlocks, unsigned flockSize)
+{
+	unsigned numBoids = numFlocks * flockSize;
+
+	ResizeAndClear(posX_, numBoids);
+	ResizeAndClear(posY_, numBoids);
+	ResizeAndClear(posZ_, numBoids);
+	ResizeAndClear(velX_, numBoids);
+	ResizeAndClear(velY_, numBoids);
+	ResizeAndClear(velZ_, numBoids);
+	ResizeAndClear(forceX_, numBoids);
+	ResizeAndClear(forceY_, numBoids);
+	ResizeAndClear(forceZ_, numBoids);
+
+	flockId_.Resize(numBoids);
+	flockStart_.Resize(numFlocks + 1);
+	for (unsigned f = 0; f < numFlocks; ++f)
+	{
+		flockStart_[f] = f * flockSize;
+		for (unsigned i = 0; i < flockSize; ++i)
+			flockId_[f * flockSize + i] = f;
+	}
+	flockStart_[numFlocks] = numBoids;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Structure-of-arrays state of every boid in every flock.
+/// Each component lives in its own contiguous float array so the flocking loops stream dense memory instead of
+/// chasing pointers into Bullet. Boids of one flock are stored next to each other: flock f is the index range
+/// [GetFlockStart(f), GetFlockStart(f) + GetFlockSize(f)).
+class FlockStore
+{
+public:
+	FlockStore();
+
+	/// Size the store for numFlocks flocks of flockSize boids each. All state is reset to zero.
+	void Resize(unsigned numFlocks, unsigned flockSize);
+
+	/// Return total number of boids.
+	unsigned GetNumBoids() const { return flockId_.Size(); }
+	/// Return number of flocks.
+	unsigned GetNumFlocks() const { return flockStart_.Size() ? flockStart_.Size() - 1 : 0; }
+	/// Return index of the first boid of a flock.
+	unsigned GetFlockStart(unsigned flock) const { return flockStart_[flock]; }
+	/// Return number of boids in a flock.
+	unsigned GetFlockSize(unsigned flock) const { return flockStart_[flock + 1] - flockStart_[flock]; }
+
+	/// Return position of a boid.
+	Vector3 GetPosition(unsigned i) const { return Vector3(posX_[i], posY_[i], posZ_[i]); }
+	/// Return velocity of a boid.
+	Vector3 GetVelocity(unsigned i) const { return Vector3(velX_[i], velY_[i], velZ_[i]); }
+	/// Return accumulated force of a boid.
+	Vector3 GetForce(unsigned i) const { return Vector3(forceX_[i], forceY_[i], forceZ_[i]); }
+	/// Set position of a boid.
+	void SetPosition(unsigned i, const Vector3& p) { posX_[i] = p.x_; posY_[i] = p.y_; posZ_[i] = p.z_; }
+	/// Set velocity of a boid.
+	void SetVelocity(unsigned i, const Vector3& v) { velX_[i] = v.x_; velY_[i] = v.y_; velZ_[i] = v.z_; }
+	/// Set accumulated force of a boid.
+	void SetForce(unsigned i, const Vector3& f) { forceX_[i] = f.x_; forceY_[i] = f.y_; forceZ_[i] = f.z_; }
+
+	/// Position components.
+	PODVector<float> posX_;
+	PODVector<float> posY_;
+	PODVector<float> posZ_;
+	/// Velocity components.
+	PODVector<float> velX_;
+	PODVector<float> velY_;
+	PODVector<float> velZ_;
+	/// Force components, written by the flocking pass and applied to the scene afterwards.
+	PODVector<float> forceX_;
+	PODVector<float> forceY_;
+	PODVector<float> forceZ_;
+	/// Flock each boid belongs to.
+	PODVector<unsigned> flockId_;
+
+private:
+	/// First boid of each flock, with one extra entry holding the total so GetFlockSize works for the last flock.
+	PODVector<unsigned> flockStart_;
+};
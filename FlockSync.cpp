@@ -0,0 +1,261 @@
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/VectorBuffer.h>
+
+#include "FlockSync.h"
+#include "NetStats.h"
+
+/// Bytes of exact state per boid: position and velocity as floats.
+static const unsigned BYTES_PER_BOID_STATE = 6 * 4;
+
+static void WriteBoidState(Serializer& dest, const FlockStore& store, unsigned i)
+{
+	dest.WriteVector3(store.GetPosition(i));
+	dest.WriteVector3(store.GetVelocity(i));
+}
+
+FlockSyncServer::FlockSyncServer() :
+	nextBoid_(0),
+	correctionsPerUpdate_(DEFAULT_FLOCK_CORRECTIONS),
+	correctionPeriod_(DEFAULT_FLOCK_CORRECTION_PERIOD),
+	bytesSent_(0),
+	correctionsSent_(0),
+	netStats_(0)
+{
+}
+
+void FlockSyncServer::AddCaptures(const BoidSet& boidSet)
+{
+	const PODVector<unsigned>& captured = boidSet.GetCaptured();
+	for (unsigned i = 0; i < captured.Size(); ++i)
+	{
+		if (!captured_.Contains(captured[i]))
+			captured_.Push(captured[i]);
+	}
+}
+
+void FlockSyncServer::Send(const BoidSet& boidSet, const Vector<SharedPtr<Connection> >& connections)
+{
+	const FlockStore& store = boidSet.store;
+	unsigned numBoids = store.GetNumBoids();
+
+	unsigned corrections = correctionsPerUpdate_;
+	if (correctionPeriod_)
+		corrections = Max(corrections, (numBoids + correctionPeriod_ - 1) / correctionPeriod_);
+	drift_.Clear();
+	for (unsigned k = 0; k < corrections && k < numBoids; ++k)
+	{
+		nextBoid_ = nextBoid_ < numBoids ? nextBoid_ : 0;
+		drift_.Push(nextBoid_++);
+	}
+
+	// Both lists are the same for every client, so encode them once
+	VectorBuffer captures;
+	VectorBuffer drift;
+	if (!captured_.Empty())
+		WriteCorrection(captures, boidSet, captured_);
+	if (!drift_.Empty())
+		WriteCorrection(drift, boidSet, drift_);
+
+	for (unsigned i = 0; i < connections.Size(); ++i)
+	{
+		Connection* connection = connections[i];
+		if (!connection->IsSceneLoaded())
+			continue;
+
+		// The setup is reliable and ordered, so the capture corrections sent after it can never arrive first
+		if (!clients_.Contains(connection))
+		{
+			VectorBuffer setup;
+			WriteSetup(setup, boidSet);
+			connection->SendMessage(MSG_FLOCKSETUP, true, true, setup);
+			bytesSent_ += setup.GetSize();
+			if (netStats_)
+				netStats_->CountSent(connection, MSG_FLOCKSETUP, setup.GetSize());
+			clients_.Insert(connection);
+			continue;
+		}
+
+		// A lost capture would leave the client's boid swimming on, drift is fixed again on the next round
+		if (captures.GetSize())
+		{
+			connection->SendMessage(MSG_FLOCKCORRECTION, true, true, captures);
+			bytesSent_ += captures.GetSize();
+			if (netStats_)
+				netStats_->CountSent(connection, MSG_FLOCKCORRECTION, captures.GetSize());
+			correctionsSent_ += captured_.Size();
+		}
+		if (drift.GetSize())
+		{
+			connection->SendMessage(MSG_FLOCKCORRECTION, false, false, drift);
+			bytesSent_ += drift.GetSize();
+			if (netStats_)
+				netStats_->CountSent(connection, MSG_FLOCKCORRECTION, drift.GetSize());
+			correctionsSent_ += drift_.Size();
+		}
+	}
+
+	captured_.Clear();
+}
+
+void FlockSyncServer::RemoveConnection(Connection* connection)
+{
+	clients_.Erase(connection);
+}
+
+void FlockSyncServer::WriteSetup(Serializer& dest, const BoidSet& boidSet) const
+{
+	const FlockStore& store = boidSet.store;
+	dest.WriteUInt(boidSet.GetTick());
+	dest.WriteVLE(boidSet.GetNumFlocks());
+	dest.WriteVLE(boidSet.GetFlockSize());
+	dest.WriteUByte((unsigned char)FlockKernel::GetType());
+	dest.WriteBool(Boids::UseSpatialGrid);
+	dest.WriteFloat(Boids::Range_FAttract);
+	dest.WriteFloat(Boids::Range_FRepel);
+	dest.WriteFloat(Boids::Range_FAlign);
+	dest.WriteFloat(Boids::FAttract_Vmax);
+	dest.WriteFloat(Boids::FAttract_Factor);
+	dest.WriteFloat(Boids::FRepel_Factor);
+	dest.WriteFloat(Boids::FAlign_Factor);
+	dest.WriteFloat(Boids::Speed_Min);
+	dest.WriteFloat(Boids::Speed_Max);
+	dest.WriteFloat(Boids::Height_Min);
+	dest.WriteFloat(Boids::Height_Max);
+	for (unsigned i = 0; i < store.GetNumBoids(); ++i)
+		WriteBoidState(dest, store, i);
+}
+
+void FlockSyncServer::WriteCorrection(Serializer& dest, const BoidSet& boidSet, const PODVector<unsigned>& boids) const
+{
+	dest.WriteUInt(boidSet.GetTick());
+	dest.WriteVLE(boids.Size());
+	for (unsigned i = 0; i < boids.Size(); ++i)
+	{
+		dest.WriteVLE(boids[i]);
+		WriteBoidState(dest, boidSet.store, boids[i]);
+	}
+}
+
+FlockSyncClient::FlockSyncClient() :
+	active_(false),
+	timeStep_(0.0f),
+	correctionsApplied_(0),
+	maxCorrection_(0.0f)
+{
+}
+
+void FlockSyncClient::HandleSetup(ResourceCache* cache, Scene* scene, BoidSet& boidSet, Deserializer& message)
+{
+	unsigned tick = message.ReadUInt();
+	unsigned numFlocks = message.ReadVLE();
+	unsigned flockSize = message.ReadVLE();
+	FlockKernelType kernel = (FlockKernelType)message.ReadUByte();
+	bool useGrid = message.ReadBool();
+	float parameters[11];
+	for (unsigned p = 0; p < 11; ++p)
+		parameters[p] = message.ReadFloat();
+	if (message.GetSize() - message.GetPosition() < numFlocks * flockSize * BYTES_PER_BOID_STATE)
+	{
+		Log::WriteRaw("Malformed flock setup from the server\n");
+		return;
+	}
+
+	// The same kernel sums neighbours in the same order as the server. A CPU without it falls back and drifts, which
+	// the corrections fix
+	FlockKernel::SetType(kernel);
+	if (FlockKernel::GetType() != kernel)
+		Log::WriteRaw("Server flocking kernel not supported, the local flock will drift between corrections\n");
+	Boids::UseSpatialGrid = useGrid;
+	Boids::Range_FAttract = parameters[0];
+	Boids::Range_FRepel = parameters[1];
+	Boids::Range_FAlign = parameters[2];
+	Boids::FAttract_Vmax = parameters[3];
+	Boids::FAttract_Factor = parameters[4];
+	Boids::FRepel_Factor = parameters[5];
+	Boids::FAlign_Factor = parameters[6];
+	Boids::Speed_Min = parameters[7];
+	Boids::Speed_Max = parameters[8];
+	Boids::Height_Min = parameters[9];
+	Boids::Height_Max = parameters[10];
+
+	// The spawn only creates the nodes, every boid is then put where the server has it
+	boidSet.Clear();
+	boidSet.SetFlockLayout(numFlocks, flockSize);
+	boidSet.SetKinematic(true);
+	boidSet.SetReplicated(false);
+	boidSet.Initialise(cache, scene);
+	FlockStore& store = boidSet.store;
+	for (unsigned i = 0; i < store.GetNumBoids(); ++i)
+	{
+		store.SetPosition(i, message.ReadVector3());
+		store.SetVelocity(i, message.ReadVector3());
+		boidSet.boidList[i].pNode->SetTransform(store.GetPosition(i), Boids::Heading(store.GetVelocity(i)));
+	}
+	boidSet.SetTick(tick);
+
+	pending_.Clear();
+	active_ = true;
+}
+
+void FlockSyncClient::HandleCorrection(BoidSet& boidSet, Deserializer& message)
+{
+	if (!active_)
+		return;
+
+	Correction correction;
+	correction.tick_ = message.ReadUInt();
+	unsigned count = message.ReadVLE();
+	for (unsigned k = 0; k < count; ++k)
+	{
+		correction.boid_ = message.ReadVLE();
+		if (message.GetSize() - message.GetPosition() < BYTES_PER_BOID_STATE || correction.boid_ >= boidSet.store.GetNumBoids())
+			return;
+		correction.position_ = message.ReadVector3();
+		correction.velocity_ = message.ReadVector3();
+
+		if ((int)(correction.tick_ - boidSet.GetTick()) > 0)
+			pending_.Push(correction);
+		else
+			Apply(boidSet, correction);
+	}
+}
+
+void FlockSyncClient::Apply(BoidSet& boidSet, const Correction& correction)
+{
+	Vector3 pos = correction.position_;
+	Vector3 vel = correction.velocity_;
+	unsigned steps = boidSet.GetTick() - correction.tick_;
+	if (steps)
+		boidSet.Advance(correction.boid_, pos, vel, steps, timeStep_);
+
+	maxCorrection_ = Max(maxCorrection_, (boidSet.store.GetPosition(correction.boid_) - pos).Length());
+	boidSet.SetState(correction.boid_, pos, vel);
+	++correctionsApplied_;
+}
+
+void FlockSyncClient::Update(BoidSet& boidSet, float timeStep)
+{
+	if (!active_)
+		return;
+	boidSet.Update(timeStep);
+	timeStep_ = timeStep;
+
+	for (unsigned k = 0; k < pending_.Size();)
+	{
+		if ((int)(pending_[k].tick_ - boidSet.GetTick()) > 0)
+		{
+			++k;
+			continue;
+		}
+		Apply(boidSet, pending_[k]);
+		pending_.Erase(k);
+	}
+}
+
+void FlockSyncClient::Clear(BoidSet& boidSet)
+{
+	if (active_)
+		boidSet.Clear();
+	active_ = false;
+	pending_.Clear();
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <Urho3D/Container/HashSet.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "Boids.h"
+
+class NetStats;
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Network message carrying the flock parameters and exact state, server to client, once per client.
+static const int MSG_FLOCKSETUP = 0x102;
+/// Network message carrying exact state of a few boids at a server tick, server to client.
+static const int MSG_FLOCKCORRECTION = 0x103;
+/// Default least number of boids sent each network update to fix drift, on top of the captured ones.
+static const unsigned DEFAULT_FLOCK_CORRECTIONS = 4;
+/// Default number of network updates every boid is fixed within, 5 seconds at the 30 fps network rate. Large flocks send
+/// more than DEFAULT_FLOCK_CORRECTIONS boids an update to keep to it.
+static const unsigned DEFAULT_FLOCK_CORRECTION_PERIOD = 150;
+
+/// Server side of client simulated flocks. A kinematic flock is a pure function of its parameters, its state and the
+/// number of steps taken, so instead of streaming every boid the server sends each client the flocking parameters and
+/// the exact state at the current tick once, and the client runs the same BoidSet from there. The setup is 24 bytes a
+/// boid, paid once per join; the spawn seed alone would not do, as the state has moved on through captures since.
+/// Only what the client cannot work out itself follows: boids the sharks captured, sent reliably, and boids in turn,
+/// sent unreliably, which catch any drift from clients running a different kernel or falling a step behind. Every boid
+/// is fixed within the correction period, so drift bandwidth grows with the flock, a few hundred bytes a second for the
+/// game's flocks and about 24 bytes per boid every period beyond that.
+class FlockSyncServer
+{
+public:
+	FlockSyncServer();
+
+	/// Note the boids the last BoidSet::Update captured. Called after every update, as several can run per network update.
+	void AddCaptures(const BoidSet& boidSet);
+	/// Send the setup to every connection whose scene has just finished loading, and the corrections to the rest.
+	void Send(const BoidSet& boidSet, const Vector<SharedPtr<Connection> >& connections);
+	/// Forget a disconnected client.
+	void RemoveConnection(Connection* connection);
+	/// Set the least number of boids sent each update to fix drift. 0 together with a correction period of 0 sends captures only.
+	void SetCorrectionsPerUpdate(unsigned count) { correctionsPerUpdate_ = count; }
+	/// Set the number of updates every boid is fixed within, sending more boids an update than the least if needed. 0 only sends the least.
+	void SetCorrectionPeriod(unsigned updates) { correctionPeriod_ = updates; }
+	/// Set the network stats setups and corrections are counted in, or null.
+	void SetStats(NetStats* stats) { netStats_ = stats; }
+
+	/// Return the least number of boids sent each update to fix drift.
+	unsigned GetCorrectionsPerUpdate() const { return correctionsPerUpdate_; }
+	/// Return the number of updates every boid is fixed within.
+	unsigned GetCorrectionPeriod() const { return correctionPeriod_; }
+	/// Return total payload bytes sent to all connections.
+	unsigned long long GetBytesSent() const { return bytesSent_; }
+	/// Return the number of boid corrections sent to all connections.
+	unsigned long long GetCorrectionsSent() const { return correctionsSent_; }
+
+private:
+	/// Write the setup message.
+	void WriteSetup(Serializer& dest, const BoidSet& boidSet) const;
+	/// Write a correction message for the boids listed.
+	void WriteCorrection(Serializer& dest, const BoidSet& boidSet, const PODVector<unsigned>& boids) const;
+
+	/// Clients that have been sent the setup.
+	HashSet<Connection*> clients_;
+	/// Boids captured since the last send.
+	PODVector<unsigned> captured_;
+	/// Boids to fix drift of this send.
+	PODVector<unsigned> drift_;
+	/// Next boid to fix drift of.
+	unsigned nextBoid_;
+	/// Least boids sent each update to fix drift.
+	unsigned correctionsPerUpdate_;
+	/// Updates every boid is fixed within.
+	unsigned correctionPeriod_;
+	/// Payload bytes sent.
+	unsigned long long bytesSent_;
+	/// Boid corrections sent.
+	unsigned long long correctionsSent_;
+	/// Network stats to count setups and corrections in.
+	NetStats* netStats_;
+};
+
+/// Client side of client simulated flocks. Builds a local kinematic BoidSet from the server's setup, steps it with the
+/// scene's physics and overwrites boids with the server's corrections. A correction for a tick the local flock has
+/// already passed is stepped on through the ticks in between, flocking and clamped as the server did; one for a tick
+/// still ahead is held until the local flock gets there.
+class FlockSyncClient
+{
+public:
+	FlockSyncClient();
+
+	/// Apply a MSG_FLOCKSETUP payload: take the server's parameters and create the flock in the scene with its state.
+	void HandleSetup(ResourceCache* cache, Scene* scene, BoidSet& boidSet, Deserializer& message);
+	/// Apply a MSG_FLOCKCORRECTION payload.
+	void HandleCorrection(BoidSet& boidSet, Deserializer& message);
+	/// Step the flock once, if the setup has arrived.
+	void Update(BoidSet& boidSet, float timeStep);
+	/// Remove the flock and wait for a new setup.
+	void Clear(BoidSet& boidSet);
+
+	/// Return whether the setup has arrived and the flock is being simulated.
+	bool IsActive() const { return active_; }
+	/// Return the number of corrections held for a tick still ahead.
+	unsigned GetNumPending() const { return pending_.Size(); }
+	/// Return the number of boid corrections applied.
+	unsigned GetCorrectionsApplied() const { return correctionsApplied_; }
+	/// Return the largest distance a correction moved a boid, how far the local simulation had drifted.
+	float GetMaxCorrection() const { return maxCorrection_; }
+
+private:
+	/// A boid's exact state at a server tick.
+	struct Correction
+	{
+		unsigned tick_;
+		unsigned boid_;
+		Vector3 position_;
+		Vector3 velocity_;
+	};
+
+	/// Overwrite a boid with a correction for the local tick or an older one.
+	void Apply(BoidSet& boidSet, const Correction& correction);
+
+	/// Whether the flock is being simulated.
+	bool active_;
+	/// Time step of the last update, used to step a correction for an older tick on.
+	float timeStep_;
+	/// Corrections for ticks the local flock has not reached yet.
+	PODVector<Correction> pending_;
+	/// Boid corrections applied.
+	unsigned correctionsApplied_;
+	/// Largest correction distance.
+	float maxCorrection_;
+};
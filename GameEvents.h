@@ -0,0 +1,20 @@
+#pragma once
+
+#include <Urho3D/Math/StringHash.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+// Port the server listens on and clients connect to unless told otherwise, shared with the bot client
+static const unsigned short SERVER_PORT = 2345;
+
+// Remote events between the game and its clients, shared with the bot client
+
+// Custom remote event we use to tell the client which object they control
+static const StringHash E_CLIENTOBJECTAUTHORITY("ClientObjectAuthority");
+// Identifier for the node ID parameter in the event data
+static const StringHash PLAYER_ID("IDENTITY");
+// Custom event on server, client has pressed button that it wants to start game
+static const StringHash E_CLIENTISREADY("ClientReadyToStart");
+// Seconds behind the newest state the client shows the boids, sent with E_CLIENTISREADY for lag compensated captures
+static const StringHash VIEW_DELAY("ViewDelay");
@@ -0,0 +1,179 @@
+#include <Urho3D/Math/MathDefs.h>
+
+#include "InputChannel.h"
+
+/// Bits of the packed buttons.
+static const unsigned char INPUT_BUTTON_BITS = 0x3f;
+/// Set in an older input's button byte when its yaw or pitch differs from the newer input's.
+static const unsigned char INPUT_TURNED = 0x40;
+/// Size of the server's input ring.
+static const unsigned INPUT_RING = INPUT_BACKLOG * 2;
+
+/// Return whether sequence a is newer than sequence b, allowing for wrapping.
+static bool IsNewer(unsigned a, unsigned b)
+{
+	return (int)(a - b) > 0;
+}
+
+/// Write a 16 bit change so small changes either way take one byte.
+static void WriteAngleDelta(Serializer& dest, unsigned short delta)
+{
+	int value = (short)delta;
+	dest.WriteVLE((unsigned)((value << 1) ^ (value >> 31)));
+}
+
+static unsigned short ReadAngleDelta(Deserializer& source)
+{
+	unsigned value = source.ReadVLE();
+	return (unsigned short)((value >> 1) ^ (0u - (value & 1)));
+}
+
+unsigned short InputFrame::QuantizeAngle(float degrees)
+{
+	float turns = degrees / 360.0f;
+	turns -= floorf(turns);
+	return (unsigned short)((int)(turns * 65536.0f + 0.5f) & 0xffff);
+}
+
+float InputFrame::DequantizeAngle(unsigned short angle)
+{
+	return (short)angle * (360.0f / 65536.0f);
+}
+
+InputSender::InputSender() :
+	newest_(0),
+	numInputs_(0),
+	redundancy_(DEFAULT_INPUT_REDUNDANCY),
+	bytesSent_(0)
+{
+}
+
+void InputSender::SetRedundancy(unsigned count)
+{
+	redundancy_ = Clamp(count, 1u, MAX_INPUT_REDUNDANCY);
+}
+
+void InputSender::Push(const InputFrame& input)
+{
+	newest_ = (newest_ + 1) % MAX_INPUT_REDUNDANCY;
+	inputs_[newest_] = input;
+	numInputs_ = Min(numInputs_ + 1, MAX_INPUT_REDUNDANCY);
+}
+
+bool InputSender::Write(VectorBuffer& dest)
+{
+	if (!numInputs_)
+		return false;
+
+	unsigned start = dest.GetSize();
+	unsigned count = Min(numInputs_, redundancy_);
+	const InputFrame& newest = inputs_[newest_];
+	dest.WriteVLE(count);
+	dest.WriteUInt(newest.sequence_);
+	dest.WriteUByte(newest.buttons_);
+	dest.WriteUShort(newest.yaw_);
+	dest.WriteUShort(newest.pitch_);
+
+	// Each older input is written against the one after it, which it nearly always matches
+	for (unsigned k = 1; k < count; ++k)
+	{
+		const InputFrame& newer = inputs_[(newest_ + MAX_INPUT_REDUNDANCY - k + 1) % MAX_INPUT_REDUNDANCY];
+		const InputFrame& input = inputs_[(newest_ + MAX_INPUT_REDUNDANCY - k) % MAX_INPUT_REDUNDANCY];
+		bool turned = input.yaw_ != newer.yaw_ || input.pitch_ != newer.pitch_;
+		dest.WriteUByte((unsigned char)((input.buttons_ & INPUT_BUTTON_BITS) | (turned ? INPUT_TURNED : 0)));
+		if (turned)
+		{
+			WriteAngleDelta(dest, (unsigned short)(newer.yaw_ - input.yaw_));
+			WriteAngleDelta(dest, (unsigned short)(newer.pitch_ - input.pitch_));
+		}
+	}
+
+	bytesSent_ += dest.GetSize() - start;
+	return true;
+}
+
+InputReceiver::InputReceiver() :
+	started_(false),
+	newest_(0),
+	numReceived_(0),
+	numSkipped_(0),
+	numRepeated_(0)
+{
+}
+
+void InputReceiver::HandleMessage(Deserializer& source)
+{
+	unsigned count = source.ReadVLE();
+	if (!count || count > MAX_INPUT_REDUNDANCY || source.GetSize() - source.GetPosition() < 9)
+		return;
+
+	InputFrame input;
+	input.sequence_ = source.ReadUInt();
+	input.buttons_ = source.ReadUByte() & INPUT_BUTTON_BITS;
+	input.yaw_ = source.ReadUShort();
+	input.pitch_ = source.ReadUShort();
+
+	// The first message starts the channel, everything in it is still to be applied
+	if (!started_)
+	{
+		started_ = true;
+		newest_ = input.sequence_;
+		current_.sequence_ = input.sequence_ - count;
+	}
+	else if (IsNewer(input.sequence_, newest_))
+		newest_ = input.sequence_;
+
+	for (unsigned k = 0;;)
+	{
+		// Only inputs still to come are kept, an input already applied or skipped stays that way
+		InputFrame& slot = pending_[input.sequence_ % INPUT_RING];
+		if (IsNewer(input.sequence_, current_.sequence_) && slot.sequence_ != input.sequence_)
+		{
+			slot = input;
+			++numReceived_;
+		}
+
+		if (++k == count || source.IsEof())
+			break;
+		unsigned char bits = source.ReadUByte();
+		--input.sequence_;
+		input.buttons_ = bits & INPUT_BUTTON_BITS;
+		if (bits & INPUT_TURNED)
+		{
+			input.yaw_ -= ReadAngleDelta(source);
+			input.pitch_ -= ReadAngleDelta(source);
+		}
+	}
+}
+
+bool InputReceiver::Next(InputFrame& input)
+{
+	if (!started_)
+		return false;
+
+	// A client stepping faster than the server would otherwise fall further and further behind
+	if ((int)(newest_ - current_.sequence_) > (int)INPUT_BACKLOG)
+	{
+		numSkipped_ += newest_ - INPUT_BACKLOG - current_.sequence_;
+		current_.sequence_ = newest_ - INPUT_BACKLOG;
+	}
+
+	// The next input in order, or failing that the first after it that made it through
+	while (IsNewer(newest_, current_.sequence_))
+	{
+		unsigned sequence = current_.sequence_ + 1;
+		const InputFrame& slot = pending_[sequence % INPUT_RING];
+		if (slot.sequence_ == sequence)
+		{
+			current_ = slot;
+			input = current_;
+			return true;
+		}
+		current_.sequence_ = sequence;
+		++numSkipped_;
+	}
+
+	++numRepeated_;
+	input = current_;
+	return true;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Network message carrying a client's newest inputs, client to server.
+static const int MSG_INPUT = 0x105;
+/// Default number of inputs in every input message. At 60 steps and 30 messages a second each input goes out twice
+/// more after its own message, so two lost messages in a row lose nothing.
+static const unsigned DEFAULT_INPUT_REDUNDANCY = 6;
+/// Most inputs a message can carry.
+static const unsigned MAX_INPUT_REDUNDANCY = 32;
+/// Inputs the server holds for a client. Any more behind the newest and the oldest are skipped, so a client whose
+/// clock runs fast cannot build up lag.
+static const unsigned INPUT_BACKLOG = 8;
+
+/// Bits of InputFrame::buttons_, in the order CharacterDemo::ToInput packs its CTRL_ buttons.
+enum InputButton
+{
+	IB_FORWARD = 1,
+	IB_BACK = 2,
+	IB_LEFT = 4,
+	IB_RIGHT = 8,
+	IB_UP = 16,
+	IB_DOWN = 32
+};
+
+/// One physics step of a client's input, as sent: the buttons in use packed into 6 bits, yaw and pitch as 16 bits.
+struct InputFrame
+{
+	InputFrame() :
+		sequence_(0),
+		buttons_(0),
+		yaw_(0),
+		pitch_(0)
+	{
+	}
+
+	/// Number of the step.
+	unsigned sequence_;
+	/// Packed buttons.
+	unsigned char buttons_;
+	/// Yaw, a full turn over the 16 bits.
+	unsigned short yaw_;
+	/// Pitch, a full turn over the 16 bits.
+	unsigned short pitch_;
+
+	/// Return an angle in degrees as 16 bits.
+	static unsigned short QuantizeAngle(float degrees);
+	/// Return 16 bits as an angle in degrees, in [-180, 180).
+	static float DequantizeAngle(unsigned short angle);
+};
+
+/// Client side of the input channel. Remembers the newest inputs and writes them all into every message: the newest
+/// in full, each older one as a byte of buttons followed, only if it turned, by the change in yaw and pitch.
+class InputSender
+{
+public:
+	InputSender();
+
+	/// Remember the input of a step.
+	void Push(const InputFrame& input);
+	/// Write the newest inputs into a message. Nothing is written before the first input.
+	bool Write(VectorBuffer& dest);
+	/// Forget every input.
+	void Clear() { numInputs_ = 0; }
+	/// Set the number of inputs in every message.
+	void SetRedundancy(unsigned count);
+
+	/// Return the number of inputs in every message.
+	unsigned GetRedundancy() const { return redundancy_; }
+	/// Return bytes written so far.
+	unsigned long long GetBytesSent() const { return bytesSent_; }
+
+private:
+	/// Newest inputs, newest at newest_.
+	InputFrame inputs_[MAX_INPUT_REDUNDANCY];
+	/// Index of the newest input.
+	unsigned newest_;
+	/// Number of inputs remembered.
+	unsigned numInputs_;
+	/// Number of inputs in every message.
+	unsigned redundancy_;
+	/// Bytes written.
+	unsigned long long bytesSent_;
+};
+
+/// Server side of the input channel for one client. Inputs are taken in order, one a physics step, whichever message
+/// brought them. An input lost from every message it was in is skipped; a step with no new input repeats the last.
+class InputReceiver
+{
+public:
+	InputReceiver();
+
+	/// Read an input message.
+	void HandleMessage(Deserializer& source);
+	/// Take the input for this physics step. False until the first input arrives.
+	bool Next(InputFrame& input);
+
+	/// Return whether an input has arrived.
+	bool IsStarted() const { return started_; }
+	/// Return the number of the newest input taken.
+	unsigned GetApplied() const { return current_.sequence_; }
+	/// Return the number of inputs received for the first time.
+	unsigned GetNumReceived() const { return numReceived_; }
+	/// Return the number of inputs skipped, lost or too far behind.
+	unsigned GetNumSkipped() const { return numSkipped_; }
+	/// Return the number of steps that repeated the last input.
+	unsigned GetNumRepeated() const { return numRepeated_; }
+
+private:
+	/// Whether an input has arrived.
+	bool started_;
+	/// Newest input number received.
+	unsigned newest_;
+	/// Input applied last.
+	InputFrame current_;
+	/// Inputs waiting, by number modulo the size.
+	InputFrame pending_[INPUT_BACKLOG * 2];
+	/// Inputs received for the first time.
+	unsigned numReceived_;
+	/// Inputs skipped.
+	unsigned numSkipped_;
+	/// Steps repeating the last input.
+	unsigned numRepeated_;
+};
@@ -0,0 +1,299 @@
+#include <Urho3D/IO/MemoryBuffer.h>
+
+#include "Interpolation.h"
+
+/// Updates to wait for before measuring the server's update interval.
+static const unsigned MIN_INTERVAL_SPAN = 8;
+/// Rate the arrival offset creeps later at, so a route that got slower is picked up. A faster one is taken at once.
+static const double OFFSET_RELAX = 0.02;
+/// Weight of a new arrival in the smoothed jitter.
+static const double JITTER_SMOOTHING = 0.1;
+
+/// Return whether counter a is newer than counter b, allowing for wrapping.
+static bool IsNewer(unsigned a, unsigned b)
+{
+	return (int)(a - b) > 0;
+}
+
+InterpolationClock::InterpolationClock() :
+	delay_(DEFAULT_INTERPOLATION_DELAY),
+	maxExtrapolation_(DEFAULT_MAX_EXTRAPOLATION)
+{
+	Reset();
+}
+
+void InterpolationClock::Reset()
+{
+	valid_ = false;
+	base_ = 0;
+	newest_ = 0;
+	baseTime_ = 0.0;
+	numArrivals_ = 0.0;
+	sumX_ = 0.0;
+	sumY_ = 0.0;
+	sumXX_ = 0.0;
+	sumXY_ = 0.0;
+	interval_ = 1.0 / 30.0;
+	offset_ = 0.0;
+	jitter_ = 0.0;
+	renderTick_ = 0.0f;
+}
+
+void InterpolationClock::SetDelay(float delay)
+{
+	delay_ = Max(delay, 0.0f);
+}
+
+void InterpolationClock::SetMaxExtrapolation(float time)
+{
+	maxExtrapolation_ = Max(time, 0.0f);
+}
+
+void InterpolationClock::Receive(unsigned counter, float time)
+{
+	if (!valid_)
+	{
+		valid_ = true;
+		base_ = counter;
+		newest_ = counter;
+		baseTime_ = time;
+		offset_ = time;
+		renderTick_ = -delay_ / (float)interval_;
+		return;
+	}
+
+	if (IsNewer(counter, newest_))
+		newest_ = counter;
+
+	// Fitted as a line through every arrival, so the jitter of single arrivals averages out
+	double x = ToTick(counter);
+	double y = time - baseTime_;
+	++numArrivals_;
+	sumX_ += x;
+	sumY_ += y;
+	sumXX_ += x * x;
+	sumXY_ += x * y;
+	double spread = numArrivals_ * sumXX_ - sumX_ * sumX_;
+	if (ToTick(newest_) >= MIN_INTERVAL_SPAN && spread > 0.0)
+		interval_ = Clamp((numArrivals_ * sumXY_ - sumX_ * sumY_) / spread, 0.001, 1.0);
+
+	double arrival = time - ToTick(counter) * interval_;
+	if (arrival < offset_)
+		offset_ = arrival;
+	else
+		offset_ += (arrival - offset_) * OFFSET_RELAX;
+	jitter_ += (Abs(arrival - offset_) - jitter_) * JITTER_SMOOTHING;
+}
+
+void InterpolationClock::Update(float time)
+{
+	if (valid_)
+		renderTick_ = (float)((time - delay_ - offset_) / interval_);
+}
+
+InterpolationBuffer::InterpolationBuffer() :
+	count_(0)
+{
+}
+
+void InterpolationBuffer::Push(float tick, const Vector3& position, const Quaternion& rotation)
+{
+	// Updates nearly always arrive in order, so search from the newest end
+	unsigned i = count_;
+	while (i > 0 && entries_[i - 1].tick_ > tick)
+		--i;
+	if (i > 0 && entries_[i - 1].tick_ == tick)
+	{
+		entries_[i - 1].position_ = position;
+		entries_[i - 1].rotation_ = rotation;
+		return;
+	}
+
+	// Full: the oldest goes, unless the new one is older still
+	if (count_ == INTERPOLATION_CAPACITY)
+	{
+		if (i == 0)
+			return;
+		for (unsigned k = 1; k < count_; ++k)
+			entries_[k - 1] = entries_[k];
+		--count_;
+		--i;
+	}
+	for (unsigned k = count_; k > i; --k)
+		entries_[k] = entries_[k - 1];
+	entries_[i].tick_ = tick;
+	entries_[i].position_ = position;
+	entries_[i].rotation_ = rotation;
+	++count_;
+}
+
+InterpolationResult InterpolationBuffer::Sample(float tick, float maxExtrapolation, Vector3& position, Quaternion& rotation)
+{
+	if (!count_)
+		return IR_NONE;
+
+	if (tick <= entries_[0].tick_)
+	{
+		position = entries_[0].position_;
+		rotation = entries_[0].rotation_;
+		return IR_HELD;
+	}
+
+	// Newest update at or before the tick. The one before it is kept too, to extrapolate from
+	unsigned k = 0;
+	while (k + 1 < count_ && entries_[k + 1].tick_ <= tick)
+		++k;
+	if (k > 1)
+	{
+		unsigned drop = k - 1;
+		for (unsigned m = drop; m < count_; ++m)
+			entries_[m - drop] = entries_[m];
+		count_ -= drop;
+		k = 1;
+	}
+
+	const Entry& a = entries_[k];
+	if (k + 1 < count_)
+	{
+		const Entry& b = entries_[k + 1];
+		float t = (tick - a.tick_) / (b.tick_ - a.tick_);
+		position = a.position_.Lerp(b.position_, t);
+		rotation = a.rotation_.Slerp(b.rotation_, t);
+		return IR_INTERPOLATED;
+	}
+
+	position = a.position_;
+	rotation = a.rotation_;
+	if (!k)
+		return IR_HELD;
+
+	const Entry& previous = entries_[k - 1];
+	float over = tick - a.tick_;
+	InterpolationResult result = IR_EXTRAPOLATED;
+	if (over > maxExtrapolation)
+	{
+		over = maxExtrapolation;
+		result = IR_HELD;
+	}
+	position += (a.position_ - previous.position_) * (over / (a.tick_ - previous.tick_));
+	return result;
+}
+
+NodeInterpolator::NodeInterpolator() :
+	counter_(0),
+	lastTimestamp_(0),
+	hasTimestamp_(false)
+{
+}
+
+void NodeInterpolator::Watch(Node* node)
+{
+	if (IsWatched(node))
+		return;
+	Entry& entry = entries_[node->GetID()];
+	entry.node_ = node;
+	entry.position_ = node->GetPosition();
+	entry.rotation_ = node->GetRotation();
+	node->SetInterceptNetworkUpdate("Network Position", true);
+	node->SetInterceptNetworkUpdate("Network Rotation", true);
+}
+
+void NodeInterpolator::Unwatch(Node* node)
+{
+	if (!entries_.Erase(node->GetID()))
+		return;
+	node->SetInterceptNetworkUpdate("Network Position", false);
+	node->SetInterceptNetworkUpdate("Network Rotation", false);
+}
+
+void NodeInterpolator::HandleNetworkUpdate(Node* node, unsigned timestamp, const String& name, const Variant& value, float time)
+{
+	HashMap<unsigned, Entry>::Iterator i = entries_.Find(node->GetID());
+	if (i == entries_.End())
+		return;
+	Entry& entry = i->second_;
+
+	// The timestamp is the low byte of the server's update count. Anything more than half a wrap back is an older
+	// update arriving late
+	unsigned counter;
+	unsigned char stamp = (unsigned char)timestamp;
+	if (!hasTimestamp_)
+	{
+		hasTimestamp_ = true;
+		lastTimestamp_ = stamp;
+		counter_ = 0;
+		counter = 0;
+	}
+	else
+	{
+		unsigned char ahead = (unsigned char)(stamp - lastTimestamp_);
+		if (ahead < 128)
+		{
+			counter_ += ahead;
+			lastTimestamp_ = stamp;
+			counter = counter_;
+		}
+		else
+			counter = counter_ - (256 - ahead);
+	}
+
+	if (name == "Network Position")
+		entry.position_ = value.GetVector3();
+	else if (name == "Network Rotation")
+	{
+		MemoryBuffer buffer(value.GetBuffer());
+		entry.rotation_ = buffer.ReadPackedQuaternion();
+	}
+	else
+		return;
+
+	clock_.Receive(counter, time);
+	entry.buffer_.Push(clock_.ToTick(counter), entry.position_, entry.rotation_);
+}
+
+void NodeInterpolator::Update(float time)
+{
+	clock_.Update(time);
+	float tick = clock_.GetRenderTick();
+	float maxExtrapolation = clock_.GetMaxExtrapolationTicks();
+
+	for (HashMap<unsigned, Entry>::Iterator i = entries_.Begin(); i != entries_.End();)
+	{
+		Entry& entry = i->second_;
+		if (!entry.node_)
+		{
+			i = entries_.Erase(i);
+			continue;
+		}
+
+		Vector3 position;
+		Quaternion rotation;
+		InterpolationResult result = entry.buffer_.Sample(tick, maxExtrapolation, position, rotation);
+		if (result == IR_INTERPOLATED)
+			++stats_.interpolated_;
+		else if (result == IR_EXTRAPOLATED)
+			++stats_.extrapolated_;
+		else if (result == IR_HELD)
+			++stats_.held_;
+		if (result != IR_NONE)
+			entry.node_->SetTransform(position, rotation);
+		++i;
+	}
+}
+
+void NodeInterpolator::Clear()
+{
+	for (HashMap<unsigned, Entry>::Iterator i = entries_.Begin(); i != entries_.End(); ++i)
+	{
+		Node* node = i->second_.node_;
+		if (node)
+		{
+			node->SetInterceptNetworkUpdate("Network Position", false);
+			node->SetInterceptNetworkUpdate("Network Rotation", false);
+		}
+	}
+	entries_.Clear();
+	clock_.Reset();
+	counter_ = 0;
+	hasTimestamp_ = false;
+}
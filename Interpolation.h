@@ -0,0 +1,201 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Math/Quaternion.h>
+#include <Urho3D/Math/Vector3.h>
+#include <Urho3D/Scene/Node.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Default time remote state is shown in the past, covering the gap between server updates plus network jitter.
+static const float DEFAULT_INTERPOLATION_DELAY = 0.1f;
+/// Default time remote state is carried on past the newest update when the next one is late.
+static const float DEFAULT_MAX_EXTRAPOLATION = 0.25f;
+/// Updates kept per entity. At 30 updates a second this covers a quarter of a second.
+static const unsigned INTERPOLATION_CAPACITY = 8;
+
+/// How an entity's shown state was worked out.
+enum InterpolationResult
+{
+	/// Nothing received yet.
+	IR_NONE = 0,
+	/// Between two updates.
+	IR_INTERPOLATED,
+	/// Carried on past the newest update.
+	IR_EXTRAPOLATED,
+	/// Held at an update: before the first one, or too long past the newest.
+	IR_HELD
+};
+
+/// Running totals of how entities were shown.
+struct InterpolationStats
+{
+	InterpolationStats() :
+		interpolated_(0),
+		extrapolated_(0),
+		held_(0)
+	{
+	}
+
+	/// Entity frames shown between two updates.
+	unsigned long long interpolated_;
+	/// Entity frames carried past the newest update.
+	unsigned long long extrapolated_;
+	/// Entity frames held at an update.
+	unsigned long long held_;
+};
+
+/// Maps a server update counter onto the client clock and picks the point in the past remote state is shown at.
+/// The server's update interval is measured from arrivals. The earliest arrival seen, relative to the counter, marks
+/// when an update can be expected at best; anything later is jitter, which the delay has to cover. Ticks handed to
+/// InterpolationBuffer are counters made relative to the first one received, as floats.
+class InterpolationClock
+{
+public:
+	InterpolationClock();
+
+	/// Note an update with a server counter arriving at a local time in seconds.
+	void Receive(unsigned counter, float time);
+	/// Move the render point to a local time in seconds. Called once a frame before sampling.
+	void Update(float time);
+	/// Forget everything received.
+	void Reset();
+	/// Set how far in the past to show remote state, in seconds.
+	void SetDelay(float delay);
+	/// Set how long to carry remote state past the newest update, in seconds.
+	void SetMaxExtrapolation(float time);
+
+	/// Return whether anything has been received.
+	bool IsValid() const { return valid_; }
+	/// Return a server counter as a tick relative to the first one received.
+	float ToTick(unsigned counter) const { return (float)(int)(counter - base_); }
+	/// Return the tick shown this frame.
+	float GetRenderTick() const { return renderTick_; }
+	/// Return the longest extrapolation in ticks.
+	float GetMaxExtrapolationTicks() const { return maxExtrapolation_ / interval_; }
+	/// Return how far in the past remote state is shown, in seconds.
+	float GetDelay() const { return delay_; }
+	/// Return how long remote state is carried past the newest update, in seconds.
+	float GetMaxExtrapolation() const { return maxExtrapolation_; }
+	/// Return the measured server update interval in seconds.
+	float GetInterval() const { return (float)interval_; }
+	/// Return the smoothed arrival jitter in seconds.
+	float GetJitter() const { return (float)jitter_; }
+	/// Return how much received state lies ahead of the render point, in seconds. Below zero the buffer has run dry.
+	float GetBufferDepth() const { return (ToTick(newest_) - renderTick_) * (float)interval_; }
+
+private:
+	/// Whether anything has been received.
+	bool valid_;
+	/// First counter received.
+	unsigned base_;
+	/// Newest counter received.
+	unsigned newest_;
+	/// Local arrival time of the first counter.
+	double baseTime_;
+	/// Running sums of the line fitted through arrival times against ticks.
+	double numArrivals_;
+	double sumX_;
+	double sumY_;
+	double sumXX_;
+	double sumXY_;
+	/// Measured server update interval.
+	double interval_;
+	/// Local time counter 0 is expected at, from the earliest arrivals.
+	double offset_;
+	/// Smoothed lateness of arrivals relative to the offset.
+	double jitter_;
+	/// Tick shown this frame.
+	float renderTick_;
+	/// Render delay in seconds.
+	float delay_;
+	/// Extrapolation limit in seconds.
+	float maxExtrapolation_;
+};
+
+/// Recent updates of one remote entity, ordered by tick, sampled at the clock's render point.
+class InterpolationBuffer
+{
+public:
+	InterpolationBuffer();
+
+	/// Add an update. One for a tick already held replaces it.
+	void Push(float tick, const Vector3& position, const Quaternion& rotation);
+	/// Work out the state at a tick, extrapolating up to maxExtrapolation ticks past the newest update.
+	/// Updates no longer needed are dropped.
+	InterpolationResult Sample(float tick, float maxExtrapolation, Vector3& position, Quaternion& rotation);
+	/// Forget every update.
+	void Clear() { count_ = 0; }
+
+	/// Return number of updates held.
+	unsigned GetCount() const { return count_; }
+
+private:
+	/// One update.
+	struct Entry
+	{
+		float tick_;
+		Vector3 position_;
+		Quaternion rotation_;
+	};
+
+	/// Updates, oldest first.
+	Entry entries_[INTERPOLATION_CAPACITY];
+	/// Number of updates held.
+	unsigned count_;
+};
+
+/// Client side interpolation of nodes Urho3D replicates, the sharks. Their network position and rotation updates are
+/// intercepted instead of applied, buffered with the server's update timestamp and shown through InterpolationClock
+/// like the boids of RemoteFlock.
+class NodeInterpolator
+{
+public:
+	NodeInterpolator();
+
+	/// Start interpolating a replicated node.
+	void Watch(Node* node);
+	/// Stop interpolating a node, leaving its network updates applied as they arrive.
+	void Unwatch(Node* node);
+	/// Handle an E_INTERCEPTNETWORKUPDATE of a watched node, received at a local time in seconds.
+	void HandleNetworkUpdate(Node* node, unsigned timestamp, const String& name, const Variant& value, float time);
+	/// Move every watched node to its state at a local time in seconds.
+	void Update(float time);
+	/// Stop interpolating every node and forget everything received.
+	void Clear();
+
+	/// Return whether a node is watched.
+	bool IsWatched(Node* node) const { return entries_.Contains(node->GetID()); }
+	/// Return the clock.
+	InterpolationClock& GetClock() { return clock_; }
+	/// Return how nodes were shown so far.
+	const InterpolationStats& GetStats() const { return stats_; }
+
+private:
+	/// A watched node.
+	struct Entry
+	{
+		/// The node.
+		WeakPtr<Node> node_;
+		/// Its updates.
+		InterpolationBuffer buffer_;
+		/// Newest position and rotation received, which arrive as separate attributes.
+		Vector3 position_;
+		Quaternion rotation_;
+	};
+
+	/// Watched nodes by ID.
+	HashMap<unsigned, Entry> entries_;
+	/// Clock shared by every node, they all share the connection's update timestamp.
+	InterpolationClock clock_;
+	/// Server timestamps unwrapped into a counter.
+	unsigned counter_;
+	/// Last 8-bit server timestamp.
+	unsigned char lastTimestamp_;
+	/// Whether a timestamp has arrived.
+	bool hasTimestamp_;
+	/// How nodes were shown.
+	InterpolationStats stats_;
+};
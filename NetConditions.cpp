@@ -0,0 +1,51 @@
+#include <Urho3D/Core/StringUtils.h>
+
+#include <kNet/MessageConnection.h>
+#include <kNet/NetworkSimulator.h>
+
+#include "NetConditions.h"
+
+bool NetConditions::Set(const String& name, const String& value)
+{
+	String lower = name.ToLower();
+	if (lower == "latency")
+		latencyMs_ = Max(ToInt(value), 0);
+	else if (lower == "jitter")
+		jitterMs_ = Max(ToInt(value), 0);
+	else if (lower == "loss")
+		loss_ = Clamp(ToFloat(value), 0.0f, 1.0f);
+	else if (lower == "duplicate")
+		duplication_ = Clamp(ToFloat(value), 0.0f, 1.0f);
+	else
+		return false;
+	return true;
+}
+
+void NetConditions::Apply(Network* network) const
+{
+	// Urho3D sets latency and loss on its connections and every new one, and turns the simulator off when both are 0
+	network->SetSimulatedLatency(latencyMs_);
+	network->SetSimulatedPacketLoss(loss_);
+	if (network->GetServerConnection())
+		Apply(network->GetServerConnection());
+	const Vector<SharedPtr<Connection> >& connections = network->GetClientConnections();
+	for (unsigned i = 0; i < connections.Size(); ++i)
+		Apply(connections[i]);
+}
+
+void NetConditions::Apply(Connection* connection) const
+{
+	kNet::MessageConnection* messageConnection = connection->GetMessageConnection();
+	if (!messageConnection)
+		return;
+	kNet::NetworkSimulator& simulator = messageConnection->NetworkSendSimulator();
+	simulator.uniformRandomPacketSendDelay = (float)jitterMs_;
+	simulator.packetDuplicationRate = duplication_;
+	simulator.enabled = IsEnabled();
+}
+
+String NetConditions::ToString() const
+{
+	return Urho3D::ToString("latency %d ms, jitter %d ms, loss %.1f%%, duplicate %.1f%%", latencyMs_, jitterMs_,
+		loss_ * 100.0f, duplication_ * 100.0f);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Network/Network.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Simulated network conditions, so the netcode can be tested over localhost as if over a real network. Everything a
+/// process sends is impaired by kNet's send simulator on each connection: a fixed latency, a random jitter on top that
+/// delays each packet differently and so also reorders them, random loss and random duplication. Each end impairs only
+/// what it sends, so conditions set on both the server and the client make up the round trip.
+struct NetConditions
+{
+	NetConditions() :
+		latencyMs_(0),
+		jitterMs_(0),
+		loss_(0.0f),
+		duplication_(0.0f)
+	{
+	}
+
+	/// Set a condition by name, latency or jitter in milliseconds, loss or duplicate as a fraction. Return false for an
+	/// unknown name.
+	bool Set(const String& name, const String& value);
+	/// Return whether any condition is set.
+	bool IsEnabled() const { return latencyMs_ > 0 || jitterMs_ > 0 || loss_ > 0.0f || duplication_ > 0.0f; }
+	/// Apply to a network and every connection it has.
+	void Apply(Network* network) const;
+	/// Apply the conditions Urho3D's network does not set to one connection. Called for every new connection.
+	void Apply(Connection* connection) const;
+	/// Return the conditions as text.
+	String ToString() const;
+
+	/// Latency added to every packet in milliseconds.
+	int latencyMs_;
+	/// Most random latency added on top in milliseconds.
+	int jitterMs_;
+	/// Chance of a packet being lost.
+	float loss_;
+	/// Chance of a packet being sent twice.
+	float duplication_;
+};
@@ -0,0 +1,280 @@
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Scene/Component.h>
+
+#include <kNet/MessageConnection.h>
+
+#include "NetStats.h"
+
+NetStats::NetStats() :
+	json_(false),
+	interval_(DEFAULT_NET_STATS_INTERVAL),
+	sampleTime_(-1.0f),
+	ticks_(0),
+	nodeUpdates_(0),
+	componentUpdates_(0),
+	nodeUpdatesPerTick_(0.0f),
+	componentUpdatesPerTick_(0.0f)
+{
+}
+
+NetStats::~NetStats()
+{
+	CloseLog();
+}
+
+void NetStats::SetMessageName(int messageID, const String& name)
+{
+	names_[messageID] = name;
+}
+
+void NetStats::CountSent(Connection* connection, int messageID, unsigned bytes)
+{
+	MessageTraffic& traffic = counters_[connection].messages_[messageID];
+	++traffic.messagesOut_;
+	traffic.bytesOut_ += bytes;
+}
+
+void NetStats::CountReceived(Connection* connection, int messageID, unsigned bytes)
+{
+	MessageTraffic& traffic = counters_[connection].messages_[messageID];
+	++traffic.messagesIn_;
+	traffic.bytesIn_ += bytes;
+}
+
+void NetStats::CountRemoteEvent(Connection* connection, bool sent)
+{
+	Counters& counters = counters_[connection];
+	if (sent)
+		++counters.remoteEventsOut_;
+	else
+		++counters.remoteEventsIn_;
+}
+
+void NetStats::CountSceneUpdates(const PODVector<Scene*>& scenes)
+{
+	++ticks_;
+	for (unsigned i = 0; i < scenes.Size(); ++i)
+		CountSceneUpdates(scenes[i], transforms_[scenes[i]]);
+
+	// Forget the scenes of rooms no longer served
+	if (transforms_.Size() > scenes.Size())
+	{
+		HashMap<Scene*, HashMap<unsigned, NodeTransform> > kept;
+		for (unsigned i = 0; i < scenes.Size(); ++i)
+			transforms_[scenes[i]].Swap(kept[scenes[i]]);
+		transforms_.Swap(kept);
+	}
+}
+
+void NetStats::CountSceneUpdates(Scene* scene, HashMap<unsigned, NodeTransform>& transforms)
+{
+	nodes_.Clear();
+	scene->GetChildren(nodes_, true);
+	for (unsigned i = 0; i < nodes_.Size(); ++i)
+	{
+		Node* node = nodes_[i];
+		if (!node->IsReplicated())
+			continue;
+		const Vector3& position = node->GetPosition();
+		const Quaternion& rotation = node->GetRotation();
+		HashMap<unsigned, NodeTransform>::Iterator last = transforms.Find(node->GetID());
+		if (last != transforms.End() && last->second_.position_ == position && last->second_.rotation_ == rotation)
+			continue;
+
+		// A moved node goes out with its transform, and its physics with it
+		NodeTransform& transform = transforms[node->GetID()];
+		transform.position_ = position;
+		transform.rotation_ = rotation;
+		++nodeUpdates_;
+		const Vector<SharedPtr<Component> >& components = node->GetComponents();
+		for (unsigned j = 0; j < components.Size(); ++j)
+		{
+			if (components[j]->IsReplicated())
+				++componentUpdates_;
+		}
+	}
+
+	// Nodes come and go with the players, drop the ones gone once there are clearly more remembered than there are
+	if (transforms.Size() > 2 * nodes_.Size() + 64)
+	{
+		HashMap<unsigned, NodeTransform> kept;
+		for (unsigned i = 0; i < nodes_.Size(); ++i)
+		{
+			HashMap<unsigned, NodeTransform>::ConstIterator last = transforms.Find(nodes_[i]->GetID());
+			if (last != transforms.End())
+				kept[last->first_] = last->second_;
+		}
+		transforms.Swap(kept);
+	}
+}
+
+void NetStats::RemoveConnection(Connection* connection)
+{
+	counters_.Erase(connection);
+	sampled_.Erase(connection);
+}
+
+bool NetStats::Update(const Vector<Connection*>& connections, float time)
+{
+	if (sampleTime_ >= 0.0f && time - sampleTime_ < interval_)
+		return false;
+	float elapsed = time - sampleTime_;
+	bool first = sampleTime_ < 0.0f;
+	sampleTime_ = time;
+	if (first)
+	{
+		// Counts from before the first sample cover no known stretch of time
+		counters_.Clear();
+		ticks_ = nodeUpdates_ = componentUpdates_ = 0;
+		return false;
+	}
+
+	sampled_.Clear();
+	totals_.Clear();
+	float rate = 1.0f / elapsed;
+	for (unsigned i = 0; i < connections.Size(); ++i)
+	{
+		Connection* connection = connections[i];
+		ConnectionStats& stats = sampled_[connection];
+		stats.address_ = connection->ToString();
+		stats.bytesInPerSec_ = connection->GetBytesInPerSec();
+		stats.bytesOutPerSec_ = connection->GetBytesOutPerSec();
+		stats.packetsInPerSec_ = (float)connection->GetPacketsInPerSec();
+		stats.packetsOutPerSec_ = (float)connection->GetPacketsOutPerSec();
+		stats.rttMs_ = connection->GetRoundTripTime();
+		// Urho3D does not pass packet loss on, kNet measures it from gaps in the packet numbers it receives
+		kNet::MessageConnection* messageConnection = connection->GetMessageConnection();
+		stats.packetLoss_ = messageConnection ? messageConnection->PacketLossRate() : 0.0f;
+
+		HashMap<Connection*, Counters>::ConstIterator counters = counters_.Find(connection);
+		if (counters == counters_.End())
+			continue;
+		stats.remoteEventsIn_ = counters->second_.remoteEventsIn_ * rate;
+		stats.remoteEventsOut_ = counters->second_.remoteEventsOut_ * rate;
+		for (HashMap<int, MessageTraffic>::ConstIterator j = counters->second_.messages_.Begin();
+			j != counters->second_.messages_.End(); ++j)
+		{
+			MessageTraffic& traffic = stats.messages_[j->first_];
+			traffic.messagesIn_ = j->second_.messagesIn_ * rate;
+			traffic.messagesOut_ = j->second_.messagesOut_ * rate;
+			traffic.bytesIn_ = j->second_.bytesIn_ * rate;
+			traffic.bytesOut_ = j->second_.bytesOut_ * rate;
+			totals_[j->first_].Add(traffic);
+		}
+	}
+
+	nodeUpdatesPerTick_ = ticks_ ? (float)nodeUpdates_ / ticks_ : 0.0f;
+	componentUpdatesPerTick_ = ticks_ ? (float)componentUpdates_ / ticks_ : 0.0f;
+	counters_.Clear();
+	ticks_ = nodeUpdates_ = componentUpdates_ = 0;
+
+	if (log_)
+		WriteLog(time);
+	return true;
+}
+
+bool NetStats::OpenLog(Context* context, const String& fileName)
+{
+	CloseLog();
+	SharedPtr<File> file(new File(context));
+	if (!file->Open(fileName, FILE_WRITE))
+		return false;
+	log_ = file;
+	json_ = fileName.EndsWith(".json", false);
+	if (!json_)
+	{
+		log_->WriteLine("time,connection,message,bytes_in_per_sec,bytes_out_per_sec,packets_in_per_sec,packets_out_per_sec,"
+			"messages_in_per_sec,messages_out_per_sec,rtt_ms,packet_loss,remote_events_in_per_sec,remote_events_out_per_sec,"
+			"node_updates_per_tick,component_updates_per_tick");
+	}
+	return true;
+}
+
+void NetStats::CloseLog()
+{
+	if (log_)
+		log_->Close();
+	log_.Reset();
+}
+
+String NetStats::GetMessageName(int messageID) const
+{
+	HashMap<int, String>::ConstIterator name = names_.Find(messageID);
+	return name != names_.End() ? name->second_ : ToString("0x%x", messageID);
+}
+
+String NetStats::ToText() const
+{
+	String text = ToString("Network, per second. Replication %.1f nodes, %.1f components per update\n", nodeUpdatesPerTick_,
+		componentUpdatesPerTick_);
+	for (HashMap<int, MessageTraffic>::ConstIterator i = totals_.Begin(); i != totals_.End(); ++i)
+	{
+		const MessageTraffic& traffic = i->second_;
+		text += ToString("  %-18s in %5.0f msg %8.1f KB  out %5.0f msg %8.1f KB\n", GetMessageName(i->first_).CString(),
+			traffic.messagesIn_, traffic.bytesIn_ / 1024.0f, traffic.messagesOut_, traffic.bytesOut_ / 1024.0f);
+	}
+	for (HashMap<Connection*, ConnectionStats>::ConstIterator i = sampled_.Begin(); i != sampled_.End(); ++i)
+	{
+		const ConnectionStats& stats = i->second_;
+		// Whatever the custom messages do not account for is Urho3D's own replication and kNet's overhead
+		MessageTraffic custom;
+		for (HashMap<int, MessageTraffic>::ConstIterator j = stats.messages_.Begin(); j != stats.messages_.End(); ++j)
+			custom.Add(j->second_);
+		text += ToString("%s  rtt %.0f ms  loss %.1f%%  events %.0f/%.0f\n", stats.address_.CString(), stats.rttMs_,
+			stats.packetLoss_ * 100.0f, stats.remoteEventsIn_, stats.remoteEventsOut_);
+		text += ToString("  in %.1f KB %.0f pkt (%.1f KB other)  out %.1f KB %.0f pkt (%.1f KB other)\n",
+			stats.bytesInPerSec_ / 1024.0f, stats.packetsInPerSec_, Max(stats.bytesInPerSec_ - custom.bytesIn_, 0.0f) / 1024.0f,
+			stats.bytesOutPerSec_ / 1024.0f, stats.packetsOutPerSec_,
+			Max(stats.bytesOutPerSec_ - custom.bytesOut_, 0.0f) / 1024.0f);
+	}
+	return text;
+}
+
+void NetStats::WriteLog(float time)
+{
+	if (json_)
+	{
+		String line = ToString("{\"time\":%.3f,\"nodeUpdatesPerTick\":%.2f,\"componentUpdatesPerTick\":%.2f,\"connections\":[",
+			time, nodeUpdatesPerTick_, componentUpdatesPerTick_);
+		for (HashMap<Connection*, ConnectionStats>::ConstIterator i = sampled_.Begin(); i != sampled_.End(); ++i)
+		{
+			const ConnectionStats& stats = i->second_;
+			if (i != sampled_.Begin())
+				line += ",";
+			line += ToString("{\"address\":\"%s\",\"bytesInPerSec\":%.1f,\"bytesOutPerSec\":%.1f,\"packetsInPerSec\":%.1f,"
+				"\"packetsOutPerSec\":%.1f,\"rttMs\":%.2f,\"packetLoss\":%.4f,\"remoteEventsInPerSec\":%.2f,"
+				"\"remoteEventsOutPerSec\":%.2f,\"messages\":{", stats.address_.CString(), stats.bytesInPerSec_,
+				stats.bytesOutPerSec_, stats.packetsInPerSec_, stats.packetsOutPerSec_, stats.rttMs_, stats.packetLoss_,
+				stats.remoteEventsIn_, stats.remoteEventsOut_);
+			for (HashMap<int, MessageTraffic>::ConstIterator j = stats.messages_.Begin(); j != stats.messages_.End(); ++j)
+			{
+				if (j != stats.messages_.Begin())
+					line += ",";
+				line += ToString("\"%s\":{\"messagesInPerSec\":%.2f,\"messagesOutPerSec\":%.2f,\"bytesInPerSec\":%.1f,"
+					"\"bytesOutPerSec\":%.1f}", GetMessageName(j->first_).CString(), j->second_.messagesIn_,
+					j->second_.messagesOut_, j->second_.bytesIn_, j->second_.bytesOut_);
+			}
+			line += "}}";
+		}
+		line += "]}";
+		log_->WriteLine(line);
+	}
+	else
+	{
+		for (HashMap<Connection*, ConnectionStats>::ConstIterator i = sampled_.Begin(); i != sampled_.End(); ++i)
+		{
+			const ConnectionStats& stats = i->second_;
+			log_->WriteLine(ToString("%.3f,%s,*,%.1f,%.1f,%.1f,%.1f,,,%.2f,%.4f,%.2f,%.2f,%.2f,%.2f", time,
+				stats.address_.CString(), stats.bytesInPerSec_, stats.bytesOutPerSec_, stats.packetsInPerSec_,
+				stats.packetsOutPerSec_, stats.rttMs_, stats.packetLoss_, stats.remoteEventsIn_, stats.remoteEventsOut_,
+				nodeUpdatesPerTick_, componentUpdatesPerTick_));
+			for (HashMap<int, MessageTraffic>::ConstIterator j = stats.messages_.Begin(); j != stats.messages_.End(); ++j)
+			{
+				log_->WriteLine(ToString("%.3f,%s,%s,%.1f,%.1f,,,%.2f,%.2f,,,,,,", time, stats.address_.CString(),
+					GetMessageName(j->first_).CString(), j->second_.bytesIn_, j->second_.bytesOut_, j->second_.messagesIn_,
+					j->second_.messagesOut_));
+			}
+		}
+	}
+	log_->Flush();
+}
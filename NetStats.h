@@ -0,0 +1,192 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Scene/Scene.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Default seconds between network stats samples, and lines of the stats log.
+static const float DEFAULT_NET_STATS_INTERVAL = 1.0f;
+
+/// Custom messages of one type, as counts over a sample and then as rates.
+struct MessageTraffic
+{
+	MessageTraffic() :
+		messagesIn_(0.0f),
+		messagesOut_(0.0f),
+		bytesIn_(0.0f),
+		bytesOut_(0.0f)
+	{
+	}
+
+	/// Add another's counts.
+	void Add(const MessageTraffic& other)
+	{
+		messagesIn_ += other.messagesIn_;
+		messagesOut_ += other.messagesOut_;
+		bytesIn_ += other.bytesIn_;
+		bytesOut_ += other.bytesOut_;
+	}
+
+	/// Messages received.
+	float messagesIn_;
+	/// Messages sent.
+	float messagesOut_;
+	/// Payload bytes received.
+	float bytesIn_;
+	/// Payload bytes sent.
+	float bytesOut_;
+};
+
+/// What one connection carried over the last sample.
+struct ConnectionStats
+{
+	ConnectionStats() :
+		bytesInPerSec_(0.0f),
+		bytesOutPerSec_(0.0f),
+		packetsInPerSec_(0.0f),
+		packetsOutPerSec_(0.0f),
+		rttMs_(0.0f),
+		packetLoss_(0.0f),
+		remoteEventsIn_(0.0f),
+		remoteEventsOut_(0.0f)
+	{
+	}
+
+	/// Address and port of the other end.
+	String address_;
+	/// Bytes received a second, everything kNet carried.
+	float bytesInPerSec_;
+	/// Bytes sent a second, everything kNet carried.
+	float bytesOutPerSec_;
+	/// Packets received a second.
+	float packetsInPerSec_;
+	/// Packets sent a second.
+	float packetsOutPerSec_;
+	/// Round trip time in milliseconds.
+	float rttMs_;
+	/// Fraction of incoming packets lost.
+	float packetLoss_;
+	/// Remote events received a second.
+	float remoteEventsIn_;
+	/// Remote events sent a second.
+	float remoteEventsOut_;
+	/// Custom message rates by message ID.
+	HashMap<int, MessageTraffic> messages_;
+};
+
+/// Network instrumentation. Custom messages and remote events are counted per connection and message ID where they are
+/// sent and received, and once a sample interval the counts become rates next to what the connection itself measures:
+/// bytes and packets, round trip and packet loss. Urho3D's own scene replication has no message of its own to count,
+/// so on the server the replicated nodes whose transform changed are counted each network update, which is what it
+/// sends; the bytes it costs are the connection's bytes less the custom messages.
+/// Each sample can be shown as text for the overlay and appended to a CSV or JSON lines log.
+class NetStats
+{
+public:
+	NetStats();
+	~NetStats();
+
+	/// Name a custom message ID for the overlay and log.
+	void SetMessageName(int messageID, const String& name);
+	/// Count a custom message sent.
+	void CountSent(Connection* connection, int messageID, unsigned bytes);
+	/// Count a custom message received.
+	void CountReceived(Connection* connection, int messageID, unsigned bytes);
+	/// Count a remote event sent or received.
+	void CountRemoteEvent(Connection* connection, bool sent);
+	/// Server: count the replicated nodes and components a network update sends from every room's scene. Called once per
+	/// network update.
+	void CountSceneUpdates(const PODVector<Scene*>& scenes);
+	/// Forget a disconnected connection.
+	void RemoveConnection(Connection* connection);
+
+	/// Take a sample of the connections given when the interval has passed since the last one, logging it if a log is
+	/// open. Return true when a sample was taken.
+	bool Update(const Vector<Connection*>& connections, float time);
+	/// Set seconds between samples.
+	void SetInterval(float interval) { interval_ = interval; }
+	/// Open a log every sample is appended to, JSON lines if the name ends in .json, CSV otherwise. Return true on
+	/// success.
+	bool OpenLog(Context* context, const String& fileName);
+	/// Close the log.
+	void CloseLog();
+
+	/// Return the last sample of each connection.
+	const HashMap<Connection*, ConnectionStats>& GetConnections() const { return sampled_; }
+	/// Return the last sample of each message type over every connection.
+	const HashMap<int, MessageTraffic>& GetMessages() const { return totals_; }
+	/// Return replicated nodes sent a network update over the last sample.
+	float GetNodeUpdatesPerTick() const { return nodeUpdatesPerTick_; }
+	/// Return replicated components sent a network update over the last sample.
+	float GetComponentUpdatesPerTick() const { return componentUpdatesPerTick_; }
+	/// Return the name of a message ID.
+	String GetMessageName(int messageID) const;
+	/// Return the last sample as text for the overlay.
+	String ToText() const;
+
+private:
+	/// Counts of one connection since the last sample.
+	struct Counters
+	{
+		Counters() :
+			remoteEventsIn_(0),
+			remoteEventsOut_(0)
+		{
+		}
+
+		/// Remote events received.
+		unsigned remoteEventsIn_;
+		/// Remote events sent.
+		unsigned remoteEventsOut_;
+		/// Custom messages by ID.
+		HashMap<int, MessageTraffic> messages_;
+	};
+
+	/// Transform a replicated node was last counted at.
+	struct NodeTransform
+	{
+		Vector3 position_;
+		Quaternion rotation_;
+	};
+
+	/// Count the nodes of one scene whose transform changed, and drop the transforms of its nodes gone.
+	void CountSceneUpdates(Scene* scene, HashMap<unsigned, NodeTransform>& transforms);
+	/// Append the last sample to the log.
+	void WriteLog(float time);
+
+	/// Counts since the last sample.
+	HashMap<Connection*, Counters> counters_;
+	/// Last sample of each connection.
+	HashMap<Connection*, ConnectionStats> sampled_;
+	/// Last sample of each message type.
+	HashMap<int, MessageTraffic> totals_;
+	/// Names of message IDs.
+	HashMap<int, String> names_;
+	/// Transforms of the replicated nodes by scene and ID, as node IDs are only unique within a scene.
+	HashMap<Scene*, HashMap<unsigned, NodeTransform> > transforms_;
+	/// Replicated nodes scratch list.
+	PODVector<Node*> nodes_;
+	/// Log every sample is appended to.
+	SharedPtr<File> log_;
+	/// Whether the log is JSON lines.
+	bool json_;
+	/// Seconds between samples.
+	float interval_;
+	/// Time of the last sample, negative before the first.
+	float sampleTime_;
+	/// Network updates counted since the last sample.
+	unsigned ticks_;
+	/// Node updates counted since the last sample.
+	unsigned nodeUpdates_;
+	/// Component updates counted since the last sample.
+	unsigned componentUpdates_;
+	/// Node updates a network update over the last sample.
+	float nodeUpdatesPerTick_;
+	/// Component updates a network update over the last sample.
+	float componentUpdatesPerTick_;
+};
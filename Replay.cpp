@@ -0,0 +1,399 @@
+#include <Urho3D/IO/FileSystem.h>
+
+#include "Replay.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+/// Bytes of the file header: ID, version, number of boids and flocks, ticks a chunk and seed.
+static const unsigned REPLAY_HEADER_SIZE = 24;
+/// Bytes of a chunk header: ID, first tick, number of ticks and bytes of tick data.
+static const unsigned REPLAY_CHUNK_HEADER_SIZE = 16;
+/// Bytes of the footer after the chunk offsets: index offset, number of chunks and ID.
+static const unsigned REPLAY_FOOTER_SIZE = 12;
+/// Bytes of a tick before its boids: tick, time step and the number of sharks, inputs and captures.
+static const unsigned REPLAY_TICK_HEADER_SIZE = 20;
+
+ReplayRecorder::ReplayRecorder() :
+	chunkFirstTick_(0),
+	numBoids_(0),
+	chunkTicks_(DEFAULT_REPLAY_CHUNK_TICKS),
+	numTicks_(0)
+{
+	gathering_.timeStep_ = 0.0f;
+}
+
+ReplayRecorder::~ReplayRecorder()
+{
+	Close();
+}
+
+bool ReplayRecorder::Open(Context* context, const String& fileName, const FlockStore& store, unsigned seed,
+	unsigned chunkTicks)
+{
+	Close();
+	SharedPtr<File> file(new File(context));
+	if (!file->Open(fileName, FILE_WRITE))
+		return false;
+	file_ = file;
+	numBoids_ = store.GetNumBoids();
+	chunkTicks_ = Max(chunkTicks, 1u);
+	numTicks_ = 0;
+	chunkOffsets_.Clear();
+	pending_.Clear();
+	gathering_.sharks_.Clear();
+	gathering_.inputs_.Clear();
+
+	file_->WriteFileID("URPL");
+	file_->WriteUInt(REPLAY_VERSION);
+	file_->WriteUInt(numBoids_);
+	file_->WriteUInt(store.GetNumFlocks());
+	file_->WriteUInt(chunkTicks_);
+	file_->WriteUInt(seed);
+	return true;
+}
+
+void ReplayRecorder::Close()
+{
+	if (!file_)
+		return;
+	FlushChunk();
+
+	unsigned indexOffset = file_->GetPosition();
+	if (!chunkOffsets_.Empty())
+		file_->Write(chunkOffsets_.Buffer(), chunkOffsets_.Size() * sizeof(unsigned));
+	file_->WriteUInt(indexOffset);
+	file_->WriteUInt(chunkOffsets_.Size());
+	file_->WriteFileID("RIDX");
+	file_->Close();
+	file_.Reset();
+	pending_.Clear();
+}
+
+void ReplayRecorder::AddShark(unsigned id, const Vector3& position, const Vector3& velocity)
+{
+	if (!file_)
+		return;
+	ReplayShark shark;
+	shark.id_ = id;
+	shark.position_ = position;
+	shark.velocity_ = velocity;
+	gathering_.sharks_.Push(shark);
+}
+
+void ReplayRecorder::AddInput(unsigned player, const InputFrame& input)
+{
+	if (!file_)
+		return;
+	ReplayInput record;
+	record.player_ = player;
+	record.sequence_ = input.sequence_;
+	record.buttons_ = input.buttons_;
+	record.padding_ = 0;
+	record.yaw_ = input.yaw_;
+	record.pitch_ = input.pitch_;
+	record.padding2_ = 0;
+	gathering_.inputs_.Push(record);
+}
+
+void ReplayRecorder::QueueTick(float timeStep)
+{
+	if (!file_)
+		return;
+	gathering_.timeStep_ = timeStep;
+	pending_.Push(gathering_);
+	gathering_.sharks_.Clear();
+	gathering_.inputs_.Clear();
+}
+
+void ReplayRecorder::WriteTick(unsigned tick, const FlockStore& store, const PODVector<unsigned>& captured)
+{
+	if (!file_)
+		return;
+	// A step queued before the recording started has nothing gathered, it is recorded with the boids alone
+	PendingTick pending;
+	pending.timeStep_ = 0.0f;
+	if (!pending_.Empty())
+	{
+		pending = pending_.Front();
+		pending_.Erase(0);
+	}
+	// The header fixes the boid count, a flock spawned again with another layout needs a recording of its own
+	if (store.GetNumBoids() != numBoids_)
+		return;
+
+	if (tickOffsets_.Empty())
+		chunkFirstTick_ = tick;
+	tickOffsets_.Push(chunk_.GetSize());
+
+	chunk_.WriteUInt(tick);
+	chunk_.WriteFloat(pending.timeStep_);
+	chunk_.WriteUInt(pending.sharks_.Size());
+	chunk_.WriteUInt(pending.inputs_.Size());
+	chunk_.WriteUInt(captured.Size());
+	if (numBoids_)
+	{
+		unsigned bytes = numBoids_ * sizeof(float);
+		chunk_.Write(store.posX_.Buffer(), bytes);
+		chunk_.Write(store.posY_.Buffer(), bytes);
+		chunk_.Write(store.posZ_.Buffer(), bytes);
+		chunk_.Write(store.velX_.Buffer(), bytes);
+		chunk_.Write(store.velY_.Buffer(), bytes);
+		chunk_.Write(store.velZ_.Buffer(), bytes);
+	}
+	if (!pending.sharks_.Empty())
+		chunk_.Write(pending.sharks_.Buffer(), pending.sharks_.Size() * sizeof(ReplayShark));
+	if (!pending.inputs_.Empty())
+		chunk_.Write(pending.inputs_.Buffer(), pending.inputs_.Size() * sizeof(ReplayInput));
+	if (!captured.Empty())
+		chunk_.Write(captured.Buffer(), captured.Size() * sizeof(unsigned));
+
+	++numTicks_;
+	if (tickOffsets_.Size() >= chunkTicks_)
+		FlushChunk();
+}
+
+void ReplayRecorder::FlushChunk()
+{
+	if (tickOffsets_.Empty())
+		return;
+	chunkOffsets_.Push(file_->GetPosition());
+	file_->WriteFileID("RCHK");
+	file_->WriteUInt(chunkFirstTick_);
+	file_->WriteUInt(tickOffsets_.Size());
+	file_->WriteUInt(chunk_.GetSize());
+	file_->Write(tickOffsets_.Buffer(), tickOffsets_.Size() * sizeof(unsigned));
+	file_->Write(chunk_.GetData(), chunk_.GetSize());
+	// Each chunk reaches the disk whole, so a crash only loses the chunk being gathered
+	file_->Flush();
+	chunk_.Clear();
+	tickOffsets_.Clear();
+}
+
+ReplayPlayer::ReplayPlayer() :
+	data_(0),
+	size_(0),
+	fileHandle_(0),
+	mappingHandle_(0),
+	indexed_(false),
+	numFrames_(0),
+	firstTick_(0),
+	numBoids_(0),
+	numFlocks_(0),
+	chunkTicks_(0),
+	seed_(0)
+{
+}
+
+ReplayPlayer::~ReplayPlayer()
+{
+	Close();
+}
+
+bool ReplayPlayer::Open(const String& fileName)
+{
+	Close();
+	String nativeName = GetNativePath(fileName);
+
+#ifdef _WIN32
+	HANDLE file = CreateFileW(WString(nativeName).CString(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < REPLAY_HEADER_SIZE || fileSize.HighPart)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingW(file, 0, PAGE_READONLY, 0, 0, 0);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : 0;
+	if (!view)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	fileHandle_ = file;
+	mappingHandle_ = mapping;
+	size_ = fileSize.LowPart;
+#else
+	int file = open(nativeName.CString(), O_RDONLY);
+	if (file < 0)
+		return false;
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || fileStat.st_size < (off_t)REPLAY_HEADER_SIZE ||
+		(unsigned long long)fileStat.st_size > M_MAX_UNSIGNED)
+	{
+		close(file);
+		return false;
+	}
+	void* view = mmap(0, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping keeps the file open by itself
+	close(file);
+	if (view == MAP_FAILED)
+		return false;
+	size_ = (unsigned)fileStat.st_size;
+#endif
+	data_ = static_cast<const unsigned char*>(view);
+
+	if (!HasID(0, "URPL") || ReadUInt(4) != REPLAY_VERSION)
+	{
+		Close();
+		return false;
+	}
+	numBoids_ = ReadUInt(8);
+	numFlocks_ = ReadUInt(12);
+	chunkTicks_ = ReadUInt(16);
+	seed_ = ReadUInt(20);
+	if (!chunkTicks_)
+	{
+		Close();
+		return false;
+	}
+
+	indexed_ = ReadIndex();
+	if (!indexed_)
+		ScanChunks();
+
+	// Every chunk but the last is full, so the frame count follows from the last one
+	numFrames_ = 0;
+	firstTick_ = 0;
+	if (!chunkOffsets_.Empty())
+	{
+		firstTick_ = ReadUInt(chunkOffsets_[0] + 4);
+		numFrames_ = (chunkOffsets_.Size() - 1) * chunkTicks_ + ReadUInt(chunkOffsets_.Back() + 8);
+	}
+	return true;
+}
+
+void ReplayPlayer::Close()
+{
+	if (data_)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data_);
+		CloseHandle((HANDLE)mappingHandle_);
+		CloseHandle((HANDLE)fileHandle_);
+#else
+		munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+	}
+	data_ = 0;
+	size_ = 0;
+	fileHandle_ = 0;
+	mappingHandle_ = 0;
+	chunkOffsets_.Clear();
+	indexed_ = false;
+	numFrames_ = 0;
+}
+
+bool ReplayPlayer::GetFrame(unsigned index, ReplayFrame& frame) const
+{
+	if (index >= numFrames_)
+		return false;
+
+	unsigned chunk = chunkOffsets_[index / chunkTicks_];
+	unsigned numTicks = ReadUInt(chunk + 8);
+	unsigned local = index % chunkTicks_;
+	if (local >= numTicks)
+		return false;
+	unsigned long long dataStart = (unsigned long long)chunk + REPLAY_CHUNK_HEADER_SIZE + numTicks * sizeof(unsigned);
+	unsigned long long dataEnd = dataStart + ReadUInt(chunk + 12);
+	if (dataEnd > size_)
+		return false;
+	unsigned long long offset = dataStart + ReadUInt(chunk + REPLAY_CHUNK_HEADER_SIZE + local * sizeof(unsigned));
+	if (offset + REPLAY_TICK_HEADER_SIZE > dataEnd)
+		return false;
+
+	unsigned tick = (unsigned)offset;
+	frame.tick_ = ReadUInt(tick);
+	unsigned timeStep = ReadUInt(tick + 4);
+	memcpy(&frame.timeStep_, &timeStep, sizeof(float));
+	frame.numBoids_ = numBoids_;
+	frame.numSharks_ = ReadUInt(tick + 8);
+	frame.numInputs_ = ReadUInt(tick + 12);
+	frame.numCaptures_ = ReadUInt(tick + 16);
+
+	unsigned long long size = REPLAY_TICK_HEADER_SIZE + 6ull * numBoids_ * sizeof(float) +
+		(unsigned long long)frame.numSharks_ * sizeof(ReplayShark) + (unsigned long long)frame.numInputs_ * sizeof(ReplayInput) +
+		(unsigned long long)frame.numCaptures_ * sizeof(unsigned);
+	if (offset + size > dataEnd)
+		return false;
+
+	// Everything in the file is 4 byte aligned, so the arrays are used where they lie
+	const float* boids = reinterpret_cast<const float*>(data_ + tick + REPLAY_TICK_HEADER_SIZE);
+	frame.posX_ = boids;
+	frame.posY_ = boids + numBoids_;
+	frame.posZ_ = boids + 2 * numBoids_;
+	frame.velX_ = boids + 3 * numBoids_;
+	frame.velY_ = boids + 4 * numBoids_;
+	frame.velZ_ = boids + 5 * numBoids_;
+	frame.sharks_ = reinterpret_cast<const ReplayShark*>(boids + 6 * numBoids_);
+	frame.inputs_ = reinterpret_cast<const ReplayInput*>(frame.sharks_ + frame.numSharks_);
+	frame.captures_ = reinterpret_cast<const unsigned*>(frame.inputs_ + frame.numInputs_);
+	return true;
+}
+
+unsigned ReplayPlayer::ReadUInt(unsigned offset) const
+{
+	unsigned value;
+	memcpy(&value, data_ + offset, sizeof(unsigned));
+	return value;
+}
+
+bool ReplayPlayer::HasID(unsigned offset, const char* id) const
+{
+	return (unsigned long long)offset + 4 <= size_ && memcmp(data_ + offset, id, 4) == 0;
+}
+
+bool ReplayPlayer::ReadIndex()
+{
+	if (size_ < REPLAY_HEADER_SIZE + REPLAY_FOOTER_SIZE || !HasID(size_ - 4, "RIDX"))
+		return false;
+	unsigned indexOffset = ReadUInt(size_ - REPLAY_FOOTER_SIZE);
+	unsigned numChunks = ReadUInt(size_ - 8);
+	if (indexOffset < REPLAY_HEADER_SIZE ||
+		(unsigned long long)indexOffset + (unsigned long long)numChunks * sizeof(unsigned) != size_ - REPLAY_FOOTER_SIZE)
+		return false;
+
+	chunkOffsets_.Resize(numChunks);
+	for (unsigned i = 0; i < numChunks; ++i)
+	{
+		chunkOffsets_[i] = ReadUInt(indexOffset + i * sizeof(unsigned));
+		if (chunkOffsets_[i] + REPLAY_CHUNK_HEADER_SIZE > indexOffset || !HasID(chunkOffsets_[i], "RCHK"))
+		{
+			chunkOffsets_.Clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+void ReplayPlayer::ScanChunks()
+{
+	chunkOffsets_.Clear();
+	unsigned long long offset = REPLAY_HEADER_SIZE;
+	while (offset + REPLAY_CHUNK_HEADER_SIZE <= size_ && HasID((unsigned)offset, "RCHK"))
+	{
+		unsigned numTicks = ReadUInt((unsigned)offset + 8);
+		unsigned long long end = offset + REPLAY_CHUNK_HEADER_SIZE + (unsigned long long)numTicks * sizeof(unsigned) +
+			ReadUInt((unsigned)offset + 12);
+		// A chunk cut short by the crash is dropped with everything after it
+		if (end > size_ || !numTicks || numTicks > chunkTicks_)
+			break;
+		chunkOffsets_.Push((unsigned)offset);
+		offset = end;
+		if (numTicks < chunkTicks_)
+			break;
+	}
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include "FlockStore.h"
+#include "InputChannel.h"
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Default number of ticks in a chunk, a second at the physics rate. A crashed recording loses at most the last chunk.
+static const unsigned DEFAULT_REPLAY_CHUNK_TICKS = 64;
+/// Version of the replay file layout.
+static const unsigned REPLAY_VERSION = 1;
+
+/// A shark as a replay records it. Written to the file as is, so it is only made of 4 byte fields.
+struct ReplayShark
+{
+	/// ID of the shark's node on the server.
+	unsigned id_;
+	/// Position.
+	Vector3 position_;
+	/// Velocity.
+	Vector3 velocity_;
+};
+
+/// A client input as a replay records it, the InputFrame fields with the padding spelled out.
+struct ReplayInput
+{
+	/// ID of the node of the shark the input steered.
+	unsigned player_;
+	/// Number of the input's step on the client.
+	unsigned sequence_;
+	/// Packed InputButton bits.
+	unsigned char buttons_;
+	unsigned char padding_;
+	/// Yaw and pitch, a full turn over the 16 bits.
+	unsigned short yaw_;
+	unsigned short pitch_;
+	unsigned short padding2_;
+};
+
+/// One recorded tick. The arrays point straight into the mapped file and stay valid until the player is closed.
+struct ReplayFrame
+{
+	ReplayFrame() :
+		tick_(0),
+		timeStep_(0.0f),
+		numBoids_(0),
+		posX_(0),
+		posY_(0),
+		posZ_(0),
+		velX_(0),
+		velY_(0),
+		velZ_(0),
+		numSharks_(0),
+		sharks_(0),
+		numInputs_(0),
+		inputs_(0),
+		numCaptures_(0),
+		captures_(0)
+	{
+	}
+
+	/// Return position of a boid.
+	Vector3 GetPosition(unsigned i) const { return Vector3(posX_[i], posY_[i], posZ_[i]); }
+	/// Return velocity of a boid.
+	Vector3 GetVelocity(unsigned i) const { return Vector3(velX_[i], velY_[i], velZ_[i]); }
+
+	/// Flock tick the state is from.
+	unsigned tick_;
+	/// Length of the tick in seconds.
+	float timeStep_;
+	/// Boid state after the tick, laid out as FlockStore's arrays.
+	unsigned numBoids_;
+	const float* posX_;
+	const float* posY_;
+	const float* posZ_;
+	const float* velX_;
+	const float* velY_;
+	const float* velZ_;
+	/// Sharks at the start of the tick.
+	unsigned numSharks_;
+	const ReplayShark* sharks_;
+	/// Inputs applied during the tick.
+	unsigned numInputs_;
+	const ReplayInput* inputs_;
+	/// Boids captured during the tick.
+	unsigned numCaptures_;
+	const unsigned* captures_;
+};
+
+/// Records a match tick by tick into an append-only binary file: the state of every boid, the sharks, the inputs that
+/// steered them and the boids captured. Ticks are gathered in memory a chunk at a time and each full chunk is appended
+/// whole, behind a table of where each of its ticks starts. Closing appends the offset of every chunk, so a player can
+/// go to any tick in constant time. A recording that never got closed still plays, up to its last whole chunk.
+/// Every field is 4 bytes or padded to it and stored in the machine's byte order, so a mapped file is read in place.
+/// The sharks and inputs of a tick are known on the main thread before the flock steps and the boids after, which with
+/// deferred room steps is on a worker, so a tick is queued first and written once its flock step has run.
+class ReplayRecorder
+{
+public:
+	ReplayRecorder();
+	/// Close the recording.
+	~ReplayRecorder();
+
+	/// Start a recording of a flock laid out like store, spawned from seed. Return false if the file cannot be opened.
+	bool Open(Context* context, const String& fileName, const FlockStore& store, unsigned seed,
+		unsigned chunkTicks = DEFAULT_REPLAY_CHUNK_TICKS);
+	/// Write what is left and the chunk index, and close the file.
+	void Close();
+
+	/// Add a shark to the tick being gathered.
+	void AddShark(unsigned id, const Vector3& position, const Vector3& velocity);
+	/// Add an input to the tick being gathered.
+	void AddInput(unsigned player, const InputFrame& input);
+	/// Queue the gathered tick for its flock step.
+	void QueueTick(float timeStep);
+	/// Write the oldest queued tick with the flock state after its step.
+	void WriteTick(unsigned tick, const FlockStore& store, const PODVector<unsigned>& captured);
+
+	/// Return whether a recording is open.
+	bool IsOpen() const { return file_.NotNull(); }
+	/// Return the number of ticks written.
+	unsigned GetNumTicks() const { return numTicks_; }
+	/// Return bytes written to the file.
+	unsigned GetBytesWritten() const { return file_ ? file_->GetPosition() : 0; }
+
+private:
+	/// Sharks and inputs of a tick waiting for its flock step.
+	struct PendingTick
+	{
+		float timeStep_;
+		PODVector<ReplayShark> sharks_;
+		PODVector<ReplayInput> inputs_;
+	};
+
+	/// Append the gathered chunk to the file.
+	void FlushChunk();
+
+	/// Recording file.
+	SharedPtr<File> file_;
+	/// Ticks of the chunk being gathered.
+	VectorBuffer chunk_;
+	/// Where each tick of the chunk being gathered starts in it.
+	PODVector<unsigned> tickOffsets_;
+	/// Tick of the first tick of the chunk being gathered.
+	unsigned chunkFirstTick_;
+	/// File offset of every chunk written.
+	PODVector<unsigned> chunkOffsets_;
+	/// Ticks queued for their flock step, oldest first.
+	Vector<PendingTick> pending_;
+	/// Tick being gathered.
+	PendingTick gathering_;
+	/// Number of boids in every tick.
+	unsigned numBoids_;
+	/// Ticks in a chunk.
+	unsigned chunkTicks_;
+	/// Ticks written.
+	unsigned numTicks_;
+};
+
+/// Plays a recording back from a memory map of the file. Any recorded tick is found in constant time through the chunk
+/// index: the chunk from the tick's number, then the tick from the chunk's table. A file whose recorder never closed it
+/// has no index, which is then rebuilt when opening by walking the chunks from the start.
+class ReplayPlayer
+{
+public:
+	ReplayPlayer();
+	/// Unmap the file.
+	~ReplayPlayer();
+
+	/// Map a recording. Return false if it cannot be mapped or is not a recording.
+	bool Open(const String& fileName);
+	/// Unmap the file. Frames taken from it are no longer valid.
+	void Close();
+	/// Fill frame with the index-th tick recorded. Return false if there is no such tick.
+	bool GetFrame(unsigned index, ReplayFrame& frame) const;
+
+	/// Return whether a recording is mapped.
+	bool IsOpen() const { return data_ != 0; }
+	/// Return whether the chunk index was read from the file rather than rebuilt.
+	bool IsIndexed() const { return indexed_; }
+	/// Return the number of ticks recorded.
+	unsigned GetNumFrames() const { return numFrames_; }
+	/// Return the flock tick of the first tick recorded.
+	unsigned GetFirstTick() const { return firstTick_; }
+	/// Return the number of boids.
+	unsigned GetNumBoids() const { return numBoids_; }
+	/// Return the number of flocks.
+	unsigned GetNumFlocks() const { return numFlocks_; }
+	/// Return the seed the flock was spawned from.
+	unsigned GetSeed() const { return seed_; }
+
+private:
+	/// Return the 4 bytes at offset.
+	unsigned ReadUInt(unsigned offset) const;
+	/// Return whether the 4 characters at offset are id.
+	bool HasID(unsigned offset, const char* id) const;
+	/// Read the chunk index at the end of the file. Return false if there is none.
+	bool ReadIndex();
+	/// Rebuild the chunk index by walking the chunks.
+	void ScanChunks();
+
+	/// Mapped file.
+	const unsigned char* data_;
+	/// Size of the mapped file.
+	unsigned size_;
+	/// Platform handles of the mapping.
+	void* fileHandle_;
+	void* mappingHandle_;
+	/// File offset of every chunk.
+	PODVector<unsigned> chunkOffsets_;
+	/// Whether the index was read from the file.
+	bool indexed_;
+	/// Ticks recorded.
+	unsigned numFrames_;
+	/// First tick recorded.
+	unsigned firstTick_;
+	/// Number of boids.
+	unsigned numBoids_;
+	/// Number of flocks.
+	unsigned numFlocks_;
+	/// Ticks in every chunk but the last.
+	unsigned chunkTicks_;
+	/// Flock seed.
+	unsigned seed_;
+};
@@ -0,0 +1,283 @@
+#include <Urho3D/Math/Random.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+
+#include "Room.h"
+#include "SharkPrediction.h"
+
+Room::Room(unsigned id, Scene* scene) :
+	id_(id),
+	scene_(scene),
+	maxRewind_(DEFAULT_MAX_REWIND),
+	seed_(0),
+	numCaptured_(0),
+	deferSteps_(false),
+	clientFlocks_(false)
+{
+}
+
+void Room::Initialise(ResourceCache* cache, const BoidSet& settings, unsigned seed)
+{
+	// Replays and checkpoints keep the seed, so it has to be the only source of randomness in the spawn
+	seed_ = seed;
+	SetRandomSeed(seed_);
+	boidSet_.CopySettings(settings);
+	boidSet_.Initialise(cache, scene_);
+	numCaptured_ = 0;
+	SetDeferSteps(deferSteps_);
+	ResetHistory();
+}
+
+void Room::Restore(ResourceCache* cache, const BoidSet& settings, const CheckpointRoom& source)
+{
+	const FlockStore& boids = source.boids_;
+	seed_ = source.seed_;
+	SetRandomSeed(seed_);
+	boidSet_.CopySettings(settings);
+	boidSet_.SetFlockLayout(boids.GetNumFlocks(), boids.GetNumFlocks() ? boids.GetFlockSize(0) : 0);
+	boidSet_.Initialise(cache, scene_);
+	numCaptured_ = 0;
+	// Spawned at random like any flock, then put where the checkpoint had them
+	unsigned numBoids = Min(boids.GetNumBoids(), boidSet_.store.GetNumBoids());
+	for (unsigned i = 0; i < numBoids; ++i)
+		boidSet_.SetState(i, boids.GetPosition(i), boids.GetVelocity(i));
+	boidSet_.SetTick(source.tick_);
+	scene_->SetElapsedTime(source.elapsedTime_);
+	SetDeferSteps(deferSteps_);
+	ResetHistory();
+}
+
+void Room::SaveCheckpoint(CheckpointRoom& dest) const
+{
+	dest.id_ = id_;
+	dest.seed_ = seed_;
+	dest.tick_ = boidSet_.GetTick();
+	dest.elapsedTime_ = scene_->GetElapsedTime();
+	dest.boids_ = boidSet_.store;
+	dest.sharks_.Clear();
+	for (HashMap<Connection*, Player>::ConstIterator i = players_.Begin(); i != players_.End(); ++i)
+		SaveShark(i->second_.node_, i->first_->GetAddress(), dest.sharks_);
+	// Sharks still waiting for their clients are kept too, a server restarted twice in a row still has them
+	for (unsigned i = 0; i < restored_.Size(); ++i)
+		SaveShark(restored_[i].node_, restored_[i].owner_, dest.sharks_);
+}
+
+void Room::SaveShark(Node* node, const String& owner, Vector<CheckpointShark>& dest)
+{
+	if (!node)
+		return;
+	RigidBody* body = node->GetComponent<RigidBody>();
+	CheckpointShark shark;
+	shark.owner_ = owner;
+	shark.position_ = node->GetPosition();
+	shark.rotation_ = node->GetRotation();
+	shark.linearVelocity_ = body ? body->GetLinearVelocity() : Vector3::ZERO;
+	shark.angularVelocity_ = body ? body->GetAngularVelocity() : Vector3::ZERO;
+	dest.Push(shark);
+}
+
+void Room::SetDeferSteps(bool enable)
+{
+	deferSteps_ = enable;
+	// A work item cannot wait on the queue it runs on, so a room stepped as one item steps its flock on that thread.
+	// Only kinematic flocks are deferred, a rigid body flock still steps on the main thread and keeps the queue
+	bool deferred = enable && boidSet_.IsKinematic();
+	boidSet_.SetWorkQueue(deferred ? 0 : scene_->GetSubsystem<WorkQueue>());
+}
+
+void Room::AddConnection(Connection* connection)
+{
+	if (!connections_.Contains(SharedPtr<Connection>(connection)))
+		connections_.Push(SharedPtr<Connection>(connection));
+	connection->SetScene(scene_);
+
+	// The client starts where a new shark spawns, or where the shark it had before a restart waits for it
+	Vector3 origin = SHARK_SPAWN_POSITION;
+	String owner = connection->GetAddress();
+	for (unsigned i = 0; i < restored_.Size(); ++i)
+	{
+		if (restored_[i].owner_ == owner && restored_[i].node_)
+		{
+			origin = restored_[i].node_->GetPosition();
+			break;
+		}
+	}
+	replicator_.AddConnection(connection, origin);
+}
+
+void Room::RemoveConnection(Connection* connection)
+{
+	replicator_.RemoveConnection(connection);
+	flockSync_.RemoveConnection(connection);
+	connections_.Remove(SharedPtr<Connection>(connection));
+
+	HashMap<Connection*, Player>::Iterator player = players_.Find(connection);
+	if (player != players_.End())
+	{
+		if (player->second_.node_)
+			player->second_.node_->Remove();
+		players_.Erase(player);
+	}
+}
+
+void Room::SetPlayer(Connection* connection, Node* node, float viewDelay)
+{
+	Player& player = players_[connection];
+	player.node_ = node;
+	player.viewDelay_ = viewDelay;
+}
+
+Node* Room::GetPlayer(Connection* connection) const
+{
+	HashMap<Connection*, Player>::ConstIterator player = players_.Find(connection);
+	return player != players_.End() ? player->second_.node_.Get() : 0;
+}
+
+void Room::AddRestoredPlayer(const String& owner, Node* node)
+{
+	RestoredPlayer player;
+	player.owner_ = owner;
+	player.node_ = node;
+	restored_.Push(player);
+}
+
+bool Room::HasRestoredPlayer(const String& owner) const
+{
+	for (unsigned i = 0; i < restored_.Size(); ++i)
+	{
+		if (restored_[i].owner_ == owner && restored_[i].node_)
+			return true;
+	}
+	return false;
+}
+
+Node* Room::ClaimRestoredPlayer(Connection* connection)
+{
+	// Clients behind one address get its sharks in turn, whichever each had before
+	String owner = connection->GetAddress();
+	for (unsigned i = 0; i < restored_.Size(); ++i)
+	{
+		if (restored_[i].owner_ != owner || !restored_[i].node_)
+			continue;
+		Node* node = restored_[i].node_;
+		restored_.Erase(i);
+		return node;
+	}
+	return 0;
+}
+
+bool Room::StartRecording(const String& fileName)
+{
+	return recorder_.Open(scene_->GetContext(), fileName, boidSet_.store, seed_);
+}
+
+void Room::RecordInput(Connection* connection, const InputFrame& input)
+{
+	Node* player = GetPlayer(connection);
+	if (player)
+		recorder_.AddInput(player->GetID(), input);
+}
+
+void Room::Update(float timeStep)
+{
+	CheckCaptures(timeStep);
+
+	// The sharks are recorded as the step starts, the boids once it has run
+	if (recorder_.IsOpen())
+	{
+		for (HashMap<Connection*, Player>::ConstIterator i = players_.Begin(); i != players_.End(); ++i)
+		{
+			Node* player = i->second_.node_;
+			if (!player)
+				continue;
+			RigidBody* body = player->GetComponent<RigidBody>();
+			recorder_.AddShark(player->GetID(), player->GetPosition(), body ? body->GetLinearVelocity() : Vector3::ZERO);
+		}
+		recorder_.QueueTick(timeStep);
+	}
+
+	// A rigid body flock has to be stepped between the physics steps, whatever the rooms do
+	queuedSteps_.Push(timeStep);
+	if (!deferSteps_ || !boidSet_.IsKinematic())
+		RunQueuedSteps();
+}
+
+void Room::RunQueuedSteps()
+{
+	for (unsigned i = 0; i < queuedSteps_.Size(); ++i)
+	{
+		boidSet_.Update(queuedSteps_[i]);
+		if (clientFlocks_)
+			flockSync_.AddCaptures(boidSet_);
+		recorder_.WriteTick(boidSet_.GetTick(), boidSet_.store, boidSet_.GetCaptured());
+		// Counted here rather than logged from the flock, which may be stepping on a worker thread
+		const PODVector<unsigned>& captured = boidSet_.GetCaptured();
+		numCaptured_ += captured.Size();
+		for (unsigned j = 0; j < captured.Size(); ++j)
+			history_.MarkCaptured(captured[j], boidSet_.GetTick());
+		history_.Record(boidSet_.GetTick(), boidSet_.store);
+	}
+	queuedSteps_.Clear();
+}
+
+void Room::ResetHistory()
+{
+	// Enough ticks to go back the whole cap, plus the newest
+	PhysicsWorld* physicsWorld = scene_->GetComponent<PhysicsWorld>();
+	unsigned fps = physicsWorld ? physicsWorld->GetFps() : 60;
+	history_.Reset((unsigned)Ceil(maxRewind_ * fps) + 1, boidSet_.store.GetNumBoids());
+}
+
+void Room::CheckCaptures(float timeStep)
+{
+	if (timeStep <= 0.0f)
+		return;
+	for (HashMap<Connection*, Player>::ConstIterator i = players_.Begin(); i != players_.End(); ++i)
+	{
+		Node* player = i->second_.node_;
+		if (!player)
+			continue;
+		// The client saw the boids a round trip plus its own view delay ago, but no further back than the cap, so a
+		// client with a bad connection cannot reach into the past at will
+		float rewind = Min(i->first_->GetRoundTripTime() / 1000.0f + i->second_.viewDelay_, maxRewind_);
+		unsigned back = (unsigned)(rewind / timeStep + 0.5f);
+		hits_.Clear();
+		history_.Query(back, player->GetPosition(), CaptureRange, hits_);
+		for (unsigned j = 0; j < hits_.Size(); ++j)
+			boidSet_.Capture(hits_[j]);
+	}
+}
+
+void Room::SendFlock()
+{
+	if (clientFlocks_)
+		flockSync_.Send(boidSet_, connections_);
+	else if (!boidSet_.IsReplicated())
+		replicator_.Send(boidSet_.store, connections_);
+}
+
+void Room::StepRooms(WorkQueue* queue, const Vector<SharedPtr<Room> >& rooms)
+{
+	if (!queue)
+	{
+		for (unsigned i = 0; i < rooms.Size(); ++i)
+			rooms[i]->RunQueuedSteps();
+		return;
+	}
+
+	for (unsigned i = 0; i < rooms.Size(); ++i)
+	{
+		if (rooms[i]->queuedSteps_.Empty())
+			continue;
+		SharedPtr<WorkItem> item = queue->GetFreeItem();
+		item->priority_ = M_MAX_UNSIGNED;
+		item->workFunction_ = RunQueuedStepsWork;
+		item->aux_ = rooms[i].Get();
+		queue->AddWorkItem(item);
+	}
+	queue->Complete(M_MAX_UNSIGNED);
+}
+
+void Room::RunQueuedStepsWork(const WorkItem* item, unsigned threadIndex)
+{
+	static_cast<Room*>(item->aux_)->RunQueuedSteps();
+}
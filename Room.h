@@ -0,0 +1,171 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "BoidHistory.h"
+#include "BoidReplication.h"
+#include "Boids.h"
+#include "Checkpoint.h"
+#include "FlockSync.h"
+#include "Replay.h"
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Default most clients put in one room before the next one is filled.
+static const unsigned DEFAULT_ROOM_SIZE = 8;
+
+/// One match on the server. A room owns its scene, and with it its own physics world, its flock and the map of its
+/// players' sharks, and replicates them to the connections assigned to it and no others.
+/// Urho3D scenes update and send their events on the main thread, so physics still steps there one room after another.
+/// A kinematic flock touches nothing outside its room, though, so with several rooms each room's flock steps are only
+/// queued during its physics and all rooms then run their queued steps at once, one work item per room. Rooms only run
+/// in parallel like that with kinematic flocks. A rigid body flock has to step between the physics steps, so it steps
+/// straight away on the main thread, one room after another, spreading each step over the work queue, as a single
+/// room always does.
+/// Captures are lag compensated: every shark is checked against the boids as its client saw them, rewound through the
+/// room's boid history by the client's round trip and view delay, up to a cap.
+class Room : public RefCounted
+{
+public:
+	/// Construct with an ID and the scene the room plays in.
+	Room(unsigned id, Scene* scene);
+
+	/// Create the flock from a seed, set up like settings.
+	void Initialise(ResourceCache* cache, const BoidSet& settings, unsigned seed);
+	/// Create the flock set up like settings but with the layout, state, tick and seed of a checkpoint, and take on the
+	/// checkpoint's clock. The sharks are left to the caller, who adds them with AddRestoredPlayer.
+	void Restore(ResourceCache* cache, const BoidSet& settings, const CheckpointRoom& source);
+	/// Copy the live state into a checkpoint.
+	void SaveCheckpoint(CheckpointRoom& dest) const;
+	/// Queue kinematic flock steps for StepRooms instead of running them in Update, and step each room on one thread.
+	/// A rigid body flock is not deferred and keeps spreading each step over the work queue.
+	void SetDeferSteps(bool enable);
+	/// Let clients simulate the flock, sending the setup and corrections instead of snapshots.
+	void SetClientFlocks(bool enable) { clientFlocks_ = enable; }
+	/// Set the furthest back in seconds a capture is checked, 0 to check against the current boids. Takes effect when the
+	/// flock is next created.
+	void SetMaxRewind(float seconds) { maxRewind_ = Max(seconds, 0.0f); }
+
+	/// Assign a connection to the room.
+	void AddConnection(Connection* connection);
+	/// Remove a connection and its shark from the room.
+	void RemoveConnection(Connection* connection);
+	/// Set the shark a connection plays, and how far in seconds behind the newest state its client shows the boids.
+	void SetPlayer(Connection* connection, Node* node, float viewDelay);
+	/// Return the shark a connection plays, or null.
+	Node* GetPlayer(Connection* connection) const;
+	/// Add a shark restored from a checkpoint, kept for the next client to start from the owner's address.
+	void AddRestoredPlayer(const String& owner, Node* node);
+	/// Return whether a restored shark is waiting for a client from an address.
+	bool HasRestoredPlayer(const String& owner) const;
+	/// Hand a restored shark waiting for the connection's address to it, and return it, or null if there is none.
+	Node* ClaimRestoredPlayer(Connection* connection);
+	/// Start recording the match to a replay file. Return false if it cannot be opened.
+	bool StartRecording(const String& fileName);
+	/// Record the input a connection's shark is steered by this physics step.
+	void RecordInput(Connection* connection, const InputFrame& input);
+
+	/// Step the flock by timeStep, or queue the step if steps are deferred. Called from the room's physics pre-step.
+	void Update(float timeStep);
+	/// Run the queued flock steps.
+	void RunQueuedSteps();
+	/// Send the flock to the room's connections. Called once per network update.
+	void SendFlock();
+	/// Run the queued flock steps of every room, in parallel over a work queue if one is given.
+	static void StepRooms(WorkQueue* queue, const Vector<SharedPtr<Room> >& rooms);
+
+	/// Return the ID.
+	unsigned GetID() const { return id_; }
+	/// Return the scene.
+	Scene* GetScene() const { return scene_; }
+	/// Return the flock.
+	BoidSet& GetBoidSet() { return boidSet_; }
+	/// Return the snapshot sender.
+	BoidReplicator& GetReplicator() { return replicator_; }
+	/// Return the client flock sender.
+	FlockSyncServer& GetFlockSync() { return flockSync_; }
+	/// Return the replay recorder.
+	ReplayRecorder& GetRecorder() { return recorder_; }
+	/// Return the boid history captures are checked against.
+	const BoidHistory& GetHistory() const { return history_; }
+	/// Return the connections assigned.
+	const Vector<SharedPtr<Connection> >& GetConnections() const { return connections_; }
+	/// Return the number of connections assigned.
+	unsigned GetNumConnections() const { return connections_.Size(); }
+	/// Return the number of boids captured since the flock was created.
+	unsigned GetNumCaptured() const { return numCaptured_; }
+
+private:
+	/// A client's shark.
+	struct Player
+	{
+		Player() :
+			viewDelay_(0.0f)
+		{
+		}
+
+		/// Shark.
+		WeakPtr<Node> node_;
+		/// Seconds behind the newest state the client shows the boids.
+		float viewDelay_;
+	};
+
+	/// Shark restored from a checkpoint that its client has not reclaimed yet.
+	struct RestoredPlayer
+	{
+		/// Address of the client that played it.
+		String owner_;
+		/// Shark.
+		WeakPtr<Node> node_;
+	};
+
+	/// Work queue entry point running one room's queued steps.
+	static void RunQueuedStepsWork(const WorkItem* item, unsigned threadIndex);
+	/// Copy a shark's body state into a checkpoint.
+	static void SaveShark(Node* node, const String& owner, Vector<CheckpointShark>& dest);
+	/// Size the boid history for the flock and the rewind cap.
+	void ResetHistory();
+	/// Check every shark against the boids as its client saw them, and have the flock capture those it caught.
+	void CheckCaptures(float timeStep);
+
+	/// ID, also the offset of the flock seed.
+	unsigned id_;
+	/// Scene with the room's physics world.
+	SharedPtr<Scene> scene_;
+	/// Flock.
+	BoidSet boidSet_;
+	/// Sends the flock as snapshots.
+	BoidReplicator replicator_;
+	/// Sends the flock setup and corrections to clients simulating it.
+	FlockSyncServer flockSync_;
+	/// Records the match, when asked to.
+	ReplayRecorder recorder_;
+	/// Connections assigned.
+	Vector<SharedPtr<Connection> > connections_;
+	/// Shark of each connection that has started playing.
+	HashMap<Connection*, Player> players_;
+	/// Restored sharks waiting for their clients.
+	Vector<RestoredPlayer> restored_;
+	/// Recent boid positions, for checking captures as clients saw them.
+	BoidHistory history_;
+	/// Boids found by a capture check.
+	PODVector<unsigned> hits_;
+	/// Furthest back a capture is checked in seconds.
+	float maxRewind_;
+	/// Seed the flock was spawned with.
+	unsigned seed_;
+	/// Time steps queued.
+	PODVector<float> queuedSteps_;
+	/// Boids captured since the flock was created.
+	unsigned numCaptured_;
+	/// Whether kinematic steps are queued.
+	bool deferSteps_;
+	/// Whether clients simulate the flock.
+	bool clientFlocks_;
+};
@@ -0,0 +1,483 @@
+#include <Urho3D/Container/HashSet.h>
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Engine/Engine.h>
+#include <Urho3D/Graphics/Light.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/Octree.h>
+#include <Urho3D/Graphics/Skybox.h>
+#include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Graphics/Terrain.h>
+#include <Urho3D/Graphics/Zone.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/Math/Random.h>
+#include <Urho3D/Physics/CollisionShape.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+#include <Urho3D/Physics/RigidBody.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "CookedScene.h"
+
+// Offline cook step for scene descriptions.
+// Cooks a description into the binary file the game reads at startup, next to the description unless -output says
+// otherwise, so a shipped build never parses XML, decodes the heightmap or places a plant. Then times -runs startups
+// each way, building the scene as a dedicated server does, with every resource released first: the way the game built
+// it before scene descriptions, which is the baseline, the way a cooked file missing or stale makes the game go,
+// cooking the description, and reading the cooked file. It also times building a scene again from what is already
+// loaded, as another room or a reconnecting client does. Prints one CSV row, with the speedup of reading the cooked
+// file over the old build and the part of a cold start spent building plant collision geometry as collision_mean_ms.
+// -verify instead builds the scene the way the game built it before scene descriptions, drawn and not, and compares
+// it with the cooked scene: the nodes of each name, the settings of their components, and where the plants are. The
+// old code placed plants from unseeded draws, so plant groups are compared by their count, spread, scale range and
+// sitting on the terrain rather than plant by plant. Plants are no longer replicated, and a scene nobody draws no
+// longer gets their models; neither is reported. Nor is a group colliding with its convex hull where the description
+// asks for it, the old scene is built with the same collision. Prints each difference and exits with 1 if there is any.
+//
+// Usage: SceneCook [-input NAME] [-output FILE] [-runs N] [-verify]
+// -input is a resource name, Scenes/SharkWorld.xml by default.
+
+static const unsigned DEFAULT_RUNS = 20;
+/// Fraction of a group's spread and scale range the cooked placement may differ from the old one by.
+static const float SPREAD_TOLERANCE = 0.25f;
+/// Largest distance of a plant above or below the terrain surface.
+static const float HEIGHT_TOLERANCE = 0.01f;
+
+/// Nodes of one name in a built scene.
+struct NodeGroup
+{
+	NodeGroup() :
+		count_(0),
+		mixed_(false),
+		minScale_(M_INFINITY),
+		maxScale_(-M_INFINITY),
+		offTerrain_(0.0f)
+	{
+	}
+
+	/// Number of nodes.
+	unsigned count_;
+	/// Components of the first node and their settings.
+	String components_;
+	/// Whether the nodes have different components.
+	bool mixed_;
+	/// World transform of the first node.
+	Matrix3x4 transform_;
+	/// Positions of the nodes.
+	BoundingBox bounds_;
+	/// Range of the nodes' scale.
+	float minScale_;
+	float maxScale_;
+	/// Largest distance of a node off the terrain surface.
+	float offTerrain_;
+};
+
+/// Build a scene the way CharacterDemo::CreateScene and CreateSceneContent built it before scene descriptions. Plants
+/// of the groups listed collide with their model's convex hull instead of its triangles.
+static void BuildOldScene(Context* context, Scene* scene, bool visible, const HashSet<String>& hullGroups)
+{
+	ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+	if (visible)
+	{
+		Node* zoneNode = scene->CreateChild("Zone", LOCAL);
+		Zone* zone = zoneNode->CreateComponent<Zone>(LOCAL);
+		zone->SetAmbientColor(Color(0.15f, 0.15f, 0.15f));
+		zone->SetFogColor(Color(0.2f, 0.5f, 0.7f));
+		zone->SetFogStart(40.0f);
+		zone->SetFogEnd(150.0f);
+		zone->SetBoundingBox(BoundingBox(-1000.0f, 1000.0f));
+
+		Node* lightNode = scene->CreateChild("DirectionalLight", LOCAL);
+		lightNode->SetDirection(Vector3(0.3f, -0.5f, 0.425f));
+		Light* light = lightNode->CreateComponent<Light>(LOCAL);
+		light->SetLightType(LIGHT_DIRECTIONAL);
+		light->SetCastShadows(true);
+		light->SetShadowBias(BiasParameters(0.00025f, 0.5f));
+		light->SetShadowCascade(CascadeParameters(10.0f, 50.0f, 200.0f, 0.0f, 0.8f));
+		light->SetSpecularIntensity(1.0f);
+		light->SetBrightness(0.6f);
+
+		Node* skyNode = scene->CreateChild("Sky", LOCAL);
+		skyNode->SetScale(80.0f);
+		Skybox* skybox = skyNode->CreateComponent<Skybox>(LOCAL);
+		skybox->SetModel(cache->GetResource<Model>("Models/Box.mdl"));
+		skybox->SetMaterial(cache->GetResource<Material>("Materials/Skybox.xml"));
+	}
+
+	Node* terrainNode = scene->CreateChild("Terrain", LOCAL);
+	terrainNode->SetPosition(Vector3(20.0f, -10.0f, 0.0f));
+	Terrain* terrain = terrainNode->CreateComponent<Terrain>(LOCAL);
+	terrain->SetPatchSize(64);
+	terrain->SetSpacing(Vector3(0.6f, 0.3f, 0.6f));
+	terrain->SetSmoothing(true);
+	terrain->SetHeightMap(cache->GetResource<Image>("Textures/HeightMap.png"));
+	if (visible)
+		terrain->SetMaterial(cache->GetResource<Material>("Materials/Terrain.xml"));
+	terrain->SetOccluder(true);
+	RigidBody* terrainBody = terrainNode->CreateComponent<RigidBody>(LOCAL);
+	terrainBody->SetCollisionLayer(2);
+	CollisionShape* terrainShape = terrainNode->CreateComponent<CollisionShape>(LOCAL);
+	terrainShape->SetTerrain();
+
+	Node* waterNode = scene->CreateChild("Water", LOCAL);
+	waterNode->SetScale(Vector3(2048.0f, 1.0f, 2048.0f));
+	waterNode->SetPosition(Vector3(0.0f, 45.0f, 0.0f));
+	waterNode->SetRotation(Quaternion(0.0f, 0.0f, 180.0f));
+	if (visible)
+	{
+		StaticModel* water = waterNode->CreateComponent<StaticModel>(LOCAL);
+		water->SetModel(cache->GetResource<Model>("Models/Plane.mdl"));
+		water->SetMaterial(cache->GetResource<Material>("Materials/Water.xml"));
+		water->SetViewMask(0x80000000);
+	}
+	RigidBody* waterBody = waterNode->CreateComponent<RigidBody>(LOCAL);
+	waterBody->SetCollisionLayer(2);
+	CollisionShape* waterShape = waterNode->CreateComponent<CollisionShape>(LOCAL);
+	waterShape->SetTerrain();
+
+	const char* names[] = { "Plant", "Bamboo" };
+	const char* models[] = { "Models/plant_002a.mdl", "Models/Bamboo.mdl" };
+	const unsigned counts[] = { 40, 60 };
+	const float areas[] = { 100.0f, 150.0f };
+	const float minScales[] = { 0.05f, 0.02f };
+	const float scaleRanges[] = { 0.05f, 0.03f };
+	for (unsigned g = 0; g < 2; ++g)
+	{
+		for (unsigned i = 0; i < counts[g]; ++i)
+		{
+			Node* objectNode = scene->CreateChild(names[g]);
+			Vector3 position(Random(areas[g]) - 30.0f, 0.0f, Random(areas[g]) - 30.0f);
+			position.y_ = terrain->GetHeight(position);
+			objectNode->SetPosition(position);
+			objectNode->SetRotation(Quaternion(0.0f, Random(360.0f), 0.0f));
+			objectNode->SetScale(minScales[g] + Random(scaleRanges[g]));
+			StaticModel* object = objectNode->CreateComponent<StaticModel>();
+			object->SetModel(cache->GetResource<Model>(models[g]));
+			object->SetMaterial(cache->GetResource<Material>("Materials/Foliage.xml"));
+			object->SetCastShadows(true);
+			RigidBody* body = objectNode->CreateComponent<RigidBody>();
+			body->SetCollisionLayer(2);
+			CollisionShape* shape = objectNode->CreateComponent<CollisionShape>();
+			if (hullGroups.Contains(names[g]))
+				shape->SetConvexHull(object->GetModel(), 0);
+			else
+				shape->SetTriangleMesh(object->GetModel(), 0);
+		}
+	}
+}
+
+/// Return the name of a resource, or nothing.
+static String GetName(Resource* resource)
+{
+	return resource ? resource->GetName() : String::EMPTY;
+}
+
+/// Return a component's type and the settings building the scene gives it.
+static String Describe(Component* component)
+{
+	String text = component->GetTypeName();
+	if (Terrain* terrain = dynamic_cast<Terrain*>(component))
+		text += " " + terrain->GetSpacing().ToString() + " " + String(terrain->GetPatchSize()) + " " +
+			String(terrain->GetSmoothing()) + " " + String(terrain->IsOccluder()) + " " +
+			terrain->GetNumVertices().ToString() + " " + GetName(terrain->GetMaterial());
+	else if (StaticModel* model = dynamic_cast<StaticModel*>(component))
+		text += " " + GetName(model->GetModel()) + " " + GetName(model->GetMaterial(0)) + " " +
+			String(model->GetCastShadows()) + " " + String(model->GetViewMask());
+	else if (Zone* zone = dynamic_cast<Zone*>(component))
+		text += " " + zone->GetAmbientColor().ToString() + " " + zone->GetFogColor().ToString() + " " +
+			String(zone->GetFogStart()) + " " + String(zone->GetFogEnd());
+	else if (Light* light = dynamic_cast<Light*>(component))
+		text += " " + String(light->GetBrightness()) + " " + String(light->GetSpecularIntensity()) + " " +
+			String(light->GetCastShadows());
+	else if (RigidBody* body = dynamic_cast<RigidBody*>(component))
+		text += " " + String(body->GetCollisionLayer()) + " " + String(body->GetMass());
+	else if (CollisionShape* shape = dynamic_cast<CollisionShape*>(component))
+	{
+		// A cooked hull is built from a model of its points alone, which has no name
+		text += " " + String((int)shape->GetShapeType());
+		if (shape->GetShapeType() != SHAPE_CONVEXHULL)
+			text += " " + GetName(shape->GetModel());
+	}
+	return text;
+}
+
+/// Gather the nodes of a scene by name. Plant models are left out of a scene nobody draws, as the cooked scene no
+/// longer creates them there.
+static HashMap<String, NodeGroup> Summarise(Scene* scene, bool visible)
+{
+	HashMap<String, NodeGroup> groups;
+	Node* terrainNode = scene->GetChild("Terrain");
+	Terrain* terrain = terrainNode ? terrainNode->GetComponent<Terrain>() : 0;
+	PODVector<Node*> nodes;
+	scene->GetChildren(nodes, false);
+	for (unsigned i = 0; i < nodes.Size(); ++i)
+	{
+		Node* node = nodes[i];
+		bool plant = node->GetName() != "Terrain" && node->GetName() != "Water";
+		String components;
+		const Vector<SharedPtr<Component> >& nodeComponents = node->GetComponents();
+		for (unsigned j = 0; j < nodeComponents.Size(); ++j)
+		{
+			if (!visible && plant && nodeComponents[j]->GetType() == StaticModel::GetTypeStatic())
+				continue;
+			components += Describe(nodeComponents[j]) + "; ";
+		}
+
+		NodeGroup& group = groups[node->GetName()];
+		if (!group.count_)
+		{
+			group.components_ = components;
+			group.transform_ = node->GetWorldTransform();
+			group.bounds_ = BoundingBox(node->GetWorldPosition(), node->GetWorldPosition());
+		}
+		else if (components != group.components_)
+			group.mixed_ = true;
+		++group.count_;
+		group.bounds_.Merge(node->GetWorldPosition());
+		group.minScale_ = Min(group.minScale_, node->GetScale().x_);
+		group.maxScale_ = Max(group.maxScale_, node->GetScale().x_);
+		if (terrain)
+			group.offTerrain_ = Max(group.offTerrain_, Abs(node->GetWorldPosition().y_ - terrain->GetHeight(node->GetWorldPosition())));
+	}
+	return groups;
+}
+
+/// Return whether a range is within tolerance of another, in proportion to the other's size.
+static bool SpreadMatches(float min, float max, float oldMin, float oldMax)
+{
+	float tolerance = (oldMax - oldMin) * SPREAD_TOLERANCE;
+	return Abs(min - oldMin) <= tolerance && Abs(max - oldMax) <= tolerance;
+}
+
+/// Print how the cooked scene differs from the old one and return the number of differences.
+static unsigned Compare(const HashMap<String, NodeGroup>& oldGroups, const HashMap<String, NodeGroup>& groups,
+	const String& label)
+{
+	unsigned differences = 0;
+	for (HashMap<String, NodeGroup>::ConstIterator i = oldGroups.Begin(); i != oldGroups.End(); ++i)
+	{
+		const String& name = i->first_;
+		const NodeGroup& oldGroup = i->second_;
+		HashMap<String, NodeGroup>::ConstIterator found = groups.Find(name);
+		if (found == groups.End())
+		{
+			PrintLine(label + ": no " + name + " nodes");
+			++differences;
+			continue;
+		}
+		const NodeGroup& group = found->second_;
+		if (group.count_ != oldGroup.count_)
+		{
+			PrintLine(label + ": " + String(group.count_) + " " + name + " nodes, not " + String(oldGroup.count_));
+			++differences;
+		}
+		if (group.components_ != oldGroup.components_ || group.mixed_)
+		{
+			PrintLine(label + ": " + name + " components " + group.components_ + "not " + oldGroup.components_);
+			++differences;
+		}
+		if (oldGroup.count_ == 1 && !group.transform_.Equals(oldGroup.transform_))
+		{
+			PrintLine(label + ": " + name + " transform " + group.transform_.ToString() + " not " +
+				oldGroup.transform_.ToString());
+			++differences;
+		}
+		if (oldGroup.count_ > 1)
+		{
+			const BoundingBox& bounds = group.bounds_;
+			const BoundingBox& oldBounds = oldGroup.bounds_;
+			if (!SpreadMatches(bounds.min_.x_, bounds.max_.x_, oldBounds.min_.x_, oldBounds.max_.x_) ||
+				!SpreadMatches(bounds.min_.z_, bounds.max_.z_, oldBounds.min_.z_, oldBounds.max_.z_) ||
+				!SpreadMatches(group.minScale_, group.maxScale_, oldGroup.minScale_, oldGroup.maxScale_))
+			{
+				PrintLine(label + ": " + name + " spread over " + bounds.ToString() + " scaled " + String(group.minScale_) +
+					" to " + String(group.maxScale_) + ", not " + oldBounds.ToString() + " scaled " +
+					String(oldGroup.minScale_) + " to " + String(oldGroup.maxScale_));
+				++differences;
+			}
+			if (group.offTerrain_ > HEIGHT_TOLERANCE)
+			{
+				PrintLine(label + ": " + name + " up to " + String(group.offTerrain_) + " off the terrain");
+				++differences;
+			}
+		}
+	}
+	for (HashMap<String, NodeGroup>::ConstIterator i = groups.Begin(); i != groups.End(); ++i)
+	{
+		if (!oldGroups.Contains(i->first_))
+		{
+			PrintLine(label + ": " + String(i->second_.count_) + " " + i->first_ + " nodes the old scene did not have");
+			++differences;
+		}
+	}
+	return differences;
+}
+
+/// Build the old scene and the cooked one, drawn and not, and return the number of differences between them. Groups
+/// the description gives convex hull collision get it in the old scene too, as the one deliberate change.
+static unsigned Verify(Context* context, const CookedScene& cooked)
+{
+	HashSet<String> hullGroups;
+	for (unsigned i = 0; i < cooked.vegetation_.Size(); ++i)
+	{
+		if (cooked.vegetation_[i].collision_ == VC_CONVEXHULL)
+			hullGroups.Insert(cooked.vegetation_[i].name_);
+	}
+	unsigned differences = 0;
+	for (unsigned visible = 0; visible < 2; ++visible)
+	{
+		SharedPtr<Scene> oldScene(new Scene(context));
+		oldScene->CreateComponent<Octree>(LOCAL);
+		oldScene->CreateComponent<PhysicsWorld>(LOCAL);
+		SetRandomSeed(1);
+		BuildOldScene(context, oldScene, visible != 0, hullGroups);
+		SharedPtr<Scene> scene(new Scene(context));
+		scene->CreateComponent<Octree>(LOCAL);
+		scene->CreateComponent<PhysicsWorld>(LOCAL);
+		cooked.Build(scene, visible != 0);
+		differences += Compare(Summarise(oldScene, visible != 0), Summarise(scene, visible != 0),
+			visible ? "drawn" : "not drawn");
+	}
+	return differences;
+}
+
+/// Build a scene as the server's was built before scene descriptions, every plant a triangle mesh, and return how long
+/// that took, in microseconds.
+static long long BuildOldScene(Context* context)
+{
+	HiresTimer timer;
+	SharedPtr<Scene> scene(new Scene(context));
+	scene->CreateComponent<Octree>(LOCAL);
+	scene->CreateComponent<PhysicsWorld>(LOCAL);
+	BuildOldScene(context, scene, false, HashSet<String>());
+	return timer.GetUSec(false);
+}
+
+/// Build a scene as the server's is built and return how long that took, in microseconds.
+static long long BuildScene(Context* context, const CookedScene& cooked)
+{
+	HiresTimer timer;
+	SharedPtr<Scene> scene(new Scene(context));
+	scene->CreateComponent<Octree>(LOCAL);
+	scene->CreateComponent<PhysicsWorld>(LOCAL);
+	cooked.Build(scene, false);
+	return timer.GetUSec(false);
+}
+
+int main(int argc, char** argv)
+{
+	String input = DEFAULT_SCENE_DESCRIPTION;
+	String output;
+	unsigned runs = DEFAULT_RUNS;
+	bool verify = false;
+
+	const Vector<String>& arguments = ParseArguments(argc, argv);
+	for (unsigned i = 0; i < arguments.Size(); ++i)
+	{
+		String argument = arguments[i].ToLower();
+		bool hasValue = i + 1 < arguments.Size();
+		if (argument == "-input" && hasValue)
+			input = arguments[++i];
+		else if (argument == "-output" && hasValue)
+			output = arguments[++i];
+		else if (argument == "-runs" && hasValue)
+			runs = Max(ToUInt(arguments[++i]), 1u);
+		else if (argument == "-verify")
+			verify = true;
+		else
+		{
+			PrintLine("Usage: SceneCook [-input NAME] [-output FILE] [-runs N] [-verify]", true);
+			return 1;
+		}
+	}
+
+	SharedPtr<Context> context(new Context());
+	SharedPtr<Engine> engine(new Engine(context));
+	VariantMap engineParameters;
+	engineParameters["Headless"] = true;
+	engineParameters["LogQuiet"] = true;
+	engineParameters["LogName"] = String::EMPTY;
+	if (!engine->Initialize(engineParameters))
+	{
+		PrintLine("Could not initialise the engine", true);
+		return 1;
+	}
+	ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+
+	CookedScene cooked;
+	if (!cooked.Cook(context, input))
+	{
+		PrintLine("Could not cook " + input, true);
+		return 1;
+	}
+	if (output.Empty())
+		output = ReplaceExtension(cache->GetResourceFileName(input), ".bin");
+	{
+		File file(context);
+		if (output.Empty() || !file.Open(output, FILE_WRITE))
+		{
+			PrintLine("Could not write " + (output.Empty() ? CookedScene::GetCookedName(input) : output), true);
+			return 1;
+		}
+		cooked.Write(file);
+	}
+	if (verify)
+	{
+		unsigned differences = Verify(context, cooked);
+		PrintLine(differences ? String(differences) + " differences from the old scene" :
+			"Cooked scene matches the old scene");
+		return differences ? 1 : 0;
+	}
+
+	long long oldUSec = 0;
+	long long cookUSec = 0;
+	long long cookedUSec = 0;
+	long long rebuildUSec = 0;
+	long long collisionUSec = 0;
+	unsigned cookedBytes = 0;
+	for (unsigned run = 0; run < runs; ++run)
+	{
+		// Released so every run decodes the heightmap and loads the models again, as a fresh start does
+		cache->ReleaseAllResources(true);
+		SetRandomSeed(1);
+		oldUSec += BuildOldScene(context);
+
+		cache->ReleaseAllResources(true);
+		HiresTimer timer;
+		CookedScene fromDescription;
+		fromDescription.Cook(context, input);
+		cookUSec += timer.GetUSec(false) + BuildScene(context, fromDescription);
+
+		cache->ReleaseAllResources(true);
+		timer.Reset();
+		File file(context, output);
+		CookedScene fromCooked;
+		if (!fromCooked.ReadFile(context, file))
+		{
+			PrintLine("Could not read back " + output, true);
+			return 1;
+		}
+		cookedUSec += timer.GetUSec(false) + BuildScene(context, fromCooked);
+		// What a cold start spends on collision geometry: hull shapes from the cooked points, and the BVH of any group
+		// still colliding with its triangle mesh, which is not kept on disk
+		collisionUSec += fromCooked.GetCollisionUSec();
+		// The collision geometry of every plant model is already built, and is only handed to the new physics world
+		rebuildUSec += BuildScene(context, fromCooked);
+		cookedBytes = file.GetSize();
+	}
+
+	PrintLine("Cooked " + input + " to " + output);
+	PrintLine("scene,plants,cooked_bytes,runs,old_mean_ms,description_mean_ms,cooked_mean_ms,collision_mean_ms,"
+		"rebuild_mean_ms,speedup");
+	float oldMs = oldUSec / 1000.0f / runs;
+	float cookedMs = cookedUSec / 1000.0f / runs;
+	PrintLine(ToString("%s,%u,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f", input.CString(), cooked.GetNumInstances(), cookedBytes,
+		runs, oldMs, cookUSec / 1000.0f / runs, cookedMs, collisionUSec / 1000.0f / runs, rebuildUSec / 1000.0f / runs,
+		cookedMs > 0.0f ? oldMs / cookedMs : 0.0f));
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+#include "ServerStats.h"
+
+void ServerFrameStats::Write(Serializer& dest) const
+{
+	dest.WriteVLE(numClients_);
+	dest.WriteVLE(numFrames_);
+	dest.WriteFloat(meanMs_);
+	dest.WriteFloat(maxMs_);
+}
+
+void ServerFrameStats::Read(Deserializer& source)
+{
+	numClients_ = source.ReadVLE();
+	numFrames_ = source.ReadVLE();
+	meanMs_ = source.ReadFloat();
+	maxMs_ = source.ReadFloat();
+}
+
+FrameTimer::FrameTimer() :
+	running_(false),
+	numFrames_(0),
+	sumUSec_(0),
+	maxUSec_(0)
+{
+}
+
+void FrameTimer::Begin()
+{
+	timer_.Reset();
+	running_ = true;
+}
+
+void FrameTimer::End()
+{
+	if (!running_)
+		return;
+	running_ = false;
+	long long usec = timer_.GetUSec(false);
+	++numFrames_;
+	sumUSec_ += usec;
+	if (usec > maxUSec_)
+		maxUSec_ = usec;
+}
+
+ServerFrameStats FrameTimer::Take(unsigned numClients)
+{
+	ServerFrameStats stats;
+	stats.numClients_ = numClients;
+	stats.numFrames_ = numFrames_;
+	stats.meanMs_ = numFrames_ ? sumUSec_ / 1000.0f / numFrames_ : 0.0f;
+	stats.maxMs_ = maxUSec_ / 1000.0f;
+	numFrames_ = 0;
+	sumUSec_ = 0;
+	maxUSec_ = 0;
+	return stats;
+}
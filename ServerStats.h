@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/IO/Serializer.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Network message carrying the server's frame times, server to client once a second.
+static const int MSG_SERVERSTATS = 0x106;
+/// Seconds between MSG_SERVERSTATS messages.
+static const float SERVER_STATS_INTERVAL = 1.0f;
+
+/// How long the server's frames took over a stretch of time.
+struct ServerFrameStats
+{
+	ServerFrameStats() :
+		numClients_(0),
+		numFrames_(0),
+		meanMs_(0.0f),
+		maxMs_(0.0f)
+	{
+	}
+
+	/// Write as a MSG_SERVERSTATS payload.
+	void Write(Serializer& dest) const;
+	/// Read a MSG_SERVERSTATS payload.
+	void Read(Deserializer& source);
+
+	/// Clients connected at the end.
+	unsigned numClients_;
+	/// Frames timed.
+	unsigned numFrames_;
+	/// Mean frame time in milliseconds.
+	float meanMs_;
+	/// Longest frame in milliseconds.
+	float maxMs_;
+};
+
+/// Times the server's frames from E_BEGINFRAME, where network messages are read, to E_POSTRENDERUPDATE, after the
+/// network update went out. The frame limiter's wait after that is left out, so this is the work a frame costs.
+class FrameTimer
+{
+public:
+	FrameTimer();
+
+	/// Note the start of a frame.
+	void Begin();
+	/// Note the end of a frame's work.
+	void End();
+	/// Return the frames timed since the last call, and start again.
+	ServerFrameStats Take(unsigned numClients);
+
+private:
+	/// Time since the start of the frame.
+	HiresTimer timer_;
+	/// Whether a frame has begun and not ended.
+	bool running_;
+	/// Frames timed.
+	unsigned numFrames_;
+	/// Sum of frame times.
+	long long sumUSec_;
+	/// Longest frame.
+	long long maxUSec_;
+};
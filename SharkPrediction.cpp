@@ -0,0 +1,121 @@
+#include <Urho3D/Math/MathDefs.h>
+
+#include "SharkPrediction.h"
+
+#include <cmath>
+
+/// Return whether sequence a is newer than sequence b, allowing for wrapping.
+static bool IsNewer(unsigned a, unsigned b)
+{
+	return (int)(a - b) > 0;
+}
+
+SharkPredictor::SharkPredictor() :
+	active_(false),
+	firstInput_(0),
+	numInputs_(0),
+	acknowledged_(0),
+	threshold_(DEFAULT_SHARK_CORRECTION_THRESHOLD),
+	smoothing_(DEFAULT_SHARK_CORRECTION_SMOOTHING),
+	numReconciled_(0),
+	numCorrections_(0),
+	numReplayed_(0),
+	errorSum_(0.0),
+	maxError_(0.0f)
+{
+}
+
+void SharkPredictor::Reset(const SharkState& state)
+{
+	active_ = true;
+	state_ = state;
+	offset_ = Vector3::ZERO;
+	firstInput_ = 0;
+	numInputs_ = 0;
+	acknowledged_ = 0;
+}
+
+void SharkPredictor::Step(SharkState& state, const Vector3& force, float timeStep)
+{
+	state.velocity_ += force * (timeStep / SHARK_MASS);
+	state.velocity_ *= powf(1.0f - SHARK_LINEAR_DAMPING, timeStep);
+	state.position_ += state.velocity_ * timeStep;
+}
+
+void SharkPredictor::Predict(unsigned sequence, const Vector3& force, const Quaternion& rotation, float timeStep)
+{
+	if (!active_)
+		return;
+
+	state_.rotation_ = rotation;
+	Step(state_, force, timeStep);
+
+	// Out of room means the server has stopped answering, the oldest input is as good as lost
+	if (numInputs_ == SHARK_INPUT_HISTORY)
+	{
+		firstInput_ = (firstInput_ + 1) % SHARK_INPUT_HISTORY;
+		--numInputs_;
+	}
+	Input& input = inputs_[(firstInput_ + numInputs_) % SHARK_INPUT_HISTORY];
+	input.sequence_ = sequence;
+	input.force_ = force;
+	input.rotation_ = rotation;
+	input.timeStep_ = timeStep;
+	input.state_ = state_;
+	++numInputs_;
+}
+
+void SharkPredictor::Reconcile(unsigned sequence, const Vector3& position, const Vector3& velocity)
+{
+	// States arrive unordered, only a newer acknowledgement says anything new
+	if (!active_ || (acknowledged_ && !IsNewer(sequence, acknowledged_)))
+		return;
+	acknowledged_ = sequence;
+
+	// Drop the inputs the server has already applied, keeping the one it answered for
+	while (numInputs_ && IsNewer(sequence, inputs_[firstInput_].sequence_))
+	{
+		firstInput_ = (firstInput_ + 1) % SHARK_INPUT_HISTORY;
+		--numInputs_;
+	}
+	if (!numInputs_ || inputs_[firstInput_].sequence_ != sequence)
+		return;
+
+	const SharkState& predicted = inputs_[firstInput_].state_;
+	float error = (predicted.position_ - position).Length();
+	++numReconciled_;
+	errorSum_ += error;
+	maxError_ = Max(maxError_, error);
+
+	firstInput_ = (firstInput_ + 1) % SHARK_INPUT_HISTORY;
+	--numInputs_;
+	if (error <= threshold_)
+		return;
+
+	// Rewind to the server's state and apply again everything it has not seen
+	Vector3 shown = GetShownPosition();
+	SharkState state = state_;
+	state.position_ = position;
+	state.velocity_ = velocity;
+	for (unsigned k = 0; k < numInputs_; ++k)
+	{
+		Input& input = inputs_[(firstInput_ + k) % SHARK_INPUT_HISTORY];
+		state.rotation_ = input.rotation_;
+		Step(state, input.force_, input.timeStep_);
+		input.state_ = state;
+	}
+	state_ = state;
+	offset_ = smoothing_ > 0.0f ? shown - state_.position_ : Vector3::ZERO;
+	++numCorrections_;
+	numReplayed_ += numInputs_;
+}
+
+void SharkPredictor::Update(float timeStep)
+{
+	if (smoothing_ <= 0.0f)
+	{
+		offset_ = Vector3::ZERO;
+		return;
+	}
+	offset_ *= Max(1.0f - timeStep / smoothing_, 0.0f);
+}
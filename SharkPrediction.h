@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Urho3D/Math/Quaternion.h>
+#include <Urho3D/Math/Vector3.h>
+
+// All Urho3D classes reside in namespace Urho3D
+using namespace Urho3D;
+
+/// Network message carrying the authoritative state of a client's shark and the last input applied to it, server to client.
+static const int MSG_SHARKSTATE = 0x104;
+/// Where a new shark starts.
+static const Vector3 SHARK_SPAWN_POSITION(0.0f, 5.0f, 0.0f);
+/// Mass of the shark's rigid body.
+static const float SHARK_MASS = 3.0f;
+/// Linear damping of the shark's rigid body.
+static const float SHARK_LINEAR_DAMPING = 0.95f;
+/// Inputs remembered for replay. At 60 steps a second this covers a round trip of about two seconds.
+static const unsigned SHARK_INPUT_HISTORY = 128;
+/// Default distance the prediction may be off by before it is corrected.
+static const float DEFAULT_SHARK_CORRECTION_THRESHOLD = 0.25f;
+/// Default time a correction is blended in over, so the shark does not visibly jump.
+static const float DEFAULT_SHARK_CORRECTION_SMOOTHING = 0.1f;
+
+/// State of a shark the prediction steps.
+struct SharkState
+{
+	/// Position.
+	Vector3 position_;
+	/// Linear velocity.
+	Vector3 velocity_;
+	/// Rotation, taken straight from the input.
+	Quaternion rotation_;
+};
+
+/// Client side prediction of the player's own shark. Every physics step the client's input is numbered, sent to the
+/// server inside its Controls, applied to a local copy of the shark and remembered. The server answers each network
+/// update with the shark's state after the newest input it has applied; the prediction for that input is compared
+/// with it and, if it is off by more than a threshold, the state is reset to the server's and every input the server
+/// has not seen yet is applied again. The local model integrates the input force the way Bullet integrates the shark's
+/// rigid body, so with no collisions the two agree and corrections are rare.
+class SharkPredictor
+{
+public:
+	SharkPredictor();
+
+	/// Start predicting from a state, forgetting every input.
+	void Reset(const SharkState& state);
+	/// Apply and remember one numbered input: a force on the shark and its rotation, over a time step.
+	void Predict(unsigned sequence, const Vector3& force, const Quaternion& rotation, float timeStep);
+	/// Check the prediction against the server's state after input sequence, and replay the newer inputs if it is off.
+	void Reconcile(unsigned sequence, const Vector3& position, const Vector3& velocity);
+	/// Blend the offset a correction left behind out of the shown position over a frame's time step.
+	void Update(float timeStep);
+	/// Set how far the prediction may be off before it is corrected.
+	void SetCorrectionThreshold(float distance) { threshold_ = distance; }
+	/// Set the time a correction is blended in over. 0 snaps.
+	void SetCorrectionSmoothing(float time) { smoothing_ = time; }
+
+	/// Advance a state by one step as Bullet does: force, then damping, then position.
+	static void Step(SharkState& state, const Vector3& force, float timeStep);
+
+	/// Return whether prediction has started.
+	bool IsActive() const { return active_; }
+	/// Return the predicted state.
+	const SharkState& GetState() const { return state_; }
+	/// Return the position to show: the predicted one plus what is left of the last correction.
+	Vector3 GetShownPosition() const { return state_.position_ + offset_; }
+	/// Return the number of server states checked.
+	unsigned GetNumReconciled() const { return numReconciled_; }
+	/// Return the number of corrections made.
+	unsigned GetNumCorrections() const { return numCorrections_; }
+	/// Return the number of inputs replayed by corrections.
+	unsigned GetNumReplayed() const { return numReplayed_; }
+	/// Return the mean distance the prediction was off by, corrected or not.
+	float GetMeanError() const { return numReconciled_ ? (float)(errorSum_ / numReconciled_) : 0.0f; }
+	/// Return the largest distance the prediction was off by.
+	float GetMaxError() const { return maxError_; }
+	/// Return the number of inputs the server has not acknowledged yet.
+	unsigned GetNumPending() const { return numInputs_; }
+
+private:
+	/// A remembered input and the state it led to.
+	struct Input
+	{
+		unsigned sequence_;
+		Vector3 force_;
+		Quaternion rotation_;
+		float timeStep_;
+		SharkState state_;
+	};
+
+	/// Whether prediction has started.
+	bool active_;
+	/// Predicted state after the newest input.
+	SharkState state_;
+	/// Shown position minus predicted position, left by the last correction.
+	Vector3 offset_;
+	/// Inputs the server has not acknowledged, oldest first from firstInput_.
+	Input inputs_[SHARK_INPUT_HISTORY];
+	/// Index of the oldest input.
+	unsigned firstInput_;
+	/// Number of inputs remembered.
+	unsigned numInputs_;
+	/// Newest input acknowledged.
+	unsigned acknowledged_;
+	/// Correction threshold.
+	float threshold_;
+	/// Correction blend time.
+	float smoothing_;
+	/// Server states checked.
+	unsigned numReconciled_;
+	/// Corrections made.
+	unsigned numCorrections_;
+	/// Inputs replayed.
+	unsigned numReplayed_;
+	/// Sum of prediction errors.
+	double errorSum_;
+	/// Largest prediction error.
+	float maxError_;
+};